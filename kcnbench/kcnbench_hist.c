@@ -0,0 +1,194 @@
+/*
+ * a histogram of latencies in the manner of HDR histograms: values are
+ * recorded to log-linear buckets in constant time and space, and a
+ * percentile is an upper bound of a bucket in which it falls.
+ */
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "kcnbench_hist.h"
+
+static size_t
+kcnbench_hist_index(uint64_t v)
+{
+	unsigned int e;
+
+	if (v < (1ULL << KCNBENCH_HIST_SUBBITS))
+		return v;
+	for (e = 0; (v >> e) >= (1ULL << KCNBENCH_HIST_SUBBITS); e++)
+		;
+	return ((size_t)e << (KCNBENCH_HIST_SUBBITS - 1)) + (v >> e);
+}
+
+static uint64_t
+kcnbench_hist_value(size_t i)
+{
+	unsigned int e;
+	uint64_t m;
+
+	if (i < (1U << KCNBENCH_HIST_SUBBITS))
+		return i;
+	e = (i >> (KCNBENCH_HIST_SUBBITS - 1)) - 1;
+	m = i - ((size_t)e << (KCNBENCH_HIST_SUBBITS - 1));
+	return ((m + 1) << e) - 1;
+}
+
+void
+kcnbench_hist_init(struct kcnbench_hist *kh)
+{
+
+	memset(kh, 0, sizeof(*kh));
+	kh->kh_min = UINT64_MAX;
+}
+
+void
+kcnbench_hist_record(struct kcnbench_hist *kh, uint64_t v)
+{
+
+	kh->kh_counts[kcnbench_hist_index(v)]++;
+	kh->kh_count++;
+	kh->kh_sum += v;
+	if (v < kh->kh_min)
+		kh->kh_min = v;
+	if (v > kh->kh_max)
+		kh->kh_max = v;
+}
+
+void
+kcnbench_hist_merge(struct kcnbench_hist *kh, const struct kcnbench_hist *okh)
+{
+	size_t i;
+
+	for (i = 0; i < KCNBENCH_HIST_NBUCKETS; i++)
+		kh->kh_counts[i] += okh->kh_counts[i];
+	kh->kh_count += okh->kh_count;
+	kh->kh_sum += okh->kh_sum;
+	if (okh->kh_min < kh->kh_min)
+		kh->kh_min = okh->kh_min;
+	if (okh->kh_max > kh->kh_max)
+		kh->kh_max = okh->kh_max;
+}
+
+uint64_t
+kcnbench_hist_count(const struct kcnbench_hist *kh)
+{
+
+	return kh->kh_count;
+}
+
+uint64_t
+kcnbench_hist_min(const struct kcnbench_hist *kh)
+{
+
+	return kh->kh_count == 0 ? 0 : kh->kh_min;
+}
+
+uint64_t
+kcnbench_hist_max(const struct kcnbench_hist *kh)
+{
+
+	return kh->kh_max;
+}
+
+double
+kcnbench_hist_mean(const struct kcnbench_hist *kh)
+{
+
+	return kh->kh_count == 0 ? 0 : (double)kh->kh_sum / kh->kh_count;
+}
+
+/* a percentile, e.g., 99.9, is never beyond a maximum actually recorded. */
+uint64_t
+kcnbench_hist_percentile(const struct kcnbench_hist *kh, double p)
+{
+	uint64_t rank, n;
+	size_t i;
+
+	if (kh->kh_count == 0)
+		return 0;
+	rank = (uint64_t)(p / 100 * kh->kh_count + 0.5);
+	if (rank < 1)
+		rank = 1;
+	if (rank > kh->kh_count)
+		rank = kh->kh_count;
+	for (n = 0, i = 0; i < KCNBENCH_HIST_NBUCKETS; i++) {
+		n += kh->kh_counts[i];
+		if (n >= rank)
+			break;
+	}
+	if (kcnbench_hist_value(i) > kh->kh_max)
+		return kh->kh_max;
+	return kcnbench_hist_value(i);
+}
+
+static void
+kcnbench_hist_json_puts(const char *s)
+{
+
+	putchar('"');
+	for (; *s != '\0'; s++) {
+		if (*s == '"' || *s == '\\')
+			printf("\\%c", *s);
+		else if ((unsigned char)*s < 0x20)
+			printf("\\u%04x", (unsigned char)*s);
+		else
+			putchar(*s);
+	}
+	putchar('"');
+}
+
+/* a report is a row of a table in text, or an object in json. */
+void
+kcnbench_hist_report_header(void)
+{
+
+	printf("%10s %7s %10s %8s %7s %7s %7s %7s %7s  %s\n",
+	    "count", "errors", "ops/sec", "mean", "p50", "p90", "p99",
+	    "p99.9", "max", "operation");
+}
+
+void
+kcnbench_hist_report_text(const char *name, const char *spec,
+    const struct kcnbench_hist *kh, uint64_t nerrors, double sec)
+{
+
+	printf("%10llu %7llu %10.1f %8.1f %7llu %7llu %7llu %7llu %7llu  "
+	    "%s%s%s\n",
+	    (unsigned long long)kcnbench_hist_count(kh),
+	    (unsigned long long)nerrors,
+	    sec > 0 ? kcnbench_hist_count(kh) / sec : 0,
+	    kcnbench_hist_mean(kh),
+	    (unsigned long long)kcnbench_hist_percentile(kh, 50),
+	    (unsigned long long)kcnbench_hist_percentile(kh, 90),
+	    (unsigned long long)kcnbench_hist_percentile(kh, 99),
+	    (unsigned long long)kcnbench_hist_percentile(kh, 99.9),
+	    (unsigned long long)kcnbench_hist_max(kh),
+	    name, spec != NULL ? " " : "", spec != NULL ? spec : "");
+}
+
+void
+kcnbench_hist_report_json(const char *name, const char *spec,
+    const struct kcnbench_hist *kh, uint64_t nerrors, double sec)
+{
+
+	printf("{\"type\":\"%s\",", name);
+	if (spec != NULL) {
+		printf("\"spec\":");
+		kcnbench_hist_json_puts(spec);
+		printf(",");
+	}
+	printf("\"count\":%llu,\"errors\":%llu,\"ops_per_sec\":%.3f,"
+	    "\"latency_usec\":{\"min\":%llu,\"mean\":%.3f,\"p50\":%llu,"
+	    "\"p90\":%llu,\"p99\":%llu,\"p999\":%llu,\"max\":%llu}}",
+	    (unsigned long long)kcnbench_hist_count(kh),
+	    (unsigned long long)nerrors,
+	    sec > 0 ? kcnbench_hist_count(kh) / sec : 0,
+	    (unsigned long long)kcnbench_hist_min(kh),
+	    kcnbench_hist_mean(kh),
+	    (unsigned long long)kcnbench_hist_percentile(kh, 50),
+	    (unsigned long long)kcnbench_hist_percentile(kh, 90),
+	    (unsigned long long)kcnbench_hist_percentile(kh, 99),
+	    (unsigned long long)kcnbench_hist_percentile(kh, 99.9),
+	    (unsigned long long)kcnbench_hist_max(kh));
+}
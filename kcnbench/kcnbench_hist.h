@@ -0,0 +1,29 @@
+/*
+ * 2^KCNBENCH_HIST_SUBBITS linear buckets for each power of two, which
+ * bounds a relative error of a recorded value to 1/64.
+ */
+#define KCNBENCH_HIST_SUBBITS	7
+#define KCNBENCH_HIST_NBUCKETS						\
+	((64 - KCNBENCH_HIST_SUBBITS + 2) << (KCNBENCH_HIST_SUBBITS - 1))
+
+struct kcnbench_hist {
+	uint64_t kh_counts[KCNBENCH_HIST_NBUCKETS];
+	uint64_t kh_count;
+	uint64_t kh_min;
+	uint64_t kh_max;
+	uint64_t kh_sum;
+};
+
+void kcnbench_hist_init(struct kcnbench_hist *);
+void kcnbench_hist_record(struct kcnbench_hist *, uint64_t);
+void kcnbench_hist_merge(struct kcnbench_hist *, const struct kcnbench_hist *);
+uint64_t kcnbench_hist_count(const struct kcnbench_hist *);
+uint64_t kcnbench_hist_min(const struct kcnbench_hist *);
+uint64_t kcnbench_hist_max(const struct kcnbench_hist *);
+double kcnbench_hist_mean(const struct kcnbench_hist *);
+uint64_t kcnbench_hist_percentile(const struct kcnbench_hist *, double);
+void kcnbench_hist_report_header(void);
+void kcnbench_hist_report_text(const char *, const char *,
+    const struct kcnbench_hist *, uint64_t, double);
+void kcnbench_hist_report_json(const char *, const char *,
+    const struct kcnbench_hist *, uint64_t, double);
@@ -0,0 +1,207 @@
+#include <err.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcn.h"
+#include "kcn_log.h"
+#include "kcn_str.h"
+#include "kcn_eq.h"
+#include "kcn_ctx.h"
+#include "kcn_netstat.h"
+#include "kcnbench_hist.h"
+#include "kcnbench_run.h"
+
+#define KCNBENCH_CONCURRENCY_DEFAULT	16
+#define KCNBENCH_CONNS_DEFAULT		4
+#define KCNBENCH_NLOCS_DEFAULT		1000
+#define KCNBENCH_DURATION_DEFAULT	10	/* sec */
+#define KCNBENCH_WARMUP_DEFAULT		2	/* sec */
+
+static void usage(const char *, const char *, ...);
+
+static void
+op_append(const char *pname, struct kcnbench_conf *kbc,
+    enum kcnbench_op_type type, const char *spec)
+{
+	struct kcnbench_op *ko;
+
+	ko = realloc(kbc->kbc_ops, (kbc->kbc_nops + 1) * sizeof(*ko));
+	if (ko == NULL)
+		err(EXIT_FAILURE, "cannot allocate operations");
+	kbc->kbc_ops = ko;
+	if (! kcnbench_op_parse(type, spec, &kbc->kbc_ops[kbc->kbc_nops]))
+		usage(pname, "invalid %s: %s",
+		    type == KCNBENCH_OP_QUERY ? "query" : "add", spec);
+		/*NOTREACHED*/
+	++kbc->kbc_nops;
+}
+
+int
+main(int argc, char * const argv[])
+{
+	const char *pname, *server;
+	struct kcn_ctx *kc;
+	struct kcnbench_conf kbc;
+	unsigned long long seed;
+	int ch, rc;
+
+	pname = (pname = strrchr(argv[0], '/')) != NULL ? pname + 1 : argv[0];
+	server = NULL;
+	memset(&kbc, 0, sizeof(kbc));
+	kbc.kbc_concurrency = KCNBENCH_CONCURRENCY_DEFAULT;
+	kbc.kbc_nconns = KCNBENCH_CONNS_DEFAULT;
+	kbc.kbc_nlocs = KCNBENCH_NLOCS_DEFAULT;
+	kbc.kbc_duration = KCNBENCH_DURATION_DEFAULT;
+	kbc.kbc_warmup = KCNBENCH_WARMUP_DEFAULT;
+	kbc.kbc_seed = (uint64_t)time(NULL) ^ ((uint64_t)getpid() << 32);
+	kbc.kbc_format = KCNBENCH_FORMAT_TEXT;
+
+	while ((ch = getopt(argc, argv, "C:L:S:a:c:d:ho:q:r:s:vw:?")) != -1) {
+		switch (ch) {
+		case 'C':
+			if (! kcn_strtoull(optarg, 1, INT_MAX, &kbc.kbc_nconns))
+				usage(pname, "invalid number of connections");
+				/*NOTREACHED*/
+			break;
+		case 'L':
+			if (! kcn_strtoull(optarg, 1, UINT32_MAX,
+			    &kbc.kbc_nlocs))
+				usage(pname, "invalid number of locators");
+				/*NOTREACHED*/
+			break;
+		case 'S':
+			if (! kcn_strtoull(optarg, 0, UINT64_MAX, &seed))
+				usage(pname, "invalid seed");
+				/*NOTREACHED*/
+			kbc.kbc_seed = seed;
+			break;
+		case 'a':
+			op_append(pname, &kbc, KCNBENCH_OP_ADD, optarg);
+			break;
+		case 'c':
+			if (! kcn_strtoull(optarg, 1, INT_MAX,
+			    &kbc.kbc_concurrency))
+				usage(pname, "invalid concurrency");
+				/*NOTREACHED*/
+			break;
+		case 'd':
+			if (! kcn_eq_window_aton(optarg, &kbc.kbc_duration))
+				usage(pname, "invalid duration");
+				/*NOTREACHED*/
+			break;
+		case 'o':
+			if (! kcnbench_format_aton(optarg, &kbc.kbc_format))
+				usage(pname, "unknown output format");
+				/*NOTREACHED*/
+			break;
+		case 'q':
+			op_append(pname, &kbc, KCNBENCH_OP_QUERY, optarg);
+			break;
+		case 'r':
+			if (! kcn_strtoull(optarg, 1, UINT32_MAX,
+			    &kbc.kbc_rate))
+				usage(pname, "invalid rate");
+				/*NOTREACHED*/
+			break;
+		case 's':
+			server = optarg;
+			break;
+		case 'v':
+			kcn_log_priority_increment();
+			break;
+		case 'w':
+			if (strcmp(optarg, "0") == 0)
+				kbc.kbc_warmup = 0;
+			else if (! kcn_eq_window_aton(optarg, &kbc.kbc_warmup))
+				usage(pname, "invalid warmup");
+				/*NOTREACHED*/
+			break;
+		case 'h':
+		case '?':
+		default:
+			usage(pname, NULL);
+			/*NOTREACHED*/
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage(pname, "wrong number of arguments");
+		/*NOTREACHED*/
+	if (kbc.kbc_nops == 0)
+		usage(pname, "no operations specified");
+		/*NOTREACHED*/
+
+	kc = kcn_ctx_new();
+	if (kc == NULL)
+		err(EXIT_FAILURE, "cannot allocate KCN context");
+	if (! kcn_netstat_init(kc))
+		err(EXIT_FAILURE, "cannot register network statistics");
+	if (server != NULL && ! kcn_ctx_server_set(kc, server))
+		err(EXIT_FAILURE, "cannot set server");
+
+	rc = kcnbench_run(kc, &kbc);
+
+	kcn_netstat_finish(kc);
+	kcn_ctx_destroy(kc);
+	free(kbc.kbc_ops);
+	return rc;
+}
+
+static void
+usage(const char *pname, const char *errfmt, ...)
+{
+	va_list ap;
+	enum kcn_eq_type type;
+
+	if (errfmt != NULL)  {
+		fprintf(stderr, "ERROR: ");
+		va_start(ap, errfmt);
+		vfprintf(stderr, errfmt, ap);
+		va_end(ap);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "\
+Usage: %s [-v] [-c concurrency | -r rate] [-C connections] [-d duration]\n\
+	  [-w warmup] [-L locators] [-S seed] [-o format] [-s server]\n\
+	  -q [weight:[maxcount:]]keywords ... -a [weight:]type ...\n\
+Options:\n\
+	-q [weight:[maxcount:]]keywords: Query keywords as key2loc does,\n\
+		e.g., \"3:10:rtt lt 50 1h\", returning ``maxcount''\n\
+		locators at maximum (default: 1).\n\
+	-a [weight:]type: Add a record of a random value and a random\n\
+		locator to a table of a type at current time.\n\
+		-q and -a can be specified multiple times, and operations\n\
+		are chosen randomly in proportion to their weights\n\
+		(default: 1).\n\
+	-c concurrency: Keep operations in flight in a closed loop, or\n\
+			limit them with -r (default: %d).\n\
+	-r rate: Issue operations per second in an open loop, where\n\
+		 latencies are measured from scheduled times.\n\
+	-C connections: The number of connections for queries and for\n\
+			adds each (default: %d).\n\
+	-d duration: Measure for a duration, e.g., 30s or 5m (default: %ds).\n\
+	-w warmup: Do not measure for a while at first (default: %ds).\n\
+	-L locators: The number of distinct locators added (default: %d).\n\
+	-S seed: A seed of random numbers for a reproducible mix.\n\
+	-o format: Print results in text or json (default: text).\n\
+	-s server: KCN database server.\n\
+	-v: Increment verbosity (can be specified 7 times at maximum).\n\
+\n\
+Supported database types are:\n\
+",
+	    pname, KCNBENCH_CONCURRENCY_DEFAULT, KCNBENCH_CONNS_DEFAULT,
+	    KCNBENCH_DURATION_DEFAULT, KCNBENCH_WARMUP_DEFAULT,
+	    KCNBENCH_NLOCS_DEFAULT);
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		fprintf(stderr, "\t%s\n", kcn_eq_type_ntoa(type));
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,558 @@
+/*
+ * drive a mix of operations against kcndbd and measure their latencies.
+ *
+ * in a closed loop, a fixed number of operations are kept in flight.  in
+ * an open loop, operations are scheduled at a fixed rate, and a latency
+ * is measured from a scheduled time rather than from a time actually
+ * issued so that a stalled server does not hide its own latency, i.e.,
+ * coordinated omission.  in either case, completions during a warmup
+ * period are not recorded.
+ *
+ * queries are pipelined over a pool of connections.  adds have no
+ * response, and each add connection has one add in flight until it is
+ * written to a socket, which is a latency of an add.
+ */
+#include <sys/queue.h>
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <event.h>
+
+#include "kcn.h"
+#include "kcn_log.h"
+#include "kcn_str.h"
+#include "kcn_time.h"
+#include "kcn_info.h"
+#include "kcn_buf.h"
+#include "kcn_net.h"
+#include "kcn_eq.h"
+#include "kcn_msg.h"
+#include "kcn_ctx.h"
+#include "kcn_client.h"
+#include "kcnbench_hist.h"
+#include "kcnbench_run.h"
+
+#define KCNBENCH_TICK		1000	/* usec */
+#define KCNBENCH_VALUE_MAX	1000
+#define KCNBENCH_USECINSEC	1000000ULL
+
+struct kcnbench;
+
+struct kcnbench_req {
+	TAILQ_ENTRY(kcnbench_req) kr_chain;
+	struct kcnbench *kr_kbn;
+	struct kcnbench_op *kr_ko;
+	struct kcn_info *kr_ki;
+	uint64_t kr_start;
+};
+
+struct kcnbench_adder {
+	struct kcnbench *ka_kbn;
+	struct kcn_net *ka_kn;
+	struct kcnbench_op *ka_ko;	/* in flight if not NULL */
+	uint64_t ka_start;
+	bool ka_down;
+};
+
+struct kcnbench {
+	const struct kcnbench_conf *kbn_conf;
+	struct kcn_ctx *kbn_kc;
+	struct event_base *kbn_evb;
+	struct event kbn_evtick;
+	struct kcn_client_pool *kbn_kcp;
+	struct kcnbench_adder *kbn_adders;
+	TAILQ_HEAD(, kcnbench_req) kbn_reqs;
+	unsigned long long kbn_weights;
+	uint64_t kbn_rng;
+	uint64_t kbn_start;
+	uint64_t kbn_mstart;
+	uint64_t kbn_end;
+	uint64_t kbn_nscheduled;
+	struct kcnbench_op *kbn_next;	/* picked but not issued yet */
+	size_t kbn_ninflight;
+};
+
+static void kcnbench_fill(struct kcnbench *);
+
+static uint64_t
+kcnbench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * KCNBENCH_USECINSEC +
+	    (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* xorshift64*, which is enough to mix operations reproducibly. */
+static uint64_t
+kcnbench_random(struct kcnbench *kbn)
+{
+	uint64_t x = kbn->kbn_rng;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	kbn->kbn_rng = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+bool
+kcnbench_op_parse(enum kcnbench_op_type type, const char *spec,
+    struct kcnbench_op *ko)
+{
+	unsigned long long n[2];
+	const char *p, *s;
+	char buf[sizeof("18446744073709551615")];
+	size_t i, len, nmax;
+
+	memset(ko, 0, sizeof(*ko));
+	ko->ko_type = type;
+	ko->ko_spec = spec;
+	ko->ko_weight = 1;
+	ko->ko_maxcount = 1;
+	kcnbench_hist_init(&ko->ko_hist);
+
+	/* leading numbers separated by ``:'' are a weight and a maxcount. */
+	nmax = type == KCNBENCH_OP_QUERY ? 2 : 1;
+	for (s = spec, i = 0; i < nmax; i++) {
+		p = strchr(s, ':');
+		if (p == NULL)
+			break;
+		len = p - s;
+		if (len == 0 || len >= sizeof(buf) ||
+		    strspn(s, "0123456789") != len)
+			break;
+		memcpy(buf, s, len);
+		buf[len] = '\0';
+		if (! kcn_strtoull(buf, i == 0 ? 0 : 1, UINT32_MAX, &n[i]))
+			return false;
+		s = p + 1;
+	}
+	if (i > 0)
+		ko->ko_weight = n[0];
+	if (i > 1)
+		ko->ko_maxcount = n[1];
+	if (*s == '\0') {
+		errno = EINVAL;
+		return false;
+	}
+	if (type == KCNBENCH_OP_ADD) {
+		if (! kcn_eq_type_aton(s, &ko->ko_eqtype)) {
+			errno = EINVAL;
+			return false;
+		}
+	} else
+		ko->ko_keys = s;
+	return true;
+}
+
+bool
+kcnbench_format_aton(const char *s, enum kcnbench_format *formatp)
+{
+
+	if (strcmp(s, "text") == 0)
+		*formatp = KCNBENCH_FORMAT_TEXT;
+	else if (strcmp(s, "json") == 0)
+		*formatp = KCNBENCH_FORMAT_JSON;
+	else
+		return false;
+	return true;
+}
+
+static struct kcnbench_op *
+kcnbench_op_pick(struct kcnbench *kbn)
+{
+	const struct kcnbench_conf *kbc = kbn->kbn_conf;
+	unsigned long long r;
+	size_t i;
+
+	r = kcnbench_random(kbn) % kbn->kbn_weights;
+	for (i = 0; i < kbc->kbc_nops - 1; i++) {
+		if (r < kbc->kbc_ops[i].ko_weight)
+			break;
+		r -= kbc->kbc_ops[i].ko_weight;
+	}
+	return &kbc->kbc_ops[i];
+}
+
+static void
+kcnbench_complete(struct kcnbench *kbn, struct kcnbench_op *ko,
+    uint64_t start, int error)
+{
+	uint64_t now;
+
+	assert(kbn->kbn_ninflight > 0);
+	--kbn->kbn_ninflight;
+	now = kcnbench_now();
+	if (now < kbn->kbn_mstart || now >= kbn->kbn_end)
+		return;
+	if (error != 0)
+		++ko->ko_nerrors;
+	else
+		kcnbench_hist_record(&ko->ko_hist, now - start);
+}
+
+static void
+kcnbench_query_done(struct kcn_info *ki, int error, void *arg)
+{
+	struct kcnbench_req *kr = arg;
+	struct kcnbench *kbn = kr->kr_kbn;
+
+	(void)ki;
+	if (error == ESRCH)
+		error = 0;	/* no locators matched. */
+	else if (error != 0)
+		KCN_LOG(DEBUG, "query failed: %s", strerror(error));
+	kcnbench_complete(kbn, kr->kr_ko, kr->kr_start, error);
+	TAILQ_REMOVE(&kbn->kbn_reqs, kr, kr_chain);
+	kcn_info_destroy(kr->kr_ki);
+	free(kr);
+	kcnbench_fill(kbn);
+}
+
+static bool
+kcnbench_query(struct kcnbench *kbn, struct kcnbench_op *ko, uint64_t start)
+{
+	struct kcnbench_req *kr;
+
+	kr = malloc(sizeof(*kr));
+	if (kr == NULL)
+		return false;
+	kr->kr_ki = kcn_info_new(KCN_LOC_TYPE_DOMAINNAME, ko->ko_maxcount);
+	if (kr->kr_ki == NULL) {
+		free(kr);
+		return false;
+	}
+	kcn_info_db_set(kr->kr_ki, "net");
+	kr->kr_kbn = kbn;
+	kr->kr_ko = ko;
+	kr->kr_start = start;
+	if (! kcn_search_async(kbn->kbn_kc, kbn->kbn_kcp, kr->kr_ki,
+	    ko->ko_keys, kcnbench_query_done, kr)) {
+		kcn_info_destroy(kr->kr_ki);
+		free(kr);
+		return false;
+	}
+	TAILQ_INSERT_TAIL(&kbn->kbn_reqs, kr, kr_chain);
+	return true;
+}
+
+static void
+kcnbench_add_done(struct kcnbench_adder *ka, int error)
+{
+	struct kcnbench_op *ko = ka->ka_ko;
+
+	if (ko == NULL)
+		return;
+	ka->ka_ko = NULL;
+	kcnbench_complete(ka->ka_kbn, ko, ka->ka_start, error);
+}
+
+static void
+kcnbench_add_drain(struct kcn_net *kn, void *arg)
+{
+	struct kcnbench_adder *ka = arg;
+
+	(void)kn;
+	if (ka->ka_ko == NULL)
+		return;
+	kcnbench_add_done(ka, 0);
+	kcnbench_fill(ka->ka_kbn);
+}
+
+static void
+kcnbench_add_close(struct kcn_net *kn, int error, void *arg)
+{
+	struct kcnbench_adder *ka = arg;
+
+	(void)kn;
+	KCN_LOG(DEBUG, "add connection closed: %s", strerror(error));
+	ka->ka_down = true;
+	kcnbench_add_done(ka, error != 0 ? error : ECONNABORTED);
+}
+
+static struct kcnbench_adder *
+kcnbench_adder_idle(struct kcnbench *kbn)
+{
+	const struct kcnbench_conf *kbc = kbn->kbn_conf;
+	size_t i;
+
+	for (i = 0; i < kbc->kbc_nconns; i++)
+		if (kbn->kbn_adders[i].ka_ko == NULL)
+			return &kbn->kbn_adders[i];
+	return NULL;
+}
+
+static bool
+kcnbench_add(struct kcnbench *kbn, struct kcnbench_adder *ka,
+    struct kcnbench_op *ko, uint64_t start)
+{
+	const struct kcnbench_conf *kbc = kbn->kbn_conf;
+	struct kcn_msg_add kma;
+	char loc[sizeof("host18446744073709551615.kcnbench.example")];
+
+	if (ka->ka_down) {
+		kcn_client_finish(ka->ka_kn);
+		ka->ka_kn = NULL;
+		ka->ka_down = false;
+	}
+	if (ka->ka_kn == NULL) {
+		ka->ka_kn = kcn_client_init(kbn->kbn_kc, kbn->kbn_evb, ka);
+		if (ka->ka_kn == NULL)
+			return false;
+		kcn_net_close_cb_set(ka->ka_kn, kcnbench_add_close);
+		kcn_net_drain_cb_set(ka->ka_kn, kcnbench_add_drain);
+	}
+	snprintf(loc, sizeof(loc), "host%llu.kcnbench.example",
+	    (unsigned long long)(kcnbench_random(kbn) % kbc->kbc_nlocs));
+	kma.kma_type = ko->ko_eqtype;
+	kma.kma_time = KCN_TIME_NOW;
+	kma.kma_val = kcnbench_random(kbn) % KCNBENCH_VALUE_MAX;
+	kma.kma_loc = loc;
+	kma.kma_loclen = strlen(loc);
+	if (! kcn_client_add_send(ka->ka_kn, &kma))
+		return false;
+	ka->ka_ko = ko;
+	ka->ka_start = start;
+	return true;
+}
+
+/*
+ * return false if an operation fails, or is blocked until an add
+ * connection is idle, in which case it is kept as a next operation.
+ */
+static bool
+kcnbench_issue(struct kcnbench *kbn, uint64_t start)
+{
+	struct kcnbench_op *ko;
+	struct kcnbench_adder *ka;
+	bool rc;
+
+	if (kbn->kbn_next == NULL)
+		kbn->kbn_next = kcnbench_op_pick(kbn);
+	ko = kbn->kbn_next;
+	errno = 0;
+	if (ko->ko_type == KCNBENCH_OP_QUERY)
+		rc = kcnbench_query(kbn, ko, start);
+	else if ((ka = kcnbench_adder_idle(kbn)) == NULL)
+		return false;
+	else
+		rc = kcnbench_add(kbn, ka, ko, start);
+	kbn->kbn_next = NULL;
+	if (! rc) {
+		KCN_LOG(DEBUG, "cannot issue %s: %s", ko->ko_spec,
+		    strerror(errno != 0 ? errno : EINVAL));
+		if (kcnbench_now() >= kbn->kbn_mstart)
+			++ko->ko_nerrors;
+		return false;
+	}
+	++kbn->kbn_ninflight;
+	return true;
+}
+
+static void
+kcnbench_fill(struct kcnbench *kbn)
+{
+	const struct kcnbench_conf *kbc = kbn->kbn_conf;
+	uint64_t now, scheduled;
+
+	now = kcnbench_now();
+	if (now >= kbn->kbn_end)
+		return;
+	while (kbn->kbn_ninflight < kbc->kbc_concurrency) {
+		if (kbc->kbc_rate == 0) {
+			if (! kcnbench_issue(kbn, kcnbench_now()))
+				break;
+			continue;
+		}
+		scheduled = kbn->kbn_start + kbn->kbn_nscheduled *
+		    KCNBENCH_USECINSEC / kbc->kbc_rate;
+		if (scheduled > now)
+			break;
+		if (! kcnbench_issue(kbn, scheduled) && kbn->kbn_next != NULL)
+			break;
+		++kbn->kbn_nscheduled;
+	}
+}
+
+static void
+kcnbench_tick(int fd, short event, void *arg)
+{
+	struct kcnbench *kbn = arg;
+	struct timeval tv;
+
+	(void)fd;
+	(void)event;
+	if (kcnbench_now() >= kbn->kbn_end) {
+		event_base_loopbreak(kbn->kbn_evb);
+		return;
+	}
+	kcnbench_fill(kbn);
+	tv.tv_sec = 0;
+	tv.tv_usec = KCNBENCH_TICK;
+	evtimer_add(&kbn->kbn_evtick, &tv);
+}
+
+static const char *
+kcnbench_op_type_ntoa(enum kcnbench_op_type type)
+{
+
+	return type == KCNBENCH_OP_QUERY ? "query" : "add";
+}
+
+/* return false if any operations fail. */
+static bool
+kcnbench_report(const struct kcnbench *kbn, double sec)
+{
+	const struct kcnbench_conf *kbc = kbn->kbn_conf;
+	const struct kcnbench_op *ko;
+	struct kcnbench_hist *kh;
+	uint64_t nerrors;
+	size_t i;
+
+	kh = malloc(sizeof(*kh));
+	if (kh == NULL) {
+		KCN_LOG(ERR, "cannot allocate a histogram: %s",
+		    strerror(errno));
+		return false;
+	}
+	kcnbench_hist_init(kh);
+	nerrors = 0;
+	for (i = 0; i < kbc->kbc_nops; i++) {
+		ko = &kbc->kbc_ops[i];
+		kcnbench_hist_merge(kh, &ko->ko_hist);
+		nerrors += ko->ko_nerrors;
+	}
+
+	if (kbc->kbc_format == KCNBENCH_FORMAT_JSON) {
+		printf("{\"mode\":\"%s\",\"concurrency\":%llu,\"rate\":%llu,"
+		    "\"connections\":%llu,\"warmup_sec\":%lld,"
+		    "\"duration_sec\":%.3f,\"seed\":%llu,\"ops\":[",
+		    kbc->kbc_rate == 0 ? "closed" : "open",
+		    kbc->kbc_concurrency, kbc->kbc_rate, kbc->kbc_nconns,
+		    (long long)kbc->kbc_warmup, sec,
+		    (unsigned long long)kbc->kbc_seed);
+		for (i = 0; i < kbc->kbc_nops; i++) {
+			ko = &kbc->kbc_ops[i];
+			if (i > 0)
+				printf(",");
+			kcnbench_hist_report_json(
+			    kcnbench_op_type_ntoa(ko->ko_type), ko->ko_spec,
+			    &ko->ko_hist, ko->ko_nerrors, sec);
+		}
+		printf("],\"total\":");
+		kcnbench_hist_report_json("total", NULL, kh, nerrors, sec);
+		printf("}\n");
+	} else {
+		if (kbc->kbc_rate == 0)
+			printf("closed loop of %llu operations in flight",
+			    kbc->kbc_concurrency);
+		else
+			printf("open loop of %llu operations/sec",
+			    kbc->kbc_rate);
+		printf(" over %llu connections, seed %llu\n",
+		    kbc->kbc_nconns, (unsigned long long)kbc->kbc_seed);
+		printf("%.3f sec measured after %lld sec warmup, "
+		    "latencies in usec\n", sec, (long long)kbc->kbc_warmup);
+		kcnbench_hist_report_header();
+		for (i = 0; i < kbc->kbc_nops; i++) {
+			ko = &kbc->kbc_ops[i];
+			kcnbench_hist_report_text(
+			    kcnbench_op_type_ntoa(ko->ko_type), ko->ko_spec,
+			    &ko->ko_hist, ko->ko_nerrors, sec);
+		}
+		kcnbench_hist_report_text("total", NULL, kh, nerrors, sec);
+	}
+	free(kh);
+	return nerrors == 0;
+}
+
+int
+kcnbench_run(struct kcn_ctx *kc, struct kcnbench_conf *kbc)
+{
+	struct kcnbench kbn;
+	struct kcnbench_req *kr;
+	struct timeval tv;
+	uint64_t end;
+	size_t i;
+	int rc = EXIT_FAILURE;
+
+	memset(&kbn, 0, sizeof(kbn));
+	kbn.kbn_conf = kbc;
+	kbn.kbn_kc = kc;
+	kbn.kbn_rng = kbc->kbc_seed != 0 ? kbc->kbc_seed : 1;
+	TAILQ_INIT(&kbn.kbn_reqs);
+	for (i = 0; i < kbc->kbc_nops; i++)
+		kbn.kbn_weights += kbc->kbc_ops[i].ko_weight;
+	if (kbn.kbn_weights == 0) {
+		KCN_LOG(ERR, "no operations weighted");
+		return EXIT_FAILURE;
+	}
+
+	kbn.kbn_evb = event_base_new();
+	if (kbn.kbn_evb == NULL) {
+		KCN_LOG(ERR, "cannot allocate event base");
+		goto out;
+	}
+	evtimer_set(&kbn.kbn_evtick, kcnbench_tick, &kbn);
+	if (event_base_set(kbn.kbn_evb, &kbn.kbn_evtick) == -1) {
+		KCN_LOG(ERR, "cannot set a timer");
+		goto out;
+	}
+	kbn.kbn_kcp = kcn_client_pool_new(kc, kbn.kbn_evb, kbc->kbc_nconns);
+	kbn.kbn_adders = calloc(kbc->kbc_nconns, sizeof(*kbn.kbn_adders));
+	if (kbn.kbn_kcp == NULL || kbn.kbn_adders == NULL) {
+		KCN_LOG(ERR, "cannot allocate connections: %s",
+		    strerror(errno));
+		goto out;
+	}
+	for (i = 0; i < kbc->kbc_nconns; i++)
+		kbn.kbn_adders[i].ka_kbn = &kbn;
+
+	kbn.kbn_start = kcnbench_now();
+	kbn.kbn_mstart = kbn.kbn_start + kbc->kbc_warmup * KCNBENCH_USECINSEC;
+	kbn.kbn_end = kbn.kbn_mstart + kbc->kbc_duration * KCNBENCH_USECINSEC;
+	kcnbench_fill(&kbn);
+	tv.tv_sec = 0;
+	tv.tv_usec = KCNBENCH_TICK;
+	evtimer_add(&kbn.kbn_evtick, &tv);
+	if (event_base_dispatch(kbn.kbn_evb) == -1) {
+		KCN_LOG(ERR, "event dispatch failed: %s", strerror(errno));
+		goto out;
+	}
+	end = kcnbench_now();
+	if (end > kbn.kbn_end)
+		end = kbn.kbn_end;
+
+	if (kcnbench_report(&kbn, end > kbn.kbn_mstart ?
+	    (double)(end - kbn.kbn_mstart) / KCNBENCH_USECINSEC : 0))
+		rc = EXIT_SUCCESS;
+  out:
+	/* queries still in flight are discarded without callbacks. */
+	if (kbn.kbn_evb != NULL)
+		event_del(&kbn.kbn_evtick);
+	kcn_client_pool_destroy(kbn.kbn_kcp);
+	while ((kr = TAILQ_FIRST(&kbn.kbn_reqs)) != NULL) {
+		TAILQ_REMOVE(&kbn.kbn_reqs, kr, kr_chain);
+		kcn_info_destroy(kr->kr_ki);
+		free(kr);
+	}
+	if (kbn.kbn_adders != NULL) {
+		for (i = 0; i < kbc->kbc_nconns; i++) {
+			/* XXX: a close callback would count an error. */
+			kbn.kbn_adders[i].ka_ko = NULL;
+			kcn_client_finish(kbn.kbn_adders[i].ka_kn);
+		}
+		free(kbn.kbn_adders);
+	}
+	if (kbn.kbn_evb != NULL)
+		event_base_free(kbn.kbn_evb);
+	return rc;
+}
@@ -0,0 +1,38 @@
+enum kcnbench_op_type {
+	KCNBENCH_OP_QUERY,
+	KCNBENCH_OP_ADD
+};
+
+enum kcnbench_format {
+	KCNBENCH_FORMAT_TEXT,
+	KCNBENCH_FORMAT_JSON
+};
+
+struct kcnbench_op {
+	enum kcnbench_op_type ko_type;
+	const char *ko_spec;
+	unsigned long long ko_weight;
+	unsigned long long ko_maxcount;		/* query */
+	const char *ko_keys;			/* query */
+	enum kcn_eq_type ko_eqtype;		/* add */
+	uint64_t ko_nerrors;
+	struct kcnbench_hist ko_hist;
+};
+
+struct kcnbench_conf {
+	struct kcnbench_op *kbc_ops;
+	size_t kbc_nops;
+	unsigned long long kbc_concurrency;
+	unsigned long long kbc_rate;		/* closed loop if 0 */
+	unsigned long long kbc_nconns;
+	unsigned long long kbc_nlocs;
+	time_t kbc_duration;
+	time_t kbc_warmup;
+	uint64_t kbc_seed;
+	enum kcnbench_format kbc_format;
+};
+
+bool kcnbench_op_parse(enum kcnbench_op_type, const char *,
+    struct kcnbench_op *);
+bool kcnbench_format_aton(const char *, enum kcnbench_format *);
+int kcnbench_run(struct kcn_ctx *, struct kcnbench_conf *);
@@ -0,0 +1,757 @@
+/*
+ * generate synthetic records of network statistics for benchmarks.
+ *
+ * each locator is sampled at a regular interval with jitter for each
+ * type.  a value is drawn around a mean of a locator, which is drawn once
+ * from a distribution of a type, so that locators keep their own
+ * character over time.  records are written in order of time as text
+ * files for kcndbctl -f, and/or as tables and a dictionary of locators in
+ * the same format as kcndbd, which kcndbd opens as they are or kcndbctl
+ * -a attaches.  tables are split into shards as kcndbd does if requested.
+ * out-of-order noise delays some records in text files by a few intervals
+ * to exercise a reorder window of kcndbd.
+ *
+ * output is the same for the same seed and parameters.
+ */
+#include <sys/param.h>	/* MAXPATHLEN */
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcn.h"
+#include "kcn_log.h"
+#include "kcn_str.h"
+#include "kcn_time.h"
+#include "kcn_eq.h"
+#include "kcndb_format.h"
+
+#define KCNDBGEN_PATH_TEXT_SUFFIX	".txt"
+#define KCNDBGEN_LOC_MAXLEN						\
+	(sizeof("host18446744073709551615.kcndbgen.example") - 1)
+#define KCNDBGEN_OBUFSIZ		(1024 * 1024)
+#define KCNDBGEN_LATE_STEPS		3	/* intervals at maximum */
+
+#define KCNDBGEN_NLOCS_DEFAULT		1000
+#define KCNDBGEN_INTERVAL_DEFAULT	KCN_TIME_MININSEC
+#define KCNDBGEN_WINDOW_DEFAULT		KCN_TIME_DAYINSEC
+
+enum kcndbgen_dist {
+	KCNDBGEN_DIST_UNIFORM,		/* between a and b */
+	KCNDBGEN_DIST_NORMAL		/* mean of a and stddev of b */
+};
+
+/* a distribution of means of locators, and noise of samples around it. */
+struct kcndbgen_model {
+	enum kcndbgen_dist km_dist;
+	double km_a;
+	double km_b;
+	uint64_t km_min;
+	uint64_t km_max;
+	unsigned int km_noise;		/* percent of a mean */
+};
+
+static struct kcndbgen_model kcndbgen_models[KCN_EQ_TYPE_MAX] = {
+	/* free space in MB. */
+	[KCN_EQ_TYPE_STORAGE] =
+	    { KCNDBGEN_DIST_UNIFORM, 1000, 2000000, 0, UINT64_MAX, 1 },
+	/* load in percent. */
+	[KCN_EQ_TYPE_CPULOAD] =
+	    { KCNDBGEN_DIST_NORMAL, 30, 15, 0, 100, 20 },
+	/* bits per second. */
+	[KCN_EQ_TYPE_TRAFFIC] =
+	    { KCNDBGEN_DIST_UNIFORM, 0, 1000000000, 0, UINT64_MAX, 30 },
+	/* milliseconds. */
+	[KCN_EQ_TYPE_RTT] =
+	    { KCNDBGEN_DIST_UNIFORM, 1, 300, 1, UINT64_MAX, 10 },
+	[KCN_EQ_TYPE_HOPCOUNT] =
+	    { KCNDBGEN_DIST_NORMAL, 12, 4, 1, 64, 5 },
+	[KCN_EQ_TYPE_ASPATHLEN] =
+	    { KCNDBGEN_DIST_NORMAL, 4, 1.5, 1, 16, 0 },
+	/* associated stations. */
+	[KCN_EQ_TYPE_WLANASSOC] =
+	    { KCNDBGEN_DIST_UNIFORM, 0, 50, 0, 255, 20 },
+};
+
+struct kcndbgen_record {
+	uint64_t kr_time;
+	uint64_t kr_val;
+	unsigned long long kr_loc;
+};
+
+/* an output file written in large blocks without stdio. */
+struct kcndbgen_out {
+	int ko_fd;
+	char ko_path[MAXPATHLEN];
+	char *ko_buf;
+	size_t ko_len;
+};
+
+struct kcndbgen_table {
+	enum kcn_eq_type kt_type;
+	bool kt_enabled;
+	const struct kcndbgen_model *kt_km;
+	struct kcndbgen_out kt_text;
+	struct kcndbgen_out kt_tables[KCNDB_DB_SHARD_MAX];
+	struct kcndbgen_record *kt_late[KCNDBGEN_LATE_STEPS + 1];
+	size_t kt_nlate[KCNDBGEN_LATE_STEPS + 1];
+	size_t kt_nlatemax[KCNDBGEN_LATE_STEPS + 1];
+};
+
+struct kcndbgen {
+	const char *kg_textdir;
+	const char *kg_tabledir;
+	uint64_t kg_seed;
+	uint64_t kg_rng;
+	unsigned long long kg_nlocs;
+	uint64_t *kg_locidx;		/* offsets in a dictionary */
+	unsigned long long kg_nshards;
+	time_t kg_start;
+	time_t kg_interval;
+	time_t kg_jitter;
+	unsigned long long kg_nsteps;
+	unsigned long long kg_late;	/* percent */
+	struct kcndbgen_record *kg_step;
+	struct kcndbgen_record *kg_sorted;
+	size_t *kg_counts;		/* of each offset of jitter */
+	struct kcndbgen_table kg_tables[KCN_EQ_TYPE_MAX];
+	unsigned long long kg_nrecords;
+};
+
+static void usage(const char *, const char *, ...);
+
+static uint64_t
+splitmix64(uint64_t x)
+{
+
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/* xorshift64*. */
+static uint64_t
+kcndbgen_random(struct kcndbgen *kg)
+{
+	uint64_t x = kg->kg_rng;
+
+	x ^= x >> 12;
+	x ^= x << 25;
+	x ^= x >> 27;
+	kg->kg_rng = x;
+	return x * 0x2545f4914f6cdd1dULL;
+}
+
+static double
+kcndbgen_uniform(uint64_t r)
+{
+
+	return (double)(r >> 11) / (double)(1ULL << 53);
+}
+
+/* an approximate standard normal variate by a sum of four uniform ones. */
+static double
+kcndbgen_normal(uint64_t r)
+{
+	double s;
+	int i;
+
+	for (s = 0, i = 0; i < 4; i++, r >>= 16)
+		s += (double)(r & 0xffff) / 65536;
+	return (s - 2) * 1.7320508075688772;
+}
+
+static uint64_t
+kcndbgen_clamp(const struct kcndbgen_model *km, double v)
+{
+
+	if (v <= (double)km->km_min)
+		return km->km_min;
+	if (v >= (double)km->km_max)
+		return km->km_max;
+	return (uint64_t)v;
+}
+
+/* a mean of a locator is derived from a seed without any state. */
+static double
+kcndbgen_mean(const struct kcndbgen *kg, const struct kcndbgen_table *kt,
+    unsigned long long loc)
+{
+	const struct kcndbgen_model *km = kt->kt_km;
+	uint64_t r;
+
+	r = splitmix64(kg->kg_seed ^ ((uint64_t)kt->kt_type << 56) ^ loc);
+	if (km->km_dist == KCNDBGEN_DIST_UNIFORM)
+		return km->km_a + (km->km_b - km->km_a) * kcndbgen_uniform(r);
+	return km->km_a + km->km_b * kcndbgen_normal(r);
+}
+
+static uint64_t
+kcndbgen_value(struct kcndbgen *kg, const struct kcndbgen_table *kt,
+    unsigned long long loc)
+{
+	const struct kcndbgen_model *km = kt->kt_km;
+	double mean;
+
+	mean = kcndbgen_mean(kg, kt, loc);
+	if (km->km_noise != 0)
+		mean += mean * km->km_noise / 100 *
+		    kcndbgen_normal(kcndbgen_random(kg));
+	return kcndbgen_clamp(km, mean);
+}
+
+static bool
+kcndbgen_model_parse(const char *spec)
+{
+	struct kcndbgen_model *km;
+	enum kcn_eq_type type;
+	char *s, *p, *dist, *ep;
+	double a, b;
+
+	s = strdup(spec);
+	if (s == NULL)
+		err(EXIT_FAILURE, "cannot allocate a distribution");
+	p = s;
+	if (! kcn_eq_type_aton(strsep(&p, ":"), &type) || p == NULL)
+		goto bad;
+	dist = strsep(&p, ":");
+	if (p == NULL)
+		goto bad;
+	a = strtod(strsep(&p, ":"), &ep);
+	if (*ep != '\0' || p == NULL)
+		goto bad;
+	b = strtod(p, &ep);
+	if (*ep != '\0' || a < 0 || b < 0)
+		goto bad;
+	km = &kcndbgen_models[type];
+	if (strcmp(dist, "uniform") == 0) {
+		if (a > b)
+			goto bad;
+		km->km_dist = KCNDBGEN_DIST_UNIFORM;
+	} else if (strcmp(dist, "normal") == 0)
+		km->km_dist = KCNDBGEN_DIST_NORMAL;
+	else
+		goto bad;
+	km->km_a = a;
+	km->km_b = b;
+	free(s);
+	return true;
+  bad:
+	free(s);
+	return false;
+}
+
+static void
+kcndbgen_out_open(struct kcndbgen_out *ko, const char *dir, const char *name,
+    const char *suffix)
+{
+
+	(void)snprintf(ko->ko_path, sizeof(ko->ko_path), "%s/%s%s", dir, name,
+	    suffix);
+	ko->ko_fd = open(ko->ko_path, O_WRONLY | O_CREAT | O_EXCL, 0600);
+	if (ko->ko_fd == -1)
+		err(EXIT_FAILURE, "cannot open %s", ko->ko_path);
+	ko->ko_buf = malloc(KCNDBGEN_OBUFSIZ);
+	if (ko->ko_buf == NULL)
+		err(EXIT_FAILURE, "cannot allocate output buffer");
+	ko->ko_len = 0;
+}
+
+static void
+kcndbgen_out_flush(struct kcndbgen_out *ko)
+{
+	ssize_t len;
+	size_t off;
+
+	for (off = 0; off < ko->ko_len; off += len) {
+		len = write(ko->ko_fd, ko->ko_buf + off, ko->ko_len - off);
+		if (len == -1) {
+			if (errno == EINTR) {
+				len = 0;
+				continue;
+			}
+			err(EXIT_FAILURE, "cannot write %s", ko->ko_path);
+		}
+	}
+	ko->ko_len = 0;
+}
+
+static char *
+kcndbgen_out_reserve(struct kcndbgen_out *ko, size_t len)
+{
+
+	if (ko->ko_len + len > KCNDBGEN_OBUFSIZ)
+		kcndbgen_out_flush(ko);
+	return ko->ko_buf + ko->ko_len;
+}
+
+static void
+kcndbgen_out_close(struct kcndbgen_out *ko)
+{
+
+	if (ko->ko_buf == NULL)
+		return;
+	kcndbgen_out_flush(ko);
+	if (fsync(ko->ko_fd) == -1 || close(ko->ko_fd) == -1)
+		err(EXIT_FAILURE, "cannot close %s", ko->ko_path);
+	free(ko->ko_buf);
+	ko->ko_buf = NULL;
+}
+
+static char *
+kcndbgen_utoa(char *p, uint64_t v)
+{
+	char buf[sizeof("18446744073709551615")], *q;
+
+	q = buf + sizeof(buf);
+	do {
+		*--q = '0' + v % 10;
+		v /= 10;
+	} while (v != 0);
+	memcpy(p, q, buf + sizeof(buf) - q);
+	return p + (buf + sizeof(buf) - q);
+}
+
+/* "host%llu.kcndbgen.example" without printf(3), which is too slow. */
+static char *
+kcndbgen_loc(char *p, unsigned long long loc)
+{
+	static const char suffix[] = ".kcndbgen.example";
+
+	memcpy(p, "host", 4);
+	p = kcndbgen_utoa(p + 4, loc);
+	memcpy(p, suffix, sizeof(suffix) - 1);
+	return p + sizeof(suffix) - 1;
+}
+
+static void
+kcndbgen_text_write(struct kcndbgen_table *kt,
+    const struct kcndbgen_record *kr)
+{
+	struct kcndbgen_out *ko = &kt->kt_text;
+	char *p, *sp;
+
+	sp = p = kcndbgen_out_reserve(ko, 20 + 1 + 20 + 1 +
+	    KCNDBGEN_LOC_MAXLEN + 1);
+	p = kcndbgen_utoa(p, kr->kr_time);
+	*p++ = ' ';
+	p = kcndbgen_utoa(p, kr->kr_val);
+	*p++ = ' ';
+	p = kcndbgen_loc(p, kr->kr_loc);
+	*p++ = '\n';
+	ko->ko_len += p - sp;
+}
+
+static void
+kcndbgen_table_write(struct kcndbgen *kg, struct kcndbgen_table *kt,
+    const struct kcndbgen_record *kr)
+{
+	struct kcndbgen_out *ko;
+	uint64_t locidx;
+	uint8_t *p;
+
+	locidx = kg->kg_locidx[kr->kr_loc];
+	ko = &kt->kt_tables[kcndb_format_shard(locidx, kg->kg_nshards)];
+	p = (uint8_t *)kcndbgen_out_reserve(ko, KCNDB_DB_RECORDSIZ);
+	kcndb_format_put64(&p[0], kr->kr_time);
+	kcndb_format_put64(&p[8], kr->kr_val);
+	kcndb_format_put64(&p[16], locidx);
+	ko->ko_len += KCNDB_DB_RECORDSIZ;
+}
+
+static void
+kcndbgen_late_add(struct kcndbgen_table *kt, size_t slot,
+    const struct kcndbgen_record *kr)
+{
+	struct kcndbgen_record *late;
+
+	if (kt->kt_nlate[slot] == kt->kt_nlatemax[slot]) {
+		kt->kt_nlatemax[slot] = kt->kt_nlatemax[slot] == 0 ? 1024 :
+		    kt->kt_nlatemax[slot] * 2;
+		late = realloc(kt->kt_late[slot],
+		    kt->kt_nlatemax[slot] * sizeof(*late));
+		if (late == NULL)
+			err(EXIT_FAILURE, "cannot allocate late records");
+		kt->kt_late[slot] = late;
+	}
+	kt->kt_late[slot][kt->kt_nlate[slot]++] = *kr;
+}
+
+static void
+kcndbgen_late_flush(struct kcndbgen_table *kt, size_t slot)
+{
+	size_t i;
+
+	for (i = 0; i < kt->kt_nlate[slot]; i++)
+		kcndbgen_text_write(kt, &kt->kt_late[slot][i]);
+	kt->kt_nlate[slot] = 0;
+}
+
+/*
+ * generate a record of each locator at a step, which is sorted by time
+ * by counting offsets of jitter.  jitter is less than a half of an
+ * interval, and steps never overlap.
+ */
+static void
+kcndbgen_step(struct kcndbgen *kg, struct kcndbgen_table *kt,
+    unsigned long long step)
+{
+	struct kcndbgen_record *kr;
+	uint64_t t, r;
+	size_t noffs, i, slot, n;
+	unsigned long long loc;
+
+	t = kg->kg_start + step * kg->kg_interval;
+	noffs = kg->kg_jitter * 2 + 1;
+	memset(kg->kg_counts, 0, noffs * sizeof(*kg->kg_counts));
+	for (loc = 0; loc < kg->kg_nlocs; loc++) {
+		kr = &kg->kg_step[loc];
+		r = kg->kg_jitter == 0 ? 0 : kcndbgen_random(kg) % noffs;
+		kr->kr_time = t - kg->kg_jitter + r;
+		kr->kr_val = kcndbgen_value(kg, kt, loc);
+		kr->kr_loc = loc;
+		++kg->kg_counts[r];
+	}
+	for (n = 0, i = 0; i < noffs; i++) {
+		n += kg->kg_counts[i];
+		kg->kg_counts[i] = n - kg->kg_counts[i];
+	}
+	for (loc = 0; loc < kg->kg_nlocs; loc++) {
+		kr = &kg->kg_step[loc];
+		i = kr->kr_time + kg->kg_jitter - t;
+		kg->kg_sorted[kg->kg_counts[i]++] = *kr;
+	}
+
+	slot = step % (KCNDBGEN_LATE_STEPS + 1);
+	for (loc = 0; loc < kg->kg_nlocs; loc++) {
+		kr = &kg->kg_sorted[loc];
+		if (kg->kg_tabledir != NULL)
+			kcndbgen_table_write(kg, kt, kr);
+		if (kg->kg_textdir == NULL)
+			continue;
+		if (kg->kg_late != 0 &&
+		    (r = kcndbgen_random(kg)) % 100 < kg->kg_late)
+			kcndbgen_late_add(kt, (slot + 1 + (r >> 32) %
+			    KCNDBGEN_LATE_STEPS) % (KCNDBGEN_LATE_STEPS + 1),
+			    kr);
+		else
+			kcndbgen_text_write(kt, kr);
+	}
+	if (kg->kg_textdir != NULL)
+		kcndbgen_late_flush(kt, slot);
+	kg->kg_nrecords += kg->kg_nlocs;
+}
+
+/*
+ * write a dictionary of locators in order of indexes.  entries are
+ * prepended to hash chains as kcndbd does, and heads of chains are
+ * written at last.
+ */
+static void
+kcndbgen_loc_write(struct kcndbgen *kg)
+{
+	struct kcndbgen_out ko;
+	uint64_t heads[KCNDB_DB_LOC_HASHSIZ], idx;
+	char loc[KCNDBGEN_LOC_MAXLEN];
+	uint8_t *p;
+	unsigned long long i;
+	unsigned int h;
+	size_t len;
+
+	kg->kg_locidx = malloc(kg->kg_nlocs * sizeof(*kg->kg_locidx));
+	if (kg->kg_locidx == NULL)
+		err(EXIT_FAILURE, "cannot allocate locators");
+	memset(heads, 0, sizeof(heads));
+	kcndbgen_out_open(&ko, kg->kg_tabledir, KCNDB_DB_PATH_LOC, "");
+	p = (uint8_t *)kcndbgen_out_reserve(&ko, sizeof(heads));
+	memset(p, 0, sizeof(heads));
+	ko.ko_len += sizeof(heads);
+	idx = KCNDB_DB_LOC_INDEXTABLESIZ;
+	for (i = 0; i < kg->kg_nlocs; i++) {
+		len = kcndbgen_loc(loc, i) - loc;
+		h = kcn_str_hash(loc, len, KCNDB_DB_LOC_HASHSIZ);
+		p = (uint8_t *)kcndbgen_out_reserve(&ko,
+		    sizeof(uint16_t) + len + sizeof(uint64_t));
+		p[0] = len >> 8;
+		p[1] = len & 0xff;
+		memcpy(&p[2], loc, len);
+		kcndb_format_put64(&p[2 + len], heads[h]);
+		ko.ko_len += sizeof(uint16_t) + len + sizeof(uint64_t);
+		kg->kg_locidx[i] = heads[h] = idx;
+		idx += sizeof(uint16_t) + len + sizeof(uint64_t);
+	}
+	kcndbgen_out_flush(&ko);
+	for (h = 0; h < KCNDB_DB_LOC_HASHSIZ; h++)
+		kcndb_format_put64(
+		    (uint8_t *)&ko.ko_buf[h * sizeof(uint64_t)], heads[h]);
+	if (pwrite(ko.ko_fd, ko.ko_buf, sizeof(heads), 0) !=
+	    (ssize_t)sizeof(heads))
+		err(EXIT_FAILURE, "cannot write %s", ko.ko_path);
+	kcndbgen_out_close(&ko);
+}
+
+static int
+kcndbgen_process(struct kcndbgen *kg)
+{
+	struct kcndbgen_table *kt;
+	enum kcn_eq_type type;
+	char name[MAXPATHLEN];
+	unsigned long long step;
+	unsigned int shard;
+	size_t slot;
+
+	kg->kg_rng = kg->kg_seed != 0 ? kg->kg_seed : 1;
+	kg->kg_step = malloc(kg->kg_nlocs * sizeof(*kg->kg_step));
+	kg->kg_sorted = malloc(kg->kg_nlocs * sizeof(*kg->kg_sorted));
+	kg->kg_counts = malloc((kg->kg_jitter * 2 + 1) *
+	    sizeof(*kg->kg_counts));
+	if (kg->kg_step == NULL || kg->kg_sorted == NULL ||
+	    kg->kg_counts == NULL)
+		err(EXIT_FAILURE, "cannot allocate records");
+	if (kg->kg_tabledir != NULL)
+		kcndbgen_loc_write(kg);
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		kt = &kg->kg_tables[type];
+		if (! kt->kt_enabled)
+			continue;
+		if (kg->kg_textdir != NULL)
+			kcndbgen_out_open(&kt->kt_text, kg->kg_textdir,
+			    kcn_eq_type_ntoa(type), KCNDBGEN_PATH_TEXT_SUFFIX);
+		if (kg->kg_tabledir == NULL)
+			continue;
+		for (shard = 0; shard < kg->kg_nshards; shard++) {
+			kcndb_format_table_name(name, sizeof(name), type,
+			    shard);
+			kcndbgen_out_open(&kt->kt_tables[shard],
+			    kg->kg_tabledir, name, "");
+		}
+	}
+
+	for (step = 0; step < kg->kg_nsteps; step++)
+		for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX;
+		    type++)
+			if (kg->kg_tables[type].kt_enabled)
+				kcndbgen_step(kg, &kg->kg_tables[type], step);
+
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		kt = &kg->kg_tables[type];
+		if (! kt->kt_enabled)
+			continue;
+		for (step = kg->kg_nsteps;
+		    step < kg->kg_nsteps + KCNDBGEN_LATE_STEPS; step++)
+			kcndbgen_late_flush(kt,
+			    step % (KCNDBGEN_LATE_STEPS + 1));
+		kcndbgen_out_close(&kt->kt_text);
+		for (shard = 0; shard < kg->kg_nshards; shard++)
+			kcndbgen_out_close(&kt->kt_tables[shard]);
+		for (slot = 0; slot <= KCNDBGEN_LATE_STEPS; slot++)
+			free(kt->kt_late[slot]);
+	}
+	KCN_LOG(NOTICE, "%llu record(s) of %llu locator(s) generated",
+	    kg->kg_nrecords, kg->kg_nlocs);
+	free(kg->kg_step);
+	free(kg->kg_sorted);
+	free(kg->kg_counts);
+	free(kg->kg_locidx);
+	return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char * const argv[])
+{
+	const char *pname;
+	struct kcndbgen kg;
+	enum kcn_eq_type type;
+	unsigned long long ullval, nrecords;
+	time_t window;
+	bool tflag;
+	int ch;
+
+	pname = (pname = strrchr(argv[0], '/')) != NULL ? pname + 1 : argv[0];
+	memset(&kg, 0, sizeof(kg));
+	kg.kg_nlocs = KCNDBGEN_NLOCS_DEFAULT;
+	kg.kg_nshards = 1;
+	kg.kg_interval = KCNDBGEN_INTERVAL_DEFAULT;
+	kg.kg_start = KCN_TIME_NOW;
+	kg.kg_seed = 1;
+	window = KCNDBGEN_WINDOW_DEFAULT;
+	nrecords = 0;
+	tflag = false;
+
+	while ((ch = getopt(argc, argv, "N:O:S:V:b:f:hi:j:l:n:s:t:vw:?")) !=
+	    -1) {
+		switch (ch) {
+		case 'N':
+			if (! kcn_strtoull(optarg, 1, KCNDB_DB_SHARD_MAX,
+			    &kg.kg_nshards))
+				usage(pname, "invalid number of shards");
+				/*NOTREACHED*/
+			break;
+		case 'O':
+			if (! kcn_strtoull(optarg, 0, 100, &kg.kg_late))
+				usage(pname, "invalid ratio of late records");
+				/*NOTREACHED*/
+			break;
+		case 'S':
+			if (! kcn_strtoull(optarg, 0, ULLONG_MAX, &ullval))
+				usage(pname, "invalid seed");
+				/*NOTREACHED*/
+			kg.kg_seed = ullval;
+			break;
+		case 'V':
+			if (! kcndbgen_model_parse(optarg))
+				usage(pname, "invalid distribution: %s",
+				    optarg);
+				/*NOTREACHED*/
+			break;
+		case 'b':
+			kg.kg_tabledir = optarg;
+			break;
+		case 'f':
+			kg.kg_textdir = optarg;
+			break;
+		case 'i':
+			if (! kcn_eq_window_aton(optarg, &kg.kg_interval))
+				usage(pname, "invalid interval");
+				/*NOTREACHED*/
+			break;
+		case 'j':
+			if (! kcn_strtoull(optarg, 0, INT_MAX, &ullval))
+				usage(pname, "invalid jitter");
+				/*NOTREACHED*/
+			kg.kg_jitter = ullval;
+			break;
+		case 'l':
+			if (! kcn_strtoull(optarg, 1, UINT32_MAX,
+			    &kg.kg_nlocs))
+				usage(pname, "invalid number of locators");
+				/*NOTREACHED*/
+			break;
+		case 'n':
+			if (! kcn_strtoull(optarg, 1, ULLONG_MAX, &nrecords))
+				usage(pname, "invalid number of records");
+				/*NOTREACHED*/
+			break;
+		case 's':
+			if (! kcn_strtoull(optarg, 0, LONG_MAX, &ullval))
+				usage(pname, "invalid start time");
+				/*NOTREACHED*/
+			kg.kg_start = ullval;
+			break;
+		case 't':
+			if (! kcn_eq_type_aton(optarg, &type))
+				usage(pname, "unknown database type");
+				/*NOTREACHED*/
+			kg.kg_tables[type].kt_enabled = true;
+			tflag = true;
+			break;
+		case 'v':
+			kcn_log_priority_increment();
+			break;
+		case 'w':
+			if (! kcn_eq_window_aton(optarg, &window))
+				usage(pname, "invalid window");
+				/*NOTREACHED*/
+			break;
+		case 'h':
+		case '?':
+		default:
+			usage(pname, NULL);
+			/*NOTREACHED*/
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 0)
+		usage(pname, "wrong number of arguments");
+		/*NOTREACHED*/
+	if (kg.kg_textdir == NULL && kg.kg_tabledir == NULL)
+		usage(pname, "neither -f nor -b specified");
+		/*NOTREACHED*/
+	if (kg.kg_jitter * 2 >= kg.kg_interval)
+		usage(pname, "jitter must be less than a half of interval");
+		/*NOTREACHED*/
+
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		if (! tflag)
+			kg.kg_tables[type].kt_enabled = true;
+		kg.kg_tables[type].kt_type = type;
+		kg.kg_tables[type].kt_km = &kcndbgen_models[type];
+	}
+	if (nrecords != 0)
+		kg.kg_nsteps = (nrecords + kg.kg_nlocs - 1) / kg.kg_nlocs;
+	else
+		kg.kg_nsteps = window / kg.kg_interval;
+	if (kg.kg_start == KCN_TIME_NOW)
+		kg.kg_start = (time(NULL) / kg.kg_interval - kg.kg_nsteps) *
+		    kg.kg_interval;
+	if (kg.kg_start < kg.kg_jitter)
+		usage(pname, "start time must not be less than jitter");
+		/*NOTREACHED*/
+
+	return kcndbgen_process(&kg);
+}
+
+static void
+usage(const char *pname, const char *errfmt, ...)
+{
+	va_list ap;
+	enum kcn_eq_type type;
+
+	if (errfmt != NULL)  {
+		fprintf(stderr, "ERROR: ");
+		va_start(ap, errfmt);
+		vfprintf(stderr, errfmt, ap);
+		va_end(ap);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "\
+Usage: %s [-v] [-f directory] [-b directory] [-t type] [-l locators]\n\
+	  [-n records | -w window] [-s start] [-i interval] [-j jitter]\n\
+	  [-O percent] [-V type:distribution:a:b] [-S seed] [-N shards]\n\
+Options:\n\
+	-f directory: Write records of each type to a text file named\n\
+		      ``type.txt'' in a directory for kcndbctl -f.\n\
+	-b directory: Write tables and a dictionary of locators to a\n\
+		      directory in the same format as kcndbd, which is\n\
+		      attached by kcndbctl -a.  Existing files are never\n\
+		      overwritten.\n\
+	-N shards: Split each table given by -b into shards as kcndbd -n\n\
+		   does, which kcndbd opens as they are (default: 1).\n\
+		   kcndbctl -a attaches only a table of one shard.\n\
+	-t type: Generate records of a type, which can be specified\n\
+		 multiple times (default: all types).\n\
+	-l locators: The number of locators (default: %d).\n\
+	-n records: The number of records of each type, which is rounded\n\
+		    up to a multiple of locators.\n\
+	-w window: Generate records of a window (default: 1d).\n\
+	-s start: Start time in UTC second (default: a window ago).\n\
+	-i interval: An interval of samples of a locator (default: 1m).\n\
+	-j jitter: Jitter of each sample in second (default: 0).\n\
+	-O percent: Delay records in text files by up to %d intervals\n\
+		    at a ratio (default: 0).\n\
+	-V type:distribution:a:b: Draw a mean of each locator of a type\n\
+		from a distribution of ``uniform'' between a and b, or\n\
+		``normal'' of a mean of a and a standard deviation of b.\n\
+		Samples are spread around a mean.\n\
+	-S seed: A seed of random numbers (default: 1).\n\
+	-v: Increment verbosity (can be specified 7 times at maximum).\n\
+\n\
+Supported database types are:\n\
+",
+	    pname, KCNDBGEN_NLOCS_DEFAULT, KCNDBGEN_LATE_STEPS);
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		fprintf(stderr, "\t%s\n", kcn_eq_type_ntoa(type));
+	exit(EXIT_FAILURE);
+}
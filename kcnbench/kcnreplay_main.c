@@ -0,0 +1,777 @@
+/*
+ * replay messages captured by kcndbd -t against kcndbd, and measure their
+ * latencies.
+ *
+ * each captured session is replayed over its own connection, which is
+ * made when a first message of a session is replayed, and closed when a
+ * session is closed.  messages are sent at their original intervals
+ * scaled by a speed, and a latency is measured from a scheduled time so
+ * that a stalled server does not hide its own latency.  at the maximum
+ * speed, messages are sent as fast as a fixed number of them are kept in
+ * flight.
+ *
+ * an attach changes a database, and is replayed only if requested since
+ * a directory attached may not exist any more or may be attached twice.
+ *
+ * a latency of a query, a history or an attach is a time until its last
+ * response is received.  adds and deletes have no response, and their
+ * latency is a time until they are written to a socket.
+ */
+#include <sys/queue.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <event.h>
+
+#include "kcn.h"
+#include "kcn_log.h"
+#include "kcn_str.h"
+#include "kcn_eq.h"
+#include "kcn_buf.h"
+#include "kcn_net.h"
+#include "kcn_msg.h"
+#include "kcn_ctx.h"
+#include "kcn_client.h"
+#include "kcn_netstat.h"
+#include "kcnbench_hist.h"
+#include "kcnbench_run.h"
+#include "kcndb_format.h"
+
+#define KCNREPLAY_TICK			1000	/* usec */
+#define KCNREPLAY_USECINSEC		1000000ULL
+#define KCNREPLAY_HASHSIZ		1024
+#define KCNREPLAY_CONCURRENCY_DEFAULT	16
+
+struct kcnreplay;
+
+struct kcnreplay_req {
+	TAILQ_ENTRY(kcnreplay_req) krr_chain;
+	enum kcn_msg_type krr_type;
+	uint64_t krr_start;
+};
+
+TAILQ_HEAD(kcnreplay_reqs, kcnreplay_req);
+
+struct kcnreplay_session {
+	LIST_ENTRY(kcnreplay_session) krs_chain;
+	TAILQ_ENTRY(kcnreplay_session) krs_closechain;
+	struct kcnreplay *krs_krp;
+	uint32_t krs_id;
+	struct kcn_net *krs_kn;
+	struct kcnreplay_reqs krs_reqs;		/* waiting for responses */
+	struct kcnreplay_reqs krs_writes;	/* waiting to be written */
+	bool krs_closing;
+	bool krs_down;
+};
+
+struct kcnreplay_stat {
+	const char *kst_name;
+	uint64_t kst_nerrors;
+	struct kcnbench_hist kst_hist;
+};
+
+struct kcnreplay_entry {
+	uint64_t kre_time;
+	uint32_t kre_session;
+	size_t kre_len;
+	uint8_t kre_buf[KCN_MSG_MAXSIZ];
+};
+
+struct kcnreplay {
+	struct kcn_ctx *krp_kc;
+	struct event_base *krp_evb;
+	struct event krp_evtick;
+	FILE *krp_fp;
+	const char *krp_path;
+	double krp_speed;		/* as fast as possible if 0 */
+	unsigned long long krp_concurrency;
+	time_t krp_offset;
+	time_t krp_duration;		/* until the end if 0 */
+	bool krp_attach;		/* replay attaches */
+	LIST_HEAD(, kcnreplay_session) krp_sessions[KCNREPLAY_HASHSIZ];
+	TAILQ_HEAD(, kcnreplay_session) krp_closings;
+	struct kcnreplay_stat krp_stats[KCN_MSG_TYPE_ATTACH + 1];
+	struct kcnreplay_entry krp_kre;
+	bool krp_loaded;		/* krp_kre is not replayed yet */
+	bool krp_eof;
+	uint64_t krp_first;		/* time of a first entry in a file */
+	uint64_t krp_t0;		/* time of a first entry replayed */
+	uint64_t krp_start;
+	uint64_t krp_nmsgs;
+	uint64_t krp_nsessions;
+	uint64_t krp_nskipped;
+	uint64_t krp_ndisconnects;
+	size_t krp_ninflight;
+};
+
+static void kcnreplay_fill(struct kcnreplay *);
+static void usage(const char *, const char *, ...);
+
+static uint64_t
+kcnreplay_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * KCNREPLAY_USECINSEC +
+	    (uint64_t)ts.tv_nsec / 1000;
+}
+
+static uint64_t
+kcnreplay_get(const uint8_t *p, size_t len)
+{
+	uint64_t v;
+
+	for (v = 0; len > 0; len--)
+		v = v << 8 | *p++;
+	return v;
+}
+
+static bool
+kcnreplay_open(struct kcnreplay *krp)
+{
+	uint8_t hdr[KCNDB_CAPTURE_HDRSIZ];
+
+	krp->krp_fp = fopen(krp->krp_path, "r");
+	if (krp->krp_fp == NULL)
+		return false;
+	if (fread(hdr, sizeof(hdr), 1, krp->krp_fp) != 1 ||
+	    memcmp(hdr, KCNDB_CAPTURE_MAGIC, 4) != 0 ||
+	    kcnreplay_get(hdr + 4, 2) != KCNDB_CAPTURE_VERSION) {
+		errno = EINVAL;
+		return false;
+	}
+	return true;
+}
+
+/* return false at the end of a file or a duration. */
+static bool
+kcnreplay_load(struct kcnreplay *krp)
+{
+	struct kcnreplay_entry *kre = &krp->krp_kre;
+	uint8_t hdr[KCNDB_CAPTURE_ENTRYHDRSIZ];
+	size_t n;
+
+	for (;;) {
+		if (krp->krp_eof)
+			return false;
+		n = fread(hdr, 1, sizeof(hdr), krp->krp_fp);
+		if (n == 0 && feof(krp->krp_fp))
+			goto end;
+		if (n != sizeof(hdr))
+			goto bad;
+		kre->kre_time = kcnreplay_get(hdr, 8);
+		kre->kre_session = kcnreplay_get(hdr + 8, 4);
+		kre->kre_len = kcnreplay_get(hdr + 8 + 4, 2);
+		if (kre->kre_len > sizeof(kre->kre_buf) ||
+		    (kre->kre_len != 0 && kre->kre_len < KCN_MSG_HDRSIZ)) {
+			warnx("%s: invalid entry of %zu bytes", krp->krp_path,
+			    kre->kre_len);
+			goto end;
+		}
+		if (kre->kre_len > 0 &&
+		    fread(kre->kre_buf, kre->kre_len, 1, krp->krp_fp) != 1)
+			goto bad;
+		if (krp->krp_first == 0)
+			krp->krp_first = kre->kre_time;
+		if (kre->kre_time <
+		    krp->krp_first + krp->krp_offset * KCNREPLAY_USECINSEC)
+			continue;
+		if (krp->krp_t0 == 0)
+			krp->krp_t0 = kre->kre_time;
+		if (krp->krp_duration != 0 && kre->kre_time >=
+		    krp->krp_t0 + krp->krp_duration * KCNREPLAY_USECINSEC)
+			goto end;
+		krp->krp_loaded = true;
+		return true;
+	}
+  bad:
+	if (ferror(krp->krp_fp))
+		warn("%s", krp->krp_path);
+	else
+		warnx("%s: truncated entry", krp->krp_path);
+  end:
+	krp->krp_eof = true;
+	return false;
+}
+
+static void
+kcnreplay_complete(struct kcnreplay *krp, struct kcnreplay_reqs *reqs,
+    int error)
+{
+	struct kcnreplay_req *krr;
+	struct kcnreplay_stat *kst;
+
+	krr = TAILQ_FIRST(reqs);
+	TAILQ_REMOVE(reqs, krr, krr_chain);
+	kst = &krp->krp_stats[krr->krr_type];
+	if (error != 0)
+		++kst->kst_nerrors;
+	else
+		kcnbench_hist_record(&kst->kst_hist,
+		    kcnreplay_now() - krr->krr_start);
+	free(krr);
+	--krp->krp_ninflight;
+}
+
+static int
+kcnreplay_read(struct kcn_net *kn, struct kcn_buf *kb, void *arg)
+{
+	struct kcnreplay_session *krs = arg;
+	struct kcnreplay *krp = krs->krs_krp;
+	struct kcn_msg_header kmh;
+	struct kcn_msg_response kmr;
+	struct kcn_msg_sample kms;
+	int error;
+
+	(void)kn;
+	while (kcn_msg_header_decode(kb, &kmh)) {
+		if (TAILQ_EMPTY(&krs->krs_reqs)) {
+			errno = EINVAL;
+			return errno;
+		}
+		switch (kmh.kmh_type) {
+		case KCN_MSG_TYPE_RESPONSE:
+			kcn_msg_response_init(&kmr);
+			if (! kcn_msg_response_decode(kb, &kmh, &kmr))
+				return errno;
+			if (kmr.kmr_loclen != 0)
+				continue;
+			error = kmr.kmr_error;
+			break;
+		case KCN_MSG_TYPE_SAMPLE:
+			if (! kcn_msg_sample_decode(kb, &kmh, &kms))
+				return errno;
+			if (! kms.kms_end)
+				continue;
+			error = kms.kms_error;
+			break;
+		default:
+			errno = EINVAL;
+			return errno;
+		}
+		if (error == ESRCH)
+			error = 0;	/* no locators matched. */
+		else if (error != 0)
+			KCN_LOG(DEBUG, "session %u failed: %s", krs->krs_id,
+			    strerror(error));
+		kcnreplay_complete(krp, &krs->krs_reqs, error);
+	}
+	if (errno != EAGAIN)
+		return errno;
+	kcnreplay_fill(krp);
+	if (TAILQ_EMPTY(&krs->krs_reqs) && kcn_buf_trailingdata(kb) == 0)
+		return 0;
+	return EAGAIN;
+}
+
+static void
+kcnreplay_drain(struct kcn_net *kn, void *arg)
+{
+	struct kcnreplay_session *krs = arg;
+
+	(void)kn;
+	while (! TAILQ_EMPTY(&krs->krs_writes))
+		kcnreplay_complete(krs->krs_krp, &krs->krs_writes, 0);
+	kcnreplay_fill(krs->krs_krp);
+}
+
+static void
+kcnreplay_close(struct kcn_net *kn, int error, void *arg)
+{
+	struct kcnreplay_session *krs = arg;
+	struct kcnreplay *krp = krs->krs_krp;
+
+	(void)kn;
+	if (error == 0)	/* destroyed by ourselves. */
+		return;
+	KCN_LOG(DEBUG, "session %u disconnected: %s", krs->krs_id,
+	    strerror(error));
+	krs->krs_down = true;
+	++krp->krp_ndisconnects;
+	while (! TAILQ_EMPTY(&krs->krs_reqs))
+		kcnreplay_complete(krp, &krs->krs_reqs, error);
+	while (! TAILQ_EMPTY(&krs->krs_writes))
+		kcnreplay_complete(krp, &krs->krs_writes, error);
+}
+
+static struct kcnreplay_session *
+kcnreplay_session_lookup(struct kcnreplay *krp, uint32_t id)
+{
+	struct kcnreplay_session *krs;
+
+	LIST_FOREACH(krs, &krp->krp_sessions[id % KCNREPLAY_HASHSIZ],
+	    krs_chain)
+		if (krs->krs_id == id)
+			return krs;
+	return NULL;
+}
+
+static struct kcnreplay_session *
+kcnreplay_session_get(struct kcnreplay *krp, uint32_t id)
+{
+	struct kcnreplay_session *krs;
+
+	krs = kcnreplay_session_lookup(krp, id);
+	if (krs == NULL) {
+		krs = malloc(sizeof(*krs));
+		if (krs == NULL)
+			return NULL;
+		krs->krs_krp = krp;
+		krs->krs_id = id;
+		krs->krs_kn = NULL;
+		TAILQ_INIT(&krs->krs_reqs);
+		TAILQ_INIT(&krs->krs_writes);
+		krs->krs_closing = false;
+		krs->krs_down = false;
+		LIST_INSERT_HEAD(&krp->krp_sessions[id % KCNREPLAY_HASHSIZ],
+		    krs, krs_chain);
+		++krp->krp_nsessions;
+	}
+	if (krs->krs_down) {
+		kcn_client_finish(krs->krs_kn);
+		krs->krs_kn = NULL;
+		krs->krs_down = false;
+	}
+	if (krs->krs_kn == NULL) {
+		krs->krs_kn = kcn_client_connect(krp->krp_kc, krp->krp_evb,
+		    kcnreplay_read, krs);
+		if (krs->krs_kn == NULL)
+			return NULL;
+		kcn_net_close_cb_set(krs->krs_kn, kcnreplay_close);
+		kcn_net_drain_cb_set(krs->krs_kn, kcnreplay_drain);
+	}
+	return krs;
+}
+
+static void
+kcnreplay_session_destroy(struct kcnreplay_session *krs)
+{
+
+	/* requests in flight are discarded. */
+	while (! TAILQ_EMPTY(&krs->krs_reqs))
+		kcnreplay_complete(krs->krs_krp, &krs->krs_reqs, ECANCELED);
+	while (! TAILQ_EMPTY(&krs->krs_writes))
+		kcnreplay_complete(krs->krs_krp, &krs->krs_writes, ECANCELED);
+	if (krs->krs_closing)
+		TAILQ_REMOVE(&krs->krs_krp->krp_closings, krs, krs_closechain);
+	else
+		LIST_REMOVE(krs, krs_chain);
+	kcn_client_finish(krs->krs_kn);
+	free(krs);
+}
+
+/*
+ * a session closed in a capture is destroyed once its requests complete.
+ * this is called only by a timer since a connection cannot be destroyed
+ * in its own callbacks.
+ */
+static void
+kcnreplay_session_reap(struct kcnreplay *krp)
+{
+	struct kcnreplay_session *krs, *nkrs;
+
+	for (krs = TAILQ_FIRST(&krp->krp_closings); krs != NULL; krs = nkrs) {
+		nkrs = TAILQ_NEXT(krs, krs_closechain);
+		if (! TAILQ_EMPTY(&krs->krs_reqs) ||
+		    ! TAILQ_EMPTY(&krs->krs_writes))
+			continue;
+		kcnreplay_session_destroy(krs);
+	}
+}
+
+static void
+kcnreplay_session_close(struct kcnreplay *krp, uint32_t id)
+{
+	struct kcnreplay_session *krs;
+
+	krs = kcnreplay_session_lookup(krp, id);
+	if (krs == NULL)
+		return;
+	/* an identifier may be reused after kcndbd restarts. */
+	LIST_REMOVE(krs, krs_chain);
+	krs->krs_closing = true;
+	TAILQ_INSERT_TAIL(&krp->krp_closings, krs, krs_closechain);
+}
+
+static void
+kcnreplay_issue(struct kcnreplay *krp, const struct kcnreplay_entry *kre,
+    uint64_t start)
+{
+	struct kcnreplay_session *krs;
+	struct kcnreplay_req *krr;
+	struct kcn_buf kb;
+	enum kcn_msg_type type;
+	bool response;
+
+	if (kre->kre_len == 0) {
+		kcnreplay_session_close(krp, kre->kre_session);
+		return;
+	}
+	type = kre->kre_buf[1];
+	switch (type) {
+	case KCN_MSG_TYPE_ATTACH:
+		if (! krp->krp_attach) {
+			++krp->krp_nskipped;
+			return;
+		}
+		response = true;
+		break;
+	case KCN_MSG_TYPE_QUERY:
+	case KCN_MSG_TYPE_HISTORY:
+		response = true;
+		break;
+	case KCN_MSG_TYPE_ADD:
+	case KCN_MSG_TYPE_DEL:
+		response = false;
+		break;
+	default:
+		KCN_LOG(DEBUG, "skip a message of unknown type %u", type);
+		++krp->krp_nskipped;
+		return;
+	}
+	++krp->krp_nmsgs;
+	krr = malloc(sizeof(*krr));
+	if (krr == NULL)
+		goto bad;
+	krr->krr_type = type;
+	krr->krr_start = start;
+	krs = kcnreplay_session_get(krp, kre->kre_session);
+	if (krs == NULL)
+		goto bad;
+	kcn_net_obuf(krs->krs_kn, &kb);
+	kcn_buf_reset(&kb, 0);
+	kcn_buf_put(&kb, kre->kre_buf, kre->kre_len);
+	if (! kcn_net_write(krs->krs_kn, &kb))
+		goto bad;
+	if (response) {
+		if (! kcn_net_read_enable(krs->krs_kn))
+			goto bad;
+		TAILQ_INSERT_TAIL(&krs->krs_reqs, krr, krr_chain);
+	} else
+		TAILQ_INSERT_TAIL(&krs->krs_writes, krr, krr_chain);
+	++krp->krp_ninflight;
+	return;
+  bad:
+	KCN_LOG(DEBUG, "cannot replay a message of session %u: %s",
+	    kre->kre_session, strerror(errno));
+	++krp->krp_stats[type].kst_nerrors;
+	free(krr);
+}
+
+static uint64_t
+kcnreplay_scheduled(const struct kcnreplay *krp)
+{
+	const struct kcnreplay_entry *kre = &krp->krp_kre;
+
+	if (kre->kre_time < krp->krp_t0)
+		return krp->krp_start;
+	return krp->krp_start +
+	    (uint64_t)((kre->kre_time - krp->krp_t0) / krp->krp_speed);
+}
+
+static void
+kcnreplay_fill(struct kcnreplay *krp)
+{
+	const struct kcnreplay_entry *kre = &krp->krp_kre;
+	uint64_t now, scheduled;
+
+	now = kcnreplay_now();
+	for (;;) {
+		if (! krp->krp_loaded && ! kcnreplay_load(krp))
+			break;
+		if (krp->krp_speed == 0) {
+			if (krp->krp_ninflight >= krp->krp_concurrency)
+				break;
+			scheduled = kcnreplay_now();
+		} else {
+			scheduled = kcnreplay_scheduled(krp);
+			if (scheduled > now)
+				break;
+		}
+		krp->krp_loaded = false;
+		kcnreplay_issue(krp, kre, scheduled);
+	}
+}
+
+static void
+kcnreplay_tick(int fd, short event, void *arg)
+{
+	struct kcnreplay *krp = arg;
+	struct timeval tv;
+
+	(void)fd;
+	(void)event;
+	kcnreplay_session_reap(krp);
+	kcnreplay_fill(krp);
+	if (krp->krp_eof && krp->krp_ninflight == 0) {
+		event_base_loopbreak(krp->krp_evb);
+		return;
+	}
+	tv.tv_sec = 0;
+	tv.tv_usec = KCNREPLAY_TICK;
+	evtimer_add(&krp->krp_evtick, &tv);
+}
+
+/* return false if any messages fail. */
+static bool
+kcnreplay_report(const struct kcnreplay *krp, double sec, bool json)
+{
+	const struct kcnreplay_stat *kst;
+	struct kcnbench_hist *kh;
+	uint64_t nerrors;
+	size_t i;
+	bool first;
+
+	kh = malloc(sizeof(*kh));
+	if (kh == NULL) {
+		warn("cannot allocate a histogram");
+		return false;
+	}
+	kcnbench_hist_init(kh);
+	nerrors = 0;
+	for (i = 0; i < KCN_MSG_TYPE_ATTACH + 1; i++) {
+		kst = &krp->krp_stats[i];
+		kcnbench_hist_merge(kh, &kst->kst_hist);
+		nerrors += kst->kst_nerrors;
+	}
+
+	if (json) {
+		printf("{\"speed\":%g,\"concurrency\":%llu,"
+		    "\"duration_sec\":%.3f,\"messages\":%llu,\"sessions\":%llu,"
+		    "\"disconnects\":%llu,\"skipped\":%llu,\"ops\":[",
+		    krp->krp_speed,
+		    krp->krp_speed == 0 ? krp->krp_concurrency : 0, sec,
+		    (unsigned long long)krp->krp_nmsgs,
+		    (unsigned long long)krp->krp_nsessions,
+		    (unsigned long long)krp->krp_ndisconnects,
+		    (unsigned long long)krp->krp_nskipped);
+		for (first = true, i = 0; i < KCN_MSG_TYPE_ATTACH + 1; i++) {
+			kst = &krp->krp_stats[i];
+			if (kst->kst_name == NULL)
+				continue;
+			if (! first)
+				printf(",");
+			first = false;
+			kcnbench_hist_report_json(kst->kst_name, NULL,
+			    &kst->kst_hist, kst->kst_nerrors, sec);
+		}
+		printf("],\"total\":");
+		kcnbench_hist_report_json("total", NULL, kh, nerrors, sec);
+		printf("}\n");
+	} else {
+		if (krp->krp_speed == 0)
+			printf("replay %s at maximum speed with %llu messages "
+			    "in flight\n", krp->krp_path, krp->krp_concurrency);
+		else
+			printf("replay %s at %gx speed\n", krp->krp_path,
+			    krp->krp_speed);
+		printf("%llu messages of %llu sessions in %.3f sec, "
+		    "%llu disconnects, %llu skipped, latencies in usec\n",
+		    (unsigned long long)krp->krp_nmsgs,
+		    (unsigned long long)krp->krp_nsessions, sec,
+		    (unsigned long long)krp->krp_ndisconnects,
+		    (unsigned long long)krp->krp_nskipped);
+		kcnbench_hist_report_header();
+		for (i = 0; i < KCN_MSG_TYPE_ATTACH + 1; i++) {
+			kst = &krp->krp_stats[i];
+			if (kst->kst_name == NULL)
+				continue;
+			kcnbench_hist_report_text(kst->kst_name, NULL,
+			    &kst->kst_hist, kst->kst_nerrors, sec);
+		}
+		kcnbench_hist_report_text("total", NULL, kh, nerrors, sec);
+	}
+	free(kh);
+	return nerrors == 0;
+}
+
+static bool
+kcnreplay_speed_aton(const char *s, double *speedp)
+{
+	char *ep;
+	double speed;
+
+	if (strcmp(s, "max") == 0) {
+		*speedp = 0;
+		return true;
+	}
+	errno = 0;
+	speed = strtod(s, &ep);
+	if (errno != 0 || ep == s || *ep != '\0' || speed < 0)
+		return false;
+	*speedp = speed;
+	return true;
+}
+
+int
+main(int argc, char * const argv[])
+{
+	const char *pname, *server;
+	struct kcnreplay *krp;
+	struct kcnreplay_session *krs;
+	enum kcnbench_format format;
+	struct timeval tv;
+	uint64_t end;
+	size_t i;
+	int ch, rc;
+
+	pname = (pname = strrchr(argv[0], '/')) != NULL ? pname + 1 : argv[0];
+	server = NULL;
+	format = KCNBENCH_FORMAT_TEXT;
+	krp = calloc(1, sizeof(*krp));
+	if (krp == NULL)
+		err(EXIT_FAILURE, "cannot allocate a replayer");
+	krp->krp_speed = 1;
+	krp->krp_concurrency = KCNREPLAY_CONCURRENCY_DEFAULT;
+
+	while ((ch = getopt(argc, argv, "O:ac:d:ho:s:vx:?")) != -1) {
+		switch (ch) {
+		case 'O':
+			if (strcmp(optarg, "0") == 0)
+				krp->krp_offset = 0;
+			else if (! kcn_eq_window_aton(optarg,
+			    &krp->krp_offset))
+				usage(pname, "invalid offset");
+				/*NOTREACHED*/
+			break;
+		case 'a':
+			krp->krp_attach = true;
+			break;
+		case 'c':
+			if (! kcn_strtoull(optarg, 1, INT_MAX,
+			    &krp->krp_concurrency))
+				usage(pname, "invalid concurrency");
+				/*NOTREACHED*/
+			break;
+		case 'd':
+			if (! kcn_eq_window_aton(optarg, &krp->krp_duration))
+				usage(pname, "invalid duration");
+				/*NOTREACHED*/
+			break;
+		case 'o':
+			if (! kcnbench_format_aton(optarg, &format))
+				usage(pname, "unknown output format");
+				/*NOTREACHED*/
+			break;
+		case 's':
+			server = optarg;
+			break;
+		case 'v':
+			kcn_log_priority_increment();
+			break;
+		case 'x':
+			if (! kcnreplay_speed_aton(optarg, &krp->krp_speed))
+				usage(pname, "invalid speed");
+				/*NOTREACHED*/
+			break;
+		case 'h':
+		case '?':
+		default:
+			usage(pname, NULL);
+			/*NOTREACHED*/
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc != 1)
+		usage(pname, "wrong number of arguments");
+		/*NOTREACHED*/
+	krp->krp_path = argv[0];
+	if (! kcnreplay_open(krp))
+		err(EXIT_FAILURE, "cannot open capture %s", krp->krp_path);
+
+	krp->krp_kc = kcn_ctx_new();
+	if (krp->krp_kc == NULL)
+		err(EXIT_FAILURE, "cannot allocate KCN context");
+	if (! kcn_netstat_init(krp->krp_kc))
+		err(EXIT_FAILURE, "cannot register network statistics");
+	if (server != NULL && ! kcn_ctx_server_set(krp->krp_kc, server))
+		err(EXIT_FAILURE, "cannot set server");
+	for (i = 0; i < KCNREPLAY_HASHSIZ; i++)
+		LIST_INIT(&krp->krp_sessions[i]);
+	TAILQ_INIT(&krp->krp_closings);
+	for (i = 0; i < KCN_MSG_TYPE_ATTACH + 1; i++)
+		kcnbench_hist_init(&krp->krp_stats[i].kst_hist);
+	krp->krp_stats[KCN_MSG_TYPE_QUERY].kst_name = "query";
+	krp->krp_stats[KCN_MSG_TYPE_ADD].kst_name = "add";
+	krp->krp_stats[KCN_MSG_TYPE_DEL].kst_name = "del";
+	krp->krp_stats[KCN_MSG_TYPE_HISTORY].kst_name = "history";
+	krp->krp_stats[KCN_MSG_TYPE_ATTACH].kst_name = "attach";
+
+	krp->krp_evb = event_base_new();
+	if (krp->krp_evb == NULL)
+		errx(EXIT_FAILURE, "cannot allocate event base");
+	evtimer_set(&krp->krp_evtick, kcnreplay_tick, krp);
+	if (event_base_set(krp->krp_evb, &krp->krp_evtick) == -1)
+		errx(EXIT_FAILURE, "cannot set a timer");
+
+	krp->krp_start = kcnreplay_now();
+	kcnreplay_fill(krp);
+	tv.tv_sec = 0;
+	tv.tv_usec = KCNREPLAY_TICK;
+	evtimer_add(&krp->krp_evtick, &tv);
+	if (event_base_dispatch(krp->krp_evb) == -1)
+		err(EXIT_FAILURE, "event dispatch failed");
+	end = kcnreplay_now();
+
+	rc = kcnreplay_report(krp, (double)(end - krp->krp_start) /
+	    KCNREPLAY_USECINSEC, format == KCNBENCH_FORMAT_JSON) ?
+	    EXIT_SUCCESS : EXIT_FAILURE;
+
+	while ((krs = TAILQ_FIRST(&krp->krp_closings)) != NULL)
+		kcnreplay_session_destroy(krs);
+	for (i = 0; i < KCNREPLAY_HASHSIZ; i++)
+		while ((krs = LIST_FIRST(&krp->krp_sessions[i])) != NULL)
+			kcnreplay_session_destroy(krs);
+	event_base_free(krp->krp_evb);
+	kcn_netstat_finish(krp->krp_kc);
+	kcn_ctx_destroy(krp->krp_kc);
+	fclose(krp->krp_fp);
+	free(krp);
+	return rc;
+}
+
+static void
+usage(const char *pname, const char *errfmt, ...)
+{
+	va_list ap;
+
+	if (errfmt != NULL)  {
+		fprintf(stderr, "ERROR: ");
+		va_start(ap, errfmt);
+		vfprintf(stderr, errfmt, ap);
+		va_end(ap);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "\
+Usage: %s [-av] [-x speed] [-c concurrency] [-O offset] [-d duration]\n\
+	  [-o format] [-s server] file\n\
+Options:\n\
+	file: A capture written by kcndbd -t.\n\
+	-x speed: Replay messages at a speed relative to the original,\n\
+		  e.g., 2 for twice as fast, or max or 0 for as fast as\n\
+		  possible (default: 1).\n\
+	-c concurrency: Keep messages in flight at the maximum speed\n\
+			(default: %d).\n\
+	-O offset: Skip messages for a while at first, e.g., 10m.\n\
+	-d duration: Replay messages captured for a duration, e.g., 1h\n\
+		     (default: until the end).\n\
+	-o format: Print results in text or json (default: text).\n\
+	-s server: KCN database server.\n\
+	-a: Replay attaches of directories, which are skipped by default.\n\
+	-v: Increment verbosity (can be specified 7 times at maximum).\n\
+",
+	    pname, KCNREPLAY_CONCURRENCY_DEFAULT);
+	exit(EXIT_FAILURE);
+}
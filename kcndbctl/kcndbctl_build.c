@@ -0,0 +1,572 @@
+/*
+ * offline bulk builder.
+ *
+ * records in the same format as -f are sorted in memory by a chunk, and
+ * each sorted chunk is spilled into a run file.  runs are then merged into
+ * a table together with a table already built, if any, in one pass.
+ * locators are deduplicated in memory, and a dictionary is written at last
+ * in the same order of indexes so that tables already built remain valid.
+ * written files are the same as ones of kcndbd, and are attached to kcndbd
+ * by kcndbctl -a or kcndbd -a.  indexes are built by kcndbd on attachment.
+ */
+#include <sys/param.h>	/* MAXPATHLEN */
+#include <sys/file.h>	/* XXX: flock on linux. */
+#include <ctype.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "kcn.h"
+#include "kcn_log.h"
+#include "kcn_str.h"
+#include "kcn_buf.h"
+#include "kcn_eq.h"
+#include "kcn_msg.h"
+#include "kcndb_format.h"
+#include "kcndbctl_build.h"
+
+#define KCNDBCTL_BUILD_PATH_TEMP_SUFFIX	".build"
+#define KCNDBCTL_BUILD_PATH_RUN_SUFFIX	".run"
+#define KCNDBCTL_BUILD_CHUNKSIZ		(4 * 1024 * 1024)	/* records */
+#define KCNDBCTL_BUILD_IOBUFSIZ		(1024 * 1024)
+#define KCNDBCTL_BUILD_HASHBITS_MIN	16
+
+struct kcndbctl_build_loc {
+	struct kcndbctl_build_loc *kcbl_hnext;
+	uint64_t kcbl_idx;
+	uint64_t kcbl_next;	/* next entry of a hash chain on a file */
+	size_t kcbl_len;
+	char kcbl_loc[1];
+};
+
+struct kcndbctl_build_record {
+	uint64_t kcbr_time;
+	uint64_t kcbr_val;
+	uint64_t kcbr_locidx;
+};
+
+/* a sorted sequence of records on a file. */
+struct kcndbctl_build_run {
+	FILE *kcbn_fp;
+	char *kcbn_buf;
+	struct kcndbctl_build_record kcbn_kcbr;
+};
+
+struct kcndbctl_build {
+	const char *kcb_dir;
+	const char *kcb_name;
+	struct kcndbctl_build_loc **kcb_hash;
+	unsigned int kcb_hashbits;
+	struct kcndbctl_build_loc **kcb_locs;	/* in order of indexes */
+	size_t kcb_nlocs;
+	size_t kcb_nlocsmax;
+	size_t kcb_nlocsold;
+	uint64_t kcb_locsize;
+	struct kcndbctl_build_record *kcb_chunk;
+	size_t kcb_nchunk;
+	size_t kcb_nruns;
+	unsigned long long kcb_nrecords;
+};
+
+static void
+kcndbctl_build_path(char *path, size_t len, const struct kcndbctl_build *kcb,
+    const char *name, const char *suffix)
+{
+
+	(void)snprintf(path, len, "%s/%s%s", kcb->kcb_dir, name, suffix);
+}
+
+static FILE *
+kcndbctl_build_fopen(const char *path, const char *mode, char **bufp)
+{
+	FILE *fp;
+
+	fp = fopen(path, mode);
+	if (fp == NULL)
+		return NULL;
+	*bufp = malloc(KCNDBCTL_BUILD_IOBUFSIZ);
+	if (*bufp == NULL ||
+	    setvbuf(fp, *bufp, _IOFBF, KCNDBCTL_BUILD_IOBUFSIZ) != 0)
+		err(EXIT_FAILURE, "cannot allocate I/O buffer");
+	return fp;
+}
+
+static void
+kcndbctl_build_fclose(FILE *fp, char *buf, const char *path, bool sync)
+{
+
+	if (fflush(fp) == EOF || (sync && fsync(fileno(fp)) == -1))
+		err(EXIT_FAILURE, "cannot write %s", path);
+	if (fclose(fp) == EOF)
+		err(EXIT_FAILURE, "cannot close %s", path);
+	free(buf);
+}
+
+static unsigned int
+kcndbctl_build_hash(const char *loc, size_t loclen, unsigned int bits)
+{
+
+	return kcn_str_hash(loc, loclen, (size_t)1 << bits);
+}
+
+static void
+kcndbctl_build_hash_alloc(struct kcndbctl_build *kcb, unsigned int bits)
+{
+	struct kcndbctl_build_loc **hash, *kcbl;
+	unsigned int h;
+	size_t i;
+
+	hash = calloc((size_t)1 << bits, sizeof(*hash));
+	if (hash == NULL)
+		err(EXIT_FAILURE, "cannot allocate hash table");
+	for (i = 0; i < kcb->kcb_nlocs; i++) {
+		kcbl = kcb->kcb_locs[i];
+		h = kcndbctl_build_hash(kcbl->kcbl_loc, kcbl->kcbl_len, bits);
+		kcbl->kcbl_hnext = hash[h];
+		hash[h] = kcbl;
+	}
+	free(kcb->kcb_hash);
+	kcb->kcb_hash = hash;
+	kcb->kcb_hashbits = bits;
+}
+
+/* return an index of a locator, which is added if not found. */
+static uint64_t
+kcndbctl_build_loc_add(struct kcndbctl_build *kcb, const char *loc,
+    size_t loclen)
+{
+	struct kcndbctl_build_loc *kcbl, **locs;
+	unsigned int h;
+
+	h = kcndbctl_build_hash(loc, loclen, kcb->kcb_hashbits);
+	for (kcbl = kcb->kcb_hash[h]; kcbl != NULL; kcbl = kcbl->kcbl_hnext)
+		if (kcbl->kcbl_len == loclen &&
+		    memcmp(kcbl->kcbl_loc, loc, loclen) == 0)
+			return kcbl->kcbl_idx;
+
+	if (kcb->kcb_nlocs == kcb->kcb_nlocsmax) {
+		kcb->kcb_nlocsmax = kcb->kcb_nlocsmax == 0 ?
+		    KCNDB_DB_LOC_HASHSIZ : kcb->kcb_nlocsmax * 2;
+		locs = realloc(kcb->kcb_locs,
+		    kcb->kcb_nlocsmax * sizeof(*locs));
+		if (locs == NULL)
+			err(EXIT_FAILURE, "cannot allocate locators");
+		kcb->kcb_locs = locs;
+	}
+	kcbl = malloc(offsetof(struct kcndbctl_build_loc, kcbl_loc[loclen]));
+	if (kcbl == NULL)
+		err(EXIT_FAILURE, "cannot allocate locator");
+	memcpy(kcbl->kcbl_loc, loc, loclen);
+	kcbl->kcbl_len = loclen;
+	kcbl->kcbl_idx = kcb->kcb_locsize;
+	kcb->kcb_locsize += sizeof(uint16_t) + loclen + sizeof(uint64_t);
+	kcb->kcb_locs[kcb->kcb_nlocs++] = kcbl;
+
+	/* keep an average chain length less than 1. */
+	if (kcb->kcb_nlocs > ((size_t)1 << kcb->kcb_hashbits))
+		kcndbctl_build_hash_alloc(kcb, kcb->kcb_hashbits + 1);
+	else {
+		kcbl->kcbl_hnext = kcb->kcb_hash[h];
+		kcb->kcb_hash[h] = kcbl;
+	}
+	return kcbl->kcbl_idx;
+}
+
+/* load a dictionary already built, whose indexes must be kept. */
+static void
+kcndbctl_build_loc_load(struct kcndbctl_build *kcb)
+{
+	char path[MAXPATHLEN], loc[UINT16_MAX], *buf;
+	uint8_t hdr[sizeof(uint16_t)], next[sizeof(uint64_t)];
+	FILE *fp;
+	size_t len;
+
+	kcb->kcb_locsize = KCNDB_DB_LOC_INDEXTABLESIZ;
+	kcndbctl_build_path(path, sizeof(path), kcb, KCNDB_DB_PATH_LOC,
+	    "");
+	fp = kcndbctl_build_fopen(path, "r", &buf);
+	if (fp == NULL) {
+		if (errno != ENOENT)
+			err(EXIT_FAILURE, "cannot open %s", path);
+		return;
+	}
+	if (fseek(fp, KCNDB_DB_LOC_INDEXTABLESIZ, SEEK_SET) == -1)
+		err(EXIT_FAILURE, "cannot seek %s", path);
+	while (fread(hdr, sizeof(hdr), 1, fp) == 1) {
+		len = (hdr[0] << 8) | hdr[1];
+		if (fread(loc, len, 1, fp) != 1 ||
+		    fread(next, sizeof(next), 1, fp) != 1)
+			break;
+		(void)kcndbctl_build_loc_add(kcb, loc, len);
+	}
+	/* a torn entry at the tail is overwritten. */
+	if (ferror(fp))
+		err(EXIT_FAILURE, "cannot read %s", path);
+	kcndbctl_build_fclose(fp, buf, path, false);
+	kcb->kcb_nlocsold = kcb->kcb_nlocs;
+	KCN_LOG(INFO, "%zu locator(s) loaded", kcb->kcb_nlocs);
+}
+
+/*
+ * write a dictionary with hash chains rebuilt.  entries are prepended to
+ * chains in order of indexes as a compaction of kcndbd does.
+ */
+static void
+kcndbctl_build_loc_write(struct kcndbctl_build *kcb)
+{
+	struct kcndbctl_build_loc *kcbl;
+	uint64_t heads[KCNDB_DB_LOC_HASHSIZ];
+	uint8_t b[sizeof(uint64_t)];
+	char path[MAXPATHLEN], tpath[MAXPATHLEN], *buf;
+	unsigned int h;
+	FILE *fp;
+	size_t i;
+
+	memset(heads, 0, sizeof(heads));
+	for (i = 0; i < kcb->kcb_nlocs; i++) {
+		kcbl = kcb->kcb_locs[i];
+		h = kcn_str_hash(kcbl->kcbl_loc, kcbl->kcbl_len,
+		    KCNDB_DB_LOC_HASHSIZ);
+		kcbl->kcbl_next = heads[h];
+		heads[h] = kcbl->kcbl_idx;
+	}
+	kcndbctl_build_path(path, sizeof(path), kcb, KCNDB_DB_PATH_LOC,
+	    "");
+	kcndbctl_build_path(tpath, sizeof(tpath), kcb,
+	    KCNDB_DB_PATH_LOC, KCNDBCTL_BUILD_PATH_TEMP_SUFFIX);
+	fp = kcndbctl_build_fopen(tpath, "w", &buf);
+	if (fp == NULL)
+		err(EXIT_FAILURE, "cannot open %s", tpath);
+	for (h = 0; h < KCNDB_DB_LOC_HASHSIZ; h++) {
+		kcndb_format_put64(b, heads[h]);
+		(void)fwrite(b, sizeof(b), 1, fp);
+	}
+	for (i = 0; i < kcb->kcb_nlocs; i++) {
+		kcbl = kcb->kcb_locs[i];
+		b[0] = kcbl->kcbl_len >> 8;
+		b[1] = kcbl->kcbl_len & 0xff;
+		(void)fwrite(b, sizeof(uint16_t), 1, fp);
+		(void)fwrite(kcbl->kcbl_loc, kcbl->kcbl_len, 1, fp);
+		kcndb_format_put64(b, kcbl->kcbl_next);
+		(void)fwrite(b, sizeof(b), 1, fp);
+	}
+	if (ferror(fp))
+		err(EXIT_FAILURE, "cannot write %s", tpath);
+	kcndbctl_build_fclose(fp, buf, tpath, true);
+	if (rename(tpath, path) == -1)
+		err(EXIT_FAILURE, "cannot rename %s", tpath);
+}
+
+static bool
+kcndbctl_build_record_read(FILE *fp, struct kcndbctl_build_record *kcbr)
+{
+	uint8_t b[KCNDB_DB_RECORDSIZ];
+
+	if (fread(b, sizeof(b), 1, fp) != 1)
+		return false;
+	kcbr->kcbr_time = kcndb_format_get64(&b[0]);
+	kcbr->kcbr_val = kcndb_format_get64(&b[8]);
+	kcbr->kcbr_locidx = kcndb_format_get64(&b[16]);
+	return true;
+}
+
+static void
+kcndbctl_build_record_write(FILE *fp, const struct kcndbctl_build_record *kcbr)
+{
+	uint8_t b[KCNDB_DB_RECORDSIZ];
+
+	kcndb_format_put64(&b[0], kcbr->kcbr_time);
+	kcndb_format_put64(&b[8], kcbr->kcbr_val);
+	kcndb_format_put64(&b[16], kcbr->kcbr_locidx);
+	(void)fwrite(b, sizeof(b), 1, fp);
+}
+
+static int
+kcndbctl_build_record_cmp(const void *a0, const void *b0)
+{
+	const struct kcndbctl_build_record *a = a0, *b = b0;
+
+	return a->kcbr_time < b->kcbr_time ? -1 :
+	    a->kcbr_time > b->kcbr_time ? 1 : 0;
+}
+
+/* sort a chunk, and spill it into a new run. */
+static void
+kcndbctl_build_chunk_spill(struct kcndbctl_build *kcb)
+{
+	char path[MAXPATHLEN], suffix[32], *buf;
+	FILE *fp;
+	size_t i;
+
+	if (kcb->kcb_nchunk == 0)
+		return;
+	qsort(kcb->kcb_chunk, kcb->kcb_nchunk, sizeof(*kcb->kcb_chunk),
+	    kcndbctl_build_record_cmp);
+	(void)snprintf(suffix, sizeof(suffix), "%s.%zu",
+	    KCNDBCTL_BUILD_PATH_RUN_SUFFIX, kcb->kcb_nruns);
+	kcndbctl_build_path(path, sizeof(path), kcb, kcb->kcb_name, suffix);
+	fp = kcndbctl_build_fopen(path, "w", &buf);
+	if (fp == NULL)
+		err(EXIT_FAILURE, "cannot open %s", path);
+	for (i = 0; i < kcb->kcb_nchunk; i++)
+		kcndbctl_build_record_write(fp, &kcb->kcb_chunk[i]);
+	if (ferror(fp))
+		err(EXIT_FAILURE, "cannot write %s", path);
+	kcndbctl_build_fclose(fp, buf, path, false);
+	KCN_LOG(INFO, "spill %zu record(s) into run %zu", kcb->kcb_nchunk,
+	    kcb->kcb_nruns);
+	++kcb->kcb_nruns;
+	kcb->kcb_nchunk = 0;
+}
+
+/* parse a line of "timestamp value locator" in place. */
+static bool
+kcndbctl_build_parse(char *line, struct kcndbctl_build_record *kcbr,
+    const char **locp, size_t *loclenp)
+{
+	char *field[3], *p;
+	unsigned long long ullval;
+	int i;
+
+	p = line;
+	for (i = 0; i < 3; i++) {
+		while (*p == ' ' || *p == '\t')
+			++p;
+		field[i] = p;
+		for (; *p != '\0' && ! isspace((unsigned char)*p); p++)
+			if (! isprint((unsigned char)*p)) {
+				errno = EINVAL;
+				return false;
+			}
+		if (p == field[i]) {
+			errno = EINVAL;
+			return false;
+		}
+		if (*p != '\0')
+			*p++ = '\0';
+	}
+	if (! kcn_strtoull(field[0], 0, ULLONG_MAX, &ullval))
+		return false;
+	kcbr->kcbr_time = ullval;
+	if (! kcn_strtoull(field[1], 0, ULLONG_MAX, &ullval))
+		return false;
+	kcbr->kcbr_val = ullval;
+	*locp = field[2];
+	*loclenp = strlen(field[2]);
+	if (*loclenp > KCN_MSG_MAXLOCSIZ) {
+		errno = E2BIG;
+		return false;
+	}
+	return true;
+}
+
+static void
+kcndbctl_build_input(struct kcndbctl_build *kcb, const char *input)
+{
+	struct kcndbctl_build_record *kcbr;
+	const char *loc;
+	char *line, *buf;
+	size_t linesize, loclen, lineno;
+	FILE *fp;
+
+	fp = kcndbctl_build_fopen(input, "r", &buf);
+	if (fp == NULL)
+		err(EXIT_FAILURE, "cannot open %s", input);
+	if (flock(fileno(fp), LOCK_EX) == -1)
+		err(EXIT_FAILURE, "cannot lock %s", input);
+	line = NULL;
+	linesize = 0;
+	for (lineno = 1; getline(&line, &linesize, fp) != -1;
+	    lineno++) {
+		if (kcb->kcb_nchunk == KCNDBCTL_BUILD_CHUNKSIZ)
+			kcndbctl_build_chunk_spill(kcb);
+		kcbr = &kcb->kcb_chunk[kcb->kcb_nchunk];
+		if (! kcndbctl_build_parse(line, kcbr, &loc, &loclen))
+			err(EXIT_FAILURE, "%s:%zu: invalid field", input,
+			    lineno);
+		kcbr->kcbr_locidx = kcndbctl_build_loc_add(kcb, loc, loclen);
+		++kcb->kcb_nchunk;
+		++kcb->kcb_nrecords;
+	}
+	if (ferror(fp))
+		err(EXIT_FAILURE, "cannot read %s", input);
+	free(line);
+	(void)flock(fileno(fp), LOCK_UN);
+	kcndbctl_build_fclose(fp, buf, input, false);
+	KCN_LOG(INFO, "%llu record(s) read with %zu new locator(s)",
+	    kcb->kcb_nrecords, kcb->kcb_nlocs - kcb->kcb_nlocsold);
+}
+
+static bool
+kcndbctl_build_run_less(const struct kcndbctl_build_run *runs,
+    const size_t *heap, size_t a, size_t b)
+{
+
+	return runs[heap[a]].kcbn_kcbr.kcbr_time <
+	    runs[heap[b]].kcbn_kcbr.kcbr_time ||
+	    (runs[heap[a]].kcbn_kcbr.kcbr_time ==
+	    runs[heap[b]].kcbn_kcbr.kcbr_time && heap[a] < heap[b]);
+}
+
+static void
+kcndbctl_build_heap_down(const struct kcndbctl_build_run *runs, size_t *heap,
+    size_t n, size_t i)
+{
+	size_t child, tmp;
+
+	for (; (child = i * 2 + 1) < n; i = child) {
+		if (child + 1 < n &&
+		    kcndbctl_build_run_less(runs, heap, child + 1, child))
+			++child;
+		if (! kcndbctl_build_run_less(runs, heap, child, i))
+			break;
+		tmp = heap[i];
+		heap[i] = heap[child];
+		heap[child] = tmp;
+	}
+}
+
+/*
+ * merge a table already built, which is regarded as the first run, and
+ * all runs into a new table.  records of the existing table precede new
+ * ones at the same time.
+ */
+static void
+kcndbctl_build_merge(struct kcndbctl_build *kcb)
+{
+	struct kcndbctl_build_run *runs, *kcbn;
+	char path[MAXPATHLEN], tpath[MAXPATHLEN], suffix[32], *buf;
+	size_t *heap, i, n;
+	FILE *fp;
+
+	runs = calloc(kcb->kcb_nruns + 1, sizeof(*runs));
+	heap = calloc(kcb->kcb_nruns + 1, sizeof(*heap));
+	if (runs == NULL || heap == NULL)
+		err(EXIT_FAILURE, "cannot allocate runs");
+	n = 0;
+	for (i = 0; i <= kcb->kcb_nruns; i++) {
+		if (i == 0)
+			kcndbctl_build_path(path, sizeof(path), kcb,
+			    kcb->kcb_name, "");
+		else {
+			(void)snprintf(suffix, sizeof(suffix), "%s.%zu",
+			    KCNDBCTL_BUILD_PATH_RUN_SUFFIX, i - 1);
+			kcndbctl_build_path(path, sizeof(path), kcb,
+			    kcb->kcb_name, suffix);
+		}
+		kcbn = &runs[i];
+		kcbn->kcbn_fp = kcndbctl_build_fopen(path, "r",
+		    &kcbn->kcbn_buf);
+		if (kcbn->kcbn_fp == NULL) {
+			if (i == 0 && errno == ENOENT)
+				continue;
+			err(EXIT_FAILURE, "cannot open %s", path);
+		}
+		if (kcndbctl_build_record_read(kcbn->kcbn_fp,
+		    &kcbn->kcbn_kcbr))
+			heap[n++] = i;
+	}
+	for (i = n; i-- > 0;)
+		kcndbctl_build_heap_down(runs, heap, n, i);
+
+	kcndbctl_build_path(tpath, sizeof(tpath), kcb, kcb->kcb_name,
+	    KCNDBCTL_BUILD_PATH_TEMP_SUFFIX);
+	fp = kcndbctl_build_fopen(tpath, "w", &buf);
+	if (fp == NULL)
+		err(EXIT_FAILURE, "cannot open %s", tpath);
+	while (n > 0) {
+		kcbn = &runs[heap[0]];
+		kcndbctl_build_record_write(fp, &kcbn->kcbn_kcbr);
+		if (! kcndbctl_build_record_read(kcbn->kcbn_fp,
+		    &kcbn->kcbn_kcbr))
+			heap[0] = heap[--n];
+		kcndbctl_build_heap_down(runs, heap, n, 0);
+	}
+	if (ferror(fp))
+		err(EXIT_FAILURE, "cannot write %s", tpath);
+	kcndbctl_build_fclose(fp, buf, tpath, true);
+
+	for (i = 0; i <= kcb->kcb_nruns; i++) {
+		kcbn = &runs[i];
+		if (kcbn->kcbn_fp == NULL)
+			continue;
+		/* a torn record at the tail of a table is dropped. */
+		if (ferror(kcbn->kcbn_fp))
+			err(EXIT_FAILURE, "cannot read run %zu", i);
+		(void)fclose(kcbn->kcbn_fp);
+		free(kcbn->kcbn_buf);
+		if (i == 0)
+			continue;
+		(void)snprintf(suffix, sizeof(suffix), "%s.%zu",
+		    KCNDBCTL_BUILD_PATH_RUN_SUFFIX, i - 1);
+		kcndbctl_build_path(path, sizeof(path), kcb, kcb->kcb_name,
+		    suffix);
+		(void)unlink(path);
+	}
+	free(runs);
+	free(heap);
+}
+
+/*
+ * build a dictionary and a table of a type in a directory from a file.
+ * the directory must not be used by kcndbd at the same time.
+ */
+int
+kcndbctl_build_process(enum kcn_eq_type type, const char *dir,
+    const char *input)
+{
+	struct kcndbctl_build kcb;
+	char path[MAXPATHLEN], tpath[MAXPATHLEN];
+	int fd;
+
+	fd = open(dir, O_RDONLY);
+	if (fd == -1)
+		err(EXIT_FAILURE, "cannot open %s", dir);
+	if (flock(fd, LOCK_EX | LOCK_NB) == -1)
+		err(EXIT_FAILURE, "cannot lock %s", dir);
+
+	memset(&kcb, 0, sizeof(kcb));
+	kcb.kcb_dir = dir;
+	kcb.kcb_name = kcn_eq_type_ntoa(type);
+	kcndbctl_build_hash_alloc(&kcb, KCNDBCTL_BUILD_HASHBITS_MIN);
+	kcb.kcb_chunk = malloc(KCNDBCTL_BUILD_CHUNKSIZ *
+	    sizeof(*kcb.kcb_chunk));
+	if (kcb.kcb_chunk == NULL)
+		err(EXIT_FAILURE, "cannot allocate chunk");
+
+	kcndbctl_build_loc_load(&kcb);
+	kcndbctl_build_input(&kcb, input);
+	kcndbctl_build_chunk_spill(&kcb);
+	free(kcb.kcb_chunk);
+	kcndbctl_build_merge(&kcb);
+
+	/*
+	 * a new dictionary is a superset of an old one, and must replace it
+	 * before a new table refers to new locators.
+	 */
+	kcndbctl_build_loc_write(&kcb);
+	kcndbctl_build_path(path, sizeof(path), &kcb, kcb.kcb_name, "");
+	kcndbctl_build_path(tpath, sizeof(tpath), &kcb, kcb.kcb_name,
+	    KCNDBCTL_BUILD_PATH_TEMP_SUFFIX);
+	if (rename(tpath, path) == -1)
+		err(EXIT_FAILURE, "cannot rename %s", tpath);
+	/* a checkpoint of an old table is no longer valid. */
+	kcndbctl_build_path(path, sizeof(path), &kcb, kcb.kcb_name,
+	    KCNDB_DB_PATH_CHECKPOINT_SUFFIX);
+	if (unlink(path) == -1 && errno != ENOENT)
+		err(EXIT_FAILURE, "cannot remove %s", path);
+	KCN_LOG(NOTICE, "%s: %llu record(s) and %zu locator(s) built",
+	    kcb.kcb_name, kcb.kcb_nrecords, kcb.kcb_nlocs);
+
+	(void)flock(fd, LOCK_UN);
+	(void)close(fd);
+	return EXIT_SUCCESS;
+}
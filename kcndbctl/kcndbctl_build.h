@@ -0,0 +1 @@
+int kcndbctl_build_process(enum kcn_eq_type, const char *, const char *);
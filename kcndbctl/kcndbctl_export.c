@@ -0,0 +1,593 @@
+/*
+ * export records of a type in a time range by reading files of kcndbd
+ * directly, which does not go through queries of kcndbd.
+ *
+ * each shard of a table is sorted by time, and a start of a range is found
+ * by binary search.  shards are then read sequentially in large blocks and
+ * merged in order of time.  records deleted by tombstones are skipped.
+ * records too late to be merged into a shard are kept in its late segment
+ * in order of arrival, which is sorted in memory and is merged as another
+ * shard.
+ *
+ * a binary format consists of a header of "KCNX", a version and a type in
+ * one octet each, and following entries in network byte order:
+ *
+ *	'L' id(8) length(2) locator	a locator used by following records.
+ *	'R' time(8) value(8) id(8)	a record.
+ *
+ * XXX: records still in a reorder window of kcndbd are not exported.
+ */
+#include <sys/mman.h>
+#include <sys/param.h>	/* MAXPATHLEN */
+#include <sys/stat.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcn.h"
+#include "kcn_log.h"
+#include "kcn_eq.h"
+#include "kcndb_format.h"
+#include "kcndbctl_export.h"
+
+#define KCNDBCTL_EXPORT_MAGIC		"KCNX"
+#define KCNDBCTL_EXPORT_VERSION		1
+#define KCNDBCTL_EXPORT_IOBUFSIZ	(1024 * 1024)
+
+struct kcndbctl_export_tomb {
+	uint64_t kxtb_locidx;
+	uint64_t kxtb_start;
+	uint64_t kxtb_end;
+};
+
+struct kcndbctl_export_shard {
+	int kxs_fd;
+	off_t kxs_off;		/* offset of a next block. */
+	off_t kxs_end;
+	uint8_t *kxs_buf;
+	size_t kxs_len;
+	size_t kxs_pos;
+	struct kcndbctl_export_tomb *kxs_tombs;
+	size_t kxs_ntombs;
+	uint64_t kxs_time;
+	uint64_t kxs_val;
+	uint64_t kxs_locidx;
+	bool kxs_valid;
+};
+
+struct kcndbctl_export {
+	enum kcndbctl_export_format kx_format;
+	const char *kx_dir;
+	uint64_t kx_start;
+	uint64_t kx_end;
+	const uint8_t *kx_loc;
+	size_t kx_locsize;
+	uint8_t *kx_seen;	/* bitmap of locators written in binary. */
+	struct kcndbctl_export_shard *kx_shards;
+	size_t kx_nshards;
+	char *kx_obuf;
+	size_t kx_olen;
+	unsigned long long kx_nrecords;
+};
+
+static void
+kcndbctl_export_flush(struct kcndbctl_export *kx)
+{
+	ssize_t n;
+	size_t off;
+
+	for (off = 0; off < kx->kx_olen; off += n) {
+		n = write(STDOUT_FILENO, kx->kx_obuf + off, kx->kx_olen - off);
+		if (n == -1) {
+			if (errno == EINTR) {
+				n = 0;
+				continue;
+			}
+			err(EXIT_FAILURE, "cannot write");
+		}
+	}
+	kx->kx_olen = 0;
+}
+
+static void
+kcndbctl_export_put(struct kcndbctl_export *kx, const void *p, size_t len)
+{
+
+	if (kx->kx_olen + len > KCNDBCTL_EXPORT_IOBUFSIZ)
+		kcndbctl_export_flush(kx);
+	memcpy(kx->kx_obuf + kx->kx_olen, p, len);
+	kx->kx_olen += len;
+}
+
+static void
+kcndbctl_export_put8(struct kcndbctl_export *kx, uint8_t v)
+{
+
+	kcndbctl_export_put(kx, &v, sizeof(v));
+}
+
+static void
+kcndbctl_export_put16(struct kcndbctl_export *kx, uint16_t v)
+{
+	uint8_t p[2];
+
+	p[0] = v >> 8;
+	p[1] = v & 0xff;
+	kcndbctl_export_put(kx, p, sizeof(p));
+}
+
+static void
+kcndbctl_export_put64(struct kcndbctl_export *kx, uint64_t v)
+{
+	uint8_t p[8];
+	int i;
+
+	for (i = 7; i >= 0; i--, v >>= 8)
+		p[i] = v & 0xff;
+	kcndbctl_export_put(kx, p, sizeof(p));
+}
+
+static void
+kcndbctl_export_path(char *path, size_t len, const struct kcndbctl_export *kx,
+    const char *name, const char *suffix)
+{
+
+	if ((size_t)snprintf(path, len, "%s/%s%s", kx->kx_dir, name, suffix) >=
+	    len)
+		errx(EXIT_FAILURE, "too long path: %s/%s%s", kx->kx_dir, name,
+		    suffix);
+}
+
+static void
+kcndbctl_export_loc_load(struct kcndbctl_export *kx)
+{
+	char path[MAXPATHLEN];
+	struct stat st;
+	void *p;
+	int fd;
+
+	kcndbctl_export_path(path, sizeof(path), kx, KCNDB_DB_PATH_LOC,
+	    "");
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return;
+		err(EXIT_FAILURE, "cannot open %s", path);
+	}
+	if (fstat(fd, &st) == -1)
+		err(EXIT_FAILURE, "cannot get size of %s", path);
+	kx->kx_locsize = st.st_size;
+	if (kx->kx_locsize > 0) {
+		p = mmap(NULL, kx->kx_locsize, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p == MAP_FAILED)
+			err(EXIT_FAILURE, "cannot map %s", path);
+		kx->kx_loc = p;
+	}
+	(void)close(fd);
+	if (kx->kx_format == KCNDBCTL_EXPORT_FORMAT_BINARY) {
+		kx->kx_seen = calloc(kx->kx_locsize / NBBY + 1, 1);
+		if (kx->kx_seen == NULL)
+			err(EXIT_FAILURE, "cannot allocate locator bitmap");
+	}
+}
+
+static const char *
+kcndbctl_export_loc(const struct kcndbctl_export *kx, uint64_t idx,
+    size_t *lenp)
+{
+	const uint8_t *p;
+
+	if (idx + sizeof(uint16_t) > kx->kx_locsize)
+		goto bad;
+	p = kx->kx_loc + idx;
+	*lenp = (p[0] << 8) | p[1];
+	if (idx + sizeof(uint16_t) + *lenp > kx->kx_locsize)
+		goto bad;
+	return (const char *)p + sizeof(uint16_t);
+  bad:
+	errx(EXIT_FAILURE, "invalid locator index %llu",
+	    (unsigned long long)idx);
+}
+
+static void
+kcndbctl_export_tomb_load(struct kcndbctl_export *kx,
+    struct kcndbctl_export_shard *kxs, const char *name)
+{
+	struct kcndbctl_export_tomb *kxtb;
+	char path[MAXPATHLEN];
+	uint8_t buf[KCNDB_DB_TOMBSIZ];
+	FILE *fp;
+
+	kcndbctl_export_path(path, sizeof(path), kx, name,
+	    KCNDB_DB_PATH_TOMB_SUFFIX);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		if (errno == ENOENT)
+			return;
+		err(EXIT_FAILURE, "cannot open %s", path);
+	}
+	while (fread(buf, sizeof(buf), 1, fp) == 1) {
+		kxs->kxs_tombs = realloc(kxs->kxs_tombs,
+		    (kxs->kxs_ntombs + 1) * sizeof(*kxs->kxs_tombs));
+		if (kxs->kxs_tombs == NULL)
+			err(EXIT_FAILURE, "cannot allocate tombstones");
+		kxtb = &kxs->kxs_tombs[kxs->kxs_ntombs++];
+		kxtb->kxtb_locidx = kcndb_format_get64(buf);
+		kxtb->kxtb_start = kcndb_format_get64(buf + 8);
+		kxtb->kxtb_end = kcndb_format_get64(buf + 16);
+	}
+	if (ferror(fp))
+		err(EXIT_FAILURE, "cannot read %s", path);
+	(void)fclose(fp);
+}
+
+static bool
+kcndbctl_export_tomb_match(const struct kcndbctl_export_shard *kxs)
+{
+	const struct kcndbctl_export_tomb *kxtb;
+	size_t i;
+
+	for (i = 0; i < kxs->kxs_ntombs; i++) {
+		kxtb = &kxs->kxs_tombs[i];
+		if ((kxtb->kxtb_locidx == 0 ||
+		    kxtb->kxtb_locidx == kxs->kxs_locidx) &&
+		    kxs->kxs_time >= kxtb->kxtb_start &&
+		    kxs->kxs_time <= kxtb->kxtb_end)
+			return true;
+	}
+	return false;
+}
+
+static uint64_t
+kcndbctl_export_time(const struct kcndbctl_export_shard *kxs, off_t n)
+{
+	uint8_t buf[sizeof(uint64_t)];
+
+	if (pread(kxs->kxs_fd, buf, sizeof(buf),
+	    n * KCNDB_DB_RECORDSIZ) != sizeof(buf))
+		err(EXIT_FAILURE, "cannot read a record");
+	return kcndb_format_get64(buf);
+}
+
+/* find the first record at or after a start time by binary search. */
+static off_t
+kcndbctl_export_search(const struct kcndbctl_export *kx,
+    const struct kcndbctl_export_shard *kxs)
+{
+	off_t lo, hi, mid;
+
+	lo = 0;
+	hi = kxs->kxs_end / KCNDB_DB_RECORDSIZ;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (kcndbctl_export_time(kxs, mid) < kx->kx_start)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo * KCNDB_DB_RECORDSIZ;
+}
+
+/* read a next record in a range, and skip deleted ones. */
+static void
+kcndbctl_export_next(const struct kcndbctl_export *kx,
+    struct kcndbctl_export_shard *kxs)
+{
+	const uint8_t *p;
+	ssize_t n;
+
+	for (;;) {
+		if (kxs->kxs_pos + KCNDB_DB_RECORDSIZ > kxs->kxs_len) {
+			n = MIN(KCNDBCTL_EXPORT_IOBUFSIZ, kxs->kxs_end -
+			    kxs->kxs_off);
+			if (n > 0)
+				n = pread(kxs->kxs_fd, kxs->kxs_buf, n,
+				    kxs->kxs_off);
+			if (n == -1)
+				err(EXIT_FAILURE, "cannot read a table");
+			n -= n % KCNDB_DB_RECORDSIZ;
+			if (n == 0) {
+				kxs->kxs_valid = false;
+				return;
+			}
+			kxs->kxs_off += n;
+			kxs->kxs_len = n;
+			kxs->kxs_pos = 0;
+		}
+		p = kxs->kxs_buf + kxs->kxs_pos;
+		kxs->kxs_pos += KCNDB_DB_RECORDSIZ;
+		kxs->kxs_time = kcndb_format_get64(p);
+		kxs->kxs_val = kcndb_format_get64(p + 8);
+		kxs->kxs_locidx = kcndb_format_get64(p + 16);
+		if (kxs->kxs_time > kx->kx_end) {
+			kxs->kxs_valid = false;
+			return;
+		}
+		if (! kcndbctl_export_tomb_match(kxs))
+			break;
+	}
+	kxs->kxs_valid = true;
+}
+
+static int
+kcndbctl_export_late_cmp(const void *a, const void *b)
+{
+	uint64_t ta, tb;
+
+	ta = kcndb_format_get64(a);
+	tb = kcndb_format_get64(b);
+	return ta < tb ? -1 : ta > tb;
+}
+
+/* read a late segment of a shard into memory as a shard read to the end. */
+static void
+kcndbctl_export_late_open(struct kcndbctl_export *kx, const char *name)
+{
+	struct kcndbctl_export_shard *kxs;
+	char path[MAXPATHLEN];
+	struct stat st;
+	size_t len;
+	int fd;
+
+	kcndbctl_export_path(path, sizeof(path), kx, name,
+	    KCNDB_DB_PATH_LATE_SUFFIX);
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return;
+		err(EXIT_FAILURE, "cannot open %s", path);
+	}
+	if (fstat(fd, &st) == -1)
+		err(EXIT_FAILURE, "cannot get size of %s", path);
+	/* a partial record being appended by kcndbd is ignored. */
+	len = st.st_size - st.st_size % KCNDB_DB_RECORDSIZ;
+	if (len == 0) {
+		(void)close(fd);
+		return;
+	}
+	kx->kx_shards = realloc(kx->kx_shards,
+	    (kx->kx_nshards + 1) * sizeof(*kx->kx_shards));
+	if (kx->kx_shards == NULL)
+		err(EXIT_FAILURE, "cannot allocate shards");
+	kxs = &kx->kx_shards[kx->kx_nshards++];
+	memset(kxs, 0, sizeof(*kxs));
+	kxs->kxs_fd = -1;
+	kxs->kxs_buf = malloc(len);
+	if (kxs->kxs_buf == NULL)
+		err(EXIT_FAILURE, "cannot allocate late records");
+	if (pread(fd, kxs->kxs_buf, len, 0) != (ssize_t)len)
+		err(EXIT_FAILURE, "cannot read %s", path);
+	(void)close(fd);
+	qsort(kxs->kxs_buf, len / KCNDB_DB_RECORDSIZ, KCNDB_DB_RECORDSIZ,
+	    kcndbctl_export_late_cmp);
+	kxs->kxs_len = len;
+	while (kxs->kxs_pos < kxs->kxs_len &&
+	    kcndb_format_get64(kxs->kxs_buf + kxs->kxs_pos) < kx->kx_start)
+		kxs->kxs_pos += KCNDB_DB_RECORDSIZ;
+	kcndbctl_export_tomb_load(kx, kxs, name);
+	kcndbctl_export_next(kx, kxs);
+}
+
+static bool
+kcndbctl_export_shard_open(struct kcndbctl_export *kx, const char *name)
+{
+	struct kcndbctl_export_shard *kxs;
+	char path[MAXPATHLEN];
+	struct stat st;
+	int fd;
+
+	kcndbctl_export_path(path, sizeof(path), kx, name, "");
+	fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		if (errno == ENOENT)
+			return false;
+		err(EXIT_FAILURE, "cannot open %s", path);
+	}
+	if (fstat(fd, &st) == -1)
+		err(EXIT_FAILURE, "cannot get size of %s", path);
+	kx->kx_shards = realloc(kx->kx_shards,
+	    (kx->kx_nshards + 1) * sizeof(*kx->kx_shards));
+	if (kx->kx_shards == NULL)
+		err(EXIT_FAILURE, "cannot allocate shards");
+	kxs = &kx->kx_shards[kx->kx_nshards++];
+	memset(kxs, 0, sizeof(*kxs));
+	kxs->kxs_fd = fd;
+	/* a partial record being appended by kcndbd is ignored. */
+	kxs->kxs_end = st.st_size - st.st_size % KCNDB_DB_RECORDSIZ;
+	kxs->kxs_buf = malloc(KCNDBCTL_EXPORT_IOBUFSIZ);
+	if (kxs->kxs_buf == NULL)
+		err(EXIT_FAILURE, "cannot allocate I/O buffer");
+	kcndbctl_export_tomb_load(kx, kxs, name);
+	kxs->kxs_off = kcndbctl_export_search(kx, kxs);
+	(void)posix_fadvise(fd, kxs->kxs_off, 0, POSIX_FADV_SEQUENTIAL);
+	kcndbctl_export_next(kx, kxs);
+	kcndbctl_export_late_open(kx, name);
+	return true;
+}
+
+static void
+kcndbctl_export_shard_close(struct kcndbctl_export_shard *kxs)
+{
+
+	if (kxs->kxs_fd != -1)
+		(void)close(kxs->kxs_fd);
+	free(kxs->kxs_buf);
+	free(kxs->kxs_tombs);
+}
+
+static void
+kcndbctl_export_csv(struct kcndbctl_export *kx, const char *loc,
+    size_t loclen)
+{
+	const char *p, *ep;
+
+	ep = loc + loclen;
+	for (p = loc; p < ep; p++)
+		if (*p == ',' || *p == '"')
+			break;
+	if (p == ep) {
+		kcndbctl_export_put(kx, loc, loclen);
+		return;
+	}
+	kcndbctl_export_put8(kx, '"');
+	for (p = loc; p < ep; p++) {
+		if (*p == '"')
+			kcndbctl_export_put8(kx, '"');
+		kcndbctl_export_put8(kx, *p);
+	}
+	kcndbctl_export_put8(kx, '"');
+}
+
+static void
+kcndbctl_export_record(struct kcndbctl_export *kx,
+    const struct kcndbctl_export_shard *kxs)
+{
+	char buf[sizeof("18446744073709551615 18446744073709551615 ")];
+	const char *loc;
+	size_t loclen;
+	uint64_t idx;
+	int len;
+
+	idx = kxs->kxs_locidx;
+	loc = kcndbctl_export_loc(kx, idx, &loclen);
+	switch (kx->kx_format) {
+	case KCNDBCTL_EXPORT_FORMAT_TEXT:
+	case KCNDBCTL_EXPORT_FORMAT_CSV:
+		len = snprintf(buf, sizeof(buf),
+		    kx->kx_format == KCNDBCTL_EXPORT_FORMAT_CSV ?
+		    "%llu,%llu," : "%llu %llu ",
+		    (unsigned long long)kxs->kxs_time,
+		    (unsigned long long)kxs->kxs_val);
+		kcndbctl_export_put(kx, buf, len);
+		if (kx->kx_format == KCNDBCTL_EXPORT_FORMAT_CSV)
+			kcndbctl_export_csv(kx, loc, loclen);
+		else
+			kcndbctl_export_put(kx, loc, loclen);
+		kcndbctl_export_put8(kx, '\n');
+		break;
+	case KCNDBCTL_EXPORT_FORMAT_BINARY:
+		if ((kx->kx_seen[idx / NBBY] & (1 << (idx % NBBY))) == 0) {
+			kx->kx_seen[idx / NBBY] |= 1 << (idx % NBBY);
+			kcndbctl_export_put8(kx, 'L');
+			kcndbctl_export_put64(kx, idx);
+			kcndbctl_export_put16(kx, loclen);
+			kcndbctl_export_put(kx, loc, loclen);
+		}
+		kcndbctl_export_put8(kx, 'R');
+		kcndbctl_export_put64(kx, kxs->kxs_time);
+		kcndbctl_export_put64(kx, kxs->kxs_val);
+		kcndbctl_export_put64(kx, idx);
+		break;
+	}
+	++kx->kx_nrecords;
+}
+
+static void
+kcndbctl_export_header(struct kcndbctl_export *kx, enum kcn_eq_type type)
+{
+
+	switch (kx->kx_format) {
+	case KCNDBCTL_EXPORT_FORMAT_TEXT:
+		break;
+	case KCNDBCTL_EXPORT_FORMAT_CSV:
+		kcndbctl_export_put(kx, "time,value,locator\n",
+		    sizeof("time,value,locator\n") - 1);
+		break;
+	case KCNDBCTL_EXPORT_FORMAT_BINARY:
+		kcndbctl_export_put(kx, KCNDBCTL_EXPORT_MAGIC,
+		    sizeof(KCNDBCTL_EXPORT_MAGIC) - 1);
+		kcndbctl_export_put8(kx, KCNDBCTL_EXPORT_VERSION);
+		kcndbctl_export_put8(kx, type);
+		break;
+	}
+}
+
+bool
+kcndbctl_export_format_aton(const char *s,
+    enum kcndbctl_export_format *formatp)
+{
+
+	if (strcmp(s, "text") == 0)
+		*formatp = KCNDBCTL_EXPORT_FORMAT_TEXT;
+	else if (strcmp(s, "binary") == 0)
+		*formatp = KCNDBCTL_EXPORT_FORMAT_BINARY;
+	else if (strcmp(s, "csv") == 0)
+		*formatp = KCNDBCTL_EXPORT_FORMAT_CSV;
+	else
+		return false;
+	return true;
+}
+
+/*
+ * export records in a window from a start time.  the window is the last one
+ * if the start time is 0, or is open if the window is 0.
+ */
+int
+kcndbctl_export_process(enum kcn_eq_type type,
+    enum kcndbctl_export_format format, const char *dir, time_t start,
+    time_t window)
+{
+	struct kcndbctl_export kx;
+	struct kcndbctl_export_shard *kxs, *min;
+	char name[MAXPATHLEN];
+	size_t i;
+
+	memset(&kx, 0, sizeof(kx));
+	kx.kx_format = format;
+	kx.kx_dir = dir;
+	if (start == 0 && window != 0)
+		start = time(NULL) - window;
+	kx.kx_start = start;
+	kx.kx_end = window != 0 ? (uint64_t)start + window : UINT64_MAX;
+	kx.kx_obuf = malloc(KCNDBCTL_EXPORT_IOBUFSIZ);
+	if (kx.kx_obuf == NULL)
+		err(EXIT_FAILURE, "cannot allocate I/O buffer");
+
+	for (i = 0; ; i++) {
+		kcndb_format_table_name(name, sizeof(name), type, i);
+		if (! kcndbctl_export_shard_open(&kx, name))
+			break;
+	}
+	if (kx.kx_nshards == 0)
+		err(EXIT_FAILURE, "cannot open %s/%s", dir,
+		    kcn_eq_type_ntoa(type));
+	/*
+	 * a locator is added before records referring to it, and the
+	 * dictionary mapped after tables are sized covers their records.
+	 */
+	kcndbctl_export_loc_load(&kx);
+
+	kcndbctl_export_header(&kx, type);
+	for (;;) {
+		min = NULL;
+		for (i = 0; i < kx.kx_nshards; i++) {
+			kxs = &kx.kx_shards[i];
+			if (kxs->kxs_valid &&
+			    (min == NULL || kxs->kxs_time < min->kxs_time))
+				min = kxs;
+		}
+		if (min == NULL)
+			break;
+		kcndbctl_export_record(&kx, min);
+		kcndbctl_export_next(&kx, min);
+	}
+	kcndbctl_export_flush(&kx);
+	KCN_LOG(INFO, "%llu record(s) exported from %zu shard(s)",
+	    kx.kx_nrecords, kx.kx_nshards);
+
+	for (i = 0; i < kx.kx_nshards; i++)
+		kcndbctl_export_shard_close(&kx.kx_shards[i]);
+	free(kx.kx_shards);
+	free(kx.kx_seen);
+	if (kx.kx_loc != NULL)
+		(void)munmap((void *)kx.kx_loc, kx.kx_locsize);
+	free(kx.kx_obuf);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,9 @@
+enum kcndbctl_export_format {
+	KCNDBCTL_EXPORT_FORMAT_TEXT,
+	KCNDBCTL_EXPORT_FORMAT_BINARY,
+	KCNDBCTL_EXPORT_FORMAT_CSV
+};
+
+bool kcndbctl_export_format_aton(const char *, enum kcndbctl_export_format *);
+int kcndbctl_export_process(enum kcn_eq_type, enum kcndbctl_export_format,
+    const char *, time_t, time_t);
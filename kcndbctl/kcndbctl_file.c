@@ -1,4 +1,13 @@
-#include <sys/param.h>	/* MAXPATHLEN */
+/*
+ * load a file of "time value locator" lines into kcndbd.
+ *
+ * a file is mapped into memory and split into chunks at line boundaries.
+ * worker threads parse chunks in place without copying, and encode add
+ * messages of a chunk into one batch.  the main thread sends batches in
+ * order of chunks so that kcndbd receives records in order of a file.
+ */
+#include <sys/mman.h>
+#include <sys/param.h>	/* MIN */
 #include <sys/stat.h>
 #include <sys/file.h>	/* XXX: flock on linux. */
 #include <assert.h>
@@ -6,8 +15,6 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <limits.h>
-#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -15,189 +22,381 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <pthread.h>
+
 #include <event.h>
 
 #include "kcn.h"
 #include "kcn_log.h"
-#include "kcn_str.h"
 #include "kcn_buf.h"
 #include "kcn_net.h"
 #include "kcn_eq.h"
 #include "kcn_msg.h"
-#include "kcn_client.h"
 #include "kcndbctl_file.h"
 
-static bool
-getfilesize(int fd, size_t *sizep)
+#define KCNDBCTL_FILE_CHUNKSIZ		(256 * 1024)
+#define KCNDBCTL_FILE_MAXTHREADS	8
+#define KCNDBCTL_FILE_WINDOW		(2 * KCNDBCTL_FILE_MAXTHREADS)
+
+struct kcndbctl_file_chunk {
+	const char *kfc_sp;
+	const char *kfc_ep;
+	struct kcn_buf_data *kfc_kbd;
+	size_t kfc_nlines;
+	const char *kfc_errp;
+	int kfc_error;
+	bool kfc_done;
+};
+
+struct kcndbctl_file {
+	enum kcn_eq_type kf_type;
+	const char *kf_path;
+	const char *kf_sp;
+	size_t kf_size;
+	struct kcndbctl_file_chunk *kf_chunks;
+	size_t kf_nchunks;
+	size_t kf_next;		/* next chunk to be parsed. */
+	size_t kf_sent;		/* next chunk to be sent. */
+	pthread_mutex_t kf_mutex;
+	pthread_cond_t kf_cond;
+};
+
+static void
+kcndbctl_file_lock(struct kcndbctl_file *kf)
 {
-	struct stat st;
+	int error;
 
-	if (fstat(fd, &st) == -1)
-		return false;
-	*sizep = st.st_size;
-	return true;
+	error = pthread_mutex_lock(&kf->kf_mutex);
+	if (error != 0) {
+		errno = error;
+		err(EXIT_FAILURE, "cannot lock");
+	}
 }
 
-static bool
-bufalloc(struct kcn_buf *kb, size_t filesize)
+static void
+kcndbctl_file_unlock(struct kcndbctl_file *kf)
 {
-	size_t bufsize;
-	struct kcn_buf_data *kbd;
+	int error;
 
-#define MAXBUFSIZ	(1ULL << 20)	/* 1MB */
-	if (filesize < MAXBUFSIZ)
-		bufsize = filesize;
-	else
-		bufsize = MAXBUFSIZ;
-	kbd = kcn_buf_data_new(bufsize);
-	if (kbd == NULL)
-		return false;
-	kcn_buf_init(kb, kbd);
-	return true;
+	error = pthread_mutex_unlock(&kf->kf_mutex);
+	if (error != 0) {
+		errno = error;
+		err(EXIT_FAILURE, "cannot unlock");
+	}
+}
+
+static void
+kcndbctl_file_wait(struct kcndbctl_file *kf)
+{
+	int error;
+
+	error = pthread_cond_wait(&kf->kf_cond, &kf->kf_mutex);
+	if (error != 0) {
+		errno = error;
+		err(EXIT_FAILURE, "cannot wait");
+	}
+}
+
+static const char *
+kcndbctl_file_skip(const char *p, const char *ep)
+{
+
+	while (p < ep && isspace((unsigned char)*p))
+		++p;
+	return p;
 }
 
 static bool
-forward(struct kcn_buf *kb)
+kcndbctl_file_get64(const char **pp, const char *ep, uint64_t *vp)
 {
-	int c;
+	const char *p;
+	uint64_t v;
+	unsigned int d;
 
-	for (;;) {
-		if (kcn_buf_trailingdata(kb) == 0) {
-			errno = EAGAIN;
-			return false;
-		}
-		c = kcn_buf_get8(kb);
-		if (isspace(c))
-			return true;
-		if (! isprint(c)) {
-			errno = EINVAL;
+	p = kcndbctl_file_skip(*pp, ep);
+	if (p == ep || ! isdigit((unsigned char)*p)) {
+		errno = EINVAL;
+		return false;
+	}
+	for (v = 0; p < ep && isdigit((unsigned char)*p); p++) {
+		d = *p - '0';
+		if (v > (UINT64_MAX - d) / 10) {
+			errno = ERANGE;
 			return false;
 		}
+		v = v * 10 + d;
+	}
+	if (p < ep && ! isspace((unsigned char)*p)) {
+		errno = EINVAL;
+		return false;
 	}
+	*pp = p;
+	*vp = v;
+	return true;
 }
 
 static bool
-getstr(struct kcn_buf *kb, const char **s, size_t *slenp)
+kcndbctl_file_getstr(const char **pp, const char *ep, const char **sp,
+    size_t *slenp)
 {
-	size_t slen;
+	const char *p;
 
-	*s = kcn_buf_current(kb);
-	if (! forward(kb))
+	p = *sp = kcndbctl_file_skip(*pp, ep);
+	for (; p < ep && ! isspace((unsigned char)*p); p++)
+		if (! isprint((unsigned char)*p)) {
+			errno = EINVAL;
+			return false;
+		}
+	*slenp = p - *sp;
+	if (*slenp == 0) {
+		errno = EINVAL;
 		return false;
-	slen = *slenp = kcn_buf_current(kb) - (void *)*s - 1;
-	if (slen > KCN_MSG_MAXLOCSIZ) {
+	}
+	if (*slenp > KCN_MSG_MAXLOCSIZ) {
 		errno = E2BIG;
 		return false;
 	}
+	*pp = p;
 	return true;
 }
 
-static bool
-get64(struct kcn_buf *kb, uint64_t *vp)
+/*
+ * parse a line between sp and ep, which excludes a newline, without copying.
+ * return false with errno of 0 for a blank line.
+ */
+bool
+kcndbctl_file_line_parse(const char *sp, const char *ep,
+    struct kcn_msg_add *kma)
 {
-	unsigned long long ullval;
 	const char *p;
 
-	p = kcn_buf_current(kb);
-	if (! forward(kb))
+	p = kcndbctl_file_skip(sp, ep);
+	if (p == ep) {
+		errno = 0;
+		return false;
+	}
+	if (! kcndbctl_file_get64(&p, ep, &kma->kma_time) ||
+	    ! kcndbctl_file_get64(&p, ep, &kma->kma_val) ||
+	    ! kcndbctl_file_getstr(&p, ep, &kma->kma_loc, &kma->kma_loclen))
 		return false;
-	kcn_buf_backward(kb, 1);
-	kcn_buf_put8(kb, '\0');
-	if (! kcn_strtoull(p, 0, ULLONG_MAX, &ullval))
+	if (kcndbctl_file_skip(p, ep) != ep) {
+		errno = EINVAL;
 		return false;
-	*vp = ullval;
+	}
 	return true;
 }
 
-struct kcn_file {
-	enum kcn_eq_type kf_type;
-	size_t kf_size;
-	size_t kf_line;
-	struct kcn_buf kf_kb;
-	struct event kf_ev;
-	struct kcn_net *kf_kn;
-};
-
-static void
-readfile(int fd, short event, void *arg)
+static bool
+kcndbctl_file_parse(struct kcndbctl_file *kf, struct kcndbctl_file_chunk *kfc,
+    struct kcn_buf *kb)
 {
-	struct kcn_file *kf = arg;
-	struct kcn_buf *kb = &kf->kf_kb;
+	struct kcn_buf batch;
 	struct kcn_msg_add kma;
-	int error;
-
-	if ((event & EV_READ) == 0)
-		goto again;
+	const char *sp, *ep;
 
-	error = kcn_buf_read(fd, kb);
-	if (error != 0)
-		goto out;
+	kfc->kfc_kbd = kcn_buf_data_new(KCNDBCTL_FILE_BATCHSIZ(
+	    (size_t)(kfc->kfc_ep - kfc->kfc_sp)));
+	if (kfc->kfc_kbd == NULL) {
+		kfc->kfc_errp = kfc->kfc_sp;
+		return false;
+	}
+	kcn_buf_init(&batch, kfc->kfc_kbd);
 	kma.kma_type = kf->kf_type;
-	kf->kf_size -= kcn_buf_len(kb);
-	while (kf->kf_size == 0 || kcn_buf_len(kb) >= KCN_MSG_MAXSIZ) {
-		if (! get64(kb, &kma.kma_time) ||
-		    ! get64(kb, &kma.kma_val) ||
-		    ! getstr(kb, &kma.kma_loc, &kma.kma_loclen)) {
-			if (errno != EAGAIN)
-				err(EXIT_FAILURE, "invalid field");
-			KCN_LOG(DEBUG, "partial read");
-			kcn_buf_start(kb);
+	for (sp = kfc->kfc_sp; sp < kfc->kfc_ep; sp = ep + 1) {
+		ep = memchr(sp, '\n', kfc->kfc_ep - sp);
+		if (ep == NULL)
+			ep = kfc->kfc_ep;
+		if (! kcndbctl_file_line_parse(sp, ep, &kma)) {
+			if (errno == 0)
+				continue;
+			goto bad;
+		}
+		kcn_msg_add_encode(kb, &kma);
+		kcn_buf_put(&batch, kcn_buf_head(kb), kcn_buf_len(kb));
+		++kfc->kfc_nlines;
+	}
+	return true;
+  bad:
+	kfc->kfc_errp = sp;
+	return false;
+}
+
+static void *
+kcndbctl_file_main(void *arg)
+{
+	struct kcndbctl_file *kf = arg;
+	struct kcndbctl_file_chunk *kfc;
+	struct kcn_buf kb;
+	struct kcn_buf_data *kbd;
+	int error;
+
+	kbd = kcn_buf_data_new(KCN_MSG_MAXSIZ);
+	if (kbd == NULL)
+		err(EXIT_FAILURE, "cannot alloc. buffer");
+	kcn_buf_init(&kb, kbd);
+	kcndbctl_file_lock(kf);
+	for (;;) {
+		while (kf->kf_next < kf->kf_nchunks &&
+		    kf->kf_next >= kf->kf_sent + KCNDBCTL_FILE_WINDOW)
+			kcndbctl_file_wait(kf);
+		if (kf->kf_next == kf->kf_nchunks)
 			break;
+		kfc = &kf->kf_chunks[kf->kf_next++];
+		kcndbctl_file_unlock(kf);
+
+		error = 0;
+		if (! kcndbctl_file_parse(kf, kfc, &kb))
+			error = errno;
+
+		kcndbctl_file_lock(kf);
+		kfc->kfc_error = error;
+		kfc->kfc_done = true;
+		(void)pthread_cond_broadcast(&kf->kf_cond);
+	}
+	kcndbctl_file_unlock(kf);
+	kcn_buf_data_destroy(kbd);
+	return NULL;
+}
+
+static size_t
+kcndbctl_file_split(struct kcndbctl_file *kf)
+{
+	struct kcndbctl_file_chunk *kfc;
+	const char *sp, *ep, *fep;
+	size_t n;
+
+	fep = kf->kf_sp + kf->kf_size;
+	n = kf->kf_size / KCNDBCTL_FILE_CHUNKSIZ + 1;
+	kf->kf_chunks = calloc(n, sizeof(*kf->kf_chunks));
+	if (kf->kf_chunks == NULL)
+		err(EXIT_FAILURE, "cannot alloc. chunks");
+	for (n = 0, sp = kf->kf_sp; sp < fep; sp = ep, n++) {
+		ep = sp + MIN(KCNDBCTL_FILE_CHUNKSIZ, (size_t)(fep - sp));
+		if (ep < fep) {
+			ep = memchr(ep, '\n', fep - ep);
+			ep = ep == NULL ? fep : ep + 1;
 		}
-		if (! kcn_client_add_send(kf->kf_kn, &kma))
-			err(EXIT_FAILURE, "cannot send add message");
-		++kf->kf_line;
-		kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
-		KCN_LOG(DEBUG, "%zu %llu %.*s", kma.kma_time,
-		    kma.kma_val, (int)kma.kma_loclen, kma.kma_loc);
+		kfc = &kf->kf_chunks[n];
+		kfc->kfc_sp = sp;
+		kfc->kfc_ep = ep;
 	}
-	kf->kf_size += kcn_buf_len(kb);
+	return n;
+}
 
-  out:
-	KCN_LOG(INFO, "file read with %s", strerror(error));
-	if (error == ESHUTDOWN) {
-		KCN_LOG(INFO, "finish reading file, %zu lines read",
-		    kf->kf_line);
-		return;
-	}
-  again:
-	if (event_add(&kf->kf_ev, NULL) == -1)
-		err(EXIT_FAILURE, "cannot add event");
+static size_t
+kcndbctl_file_lineno(const struct kcndbctl_file *kf, const char *errp)
+{
+	const char *p;
+	size_t line;
+
+	for (line = 1, p = kf->kf_sp;
+	    (p = memchr(p, '\n', errp - p)) != NULL; p++)
+		++line;
+	return line;
+}
+
+static size_t
+kcndbctl_file_send(struct kcndbctl_file *kf, struct kcn_net *kn)
+{
+	struct kcndbctl_file_chunk *kfc;
+	struct kcn_buf kb;
+	size_t nlines;
+
+	for (nlines = 0; kf->kf_sent < kf->kf_nchunks; ) {
+		kfc = &kf->kf_chunks[kf->kf_sent];
+		kcndbctl_file_lock(kf);
+		while (! kfc->kfc_done)
+			kcndbctl_file_wait(kf);
+		kcndbctl_file_unlock(kf);
+		if (kfc->kfc_error != 0) {
+			errno = kfc->kfc_error;
+			err(EXIT_FAILURE, "%s: line %zu", kf->kf_path,
+			    kcndbctl_file_lineno(kf, kfc->kfc_errp));
+		}
+		kcn_buf_init(&kb, kfc->kfc_kbd);
+		kcn_buf_end(&kb);
+		if (kcn_buf_len(&kb) > 0 &&
+		    (! kcn_net_write(kn, &kb) || ! kcn_net_flush(kn)))
+			err(EXIT_FAILURE, "cannot send add messages");
+		kcn_buf_data_destroy(kfc->kfc_kbd);
+		kfc->kfc_kbd = NULL;
+		nlines += kfc->kfc_nlines;
+
+		kcndbctl_file_lock(kf);
+		++kf->kf_sent;
+		(void)pthread_cond_broadcast(&kf->kf_cond);
+		kcndbctl_file_unlock(kf);
+	}
+	return nlines;
 }
 
 int
 kcndbctl_file_process(enum kcn_eq_type type, struct kcn_net *kn,
     const char *path)
 {
-	struct kcn_file kf;
-	int fd, rc;
+	struct kcndbctl_file kf;
+	struct stat st;
+	pthread_t tids[KCNDBCTL_FILE_MAXTHREADS];
+	size_t i, nthreads, nlines;
+	long ncpus;
+	void *p;
+	int fd, error;
 
 	kf.kf_type = type;
-	kf.kf_line = 0;
-	kf.kf_kn = kn;
+	kf.kf_path = path;
+	kf.kf_next = kf.kf_sent = 0;
 
 	fd = open(path, O_RDONLY);
 	if (fd == -1)
-		err(EXIT_FAILURE, "cannot open file: %s", strerror(errno));
+		err(EXIT_FAILURE, "cannot open file: %s", path);
 	if (flock(fd, LOCK_EX) == -1)
-		err(EXIT_FAILURE, "cannot lock file: %s", strerror(errno));
-	if (! getfilesize(fd, &kf.kf_size))
-		err(EXIT_FAILURE, "cannot get file size: %s", strerror(errno));
-	if (! bufalloc(&kf.kf_kb, kf.kf_size))
-		err(EXIT_FAILURE, "cannot alloc. buffer: %s", strerror(errno));
-	event_set(&kf.kf_ev, fd, EV_READ, readfile, &kf);
-	if (event_base_set(kcn_net_event_base(kf.kf_kn), &kf.kf_ev) == -1)
-		err(EXIT_FAILURE, "cannot set event base: %s", strerror(errno));
-	if (event_add(&kf.kf_ev, NULL) == -1)
-		err(EXIT_FAILURE, "cannot enable event: %s", strerror(errno));
-
-	if (kcn_net_loop(kf.kf_kn))
-		rc = EXIT_SUCCESS;
-	else
-		rc = EXIT_FAILURE;
+		err(EXIT_FAILURE, "cannot lock file: %s", path);
+	if (fstat(fd, &st) == -1)
+		err(EXIT_FAILURE, "cannot get file size: %s", path);
+	kf.kf_size = st.st_size;
+	if (kf.kf_size == 0) {
+		p = NULL;
+		goto out;
+	}
+	p = mmap(NULL, kf.kf_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (p == MAP_FAILED)
+		err(EXIT_FAILURE, "cannot map file: %s", path);
+	(void)madvise(p, kf.kf_size, MADV_SEQUENTIAL);
+	kf.kf_sp = p;
+	kf.kf_nchunks = kcndbctl_file_split(&kf);
 
+	ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nthreads = ncpus > 0 ? (size_t)ncpus : 1;
+	nthreads = MIN(nthreads, KCNDBCTL_FILE_MAXTHREADS);
+	nthreads = MIN(nthreads, kf.kf_nchunks);
+	if ((error = pthread_mutex_init(&kf.kf_mutex, NULL)) != 0 ||
+	    (error = pthread_cond_init(&kf.kf_cond, NULL)) != 0) {
+		errno = error;
+		err(EXIT_FAILURE, "cannot initialize lock");
+	}
+	for (i = 0; i < nthreads; i++) {
+		error = pthread_create(&tids[i], NULL, kcndbctl_file_main, &kf);
+		if (error != 0) {
+			errno = error;
+			err(EXIT_FAILURE, "cannot create thread");
+		}
+	}
+	KCN_LOG(DEBUG, "parse %zu chunk(s) with %zu thread(s)",
+	    kf.kf_nchunks, nthreads);
+
+	nlines = kcndbctl_file_send(&kf, kn);
+
+	for (i = 0; i < nthreads; i++)
+		(void)pthread_join(tids[i], NULL);
+	(void)pthread_cond_destroy(&kf.kf_cond);
+	(void)pthread_mutex_destroy(&kf.kf_mutex);
+	free(kf.kf_chunks);
+	(void)munmap(p, kf.kf_size);
+	KCN_LOG(INFO, "finish reading file, %zu lines read", nlines);
+
+  out:
 	(void)flock(fd, LOCK_UN);
 	(void)close(fd);
 
-	return rc;
+	return EXIT_SUCCESS;
 }
@@ -1 +1,9 @@
+/* maximum size of add messages encoded from len bytes of lines. */
+#define KCNDBCTL_FILE_MINLINESIZ	5	/* "0 0 a" */
+#define KCNDBCTL_FILE_BATCHSIZ(len)					\
+	((len) + ((len) / KCNDBCTL_FILE_MINLINESIZ + 1) *		\
+	    (KCN_MSG_HDRSIZ + KCN_MSG_ADD_MINSIZ))
+
+bool kcndbctl_file_line_parse(const char *, const char *,
+    struct kcn_msg_add *);
 int kcndbctl_file_process(enum kcn_eq_type, struct kcn_net *, const char *);
@@ -0,0 +1,463 @@
+/*
+ * follow a file, or files in a directory, and stream appended lines to
+ * kcndbd.
+ *
+ * a file is followed until it is rotated, i.e., another file replaces it
+ * at its path, or a file with a larger name appears in a directory.  the
+ * rotated file is still read for a while before moving to the next one.
+ * an inode number and an offset of a current file are checkpointed after
+ * each batch is sent so that a restart never skips lines.  delivery is
+ * at-least-once, though: lines sent but not yet checkpointed when a
+ * process or a connection dies are sent again.
+ */
+#include <sys/param.h>	/* MAXPATHLEN */
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif /* __linux__ */
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <event.h>
+
+#include "kcn.h"
+#include "kcn_log.h"
+#include "kcn_buf.h"
+#include "kcn_net.h"
+#include "kcn_eq.h"
+#include "kcn_msg.h"
+#include "kcn_ctx.h"
+#include "kcn_client.h"
+#include "kcndbctl_file.h"
+#include "kcndbctl_follow.h"
+
+#define KCNDBCTL_FOLLOW_BUFSIZ		(256 * 1024)
+#define KCNDBCTL_FOLLOW_INTERVAL	1000	/* msec */
+#define KCNDBCTL_FOLLOW_ROTATEWAIT	2	/* sec */
+
+struct kcndbctl_follow {
+	enum kcn_eq_type kf_type;
+	const char *kf_path;
+	const char *kf_ckpt;
+	char kf_ckptdir[MAXPATHLEN];
+	bool kf_isdir;
+	char kf_dir[MAXPATHLEN];
+	char kf_name[MAXPATHLEN];
+	int kf_fd;
+	ino_t kf_ino;
+	off_t kf_off;
+	time_t kf_rotated;
+	char *kf_buf;
+	struct kcn_buf_data *kf_batch;
+	struct kcn_buf_data *kf_obuf;
+	const struct kcn_ctx *kf_kc;
+	struct event_base *kf_evb;
+	struct kcn_net *kf_kn;
+	time_t kf_lastsend;
+	int kf_ifd;
+};
+
+static const char *
+kcndbctl_follow_file(const struct kcndbctl_follow *kf, char *path,
+    size_t pathlen)
+{
+
+	if (! kf->kf_isdir)
+		return kf->kf_path;
+	if ((size_t)snprintf(path, pathlen, "%s/%s", kf->kf_dir, kf->kf_name)
+	    >= pathlen)
+		errx(EXIT_FAILURE, "too long path: %s/%s", kf->kf_dir,
+		    kf->kf_name);
+	return path;
+}
+
+static void
+kcndbctl_follow_dirname(const char *path, char *dir, size_t dirlen)
+{
+	const char *p;
+
+	p = strrchr(path, '/');
+	if (p == NULL)
+		strlcpy(dir, ".", dirlen);
+	else if (p == path)
+		strlcpy(dir, "/", dirlen);
+	else
+		strlcpy(dir, path, MIN((size_t)(p - path) + 1, dirlen));
+}
+
+static bool
+kcndbctl_follow_ckpt_load(struct kcndbctl_follow *kf, ino_t *inop,
+    off_t *offp)
+{
+	FILE *fp;
+	char *line;
+	size_t linesiz;
+	unsigned long long ino;
+	long long off;
+	int n;
+
+	fp = fopen(kf->kf_ckpt, "r");
+	if (fp == NULL) {
+		if (errno == ENOENT)
+			return false;
+		err(EXIT_FAILURE, "cannot open checkpoint: %s", kf->kf_ckpt);
+	}
+	line = NULL;
+	linesiz = 0;
+	if (getline(&line, &linesiz, fp) == -1 ||
+	    sscanf(line, "%llu %lld %n", &ino, &off, &n) != 2 || off < 0)
+		errx(EXIT_FAILURE, "invalid checkpoint: %s", kf->kf_ckpt);
+	line[strcspn(line, "\n")] = '\0';
+	strlcpy(kf->kf_name, line + n, sizeof(kf->kf_name));
+	free(line);
+	(void)fclose(fp);
+	*inop = ino;
+	*offp = off;
+	return true;
+}
+
+static void
+kcndbctl_follow_ckpt_save(const struct kcndbctl_follow *kf)
+{
+	char tpath[MAXPATHLEN];
+	FILE *fp;
+	int fd;
+
+	if ((size_t)snprintf(tpath, sizeof(tpath), "%s.tmp", kf->kf_ckpt) >=
+	    sizeof(tpath))
+		errx(EXIT_FAILURE, "too long path: %s", kf->kf_ckpt);
+	fp = fopen(tpath, "w");
+	if (fp == NULL)
+		err(EXIT_FAILURE, "cannot open checkpoint: %s", tpath);
+	fprintf(fp, "%llu %lld %s\n", (unsigned long long)kf->kf_ino,
+	    (long long)kf->kf_off, kf->kf_name);
+	if (fflush(fp) == EOF || fsync(fileno(fp)) == -1 || fclose(fp) == EOF)
+		err(EXIT_FAILURE, "cannot write checkpoint: %s", tpath);
+	if (rename(tpath, kf->kf_ckpt) == -1)
+		err(EXIT_FAILURE, "cannot rename checkpoint: %s", tpath);
+	/* a rename is durable only after its directory is synced. */
+	fd = open(kf->kf_ckptdir, O_RDONLY);
+	if (fd == -1 || fsync(fd) == -1)
+		err(EXIT_FAILURE, "cannot sync directory: %s", kf->kf_ckptdir);
+	(void)close(fd);
+}
+
+static bool
+kcndbctl_follow_open(struct kcndbctl_follow *kf, ino_t ino, off_t off)
+{
+	char pathbuf[MAXPATHLEN];
+	const char *path;
+	struct stat st;
+
+	path = kcndbctl_follow_file(kf, pathbuf, sizeof(pathbuf));
+	kf->kf_fd = open(path, O_RDONLY);
+	if (kf->kf_fd == -1) {
+		if (errno != ENOENT)
+			KCN_LOG(WARN, "cannot open %s: %s",
+			    path, strerror(errno));
+		return false;
+	}
+	if (fstat(kf->kf_fd, &st) == -1)
+		err(EXIT_FAILURE, "cannot get file status: %s", path);
+	kf->kf_ino = st.st_ino;
+	if (st.st_ino == ino && off <= st.st_size)
+		kf->kf_off = off;
+	else
+		kf->kf_off = 0;
+	KCN_LOG(INFO, "follow %s from offset %lld", path,
+	    (long long)kf->kf_off);
+	return true;
+}
+
+/* find a regular file with the smallest name larger than a current one. */
+static bool
+kcndbctl_follow_next(const struct kcndbctl_follow *kf, char *name,
+    size_t namelen)
+{
+	char path[MAXPATHLEN];
+	struct stat st;
+	struct dirent *de;
+	DIR *dir;
+	bool found;
+
+	dir = opendir(kf->kf_dir);
+	if (dir == NULL)
+		err(EXIT_FAILURE, "cannot open directory: %s", kf->kf_dir);
+	found = false;
+	while ((de = readdir(dir)) != NULL) {
+		if (de->d_name[0] == '.' ||
+		    strcmp(de->d_name, kf->kf_name) <= 0 ||
+		    (found && strcmp(de->d_name, name) >= 0))
+			continue;
+		if ((size_t)snprintf(path, sizeof(path), "%s/%s", kf->kf_dir,
+		    de->d_name) >= sizeof(path) ||
+		    stat(path, &st) == -1 || ! S_ISREG(st.st_mode))
+			continue;
+		strlcpy(name, de->d_name, namelen);
+		found = true;
+	}
+	(void)closedir(dir);
+	return found;
+}
+
+static bool
+kcndbctl_follow_open_next(struct kcndbctl_follow *kf)
+{
+	char name[MAXPATHLEN];
+
+	if (kf->kf_isdir) {
+		if (! kcndbctl_follow_next(kf, name, sizeof(name)))
+			return false;
+		strlcpy(kf->kf_name, name, sizeof(kf->kf_name));
+	}
+	return kcndbctl_follow_open(kf, 0, 0);
+}
+
+static void
+kcndbctl_follow_disconnect(struct kcndbctl_follow *kf)
+{
+
+	if (kf->kf_kn == NULL)
+		return;
+	kcn_client_finish(kf->kf_kn);
+	kf->kf_kn = NULL;
+}
+
+/*
+ * XXX: kcndbd closes a connection idle for kcn_net_timeouttv, and lines
+ *	written to the closed connection would be lost silently.  reconnect
+ *	after a half of the timeout in advance.  a batch partially written
+ *	before an error is sent again, though.
+ */
+static bool
+kcndbctl_follow_send(struct kcndbctl_follow *kf, struct kcn_buf *kb)
+{
+	time_t now;
+
+	now = time(NULL);
+	if (kf->kf_kn != NULL &&
+	    now - kf->kf_lastsend >= kcn_net_timeouttv.tv_sec / 2)
+		kcndbctl_follow_disconnect(kf);
+	if (kf->kf_kn == NULL) {
+		kf->kf_kn = kcn_client_init(kf->kf_kc, kf->kf_evb, NULL);
+		if (kf->kf_kn == NULL) {
+			KCN_LOG(WARN, "cannot connect to kcndbd");
+			return false;
+		}
+	}
+	if (! kcn_net_write(kf->kf_kn, kb) || ! kcn_net_flush(kf->kf_kn)) {
+		KCN_LOG(WARN, "cannot send add messages: %s", strerror(errno));
+		kcndbctl_follow_disconnect(kf);
+		return false;
+	}
+	kf->kf_lastsend = now;
+	return true;
+}
+
+/*
+ * send complete lines appended to a current file.  a trailing line without
+ * a newline is sent only when the file is no longer written, i.e., last.
+ */
+static bool
+kcndbctl_follow_read(struct kcndbctl_follow *kf, bool last)
+{
+	struct kcn_buf batch, kb;
+	struct kcn_msg_add kma;
+	const char *sp, *ep;
+	ssize_t n;
+	size_t len;
+
+	kma.kma_type = kf->kf_type;
+	kcn_buf_init(&kb, kf->kf_obuf);
+	for (;;) {
+		n = pread(kf->kf_fd, kf->kf_buf, KCNDBCTL_FOLLOW_BUFSIZ,
+		    kf->kf_off);
+		if (n == -1) {
+			KCN_LOG(ERR, "%s: cannot read: %s", kf->kf_name,
+			    strerror(errno));
+			return false;
+		}
+		if (n == 0)
+			return true;
+		for (len = n; len > 0 && kf->kf_buf[len - 1] != '\n'; len--)
+			;
+		if (last || (len == 0 && n == KCNDBCTL_FOLLOW_BUFSIZ))
+			len = n;
+		if (len == 0)
+			return true;
+
+		kcn_buf_init(&batch, kf->kf_batch);
+		kcn_buf_reset(&batch, 0);
+		for (sp = kf->kf_buf; sp < kf->kf_buf + len; sp = ep + 1) {
+			ep = memchr(sp, '\n', kf->kf_buf + len - sp);
+			if (ep == NULL)
+				ep = kf->kf_buf + len;
+			if (! kcndbctl_file_line_parse(sp, ep, &kma)) {
+				if (errno != 0)
+					KCN_LOG(WARN, "%s: skip a line at "
+					    "offset %lld: %s", kf->kf_name,
+					    (long long)(kf->kf_off +
+					    (sp - kf->kf_buf)),
+					    strerror(errno));
+				continue;
+			}
+			kcn_msg_add_encode(&kb, &kma);
+			kcn_buf_put(&batch, kcn_buf_head(&kb),
+			    kcn_buf_len(&kb));
+		}
+		if (kcn_buf_len(&batch) > 0 &&
+		    ! kcndbctl_follow_send(kf, &batch))
+			return false;
+		kf->kf_off += len;
+		kcndbctl_follow_ckpt_save(kf);
+		if (len < (size_t)n)
+			return true;
+	}
+}
+
+static bool
+kcndbctl_follow_rotated(struct kcndbctl_follow *kf)
+{
+	char name[MAXPATHLEN];
+	struct stat st;
+
+	if (fstat(kf->kf_fd, &st) == -1)
+		err(EXIT_FAILURE, "cannot get file status: %s", kf->kf_name);
+	if (st.st_size < kf->kf_off) {
+		KCN_LOG(NOTICE, "%s: truncated", kf->kf_name);
+		kf->kf_off = 0;
+		kcndbctl_follow_ckpt_save(kf);
+		return false;
+	}
+	if (kf->kf_isdir)
+		return kcndbctl_follow_next(kf, name, sizeof(name));
+	if (stat(kf->kf_path, &st) == -1) {
+		if (errno != ENOENT)
+			err(EXIT_FAILURE, "cannot get file status: %s",
+			    kf->kf_path);
+		return true;
+	}
+	return st.st_ino != kf->kf_ino;
+}
+
+static void
+kcndbctl_follow_scan(struct kcndbctl_follow *kf)
+{
+
+	for (;;) {
+		if (kf->kf_fd == -1 && ! kcndbctl_follow_open_next(kf))
+			return;
+		if (! kcndbctl_follow_read(kf, false))
+			return;
+		if (kf->kf_rotated == 0) {
+			if (! kcndbctl_follow_rotated(kf))
+				return;
+			kf->kf_rotated = time(NULL);
+		}
+		/* a writer may still append lines after rotation. */
+		if (time(NULL) - kf->kf_rotated < KCNDBCTL_FOLLOW_ROTATEWAIT)
+			return;
+		if (! kcndbctl_follow_read(kf, true))
+			return;
+		KCN_LOG(INFO, "%s: rotated at offset %lld", kf->kf_name,
+		    (long long)kf->kf_off);
+		(void)close(kf->kf_fd);
+		kf->kf_fd = -1;
+		kf->kf_rotated = 0;
+	}
+}
+
+static void
+kcndbctl_follow_watch(struct kcndbctl_follow *kf)
+{
+
+#ifdef __linux__
+	kf->kf_ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (kf->kf_ifd != -1 && inotify_add_watch(kf->kf_ifd, kf->kf_dir,
+	    IN_MODIFY | IN_CREATE | IN_MOVED_TO | IN_CLOSE_WRITE) != -1)
+		return;
+	KCN_LOG(WARN, "cannot watch %s, and poll instead: %s", kf->kf_dir,
+	    strerror(errno));
+	if (kf->kf_ifd != -1)
+		(void)close(kf->kf_ifd);
+#endif /* __linux__ */
+	kf->kf_ifd = -1;
+}
+
+static void
+kcndbctl_follow_wait(struct kcndbctl_follow *kf)
+{
+	struct pollfd pfd;
+
+	pfd.fd = kf->kf_ifd;
+	pfd.events = POLLIN;
+	if (poll(&pfd, kf->kf_ifd != -1 ? 1 : 0,
+	    KCNDBCTL_FOLLOW_INTERVAL) == -1 && errno != EINTR)
+		err(EXIT_FAILURE, "cannot poll");
+	/* just drain events, and see files anyway. */
+	if (kf->kf_ifd != -1)
+		while (read(kf->kf_ifd, kf->kf_buf, KCNDBCTL_FOLLOW_BUFSIZ) > 0)
+			;
+}
+
+int
+kcndbctl_follow_process(enum kcn_eq_type type, const struct kcn_ctx *kc,
+    struct event_base *evb, const char *path, const char *ckpt)
+{
+	struct kcndbctl_follow kf;
+	struct stat st;
+	const char *p;
+	ino_t ino;
+	off_t off;
+
+	memset(&kf, 0, sizeof(kf));
+	kf.kf_type = type;
+	kf.kf_path = path;
+	kf.kf_ckpt = ckpt;
+	kf.kf_fd = -1;
+	kf.kf_kc = kc;
+	kf.kf_evb = evb;
+	kf.kf_kn = NULL;
+
+	if (stat(path, &st) == -1)
+		err(EXIT_FAILURE, "cannot get file status: %s", path);
+	kf.kf_isdir = S_ISDIR(st.st_mode);
+	p = strrchr(path, '/');
+	if (kf.kf_isdir)
+		strlcpy(kf.kf_dir, path, sizeof(kf.kf_dir));
+	else
+		kcndbctl_follow_dirname(path, kf.kf_dir, sizeof(kf.kf_dir));
+	if (! kf.kf_isdir)
+		strlcpy(kf.kf_name, p != NULL ? p + 1 : path,
+		    sizeof(kf.kf_name));
+	kcndbctl_follow_dirname(ckpt, kf.kf_ckptdir, sizeof(kf.kf_ckptdir));
+
+	kf.kf_buf = malloc(KCNDBCTL_FOLLOW_BUFSIZ);
+	kf.kf_batch = kcn_buf_data_new(
+	    KCNDBCTL_FILE_BATCHSIZ(KCNDBCTL_FOLLOW_BUFSIZ));
+	kf.kf_obuf = kcn_buf_data_new(KCN_MSG_MAXSIZ);
+	if (kf.kf_buf == NULL || kf.kf_batch == NULL || kf.kf_obuf == NULL)
+		err(EXIT_FAILURE, "cannot alloc. buffer");
+
+	/* resume a file in a checkpoint, or a next one if it disappears. */
+	if (kcndbctl_follow_ckpt_load(&kf, &ino, &off))
+		(void)kcndbctl_follow_open(&kf, ino, off);
+	kcndbctl_follow_watch(&kf);
+
+	for (;;) {
+		kcndbctl_follow_scan(&kf);
+		kcndbctl_follow_wait(&kf);
+	}
+	/*NOTREACHED*/
+}
@@ -0,0 +1,2 @@
+int kcndbctl_follow_process(enum kcn_eq_type, const struct kcn_ctx *,
+    struct event_base *, const char *, const char *);
@@ -1,22 +1,29 @@
 #include <err.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <event.h>
 
 #include "kcn.h"
 #include "kcn_log.h"
+#include "kcn_str.h"
 #include "kcn_buf.h"
 #include "kcn_net.h"
 #include "kcn_eq.h"
 #include "kcn_msg.h"
+#include "kcn_ctx.h"
 #include "kcn_client.h"
 #include "kcndbctl_msg.h"
 #include "kcndbctl_file.h"
+#include "kcndbctl_build.h"
+#include "kcndbctl_follow.h"
+#include "kcndbctl_export.h"
 
 static const char *usage(const char *, const char *, ...);
 
@@ -24,23 +31,67 @@ int
 main(int argc, char * const argv[])
 {
 	const char *pname;
-	const char *path;
+	const char *path, *loc, *build, *attach, *follow, *dir;
+	struct kcn_ctx *kc;
 	struct event_base *evb;
 	struct kcn_net *kn;
 	enum kcn_eq_type type;
+	enum kcndbctl_export_format format;
+	unsigned long long start;
+	time_t window;
+	bool dflag, xflag;
 	int ch, rc;
 
 	pname = (pname = strrchr(argv[0], '/')) != NULL ? pname + 1 : argv[0];
-	path = NULL;
+	path = loc = build = attach = follow = NULL;
+	dir = KCN_DB_PATH;
+	format = KCNDBCTL_EXPORT_FORMAT_TEXT;
+	start = 0;
+	window = 0;
+	dflag = xflag = false;
 
-	while ((ch = getopt(argc, argv, "f:hv?")) != -1) {
+	while ((ch = getopt(argc, argv, "D:F:a:b:df:hl:s:vw:x:?")) != -1) {
 		switch (ch) {
+		case 'D':
+			dir = optarg;
+			break;
+		case 'F':
+			follow = optarg;
+			break;
+		case 'a':
+			attach = optarg;
+			break;
+		case 'b':
+			build = optarg;
+			break;
+		case 'd':
+			dflag = true;
+			break;
 		case 'f':
 			path = optarg;
 			break;
+		case 'l':
+			loc = optarg;
+			break;
+		case 's':
+			if (! kcn_strtoull(optarg, 1, LONG_MAX, &start))
+				usage(pname, "invalid start time");
+				/*NOTREACHED*/
+			break;
+		case 'w':
+			if (! kcn_eq_window_aton(optarg, &window))
+				usage(pname, "invalid window");
+				/*NOTREACHED*/
+			break;
 		case 'v':
 			kcn_log_priority_increment();
 			break;
+		case 'x':
+			if (! kcndbctl_export_format_aton(optarg, &format))
+				usage(pname, "unknown export format");
+				/*NOTREACHED*/
+			xflag = true;
+			break;
 		case 'h':
 		case '?':
 		default:
@@ -51,6 +102,26 @@ main(int argc, char * const argv[])
 	argc -= optind;
 	argv += optind;
 
+	kc = kcn_ctx_new();
+	if (kc == NULL)
+		err(EXIT_FAILURE, "cannot allocate KCN context");
+
+	if (attach != NULL) {
+		if (argc != 0 || build != NULL || path != NULL || dflag ||
+		    loc != NULL || follow != NULL)
+			usage(pname, "wrong number of arguments");
+			/*NOTREACHED*/
+		return kcndbctl_msg_attach(kc, attach);
+	}
+
+	if (argc > 0 && strcmp(argv[0], "stats") == 0) {
+		if (argc != 1 || build != NULL || path != NULL || dflag ||
+		    loc != NULL || follow != NULL || xflag)
+			usage(pname, "wrong number of arguments");
+			/*NOTREACHED*/
+		return kcndbctl_msg_stats(kc);
+	}
+
 	if (argc < 1)
 		usage(pname, "missing database type");
 		/*NOTREACHED*/
@@ -60,27 +131,69 @@ main(int argc, char * const argv[])
 	KCN_LOG(NOTICE, "choose a table type of %s", kcn_eq_type_ntoa(type));
 	--argc, ++argv;
 
-	evb = event_init();
+	if (build != NULL) {
+		if (path == NULL || argc != 0 || dflag || loc != NULL ||
+		    follow != NULL)
+			usage(pname, "wrong number of arguments");
+			/*NOTREACHED*/
+		return kcndbctl_build_process(type, build, path);
+	}
+
+	if (xflag) {
+		if (path != NULL || argc != 0 || dflag || loc != NULL ||
+		    build != NULL || follow != NULL)
+			usage(pname, "wrong number of arguments");
+			/*NOTREACHED*/
+		return kcndbctl_export_process(type, format, dir,
+		    (time_t)start, window);
+	}
+
+	if (follow != NULL) {
+		if (path == NULL || argc != 0 || dflag || loc != NULL)
+			usage(pname, "wrong number of arguments");
+			/*NOTREACHED*/
+		evb = event_base_new();
+		if (evb == NULL)
+			usage(pname, "cannot allocate event base");
+			/*NOTREACHED*/
+		return kcndbctl_follow_process(type, kc, evb, path, follow);
+	}
+
+	if (loc != NULL && ! dflag) {
+		if (path != NULL || argc != 0)
+			usage(pname, "wrong number of arguments");
+			/*NOTREACHED*/
+		return kcndbctl_msg_history(type, kc, loc, window);
+	}
+
+	evb = event_base_new();
 	if (evb == NULL)
 		usage(pname, "cannot allocate event base");
 		/*NOTREACHED*/
 
-	kn = kcn_client_init(evb, NULL);
+	kn = kcn_client_init(kc, evb, NULL);
 	if (kn == NULL)
 		usage(pname, "cannot connect to kcndbd");
 		/*NOTREACHED*/
 
-	if ((path != NULL && argc > 0) || (path == NULL && argc != 2))
+	if (dflag) {
+		if (path != NULL || argc != 0)
+			usage(pname, "wrong number of arguments");
+			/*NOTREACHED*/
+	} else if ((path != NULL && argc > 0) || (path == NULL && argc != 2))
 		usage(pname, "wrong number of arguments");
 		/*NOTREACHED*/
 
-	if (path != NULL)
+	if (dflag)
+		rc = kcndbctl_msg_del_send(type, kn, loc, window);
+	else if (path != NULL)
 		rc = kcndbctl_file_process(type, kn, path);
 	else
 		rc = kcndbctl_msg_add_send(type, kn, argv[0], argv[1]);
 
 	kcn_client_finish(kn);
 	event_base_free(evb);
+	kcn_ctx_destroy(kc);
 
 	return rc;
 }
@@ -101,6 +214,13 @@ usage(const char *pname, const char *errfmt, ...)
 	fprintf(stderr, "\
 Usage: %s [-v] type value locator\n\
        %s [-v] -f filename type\n\
+       %s [-v] -l locator [-w window] type\n\
+       %s [-v] -d [-l locator] [-w window] type\n\
+       %s [-v] -b directory -f filename type\n\
+       %s [-v] -a directory\n\
+       %s [-v] stats\n\
+       %s [-v] -F checkpoint -f path type\n\
+       %s [-v] -x format [-D directory] [-s start] [-w window] type\n\
 Options:\n\
 	type: Database type.\n\
 	value, locator: Send current data to a KCN database server.\n\
@@ -115,11 +235,40 @@ Options:\n\
 			value:		value of unsigned 64-bit integer.\n\
 			locator:	FQDN or URI consisting of printable\n\
 					characters.\n\
+	-l locator: Print samples of a locator in the same format as\n\
+		    above.\n\
+	-d: Delete records of a locator given by -l, or of all locators,\n\
+	    in a window given by -w, or of all time.\n\
+	-b directory: Build a table and a dictionary of locators in a\n\
+		      directory from a file given by -f without the\n\
+		      server.  Records are sorted, and are merged into\n\
+		      ones already built in the directory, if any.\n\
+	-a directory: Attach a directory built by -b to the server.\n\
+		      Records in the directory are merged into tables of\n\
+		      the server atomically.\n\
+	stats: Print counters of the server, such as connections, queries\n\
+	       and adds per type, records scanned and matched, bytes in and\n\
+	       out, and hits of archives and queries in flight, followed by\n\
+	       cumulative histograms of latencies in usec of stages, i.e.,\n\
+	       query, decode, search, scan, lock wait, add and write.\n\
+	-F checkpoint: Follow a file given by -f, or files in a directory\n\
+		       given by -f in order of their names, and send lines\n\
+		       appended to them to the server.  A file is followed\n\
+		       until it is rotated.  An offset in a file is saved\n\
+		       in a checkpoint file to resume after restart.\n\
+	-x format: Export records by reading files of the server directly\n\
+		   in a format of text (same as -f), csv or binary.\n\
+	-D directory: Specify a database directory for -x (default: %s).\n\
+	-s start: Export records from a start time in UTC second with -x.\n\
+	-w window: Print samples only in a window (e.g., 30m, 1h or 7d)\n\
+		   with -l, or export records in a window from a start\n\
+		   time, or in the last window without -s, with -x.\n\
  	-v: Increment verbosity (can be specified 7 times at maximum).\n\
 \n\
 Supported database types are:\n\
 ",
-	    pname, pname);
+	    pname, pname, pname, pname, pname, pname, pname, pname, pname,
+	    KCN_DB_PATH);
 	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
 		fprintf(stderr, "\t%s\n", kcn_eq_type_ntoa(type));
 	exit(EXIT_FAILURE);
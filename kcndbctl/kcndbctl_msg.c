@@ -1,10 +1,15 @@
+#include <sys/time.h>
+
 #include <err.h>
+#include <errno.h>
 #include <limits.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <event.h>
 
@@ -16,6 +21,7 @@
 #include "kcn_time.h"
 #include "kcn_eq.h"
 #include "kcn_msg.h"
+#include "kcn_ctx.h"
 #include "kcn_client.h"
 #include "kcndbctl_msg.h"
 
@@ -43,3 +49,127 @@ kcndbctl_msg_add_send(enum kcn_eq_type type, struct kcn_net *kn,
   bad:
 	return EXIT_FAILURE;
 }
+
+/* delete records of a locator, or of all locators, in a window if any. */
+int
+kcndbctl_msg_del_send(enum kcn_eq_type type, struct kcn_net *kn,
+    const char *loc, time_t window)
+{
+	struct kcn_msg_del kmd;
+	time_t now;
+
+	kmd.kmd_type = type;
+	kmd.kmd_start = 0;
+	if (window != 0) {
+		if (time(&now) == -1)
+			goto bad;
+		kmd.kmd_start = now - window;
+	}
+	kmd.kmd_end = KCN_TIME_NOW;
+	kmd.kmd_loc = loc != NULL ? loc : "";
+	kmd.kmd_loclen = loc != NULL ? strlen(loc) : 0;
+	if (! kcn_client_del_send(kn, &kmd)) {
+		KCN_LOG(ERR, "cannot send delete message");
+		goto bad;
+	}
+	if (! kcn_net_loop(kn))
+		goto bad;
+	return EXIT_SUCCESS;
+  bad:
+	return EXIT_FAILURE;
+}
+
+static bool
+kcndbctl_msg_sample_print(const struct kcn_msg_sample *kms, void *arg)
+{
+	const char *loc = arg;
+
+	printf("%llu %llu %s\n", (unsigned long long)kms->kms_time,
+	    (unsigned long long)kms->kms_val, loc);
+	return true;
+}
+
+/* print samples in the same format as a file given by -f. */
+int
+kcndbctl_msg_history(enum kcn_eq_type type, const struct kcn_ctx *kc,
+    const char *loc, time_t window)
+{
+	struct kcn_msg_history kmhi;
+	time_t now;
+
+	kmhi.kmhi_type = type;
+	kmhi.kmhi_maxcount = 0;
+	kmhi.kmhi_start = 0;
+	if (window != 0) {
+		if (time(&now) == -1)
+			goto bad;
+		kmhi.kmhi_start = now - window;
+	}
+	kmhi.kmhi_end = KCN_TIME_NOW;
+	kmhi.kmhi_loc = loc;
+	kmhi.kmhi_loclen = strlen(loc);
+	if (! kcn_client_history(kc, &kmhi, kcndbctl_msg_sample_print,
+	    (void *)(uintptr_t)loc)) {
+		KCN_LOG(ERR, "cannot retrieve history: %s", strerror(errno));
+		goto bad;
+	}
+	return EXIT_SUCCESS;
+  bad:
+	return EXIT_FAILURE;
+}
+
+/*
+ * the server resolves a path of a directory in its own file system.  it
+ * replies only after building indexes of all records attached, which may
+ * take far longer than other requests.
+ */
+#define KCNDBCTL_MSG_ATTACH_TIMEOUT	(24 * 60 * 60)	/* sec */
+
+int
+kcndbctl_msg_attach(struct kcn_ctx *kc, const char *dir)
+{
+	static const struct timeval tv = {
+		.tv_sec = KCNDBCTL_MSG_ATTACH_TIMEOUT,
+		.tv_usec = 0
+	};
+	struct kcn_msg_attach kmat;
+	char path[PATH_MAX];
+
+	if (realpath(dir, path) == NULL) {
+		KCN_LOG(ERR, "cannot resolve %s: %s", dir, strerror(errno));
+		goto bad;
+	}
+	kmat.kmat_path = path;
+	kmat.kmat_pathlen = strlen(path);
+	kcn_ctx_timeout_set(kc, &tv);
+	if (! kcn_client_attach(kc, &kmat)) {
+		KCN_LOG(ERR, "cannot attach %s: %s", path, strerror(errno));
+		goto bad;
+	}
+	return EXIT_SUCCESS;
+  bad:
+	return EXIT_FAILURE;
+}
+
+static bool
+kcndbctl_msg_counter_print(const struct kcn_msg_counter *kmc, void *arg)
+{
+
+	(void)arg;
+	printf("%.*s %llu\n", (int)kmc->kmc_namelen, kmc->kmc_name,
+	    (unsigned long long)kmc->kmc_val);
+	return true;
+}
+
+/* print counters of the server as "name value" in lines. */
+int
+kcndbctl_msg_stats(const struct kcn_ctx *kc)
+{
+
+	if (! kcn_client_stats(kc, kcndbctl_msg_counter_print, NULL)) {
+		KCN_LOG(ERR, "cannot retrieve statistics: %s",
+		    strerror(errno));
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
@@ -1,2 +1,8 @@
 int kcndbctl_msg_add_send(enum kcn_eq_type, struct kcn_net *,
     const char *, const char *);
+int kcndbctl_msg_del_send(enum kcn_eq_type, struct kcn_net *, const char *,
+    time_t);
+int kcndbctl_msg_history(enum kcn_eq_type, const struct kcn_ctx *,
+    const char *, time_t);
+int kcndbctl_msg_attach(struct kcn_ctx *, const char *);
+int kcndbctl_msg_stats(const struct kcn_ctx *);
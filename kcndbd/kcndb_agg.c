@@ -0,0 +1,308 @@
+/*
+ * per-locator accumulators for aggregate queries.
+ *
+ * records in a window are fed once in time order, and each locator keeps
+ * just enough state to compute its aggregate at the end of the scan.  an
+ * equation without a function is regarded as an aggregate that matches if
+ * any record of a locator matches, which allows a join to probe plain and
+ * aggregate equations in the same way.
+ */
+#include <sys/queue.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kcn.h"
+#include "kcn_eq.h"
+#include "kcn_log.h"
+
+#include "kcndb_hash.h"
+#include "kcndb_agg.h"
+
+struct kcndb_agg_loc {
+	struct kcndb_hash_entry kal_hentry;	/* must be first. */
+#define kal_locidx	kal_hentry.khe_key
+	STAILQ_ENTRY(kcndb_agg_loc) kal_chain;
+	size_t kal_count;
+	double kal_sum;
+	unsigned long long kal_min;
+	unsigned long long kal_max;
+	time_t kal_first;
+	time_t kal_last;
+	unsigned long long kal_lastval;
+	double kal_increase;
+	unsigned long long *kal_vals;
+	size_t kal_valsize;
+	bool kal_matched;
+	double kal_v;
+};
+
+struct kcndb_agg {
+	struct kcn_eq ka_ke;
+	size_t ka_nlocs;
+	size_t ka_nmatches;
+	bool ka_finished;
+	struct kcndb_hash ka_hash;
+	STAILQ_HEAD(, kcndb_agg_loc) ka_locs;
+};
+
+#define KCNDB_AGG_VALSIZ_MIN	16
+
+struct kcndb_agg *
+kcndb_agg_new(const struct kcn_eq *ke)
+{
+	struct kcndb_agg *ka;
+
+	ka = malloc(sizeof(*ka));
+	if (ka == NULL)
+		return NULL;
+	ka->ka_ke = *ke;
+	ka->ka_nlocs = 0;
+	ka->ka_nmatches = 0;
+	ka->ka_finished = false;
+	STAILQ_INIT(&ka->ka_locs);
+	if (! kcndb_hash_init(&ka->ka_hash)) {
+		free(ka);
+		return NULL;
+	}
+	return ka;
+}
+
+void
+kcndb_agg_destroy(struct kcndb_agg *ka)
+{
+	struct kcndb_agg_loc *kal;
+
+	if (ka == NULL)
+		return;
+	while ((kal = STAILQ_FIRST(&ka->ka_locs)) != NULL) {
+		STAILQ_REMOVE_HEAD(&ka->ka_locs, kal_chain);
+		free(kal->kal_vals);
+		free(kal);
+	}
+	kcndb_hash_finish(&ka->ka_hash);
+	free(ka);
+}
+
+static struct kcndb_agg_loc *
+kcndb_agg_loc_find(const struct kcndb_agg *ka, uint64_t locidx)
+{
+
+	return (struct kcndb_agg_loc *)kcndb_hash_find(&ka->ka_hash, locidx);
+}
+
+static struct kcndb_agg_loc *
+kcndb_agg_loc_lookup(struct kcndb_agg *ka, uint64_t locidx)
+{
+	struct kcndb_agg_loc *kal;
+
+	kal = kcndb_agg_loc_find(ka, locidx);
+	if (kal != NULL)
+		return kal;
+	kal = malloc(sizeof(*kal));
+	if (kal == NULL)
+		return NULL;
+	kal->kal_locidx = locidx;
+	kal->kal_count = 0;
+	kal->kal_sum = 0;
+	kal->kal_increase = 0;
+	kal->kal_vals = NULL;
+	kal->kal_valsize = 0;
+	kal->kal_matched = false;
+	if (! kcndb_hash_insert(&ka->ka_hash, &kal->kal_hentry)) {
+		free(kal);
+		return NULL;
+	}
+	STAILQ_INSERT_TAIL(&ka->ka_locs, kal, kal_chain);
+	++ka->ka_nlocs;
+	return kal;
+}
+
+static bool
+kcndb_agg_val_append(struct kcndb_agg_loc *kal, unsigned long long val)
+{
+	unsigned long long *vals;
+	size_t size;
+
+	if (kal->kal_count == kal->kal_valsize) {
+		size = kal->kal_valsize == 0 ?
+		    KCNDB_AGG_VALSIZ_MIN : kal->kal_valsize * 2;
+		vals = realloc(kal->kal_vals, size * sizeof(*vals));
+		if (vals == NULL)
+			return false;
+		kal->kal_vals = vals;
+		kal->kal_valsize = size;
+	}
+	kal->kal_vals[kal->kal_count] = val;
+	return true;
+}
+
+static bool
+kcndb_agg_val_match(const struct kcn_eq *ke, double v)
+{
+	double val = ke->ke_val;
+
+	switch (ke->ke_op) {
+	case KCN_EQ_OP_LT:	return v < val;
+	case KCN_EQ_OP_LE:	return v <= val;
+	case KCN_EQ_OP_EQ:	return v == val;
+	case KCN_EQ_OP_GT:	return v > val;
+	case KCN_EQ_OP_GE:	return v >= val;
+	default:
+		return false;
+	}
+}
+
+/* records must be added in time order. */
+bool
+kcndb_agg_add(struct kcndb_agg *ka, uint64_t locidx, time_t t,
+    unsigned long long val)
+{
+	struct kcndb_agg_loc *kal;
+
+	assert(! ka->ka_finished);
+	if (ka->ka_ke.ke_func == KCN_EQ_FUNC_NONE &&
+	    ! kcndb_agg_val_match(&ka->ka_ke, val))
+		return true;
+	kal = kcndb_agg_loc_lookup(ka, locidx);
+	if (kal == NULL)
+		return false;
+	if (ka->ka_ke.ke_func == KCN_EQ_FUNC_PERCENTILE &&
+	    ! kcndb_agg_val_append(kal, val))
+		return false;
+	if (kal->kal_count == 0) {
+		kal->kal_min = kal->kal_max = val;
+		kal->kal_first = t;
+	} else {
+		if (val < kal->kal_min)
+			kal->kal_min = val;
+		if (val > kal->kal_max)
+			kal->kal_max = val;
+		/* a counter going backward is regarded as a reset. */
+		if (val >= kal->kal_lastval)
+			kal->kal_increase += val - kal->kal_lastval;
+		else
+			kal->kal_increase += val;
+	}
+	kal->kal_last = t;
+	kal->kal_lastval = val;
+	kal->kal_sum += val;
+	++kal->kal_count;
+	return true;
+}
+
+static int
+kcndb_agg_val_cmp(const void *a0, const void *b0)
+{
+	const unsigned long long *a = a0, *b = b0;
+
+	return *a < *b ? -1 : *a > *b ? 1 : 0;
+}
+
+static bool
+kcndb_agg_loc_value(const struct kcndb_agg *ka, struct kcndb_agg_loc *kal,
+    double *vp)
+{
+	size_t rank;
+
+	assert(kal->kal_count > 0);
+	switch (ka->ka_ke.ke_func) {
+	case KCN_EQ_FUNC_AVG:
+		*vp = kal->kal_sum / kal->kal_count;
+		break;
+	case KCN_EQ_FUNC_MIN:
+		*vp = kal->kal_min;
+		break;
+	case KCN_EQ_FUNC_MAX:
+		*vp = kal->kal_max;
+		break;
+	case KCN_EQ_FUNC_PERCENTILE:
+		/* nearest-rank method. */
+		qsort(kal->kal_vals, kal->kal_count, sizeof(*kal->kal_vals),
+		    kcndb_agg_val_cmp);
+		rank = (kal->kal_count * ka->ka_ke.ke_funcarg +
+		    KCN_EQ_PERCENTILE_MAX - 1) / KCN_EQ_PERCENTILE_MAX;
+		*vp = kal->kal_vals[rank > 0 ? rank - 1 : 0];
+		break;
+	case KCN_EQ_FUNC_RATE:
+		/* at least two samples at different time are required. */
+		if (kal->kal_last == kal->kal_first)
+			return false;
+		*vp = kal->kal_increase / (kal->kal_last - kal->kal_first);
+		break;
+	case KCN_EQ_FUNC_NONE:
+		/* only matched records are fed. */
+		*vp = kal->kal_lastval;
+		break;
+	default:
+		assert(0);
+		return false;
+	}
+	return true;
+}
+
+/* compute aggregates of all locators, and return the number of matches. */
+size_t
+kcndb_agg_finish(struct kcndb_agg *ka)
+{
+	struct kcndb_agg_loc *kal;
+
+	if (ka->ka_finished)
+		return ka->ka_nmatches;
+	STAILQ_FOREACH(kal, &ka->ka_locs, kal_chain) {
+		if (! kcndb_agg_loc_value(ka, kal, &kal->kal_v))
+			continue;
+		if (! kcndb_agg_val_match(&ka->ka_ke, kal->kal_v))
+			continue;
+		kal->kal_matched = true;
+		++ka->ka_nmatches;
+	}
+	ka->ka_finished = true;
+	KCN_LOG(DEBUG, "aggregate %zu locator(s), %zu match(es)",
+	    ka->ka_nlocs, ka->ka_nmatches);
+	return ka->ka_nmatches;
+}
+
+bool
+kcndb_agg_lookup(const struct kcndb_agg *ka, uint64_t locidx, double *vp)
+{
+	const struct kcndb_agg_loc *kal;
+
+	assert(ka->ka_finished);
+	kal = kcndb_agg_loc_find(ka, locidx);
+	if (kal == NULL || ! kal->kal_matched)
+		return false;
+	*vp = kal->kal_v;
+	return true;
+}
+
+/*
+ * call back locators whose aggregate satisfies an equation in order of
+ * their appearance up to maxnlocs.
+ */
+bool
+kcndb_agg_match(struct kcndb_agg *ka, size_t maxnlocs,
+    bool (*cb)(uint64_t, double, void *), void *arg)
+{
+	struct kcndb_agg_loc *kal;
+	size_t n;
+
+	(void)kcndb_agg_finish(ka);
+	n = 0;
+	STAILQ_FOREACH(kal, &ka->ka_locs, kal_chain) {
+		if (n == maxnlocs)
+			break;
+		if (! kal->kal_matched)
+			continue;
+		if (! (*cb)(kal->kal_locidx, kal->kal_v, arg))
+			return false;
+		++n;
+	}
+	return true;
+}
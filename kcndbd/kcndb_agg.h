@@ -0,0 +1,9 @@
+struct kcndb_agg;
+
+struct kcndb_agg *kcndb_agg_new(const struct kcn_eq *);
+void kcndb_agg_destroy(struct kcndb_agg *);
+bool kcndb_agg_add(struct kcndb_agg *, uint64_t, time_t, unsigned long long);
+size_t kcndb_agg_finish(struct kcndb_agg *);
+bool kcndb_agg_lookup(const struct kcndb_agg *, uint64_t, double *);
+bool kcndb_agg_match(struct kcndb_agg *, size_t,
+    bool (*)(uint64_t, double, void *), void *);
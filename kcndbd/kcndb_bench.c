@@ -0,0 +1,769 @@
+/*
+ * microbenchmarks of hot paths of kcndbd.
+ *
+ * results are printed one per line in the format of go test -bench, i.e.,
+ * a name, the number of iterations and nanoseconds per iteration, so that
+ * results of two commits can be compared by benchstat or a plain diff.
+ * pure functions are iterated until a benchmark time elapses, while ones
+ * growing a dictionary are iterated a fixed number of times.  a database
+ * is built in a temporary directory unless specified.
+ */
+#include <sys/param.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "kcn.h"
+#include "kcn_log.h"
+#include "kcn_str.h"
+#include "kcn_time.h"
+#include "kcn_buf.h"
+#include "kcn_eq.h"
+#include "kcn_msg.h"
+
+#include "kcndb_db.h"
+
+#define KCNDB_BENCH_NSECINSEC	1000000000ULL
+#define KCNDB_BENCH_TIME_DEFAULT	1	/* sec */
+#define KCNDB_BENCH_COUNT_DEFAULT	1
+#define KCNDB_BENCH_NITERS_MAX	1000000000ULL
+#define KCNDB_BENCH_BUFSIZ	KCN_MSG_MAXSIZ
+#define KCNDB_BENCH_LOCSIZ	48
+#define KCNDB_BENCH_LOC(locs, i)	((locs) + (i) * KCNDB_BENCH_LOCSIZ)
+#define KCNDB_BENCH_NLOCS	1000	/* locators of records and tables */
+#define KCNDB_BENCH_TIME_ORIGIN	1000000000	/* fixed for reproducibility */
+
+struct kcndb_bench {
+	const char *kbe_name;
+	uint64_t (*kbe_func)(const struct kcndb_bench *, size_t);
+	size_t kbe_arg;
+	size_t kbe_arg2;
+	size_t kbe_niters;	/* calibrated if 0 */
+};
+
+static volatile uint64_t kcndb_bench_sink;
+
+static char *kcndb_bench_dir;
+static bool kcndb_bench_tmpdir;
+static struct kcndb_db *kcndb_bench_kd;
+static size_t kcndb_bench_nlocs;
+static time_t kcndb_bench_time = KCNDB_BENCH_TIME_ORIGIN;
+static size_t kcndb_bench_nrecords[KCN_EQ_TYPE_MAX];
+
+static void usage(const char *, const char *, ...);
+
+static uint64_t
+kcndb_bench_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * KCNDB_BENCH_NSECINSEC +
+	    (uint64_t)ts.tv_nsec;
+}
+
+static struct kcn_buf_data *
+kcndb_bench_buf_new(struct kcn_buf *kb)
+{
+	struct kcn_buf_data *kbd;
+
+	kbd = kcn_buf_data_new(KCNDB_BENCH_BUFSIZ);
+	if (kbd == NULL)
+		err(EXIT_FAILURE, "cannot allocate buffer");
+	kcn_buf_init(kb, kbd);
+	kcn_buf_reset(kb, 0);
+	return kbd;
+}
+
+/*
+ * a buffer is rewound whenever full so that an iteration just puts or
+ * gets a value of a given octets.
+ */
+static uint64_t
+kcndb_bench_buf_put(const struct kcndb_bench *kbe, size_t n)
+{
+	struct kcn_buf kb;
+	struct kcn_buf_data *kbd;
+	size_t i, j, m;
+	uint64_t start, end;
+
+	kbd = kcndb_bench_buf_new(&kb);
+	m = KCNDB_BENCH_BUFSIZ / kbe->kbe_arg;
+	start = kcndb_bench_now();
+	for (i = 0, j = 0; i < n; i++) {
+		if (j++ == m) {
+			kcn_buf_reset(&kb, 0);
+			j = 1;
+		}
+		switch (kbe->kbe_arg) {
+		case 1:
+			kcn_buf_put8(&kb, i);
+			break;
+		case 2:
+			kcn_buf_put16(&kb, i);
+			break;
+		case 4:
+			kcn_buf_put32(&kb, i);
+			break;
+		case 8:
+			kcn_buf_put64(&kb, i);
+			break;
+		}
+	}
+	end = kcndb_bench_now();
+	kcn_buf_data_destroy(kbd);
+	return end - start;
+}
+
+static uint64_t
+kcndb_bench_buf_get(const struct kcndb_bench *kbe, size_t n)
+{
+	struct kcn_buf kb;
+	struct kcn_buf_data *kbd;
+	size_t i, j, m;
+	uint64_t start, end, v;
+
+	kbd = kcndb_bench_buf_new(&kb);
+	kcn_buf_putnull(&kb, KCNDB_BENCH_BUFSIZ);
+	kcn_buf_start(&kb);
+	m = KCNDB_BENCH_BUFSIZ / kbe->kbe_arg;
+	v = 0;
+	start = kcndb_bench_now();
+	for (i = 0, j = 0; i < n; i++) {
+		if (j++ == m) {
+			kcn_buf_start(&kb);
+			j = 1;
+		}
+		switch (kbe->kbe_arg) {
+		case 1:
+			v += kcn_buf_get8(&kb);
+			break;
+		case 2:
+			v += kcn_buf_get16(&kb);
+			break;
+		case 4:
+			v += kcn_buf_get32(&kb);
+			break;
+		case 8:
+			v += kcn_buf_get64(&kb);
+			break;
+		}
+	}
+	end = kcndb_bench_now();
+	kcndb_bench_sink = v;
+	kcn_buf_data_destroy(kbd);
+	return end - start;
+}
+
+static uint64_t
+kcndb_bench_buf_putbytes(const struct kcndb_bench *kbe, size_t n)
+{
+	struct kcn_buf kb;
+	struct kcn_buf_data *kbd;
+	char src[KCNDB_BENCH_BUFSIZ];
+	size_t i, j, m;
+	uint64_t start, end;
+
+	kbd = kcndb_bench_buf_new(&kb);
+	memset(src, 'x', kbe->kbe_arg);
+	m = KCNDB_BENCH_BUFSIZ / kbe->kbe_arg;
+	start = kcndb_bench_now();
+	for (i = 0, j = 0; i < n; i++) {
+		if (j++ == m) {
+			kcn_buf_reset(&kb, 0);
+			j = 1;
+		}
+		kcn_buf_put(&kb, src, kbe->kbe_arg);
+	}
+	end = kcndb_bench_now();
+	kcn_buf_data_destroy(kbd);
+	return end - start;
+}
+
+static void
+kcndb_bench_loc(char *loc, size_t locsiz, size_t idx)
+{
+
+	snprintf(loc, locsiz, "loc-%zu.example.com", idx);
+}
+
+static void
+kcndb_bench_query_init(struct kcn_msg_query *kmq, size_t neqs)
+{
+	struct kcn_eq *ke;
+	size_t i;
+
+	memset(kmq, 0, sizeof(*kmq));
+	kmq->kmq_loctype = KCN_LOC_TYPE_DOMAINNAME;
+	kmq->kmq_maxcount = 1;
+	kmq->kmq_neqs = neqs;
+	for (i = 0; i < neqs; i++) {
+		ke = &kmq->kmq_eqs[i];
+		ke->ke_type = KCN_EQ_TYPE_MIN + 1 + i % (KCN_EQ_TYPE_MAX - 1);
+		ke->ke_func = neqs > 1 ? KCN_EQ_FUNC_AVG : KCN_EQ_FUNC_NONE;
+		ke->ke_op = KCN_EQ_OP_LT;
+		ke->ke_val = 100;
+		ke->ke_start = KCNDB_BENCH_TIME_ORIGIN;
+		ke->ke_end = KCN_TIME_NOW;
+	}
+}
+
+static void
+kcndb_bench_add_init(struct kcn_msg_add *kma, char *loc, size_t locsiz)
+{
+
+	kcndb_bench_loc(loc, locsiz, 0);
+	kma->kma_type = KCN_EQ_TYPE_RTT;
+	kma->kma_time = KCNDB_BENCH_TIME_ORIGIN;
+	kma->kma_val = 100;
+	kma->kma_loc = loc;
+	kma->kma_loclen = strlen(loc);
+}
+
+static uint64_t
+kcndb_bench_msg_query_encode(const struct kcndb_bench *kbe, size_t n)
+{
+	struct kcn_buf kb;
+	struct kcn_buf_data *kbd;
+	struct kcn_msg_query kmq;
+	size_t i;
+	uint64_t start, end;
+
+	kbd = kcndb_bench_buf_new(&kb);
+	kcndb_bench_query_init(&kmq, kbe->kbe_arg);
+	start = kcndb_bench_now();
+	for (i = 0; i < n; i++)
+		kcn_msg_query_encode(&kb, &kmq);
+	end = kcndb_bench_now();
+	kcn_buf_data_destroy(kbd);
+	return end - start;
+}
+
+static uint64_t
+kcndb_bench_msg_add_encode(const struct kcndb_bench *kbe, size_t n)
+{
+	struct kcn_buf kb;
+	struct kcn_buf_data *kbd;
+	struct kcn_msg_add kma;
+	char loc[KCNDB_BENCH_LOCSIZ];
+	size_t i;
+	uint64_t start, end;
+
+	(void)kbe;
+	kbd = kcndb_bench_buf_new(&kb);
+	kcndb_bench_add_init(&kma, loc, sizeof(loc));
+	start = kcndb_bench_now();
+	for (i = 0; i < n; i++)
+		kcn_msg_add_encode(&kb, &kma);
+	end = kcndb_bench_now();
+	kcn_buf_data_destroy(kbd);
+	return end - start;
+}
+
+static uint64_t
+kcndb_bench_msg_response_encode(const struct kcndb_bench *kbe, size_t n)
+{
+	struct kcn_buf kb;
+	struct kcn_buf_data *kbd;
+	struct kcn_msg_response kmr;
+	char loc[KCNDB_BENCH_LOCSIZ];
+	size_t i;
+	uint64_t start, end;
+
+	(void)kbe;
+	kbd = kcndb_bench_buf_new(&kb);
+	kcndb_bench_loc(loc, sizeof(loc), 0);
+	kcn_msg_response_init(&kmr);
+	kmr.kmr_loc = loc;
+	kmr.kmr_loclen = strlen(loc);
+	start = kcndb_bench_now();
+	for (i = 0; i < n; i++)
+		kcn_msg_response_encode(&kb, &kmr);
+	end = kcndb_bench_now();
+	kcn_buf_data_destroy(kbd);
+	return end - start;
+}
+
+/*
+ * a message encoded in advance is decoded repeatedly.  a decoder trims a
+ * message off a buffer, which is prepended back before the next one.
+ */
+static uint64_t
+kcndb_bench_msg_decode(const struct kcndb_bench *kbe, size_t n)
+{
+	struct kcn_buf kb;
+	struct kcn_buf_data *kbd;
+	struct kcn_msg_header kmh;
+	struct kcn_msg_query kmq;
+	struct kcn_msg_response kmr;
+	struct kcn_msg_add kma;
+	char loc[KCNDB_BENCH_LOCSIZ];
+	size_t i, len;
+	uint64_t start, end;
+	bool rc;
+
+	kbd = kcndb_bench_buf_new(&kb);
+	switch (kbe->kbe_arg) {
+	case KCN_MSG_TYPE_QUERY:
+		kcndb_bench_query_init(&kmq, kbe->kbe_arg2);
+		kcn_msg_query_encode(&kb, &kmq);
+		break;
+	case KCN_MSG_TYPE_RESPONSE:
+		kcndb_bench_loc(loc, sizeof(loc), 0);
+		kcn_msg_response_init(&kmr);
+		kmr.kmr_loc = loc;
+		kmr.kmr_loclen = strlen(loc);
+		kcn_msg_response_encode(&kb, &kmr);
+		break;
+	case KCN_MSG_TYPE_ADD:
+		kcndb_bench_add_init(&kma, loc, sizeof(loc));
+		kcn_msg_add_encode(&kb, &kma);
+		break;
+	}
+	len = kcn_buf_len(&kb);
+	kcn_buf_trim_head(&kb, len);
+	rc = true;
+	start = kcndb_bench_now();
+	for (i = 0; i < n && rc; i++) {
+		kcn_buf_prepend(&kb, len);
+		rc = kcn_msg_header_decode(&kb, &kmh);
+		if (! rc)
+			break;
+		switch (kmh.kmh_type) {
+		case KCN_MSG_TYPE_QUERY:
+			rc = kcn_msg_query_decode(&kb, &kmh, &kmq);
+			break;
+		case KCN_MSG_TYPE_RESPONSE:
+			rc = kcn_msg_response_decode(&kb, &kmh, &kmr);
+			break;
+		case KCN_MSG_TYPE_ADD:
+			rc = kcn_msg_add_decode(&kb, &kmh, &kma);
+			break;
+		default:
+			rc = false;
+			break;
+		}
+	}
+	end = kcndb_bench_now();
+	if (! rc)
+		err(EXIT_FAILURE, "%s: cannot decode", kbe->kbe_name);
+	kcn_buf_data_destroy(kbd);
+	return end - start;
+}
+
+static uint64_t
+kcndb_bench_str_hash(const struct kcndb_bench *kbe, size_t n)
+{
+	char s[KCNDB_BENCH_BUFSIZ];
+	size_t i;
+	uint64_t start, end, v;
+
+	memset(s, 'x', kbe->kbe_arg);
+	v = 0;
+	start = kcndb_bench_now();
+	for (i = 0; i < n; i++) {
+		s[0] = i;
+		v += kcn_str_hash(s, kbe->kbe_arg, 256);
+	}
+	end = kcndb_bench_now();
+	kcndb_bench_sink = v;
+	return end - start;
+}
+
+static struct kcndb_db *
+kcndb_bench_db(void)
+{
+	char path[MAXPATHLEN];
+
+	if (kcndb_bench_kd != NULL)
+		return kcndb_bench_kd;
+	if (kcndb_bench_dir == NULL) {
+		snprintf(path, sizeof(path), "%s/kcndb_bench.XXXXXX",
+		    getenv("TMPDIR") != NULL ? getenv("TMPDIR") : "/tmp");
+		if (mkdtemp(path) == NULL)
+			err(EXIT_FAILURE, "cannot create %s", path);
+		kcndb_bench_dir = strdup(path);
+		if (kcndb_bench_dir == NULL)
+			err(EXIT_FAILURE, "cannot allocate path");
+		kcndb_bench_tmpdir = true;
+	} else if (mkdir(kcndb_bench_dir, 0700) == -1 && errno != EEXIST)
+		err(EXIT_FAILURE, "cannot create %s", kcndb_bench_dir);
+	kcndb_db_path_set(kcndb_bench_dir);
+	kcndb_bench_kd = kcndb_db_new();
+	if (kcndb_bench_kd == NULL)
+		err(EXIT_FAILURE, "cannot open database in %s",
+		    kcndb_bench_dir);
+	return kcndb_bench_kd;
+}
+
+static void
+kcndb_bench_db_cleanup(void)
+{
+	char path[MAXPATHLEN];
+	struct dirent *de;
+	DIR *dir;
+
+	kcndb_db_destroy(kcndb_bench_kd);
+	if (! kcndb_bench_tmpdir)
+		return;
+	dir = opendir(kcndb_bench_dir);
+	if (dir == NULL) {
+		warn("cannot open %s", kcndb_bench_dir);
+		return;
+	}
+	while ((de = readdir(dir)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 ||
+		    strcmp(de->d_name, "..") == 0)
+			continue;
+		snprintf(path, sizeof(path), "%s/%s", kcndb_bench_dir,
+		    de->d_name);
+		if (unlink(path) == -1)
+			warn("cannot remove %s", path);
+	}
+	closedir(dir);
+	if (rmdir(kcndb_bench_dir) == -1)
+		warn("cannot remove %s", kcndb_bench_dir);
+}
+
+static void
+kcndb_bench_record_add(enum kcn_eq_type type, const char *loc,
+    unsigned long long val)
+{
+	struct kcndb_db_record kdr;
+
+	kdr.kdr_time = kcndb_bench_time++;
+	kdr.kdr_val = val;
+	kdr.kdr_loc = loc;
+	kdr.kdr_loclen = strlen(loc);
+	if (! kcndb_db_record_add(kcndb_bench_kd, type, &kdr))
+		err(EXIT_FAILURE, "cannot add record");
+}
+
+/* locators are formatted in advance not to be measured. */
+static char *
+kcndb_bench_locs_new(size_t base, size_t n)
+{
+	char *locs;
+	size_t i;
+
+	locs = malloc(n * KCNDB_BENCH_LOCSIZ);
+	if (locs == NULL)
+		err(EXIT_FAILURE, "cannot allocate locators");
+	for (i = 0; i < n; i++)
+		kcndb_bench_loc(KCNDB_BENCH_LOC(locs, i), KCNDB_BENCH_LOCSIZ,
+		    base + i);
+	return locs;
+}
+
+/* a dictionary grows up to a given size first, and each run adds more. */
+static void
+kcndb_bench_db_locs_grow(size_t nlocs)
+{
+	char loc[KCNDB_BENCH_LOCSIZ];
+
+	for (; kcndb_bench_nlocs < nlocs; kcndb_bench_nlocs++) {
+		kcndb_bench_loc(loc, sizeof(loc), kcndb_bench_nlocs);
+		kcndb_bench_record_add(KCN_EQ_TYPE_HOPCOUNT, loc, 0);
+	}
+}
+
+/*
+ * kcndb_db_loc_add() is internal to kcndb_db.c, and is measured through
+ * kcndb_db_record_add() with new locators.  LocAdd minus RecordAdd of
+ * known locators approximates the cost of the dictionary.
+ */
+static uint64_t
+kcndb_bench_db_loc_add(const struct kcndb_bench *kbe, size_t n)
+{
+	char *locs;
+	size_t i;
+	uint64_t start, end;
+
+	(void)kcndb_bench_db();
+	kcndb_bench_db_locs_grow(kbe->kbe_arg);
+	locs = kcndb_bench_locs_new(kcndb_bench_nlocs, n);
+	start = kcndb_bench_now();
+	for (i = 0; i < n; i++)
+		kcndb_bench_record_add(KCN_EQ_TYPE_HOPCOUNT,
+		    KCNDB_BENCH_LOC(locs, i), i);
+	end = kcndb_bench_now();
+	kcndb_bench_nlocs += n;
+	free(locs);
+	return end - start;
+}
+
+static uint64_t
+kcndb_bench_db_record_add(const struct kcndb_bench *kbe, size_t n)
+{
+	char *locs;
+	size_t i, nlocs;
+	uint64_t start, end;
+
+	(void)kcndb_bench_db();
+	nlocs = kbe->kbe_arg;
+	kcndb_bench_db_locs_grow(nlocs);
+	locs = kcndb_bench_locs_new(0, nlocs);
+	start = kcndb_bench_now();
+	for (i = 0; i < n; i++)
+		kcndb_bench_record_add(KCN_EQ_TYPE_RTT,
+		    KCNDB_BENCH_LOC(locs, i % nlocs), i);
+	end = kcndb_bench_now();
+	free(locs);
+	return end - start;
+}
+
+static bool
+kcndb_bench_db_search_cb(const struct kcndb_db_record *kdr, size_t score,
+    void *arg)
+{
+	size_t *np = arg;
+
+	(void)kdr;
+	(void)score;
+	++*np;
+	return true;
+}
+
+/*
+ * a table of a size per type has values cycling through locators, and
+ * ``lt'' a multiple of 1% of them matches the percentage of records.
+ */
+static enum kcn_eq_type
+kcndb_bench_db_table(size_t nrecords)
+{
+	char *locs;
+	enum kcn_eq_type type;
+	size_t i;
+
+	for (type = KCN_EQ_TYPE_STORAGE; type < KCN_EQ_TYPE_RTT; type++)
+		if (kcndb_bench_nrecords[type] == nrecords ||
+		    kcndb_bench_nrecords[type] == 0)
+			break;
+	if (type == KCN_EQ_TYPE_RTT)
+		errx(EXIT_FAILURE, "too many tables");
+	if (kcndb_bench_nrecords[type] == nrecords)
+		return type;
+	kcndb_bench_db_locs_grow(KCNDB_BENCH_NLOCS);
+	locs = kcndb_bench_locs_new(0, KCNDB_BENCH_NLOCS);
+	for (i = 0; i < nrecords; i++)
+		kcndb_bench_record_add(type,
+		    KCNDB_BENCH_LOC(locs, i % KCNDB_BENCH_NLOCS),
+		    i % KCNDB_BENCH_NLOCS);
+	free(locs);
+	kcndb_bench_nrecords[type] = nrecords;
+	return type;
+}
+
+static uint64_t
+kcndb_bench_db_search(const struct kcndb_bench *kbe, size_t n)
+{
+	struct kcndb_db *kd;
+	struct kcn_eq ke;
+	size_t i, nmatches, expected;
+	uint64_t start, end;
+
+	kd = kcndb_bench_db();
+	memset(&ke, 0, sizeof(ke));
+	ke.ke_type = kcndb_bench_db_table(kbe->kbe_arg);
+	ke.ke_func = KCN_EQ_FUNC_NONE;
+	ke.ke_op = KCN_EQ_OP_LT;
+	ke.ke_val = KCNDB_BENCH_NLOCS * kbe->kbe_arg2 / 100;
+	/* a window from the epoch is never answered by archives. */
+	ke.ke_start = 0;
+	ke.ke_end = KCN_TIME_NOW;
+	nmatches = 0;
+	start = kcndb_bench_now();
+	for (i = 0; i < n; i++)
+		if (! kcndb_db_search(kd, &ke, 1, SIZE_MAX,
+		    kcndb_bench_db_search_cb, &nmatches))
+			err(EXIT_FAILURE, "%s: cannot search", kbe->kbe_name);
+	end = kcndb_bench_now();
+	expected = kbe->kbe_arg * kbe->kbe_arg2 / 100;
+	if (nmatches != n * expected)
+		errx(EXIT_FAILURE, "%s: %zu records matched, not %zu",
+		    kbe->kbe_name, nmatches / n, expected);
+	return end - start;
+}
+
+static const struct kcndb_bench kcndb_bench_list[] = {
+	{ "BufPut8",		kcndb_bench_buf_put,		1, 0, 0 },
+	{ "BufPut16",		kcndb_bench_buf_put,		2, 0, 0 },
+	{ "BufPut32",		kcndb_bench_buf_put,		4, 0, 0 },
+	{ "BufPut64",		kcndb_bench_buf_put,		8, 0, 0 },
+	{ "BufPut/len=32",	kcndb_bench_buf_putbytes,	32, 0, 0 },
+	{ "BufPut/len=256",	kcndb_bench_buf_putbytes,	256, 0, 0 },
+	{ "BufGet8",		kcndb_bench_buf_get,		1, 0, 0 },
+	{ "BufGet16",		kcndb_bench_buf_get,		2, 0, 0 },
+	{ "BufGet32",		kcndb_bench_buf_get,		4, 0, 0 },
+	{ "BufGet64",		kcndb_bench_buf_get,		8, 0, 0 },
+	{ "MsgQueryEncode/eqs=1", kcndb_bench_msg_query_encode,	1, 0, 0 },
+	{ "MsgQueryEncode/eqs=8", kcndb_bench_msg_query_encode,	8, 0, 0 },
+	{ "MsgQueryDecode/eqs=1", kcndb_bench_msg_decode,
+	  KCN_MSG_TYPE_QUERY, 1, 0 },
+	{ "MsgQueryDecode/eqs=8", kcndb_bench_msg_decode,
+	  KCN_MSG_TYPE_QUERY, 8, 0 },
+	{ "MsgResponseEncode",	kcndb_bench_msg_response_encode, 0, 0, 0 },
+	{ "MsgResponseDecode",	kcndb_bench_msg_decode,
+	  KCN_MSG_TYPE_RESPONSE, 0, 0 },
+	{ "MsgAddEncode",	kcndb_bench_msg_add_encode,	0, 0, 0 },
+	{ "MsgAddDecode",	kcndb_bench_msg_decode,
+	  KCN_MSG_TYPE_ADD, 0, 0 },
+	{ "StrHash/len=16",	kcndb_bench_str_hash,		16, 0, 0 },
+	{ "StrHash/len=64",	kcndb_bench_str_hash,		64, 0, 0 },
+	{ "StrHash/len=256",	kcndb_bench_str_hash,		256, 0, 0 },
+	/* in ascending order of sizes, since a dictionary never shrinks. */
+	{ "LocAdd/locs=1000",	kcndb_bench_db_loc_add,	1000, 0, 1000 },
+	{ "LocAdd/locs=10000",	kcndb_bench_db_loc_add,	10000, 0, 1000 },
+	{ "LocAdd/locs=50000",	kcndb_bench_db_loc_add,	50000, 0, 1000 },
+	{ "RecordAdd/locs=1000", kcndb_bench_db_record_add,
+	  KCNDB_BENCH_NLOCS, 0, 0 },
+	{ "Search/records=10000/match=1%",	kcndb_bench_db_search,
+	  10000, 1, 0 },
+	{ "Search/records=10000/match=10%",	kcndb_bench_db_search,
+	  10000, 10, 0 },
+	{ "Search/records=10000/match=100%",	kcndb_bench_db_search,
+	  10000, 100, 0 },
+	{ "Search/records=100000/match=1%",	kcndb_bench_db_search,
+	  100000, 1, 0 },
+	{ "Search/records=100000/match=10%",	kcndb_bench_db_search,
+	  100000, 10, 0 },
+	{ "Search/records=100000/match=100%",	kcndb_bench_db_search,
+	  100000, 100, 0 },
+	{ "Search/records=1000000/match=1%",	kcndb_bench_db_search,
+	  1000000, 1, 0 },
+	{ "Search/records=1000000/match=10%",	kcndb_bench_db_search,
+	  1000000, 10, 0 },
+	{ "Search/records=1000000/match=100%",	kcndb_bench_db_search,
+	  1000000, 100, 0 },
+};
+
+/*
+ * iterations are grown as go test does until a run takes a benchmark
+ * time, and a result of the last run is reported.
+ */
+static void
+kcndb_bench_run(const struct kcndb_bench *kbe, uint64_t benchtime)
+{
+	uint64_t elapsed, n, next;
+
+	n = kbe->kbe_niters != 0 ? kbe->kbe_niters : 1;
+	for (;;) {
+		elapsed = (*kbe->kbe_func)(kbe, n);
+		if (kbe->kbe_niters != 0 || elapsed >= benchtime ||
+		    n >= KCNDB_BENCH_NITERS_MAX)
+			break;
+		next = elapsed == 0 ? n * 100 :
+		    (uint64_t)((double)n * benchtime / elapsed * 1.2);
+		if (next > n * 100)
+			next = n * 100;
+		if (next <= n)
+			next = n + 1;
+		if (next > KCNDB_BENCH_NITERS_MAX)
+			next = KCNDB_BENCH_NITERS_MAX;
+		n = next;
+	}
+	printf("Benchmark%s\t%10llu\t%12.2f ns/op\n", kbe->kbe_name,
+	    (unsigned long long)n, (double)elapsed / n);
+	fflush(stdout);
+}
+
+int
+main(int argc, char * const argv[])
+{
+	const char *pname, *filter;
+	const struct kcndb_bench *kbe;
+	unsigned long long count;
+	time_t benchtime;
+	size_t i, j;
+	int ch;
+
+	pname = (pname = strrchr(argv[0], '/')) != NULL ? pname + 1 : argv[0];
+	benchtime = KCNDB_BENCH_TIME_DEFAULT;
+	count = KCNDB_BENCH_COUNT_DEFAULT;
+
+	while ((ch = getopt(argc, argv, "b:c:d:hv?")) != -1) {
+		switch (ch) {
+		case 'b':
+			if (! kcn_eq_window_aton(optarg, &benchtime))
+				usage(pname, "invalid benchmark time");
+				/*NOTREACHED*/
+			break;
+		case 'c':
+			if (! kcn_strtoull(optarg, 1, INT_MAX, &count))
+				usage(pname, "invalid count");
+				/*NOTREACHED*/
+			break;
+		case 'd':
+			kcndb_bench_dir = optarg;
+			break;
+		case 'v':
+			kcn_log_priority_increment();
+			break;
+		case 'h':
+		case '?':
+		default:
+			usage(pname, NULL);
+			/*NOTREACHED*/
+		}
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 1)
+		usage(pname, "wrong number of arguments");
+		/*NOTREACHED*/
+	filter = argc == 1 ? argv[0] : NULL;
+
+	for (i = 0; i < sizeof(kcndb_bench_list) / sizeof(kcndb_bench_list[0]);
+	    i++) {
+		kbe = &kcndb_bench_list[i];
+		if (filter != NULL && strstr(kbe->kbe_name, filter) == NULL)
+			continue;
+		for (j = 0; j < count; j++)
+			kcndb_bench_run(kbe,
+			    (uint64_t)benchtime * KCNDB_BENCH_NSECINSEC);
+	}
+
+	if (kcndb_bench_kd != NULL)
+		kcndb_bench_db_cleanup();
+	return EXIT_SUCCESS;
+}
+
+static void
+usage(const char *pname, const char *errfmt, ...)
+{
+	va_list ap;
+
+	if (errfmt != NULL)  {
+		fprintf(stderr, "ERROR: ");
+		va_start(ap, errfmt);
+		vfprintf(stderr, errfmt, ap);
+		va_end(ap);
+		fprintf(stderr, "\n");
+	}
+	fprintf(stderr, "\
+Usage: %s [-v] [-b benchtime] [-c count] [-d directory] [filter]\n\
+Options:\n\
+	-b benchtime: Run each benchmark for a while, e.g., 3s\n\
+		      (default: %ds).\n\
+	-c count: Run each benchmark a number of times (default: %d).\n\
+	-d directory: Build a database in a directory, which is\n\
+		      left after a run (default: a temporary one).\n\
+	-v: Increment verbosity (can be specified 7 times at maximum).\n\
+	filter: Run only benchmarks of which names contain a filter.\n\
+",
+	    pname, KCNDB_BENCH_TIME_DEFAULT, KCNDB_BENCH_COUNT_DEFAULT);
+	exit(EXIT_FAILURE);
+}
@@ -0,0 +1,201 @@
+/*
+ * capture of received messages to replay a real load later.
+ *
+ * a capture file consists of a header of "KCNC" and a version in two
+ * octets, and following entries in network byte order:
+ *
+ *	time(8) session(4) length(2) message
+ *
+ * where time is in usec since the epoch, and a message is a whole frame
+ * with its header as received.  an entry of length 0 marks a session
+ * closed.  entries are buffered, and written when a buffer is full, a
+ * second passes or a session is closed.  a file is appended if exists.
+ *
+ * XXX: entries buffered are lost when kcndbd is killed.
+ */
+#include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <pthread.h>
+
+#include "kcn.h"
+#include "kcn_eq.h"
+#include "kcn_log.h"
+#include "kcn_buf.h"
+#include "kcn_msg.h"
+
+#include "kcndb_format.h"
+#include "kcndb_capture.h"
+
+#define KCNDB_CAPTURE_BUFSIZ		(64 * 1024)
+#define KCNDB_CAPTURE_FLUSH_INTERVAL	1000000ULL	/* usec */
+
+static int kcndb_capture_fd = -1;	/* written with a mutex held */
+static pthread_mutex_t kcndb_capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t kcndb_capture_nsessions;
+static struct kcn_buf kcndb_capture_kb;
+static uint64_t kcndb_capture_flushed;
+
+static uint64_t
+kcndb_capture_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* only a hint without a mutex, which is checked again with it held. */
+static bool
+kcndb_capture_enabled(void)
+{
+
+	return __atomic_load_n(&kcndb_capture_fd, __ATOMIC_RELAXED) != -1;
+}
+
+/* the caller must hold a mutex. */
+static void
+kcndb_capture_flush(uint64_t now)
+{
+	struct kcn_buf *kb = &kcndb_capture_kb;
+	const uint8_t *p;
+	size_t len;
+	ssize_t n;
+
+	kcndb_capture_flushed = now;
+	for (p = kcn_buf_head(kb), len = kcn_buf_len(kb); len > 0;
+	    p += n, len -= n) {
+		n = write(kcndb_capture_fd, p, len);
+		if (n == -1 && errno == EINTR)
+			n = 0;
+		else if (n == -1) {
+			KCN_LOG(ERR, "cannot write capture, and stop "
+			    "capturing: %s", strerror(errno));
+			(void)close(kcndb_capture_fd);
+			__atomic_store_n(&kcndb_capture_fd, -1,
+			    __ATOMIC_RELAXED);
+			break;
+		}
+	}
+	kcn_buf_reset(kb, 0);
+}
+
+bool
+kcndb_capture_open(const char *path)
+{
+	struct kcn_buf_data *kbd;
+	uint8_t hdr[KCNDB_CAPTURE_HDRSIZ];
+	struct stat st;
+	int fd;
+
+	kbd = NULL;
+	fd = open(path, O_RDWR | O_APPEND | O_CREAT, 0600);
+	if (fd == -1)
+		goto bad;
+	if (fstat(fd, &st) == -1)
+		goto bad;
+	if (st.st_size != 0 &&
+	    (pread(fd, hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+	     memcmp(hdr, KCNDB_CAPTURE_MAGIC, 4) != 0 ||
+	     (hdr[4] << 8 | hdr[5]) != KCNDB_CAPTURE_VERSION)) {
+		errno = EINVAL;
+		goto bad;
+	}
+	kbd = kcn_buf_data_new(KCNDB_CAPTURE_BUFSIZ);
+	if (kbd == NULL)
+		goto bad;
+	(void)pthread_mutex_lock(&kcndb_capture_mutex);
+	kcn_buf_init(&kcndb_capture_kb, kbd);
+	kcn_buf_reset(&kcndb_capture_kb, 0);
+	__atomic_store_n(&kcndb_capture_fd, fd, __ATOMIC_RELAXED);
+	if (st.st_size == 0) {
+		kcn_buf_put(&kcndb_capture_kb, KCNDB_CAPTURE_MAGIC, 4);
+		kcn_buf_put16(&kcndb_capture_kb, KCNDB_CAPTURE_VERSION);
+		kcndb_capture_flush(kcndb_capture_now());
+	}
+	kcndb_capture_flushed = kcndb_capture_now();
+	fd = kcndb_capture_fd;
+	(void)pthread_mutex_unlock(&kcndb_capture_mutex);
+	if (fd == -1)
+		return false;
+	KCN_LOG(INFO, "capture messages to %s", path);
+	return true;
+  bad:
+	if (fd != -1)
+		(void)close(fd);
+	kcn_buf_data_destroy(kbd);
+	return false;
+}
+
+uint32_t
+kcndb_capture_session_new(void)
+{
+	uint32_t session;
+
+	if (! kcndb_capture_enabled())
+		return 0;
+	(void)pthread_mutex_lock(&kcndb_capture_mutex);
+	session = kcndb_capture_fd == -1 ? 0 : ++kcndb_capture_nsessions;
+	(void)pthread_mutex_unlock(&kcndb_capture_mutex);
+	return session;
+}
+
+static void
+kcndb_capture_entry(uint32_t session, const struct kcn_msg_header *kmh,
+    const void *body)
+{
+	struct kcn_buf *kb = &kcndb_capture_kb;
+	uint64_t now;
+	size_t len;
+
+	len = KCNDB_CAPTURE_ENTRYHDRSIZ;
+	if (kmh != NULL)
+		len += KCN_MSG_HDRSIZ + kmh->kmh_len;
+	(void)pthread_mutex_lock(&kcndb_capture_mutex);
+	if (kcndb_capture_fd == -1)
+		goto out;
+	now = kcndb_capture_now();
+	if (kcn_buf_len(kb) + len > KCNDB_CAPTURE_BUFSIZ)
+		kcndb_capture_flush(now);
+	kcn_buf_put64(kb, now);
+	kcn_buf_put32(kb, session);
+	if (kmh != NULL) {
+		kcn_buf_put16(kb, KCN_MSG_HDRSIZ + kmh->kmh_len);
+		kcn_buf_put8(kb, kmh->kmh_version);
+		kcn_buf_put8(kb, kmh->kmh_type);
+		kcn_buf_put16(kb, kmh->kmh_len);
+		kcn_buf_put(kb, body, kmh->kmh_len);
+	} else
+		kcn_buf_put16(kb, 0);
+	if (kmh == NULL ||
+	    now - kcndb_capture_flushed >= KCNDB_CAPTURE_FLUSH_INTERVAL)
+		kcndb_capture_flush(now);
+  out:
+	(void)pthread_mutex_unlock(&kcndb_capture_mutex);
+}
+
+void
+kcndb_capture_msg(uint32_t session, const struct kcn_msg_header *kmh,
+    const void *body)
+{
+
+	if (! kcndb_capture_enabled())
+		return;
+	kcndb_capture_entry(session, kmh, body);
+}
+
+void
+kcndb_capture_session_end(uint32_t session)
+{
+
+	if (! kcndb_capture_enabled())
+		return;
+	kcndb_capture_entry(session, NULL, NULL);
+}
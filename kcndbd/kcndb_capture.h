@@ -0,0 +1,6 @@
+struct kcn_msg_header;
+
+bool kcndb_capture_open(const char *);
+uint32_t kcndb_capture_session_new(void);
+void kcndb_capture_msg(uint32_t, const struct kcn_msg_header *, const void *);
+void kcndb_capture_session_end(uint32_t);
@@ -1,4 +1,6 @@
 #include <sys/param.h>	/* MAXPATHLEN */
+#include <sys/queue.h>
+#include <sys/stat.h>
 
 #include <assert.h>
 #include <errno.h>
@@ -8,6 +10,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <pthread.h>
 
@@ -16,47 +20,229 @@
 #include "kcn_eq.h"
 #include "kcn_log.h"
 #include "kcn_buf.h"
+#include "kcn_time.h"
 
 #include "kcndb_file.h"
+#include "kcndb_agg.h"
+#include "kcndb_post.h"
+#include "kcndb_rra.h"
+#include "kcndb_tomb.h"
+#include "kcndb_format.h"
 #include "kcndb_db.h"
+#include "kcndb_stats.h"
 
 #define	TYPE2INDEX(t)	((t) - 1)
 
+#define KCNDB_DB_NAMELEN	32
+
+/* a table, or a shard of a table. */
 struct kcndb_db_table {
 	enum kcn_eq_type kdt_type;
-	struct kcndb_file *kdt_loc;
+	unsigned int kdt_shard;
+	struct kcndb_db_base *kdt_base;
+	char kdt_name[KCNDB_DB_NAMELEN];
 	struct kcndb_file *kdt_table;
 };
 
 struct kcndb_db {
-	struct kcndb_db_table *kd_tables[KCN_EQ_TYPE_MAX - 1];
+	pthread_mutex_t kd_lock;	/* held during an operation */
+	LIST_ENTRY(kcndb_db) kd_chain;
+	unsigned long kd_generation;
+	struct kcndb_file *kd_loc;
+	struct kcndb_db_table
+	    *kd_tables[KCN_EQ_TYPE_MAX - 1][KCNDB_DB_SHARD_MAX];
+};
+
+struct kcndb_db_aggregate {
+	struct kcndb_db *kda_kd;
+	bool (*kda_cb)(const struct kcndb_db_record *, size_t, void *);
+	void *kda_arg;
+	size_t kda_n;
+};
+
+struct kcndb_db_join {
+	struct kcndb_db *kdj_kd;
+	const struct kcn_eq *kdj_kes;
+	struct kcndb_agg **kdj_kas;
+	size_t kdj_neqs;
+	size_t kdj_driver;
+	size_t kdj_maxnlocs;
+	bool (*kdj_cb)(const struct kcndb_db_record *, size_t, void *);
+	void *kdj_arg;
+	size_t kdj_n;
 };
 
 struct kcndb_db_base {
-	size_t kdb_locsize;
 	size_t kdb_tablesize;
+	struct kcndb_post *kdb_post;
+	struct kcndb_rra *kdb_rra;
+	bool kdb_dirty;
+	size_t kdb_ckptsize;	/* table size covered by a checkpoint */
+	uint64_t kdb_rewrites;	/* times records were rewritten */
+	struct kcndb_db_record *kdb_reorder;	/* sorted in time order */
+	size_t kdb_nreorder;
+	time_t kdb_reorderlast;	/* when the last record was added */
+	struct kcndb_db_record *kdb_late;	/* sorted in time order */
+	size_t kdb_nlate;
+	size_t kdb_latemax;
+	struct kcndb_tomb *kdb_tomb;	/* indexed tombstones */
+	size_t kdb_ntombs;
 	pthread_rwlock_t kdb_lock;
 };
 
-#define KCNDB_DB_BASE_INITIALIZER	{ 0, 0, PTHREAD_RWLOCK_INITIALIZER }
+/* records of a locator, or of all locators if 0, in a time range. */
+struct kcndb_db_tomb {
+	uint64_t kdtb_locidx;
+	time_t kdtb_start;
+	time_t kdtb_end;
+};
+
+struct kcndb_db_loc_map {
+	uint64_t kdlm_oidx;
+	uint64_t kdlm_idx;
+};
+
+struct kcndb_db_loc_entry {
+	uint64_t kdle_idx;
+	uint64_t kdle_next;
+	size_t kdle_len;
+	unsigned int kdle_hash;
+	bool kdle_linked;
+};
 
 static const char *kcndb_db_path = KCN_DB_PATH;
 
-static struct kcndb_db_base kcndb_db_base[KCN_EQ_TYPE_MAX - 1] = {
-	[TYPE2INDEX(KCN_EQ_TYPE_STORAGE)]	= KCNDB_DB_BASE_INITIALIZER,
-	[TYPE2INDEX(KCN_EQ_TYPE_CPULOAD)]	= KCNDB_DB_BASE_INITIALIZER,
-	[TYPE2INDEX(KCN_EQ_TYPE_TRAFFIC)]	= KCNDB_DB_BASE_INITIALIZER,
-	[TYPE2INDEX(KCN_EQ_TYPE_RTT)]		= KCNDB_DB_BASE_INITIALIZER,
-	[TYPE2INDEX(KCN_EQ_TYPE_HOPCOUNT)]	= KCNDB_DB_BASE_INITIALIZER,
-	[TYPE2INDEX(KCN_EQ_TYPE_ASPATHLEN)]	= KCNDB_DB_BASE_INITIALIZER,
-	[TYPE2INDEX(KCN_EQ_TYPE_WLANASSOC)]	= KCNDB_DB_BASE_INITIALIZER
+/*
+ * a table of each type is partitioned into shards by locators so that
+ * records of different locators can be added in parallel.  each shard has
+ * its own file, lock and indexes, and is kept sorted in time order.  a
+ * shard 0 is stored in a file named by a type, and others are suffixed by
+ * their numbers.  shards found beyond a configured number are still read
+ * while no record is added to them.
+ */
+static struct kcndb_db_base kcndb_db_base[KCN_EQ_TYPE_MAX - 1]
+    [KCNDB_DB_SHARD_MAX];
+static unsigned int kcndb_db_nshards = 1;
+static unsigned int kcndb_db_ntables[KCN_EQ_TYPE_MAX - 1];
+static pthread_once_t kcndb_db_once = PTHREAD_ONCE_INIT;
+
+/*
+ * a locator dictionary is shared by all tables, and an index of a locator,
+ * i.e., an offset of its entry, is stable and comparable across tables.
+ * a lock of the dictionary must be acquired after that of a table if both
+ * are necessary.
+ */
+static size_t kcndb_db_locsize;
+static pthread_rwlock_t kcndb_db_loclock = PTHREAD_RWLOCK_INITIALIZER;
+
+/*
+ * dirty flags of files to be flushed on sync, protected by a mutex
+ * instead of table locks so that a syncer does not block readers.
+ */
+static enum kcndb_db_durability kcndb_db_durability =
+    KCNDB_DB_DURABILITY_NONE;
+static unsigned int kcndb_db_sync_interval;	/* msec */
+static bool kcndb_db_locdirty;
+static pthread_mutex_t kcndb_db_dirty_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* a database whose files hold locked regions while a server runs. */
+static struct kcndb_db *kcndb_db_warm;
+
+/*
+ * a checkpoint of in-memory indexes of a table begins with a header below,
+ * and is followed by snapshots of posting lists and archives.  the last
+ * record covered is kept to detect a table rewritten or truncated later.
+ */
+#define KCNDB_DB_CHECKPOINT_MAGIC	0x4b434e4b	/* "KCNK" */
+#define KCNDB_DB_CHECKPOINT_VERSION	1
+#define KCNDB_DB_CHECKPOINT_HDRSIZ					\
+	(sizeof(uint32_t) * 2 + sizeof(uint64_t) + KCNDB_DB_RECORDSIZ)
+
+static unsigned int kcndb_db_checkpoint_interval =
+    KCNDB_DB_CHECKPOINT_INTERVAL_DEFAULT;	/* sec */
+
+/*
+ * records within a window behind the newest one of a shard are held in
+ * memory, and are not visible to searches until they are written.
+ */
+#define KCNDB_DB_REORDER_MAX	4096	/* records per shard */
+static unsigned int kcndb_db_reorder_window;	/* sec */
+
+/*
+ * a record older than the window is merged into a table by rewriting
+ * records after it, which are limited so that a merge stays cheap.  a
+ * merged tail is logged before a rewrite, and the log begins with a header
+ * below followed by records.  a record farther behind is appended to a
+ * late segment of a shard instead, which is held in memory in time order
+ * and is folded into a table by a compaction or an attachment.
+ */
+#define KCNDB_DB_MERGE_MAX	65536	/* records rewritten */
+#define KCNDB_DB_MERGE_MAGIC	0x4b434e4d	/* "KCNM" */
+#define KCNDB_DB_MERGE_HDRSIZ	(sizeof(uint32_t) + sizeof(uint64_t))
+
+/*
+ * deleted records are hidden by tombstones until a compactor rewrites
+ * tables and the dictionary without them, by which late records are also
+ * folded into tables.  since a compaction renumbers indexes of locators
+ * and replaces files, a database reopens its files when their generation
+ * is changed.  an operation on a database holds its own lock, which is
+ * used by one thread and is not contended but by an exclusive section, in
+ * which locks of all databases are held.  files are rewritten aside
+ * without the exclusive section, which is held only to catch up with
+ * records added meanwhile and to replace files.
+ */
+static unsigned int kcndb_db_compact_interval =
+    KCNDB_DB_COMPACT_INTERVAL_DEFAULT;	/* sec */
+static LIST_HEAD(, kcndb_db) kcndb_db_list =
+    LIST_HEAD_INITIALIZER(kcndb_db_list);
+static pthread_mutex_t kcndb_db_listlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t kcndb_db_rewritelock =
+    PTHREAD_MUTEX_INITIALIZER;	/* serializes compactions and attachments */
+static unsigned long kcndb_db_generation;
+
+/*
+ * attachments are requested to the compactor thread so that server threads
+ * go on serving other sessions while tables are rewritten.  a requester is
+ * called back in the thread when an attachment completes.
+ */
+struct kcndb_db_attach_req {
+	STAILQ_ENTRY(kcndb_db_attach_req) kdar_chain;
+	void (*kdar_cb)(int, void *);
+	void *kdar_arg;
+	char kdar_dir[MAXPATHLEN];
 };
+static STAILQ_HEAD(, kcndb_db_attach_req) kcndb_db_attach_reqs =
+    STAILQ_HEAD_INITIALIZER(kcndb_db_attach_reqs);
+static pthread_mutex_t kcndb_db_attach_reqlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kcndb_db_attach_reqcond = PTHREAD_COND_INITIALIZER;
+static bool kcndb_db_compactor_running;
 
 static void kcndb_db_table_close(struct kcndb_db_table *);
-static bool kcndb_db_loc_init(struct kcndb_db_table *);
+static bool kcndb_db_loc_open(struct kcndb_db *);
+static struct kcndb_db_table *kcndb_db_table_open(struct kcndb_db *,
+    enum kcn_eq_type, unsigned int);
+static bool kcndb_db_loc_rdlock(void);
+static void kcndb_db_loc_unlock(void);
+static bool kcndb_db_record_read_at(struct kcndb_db_table *, uint64_t,
+    struct kcndb_db_record *);
+static size_t kcndb_db_table_size(const struct kcndb_db_table *);
+static bool kcndb_db_loc_add(struct kcndb_db *, const char *, size_t,
+    uint64_t *, bool *);
+static bool kcndb_db_record_read(struct kcndb_file *,
+    struct kcndb_db_record *);
+static bool kcndb_db_merge_recover(struct kcndb_db_table *);
+static void kcndb_db_compact_recover(void);
+
+static void
+kcndb_db_table_name(char *name, size_t len, enum kcn_eq_type type,
+    unsigned int shard)
+{
+
+	kcndb_format_table_name(name, len, type, shard);
+}
 
 static struct kcndb_db_table *
-kcndb_db_table_new(enum kcn_eq_type type)
+kcndb_db_table_new(enum kcn_eq_type type, unsigned int shard)
 {
 	struct kcndb_db_table *kdt;
 
@@ -64,7 +250,9 @@ kcndb_db_table_new(enum kcn_eq_type type)
 	if (kdt == NULL)
 		return NULL;
 	kdt->kdt_type = type;
-	kdt->kdt_loc = NULL;
+	kdt->kdt_shard = shard;
+	kdt->kdt_base = &kcndb_db_base[TYPE2INDEX(type)][shard];
+	kcndb_db_table_name(kdt->kdt_name, sizeof(kdt->kdt_name), type, shard);
 	kdt->kdt_table = NULL;
 	return kdt;
 }
@@ -92,441 +280,4394 @@ kcndb_db_path_get(void)
 	return kcndb_db_path;
 }
 
-static bool
-kcndb_db_init(struct kcndb_db_table *kdt)
-{
-	struct kcndb_db_base *kdb;
-
-	kdb = &kcndb_db_base[TYPE2INDEX(kdt->kdt_type)];
-	if (kdb->kdb_locsize == 0 &&
-	    ! kcndb_file_size_get(kdt->kdt_loc, &kdb->kdb_locsize))
-		return false;
-	if (kdb->kdb_tablesize == 0 &&
-	    ! kcndb_file_size_get(kdt->kdt_table, &kdb->kdb_tablesize))
-		return false;
-	if (! kcndb_db_loc_init(kdt))
-		return false;
-	return true;
-}
-
-static size_t
-kcndb_db_loc_size(const struct kcndb_db_table *kdt)
+void
+kcndb_db_shards_set(unsigned int nshards)
 {
 
-	return kcndb_db_base[TYPE2INDEX(kdt->kdt_type)].kdb_locsize;
+	assert(nshards > 0 && nshards <= KCNDB_DB_SHARD_MAX);
+	kcndb_db_nshards = nshards;
 }
 
 static void
-kcndb_db_loc_size_increment(const struct kcndb_db_table *kdt, size_t size)
+kcndb_db_base_init(void)
 {
+	enum kcn_eq_type type;
+	char name[KCNDB_DB_NAMELEN], path[MAXPATHLEN];
+	unsigned int i;
+	int idx, error;
 
-	kcndb_db_base[TYPE2INDEX(kdt->kdt_type)].kdb_locsize += size;
+	kcndb_db_compact_recover();
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		idx = TYPE2INDEX(type);
+		kcndb_db_ntables[idx] = kcndb_db_nshards;
+		for (i = 0; i < KCNDB_DB_SHARD_MAX; i++) {
+			error = pthread_rwlock_init(
+			    &kcndb_db_base[idx][i].kdb_lock, NULL);
+			if (error != 0)
+				KCN_LOG(EMERG, "cannot initialize lock: %s",
+				    strerror(error));
+			assert(error == 0);
+			kcndb_db_table_name(name, sizeof(name), type, i);
+			(void)snprintf(path, sizeof(path), "%s/%s",
+			    kcndb_db_path, name);
+			if (i >= kcndb_db_nshards && access(path, F_OK) == 0)
+				kcndb_db_ntables[idx] = i + 1;
+		}
+		if (kcndb_db_ntables[idx] > kcndb_db_nshards)
+			KCN_LOG(WARN, "%s: %u shard(s) found while %u "
+			    "configured", kcn_eq_type_ntoa(type),
+			    kcndb_db_ntables[idx], kcndb_db_nshards);
+	}
 }
 
-static size_t
-kcndb_db_table_size(const struct kcndb_db_table *kdt)
+/* a shard to which records of a locator are added. */
+static unsigned int
+kcndb_db_shard(uint64_t locidx)
 {
 
-	return kcndb_db_base[TYPE2INDEX(kdt->kdt_type)].kdb_tablesize;
+	return kcndb_format_shard(locidx, kcndb_db_nshards);
 }
 
 static void
-kcndb_db_table_size_increment(const struct kcndb_db_table *kdt, size_t size)
+kcndb_db_checkpoint_path(char *path, size_t len,
+    const struct kcndb_db_table *kdt, const char *suffix)
 {
 
-	kcndb_db_base[TYPE2INDEX(kdt->kdt_type)].kdb_tablesize += size;
+	(void)snprintf(path, len, "%s/%s%s", kcndb_db_path, kdt->kdt_name,
+	    suffix);
 }
 
-static bool
-kcndb_db_rdlock(const struct kcndb_db_table *kdt)
+/*
+ * load a checkpoint into empty indexes, and return a table offset from
+ * which records must be replayed, or 0 if no valid checkpoint exists.
+ */
+static uint64_t
+kcndb_db_checkpoint_load(struct kcndb_db_table *kdt, struct kcndb_post *kp,
+    struct kcndb_rra *kra)
 {
-	struct kcndb_db_base *kdb = &kcndb_db_base[TYPE2INDEX(kdt->kdt_type)];
-	int error;
+	struct kcndb_file *kf;
+	struct kcn_buf *kb;
+	struct kcndb_db_record kdr;
+	char path[MAXPATHLEN];
+	const char *name;
+	struct stat st;
+	uint64_t off, t, val, locidx;
+	bool rc;
 
-	error = pthread_rwlock_rdlock(&kdb->kdb_lock);
-	if (error != 0) {
-		errno = error;
-		KCN_LOG(ERR, "database read lock error: %s", strerror(errno));
+	name = kdt->kdt_name;
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_CHECKPOINT_SUFFIX);
+	if (stat(path, &st) == -1)
+		return 0;
+	kf = kcndb_file_open(path);
+	if (kf == NULL)
+		return 0;
+	rc = false;
+	off = 0;
+	kb = kcndb_file_buf(kf);
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_ensure(kf, KCNDB_DB_CHECKPOINT_HDRSIZ))
+		goto out;
+	if (kcn_buf_get32(kb) != KCNDB_DB_CHECKPOINT_MAGIC ||
+	    kcn_buf_get32(kb) != KCNDB_DB_CHECKPOINT_VERSION) {
+		errno = EINVAL;
+		goto out;
 	}
-	return error == 0 ? true : false;
+	off = kcn_buf_get64(kb);
+	t = kcn_buf_get64(kb);
+	val = kcn_buf_get64(kb);
+	locidx = kcn_buf_get64(kb);
+	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	if (off % KCNDB_DB_RECORDSIZ != 0 ||
+	    off > kcndb_db_table_size(kdt)) {
+		errno = ERANGE;
+		goto out;
+	}
+	if (off > 0) {
+		if (! kcndb_db_record_read_at(kdt, off - KCNDB_DB_RECORDSIZ,
+		    &kdr))
+			goto out;
+		if ((uint64_t)kdr.kdr_time != t || kdr.kdr_val != val ||
+		    kdr.kdr_locidx != locidx) {
+			errno = ESTALE;
+			goto out;
+		}
+	}
+	if (! kcndb_post_load(kp, kf, off) || ! kcndb_rra_load(kra, kf))
+		goto out;
+	rc = true;
+  out:
+	if (! rc) {
+		KCN_LOG(WARN, "%s: ignore checkpoint: %s", name,
+		    errno == ESHUTDOWN ? "truncated" : strerror(errno));
+		off = 0;
+	}
+	kcndb_file_close(kf);
+	return off;
 }
 
+/*
+ * build posting lists and archives of a table from a checkpoint, if any,
+ * and records appended after the checkpoint.
+ */
 static bool
-kcndb_db_wrlock(const struct kcndb_db_table *kdt)
+kcndb_db_index_init(struct kcndb_db_table *kdt)
 {
-	struct kcndb_db_base *kdb = &kcndb_db_base[TYPE2INDEX(kdt->kdt_type)];
-	int error;
+	struct kcndb_db_base *kdb;
+	struct kcndb_post *kp;
+	struct kcndb_rra *kra;
+	struct kcndb_db_record kdr;
+	uint64_t off, start;
 
-	error = pthread_rwlock_wrlock(&kdb->kdb_lock);
-	if (error != 0) {
-		errno = error;
-		KCN_LOG(ERR, "database write lock error: %s", strerror(errno));
+	kdb = kdt->kdt_base;
+	kp = kcndb_post_new();
+	kra = kcndb_rra_new();
+	if (kp == NULL || kra == NULL)
+		goto bad;
+	start = kcndb_db_checkpoint_load(kdt, kp, kra);
+	if (start == 0) {
+		/* a partially loaded checkpoint must be discarded. */
+		kcndb_post_destroy(kp);
+		kcndb_rra_destroy(kra);
+		kp = kcndb_post_new();
+		kra = kcndb_rra_new();
+		if (kp == NULL || kra == NULL)
+			goto bad;
 	}
-	return error == 0 ? true : false;
+	kdb->kdb_ckptsize = start;
+	if (! kcndb_file_seek_head(kdt->kdt_table, start))
+		goto bad;
+	kcn_buf_reset(kcndb_file_buf(kdt->kdt_table), 0);
+	for (off = start;; off += KCNDB_DB_RECORDSIZ) {
+		if (! kcndb_db_record_read(kdt->kdt_table, &kdr)) {
+			if (errno == ESHUTDOWN)
+				break;
+			goto bad;
+		}
+		if (! kcndb_post_add(kp, kdr.kdr_locidx, off) ||
+		    ! kcndb_rra_add(kra, kdr.kdr_locidx, kdr.kdr_time,
+		    kdr.kdr_val))
+			goto bad;
+	}
+	KCN_LOG(INFO, "%s: %llu record(s) indexed, %llu from checkpoint",
+	    kdt->kdt_name,
+	    (unsigned long long)(off / KCNDB_DB_RECORDSIZ),
+	    (unsigned long long)(start / KCNDB_DB_RECORDSIZ));
+	kdb->kdb_post = kp;
+	kdb->kdb_rra = kra;
+	return true;
+  bad:
+	KCN_LOG(ERR, "%s: cannot index records: %s",
+	    kdt->kdt_name, strerror(errno));
+	kcndb_post_destroy(kp);
+	kcndb_rra_destroy(kra);
+	return false;
 }
 
-static void
-kcndb_db_unlock(const struct kcndb_db_table *kdt)
+/*
+ * a torn append leaves a partial record at the tail, and records appended
+ * after the last flushed locator may refer to a lost locator.  both are
+ * truncated since they are at the tail.
+ */
+static bool
+kcndb_db_table_recover(struct kcndb_db_table *kdt)
 {
-	struct kcndb_db_base *kdb = &kcndb_db_base[TYPE2INDEX(kdt->kdt_type)];
-	int error;
+	struct kcndb_db_base *kdb;
+	struct kcndb_db_record kdr;
+	const char *name;
+	size_t size, locsize;
 
-	error = pthread_rwlock_unlock(&kdb->kdb_lock);
-	if (error != 0) {
-		errno = error;
-		KCN_LOG(ERR, "database unlock failed: %s", strerror(errno));
+	kdb = kdt->kdt_base;
+	name = kdt->kdt_name;
+	size = kdb->kdb_tablesize - kdb->kdb_tablesize % KCNDB_DB_RECORDSIZ;
+	if (size != kdb->kdb_tablesize)
+		KCN_LOG(WARN, "%s: truncate torn record of %zu byte(s)", name,
+		    kdb->kdb_tablesize - size);
+	if (! kcndb_db_loc_rdlock())
+		return false;
+	locsize = kcndb_db_locsize;
+	kcndb_db_loc_unlock();
+	while (size >= KCNDB_DB_RECORDSIZ) {
+		if (! kcndb_db_record_read_at(kdt, size - KCNDB_DB_RECORDSIZ,
+		    &kdr))
+			return false;
+		if (kdr.kdr_locidx >= KCNDB_DB_LOC_INDEXTABLESIZ &&
+		    kdr.kdr_locidx < locsize)
+			break;
+		KCN_LOG(WARN, "%s: truncate record of lost locator %llu",
+		    name, (unsigned long long)kdr.kdr_locidx);
+		size -= KCNDB_DB_RECORDSIZ;
 	}
+	if (size == kdb->kdb_tablesize)
+		return true;
+	if (! kcndb_file_truncate(kdt->kdt_table, size))
+		return false;
+	kdb->kdb_tablesize = size;
+	return true;
 }
 
-static struct kcndb_db_table *
-kcndb_db_table_open(enum kcn_eq_type type)
+/*
+ * read up to nmax tombstones of a table into a new index, or return NULL
+ * in *ktp if none.  tombstones are only appended, and those counted are
+ * read without a lock.
+ */
+static bool
+kcndb_db_tomb_read(struct kcndb_db_table *kdt, size_t nmax,
+    struct kcndb_tomb **ktp, size_t *np)
 {
-	struct kcndb_db_table *kdt;
-	const char *name;
+	struct kcndb_db_tomb kdtb;
+	struct kcndb_tomb *kt;
+	struct kcndb_file *kf;
+	struct kcn_buf *kb;
 	char path[MAXPATHLEN];
+	size_t i, n, size;
 	bool rc;
 
-	name = kcn_eq_type_ntoa(type);
-	if (name == NULL) {
-		errno = ENOENT;
-		KCN_LOG(DEBUG, "unknown database type: %hu", type);
-		return NULL;
+	*ktp = NULL;
+	*np = 0;
+	if (nmax == 0)
+		return true;
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_TOMB_SUFFIX);
+	if (access(path, F_OK) == -1)
+		return errno == ENOENT ? true : false;
+	kf = kcndb_file_open(path);
+	if (kf == NULL)
+		return false;
+	kt = NULL;
+	rc = false;
+	if (! kcndb_file_size_get(kf, &size))
+		goto out;
+	/* a torn tombstone at the tail is ignored. */
+	n = size / KCNDB_DB_TOMBSIZ;
+	if (n > nmax)
+		n = nmax;
+	kt = kcndb_tomb_new();
+	if (kt == NULL)
+		goto out;
+	kb = kcndb_file_buf(kf);
+	kcn_buf_reset(kb, 0);
+	for (i = 0; i < n; i++) {
+		if (! kcndb_file_ensure(kf, KCNDB_DB_TOMBSIZ))
+			goto out;
+		kdtb.kdtb_locidx = kcn_buf_get64(kb);
+		kdtb.kdtb_start = kcn_buf_get64(kb);
+		kdtb.kdtb_end = kcn_buf_get64(kb);
+		kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+		if (! kcndb_tomb_add(kt, kdtb.kdtb_locidx, kdtb.kdtb_start,
+		    kdtb.kdtb_end))
+			goto out;
 	}
+	*ktp = kt;
+	*np = n;
+	kt = NULL;
+	rc = true;
+  out:
+	kcndb_tomb_destroy(kt);
+	kcndb_file_close(kf);
+	return rc;
+}
 
-	kdt = kcndb_db_table_new(type);
-	if (kdt == NULL) {
-		KCN_LOG(DEBUG, "cannot allocate table structure");
-		return NULL;
-	}
+static bool
+kcndb_db_tomb_load(struct kcndb_db_table *kdt)
+{
+	struct kcndb_db_base *kdb;
+	struct kcndb_tomb *kt;
+	size_t n;
 
-	(void)snprintf(path, sizeof(path), "%s/%s%s",
-	    kcndb_db_path, name, KCNDB_DB_PATH_LOC_SUFFIX);
-	kdt->kdt_loc = kcndb_file_open(path);
-	if (kdt->kdt_loc == NULL)
-		goto bad;
+	kdb = kdt->kdt_base;
+	if (! kcndb_db_tomb_read(kdt, SIZE_MAX, &kt, &n))
+		return false;
+	kcndb_tomb_destroy(kdb->kdb_tomb);
+	kdb->kdb_tomb = kt;
+	kdb->kdb_ntombs = n;
+	if (n > 0)
+		KCN_LOG(INFO, "%s: %zu tombstone(s) loaded", kdt->kdt_name, n);
+	return true;
+}
 
-	(void)snprintf(path, sizeof(path), "%s/%s", kcndb_db_path, name);
-	kdt->kdt_table = kcndb_file_open(path);
-	if (kdt->kdt_table == NULL)
-		goto bad;
+/* the caller must hold a write lock. */
+static bool
+kcndb_db_tomb_add(struct kcndb_db_table *kdt,
+    const struct kcndb_db_tomb *kdtb)
+{
+	struct kcndb_db_base *kdb;
+	struct kcndb_file *kf;
+	struct kcn_buf *kb;
+	char path[MAXPATHLEN];
+	bool rc;
 
-	if (! kcndb_db_wrlock(kdt))
-		goto bad;
-	rc = kcndb_db_init(kdt);
-	kcndb_db_unlock(kdt);
+	kdb = kdt->kdt_base;
+	if (kdb->kdb_tomb == NULL) {
+		kdb->kdb_tomb = kcndb_tomb_new();
+		if (kdb->kdb_tomb == NULL)
+			return false;
+	}
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_TOMB_SUFFIX);
+	kf = kcndb_file_open(path);
+	if (kf == NULL)
+		return false;
+	kb = kcndb_file_buf(kf);
+	kcn_buf_reset(kb, 0);
+	kcn_buf_put64(kb, kdtb->kdtb_locidx);
+	kcn_buf_put64(kb, kdtb->kdtb_start);
+	kcn_buf_put64(kb, kdtb->kdtb_end);
+	rc = kcndb_file_append(kf) && kcndb_file_sync(kf);
+	kcndb_file_close(kf);
 	if (! rc)
-		goto bad;
-	return kdt;
-  bad:
-	kcndb_db_table_close(kdt);
-	return NULL;
+		return false;
+	/*
+	 * tombstones saved are counted so that a compactor reads them.
+	 * XXX: a tombstone saved but not indexed takes effect after
+	 *	indexes are rebuilt, e.g., on restart.
+	 */
+	kdb->kdb_ntombs++;
+	return kcndb_tomb_add(kdb->kdb_tomb, kdtb->kdtb_locidx,
+	    kdtb->kdtb_start, kdtb->kdtb_end);
 }
 
-static void
-kcndb_db_table_close(struct kcndb_db_table *kdt)
+/* the caller must hold a lock. */
+static bool
+kcndb_db_tomb_match(const struct kcndb_db_table *kdt,
+    const struct kcndb_db_record *kdr)
 {
+	const struct kcndb_db_base *kdb = kdt->kdt_base;
 
-	if (kdt == NULL)
-		return;
-	kcndb_file_close(kdt->kdt_loc);
-	kcndb_file_close(kdt->kdt_table);
-	kcndb_db_table_destroy(kdt);
+	return kdb->kdb_ntombs > 0 &&
+	    kcndb_tomb_match(kdb->kdb_tomb, kdr->kdr_locidx, kdr->kdr_time);
 }
 
-static struct kcndb_db_table *
-kcndb_db_table_lookup(struct kcndb_db *kd, enum kcn_eq_type type)
+static int
+kcndb_db_late_cmp(const void *a0, const void *b0)
 {
+	const struct kcndb_db_record *a = a0, *b = b0;
 
-	return kd->kd_tables[TYPE2INDEX(type)];
+	return a->kdr_time < b->kdr_time ? -1 : a->kdr_time > b->kdr_time;
 }
 
+/*
+ * load a late segment of a table into memory in time order.  a torn
+ * record at the tail is ignored.
+ */
 static bool
-kcndb_db_loc_init(struct kcndb_db_table *kdt)
+kcndb_db_late_load(struct kcndb_db_table *kdt)
 {
+	struct kcndb_db_base *kdb;
+	struct kcndb_db_record *kdrs;
 	struct kcndb_file *kf;
-	struct kcn_buf *kb;
+	char path[MAXPATHLEN];
+	size_t i, n, size;
 	bool rc;
 
-	if (kcndb_db_loc_size(kdt) > 0)
-		return true;
-
-#define KCNDB_DB_LOC_HASHSIZ	256
-#define KCNDB_DB_LOC_INDEXSIZ	sizeof(uint64_t)
-#define KCNDB_DB_LOC_INDEXTABLESIZ					\
-	(KCNDB_DB_LOC_INDEXSIZ * KCNDB_DB_LOC_HASHSIZ)
-	kf = kdt->kdt_loc;
-	kb = kcndb_file_buf(kf);
-	kcn_buf_putnull(kb, KCNDB_DB_LOC_INDEXTABLESIZ);
-	rc = kcndb_file_append(kf);
-	if (rc)
-		kcndb_db_loc_size_increment(kdt, KCNDB_DB_LOC_INDEXTABLESIZ);
+	kdb = kdt->kdt_base;
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_LATE_SUFFIX);
+	if (access(path, F_OK) == -1)
+		return errno == ENOENT ? true : false;
+	kf = kcndb_file_open(path);
+	if (kf == NULL)
+		return false;
+	kdrs = NULL;
+	rc = false;
+	if (! kcndb_file_size_get(kf, &size))
+		goto out;
+	n = size / KCNDB_DB_RECORDSIZ;
+	if (n == 0) {
+		rc = true;
+		goto out;
+	}
+	kdrs = malloc(n * sizeof(*kdrs));
+	if (kdrs == NULL)
+		goto out;
+	kcn_buf_reset(kcndb_file_buf(kf), 0);
+	for (i = 0; i < n; i++) {
+		if (! kcndb_db_record_read(kf, &kdrs[i]))
+			goto out;
+		kdrs[i].kdr_loc = NULL;
+		kdrs[i].kdr_loclen = 0;
+	}
+	qsort(kdrs, n, sizeof(*kdrs), kcndb_db_late_cmp);
+	free(kdb->kdb_late);
+	kdb->kdb_late = kdrs;
+	kdb->kdb_nlate = kdb->kdb_latemax = n;
+	kdrs = NULL;
+	KCN_LOG(INFO, "%s: %zu late record(s) loaded", kdt->kdt_name, n);
+	rc = true;
+  out:
+	free(kdrs);
+	kcndb_file_close(kf);
 	return rc;
 }
 
+/*
+ * append records in time order to a late segment of a table, and insert
+ * them into memory after ones at the same time.  the caller must hold a
+ * write lock.
+ */
 static bool
-kcndb_db_loc_add(struct kcndb_db_table *kdt, const char *loc, size_t loclen,
-    uint64_t *idxp)
+kcndb_db_late_add(struct kcndb_db_table *kdt,
+    const struct kcndb_db_record *kdrs, size_t n)
 {
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	struct kcndb_db_record *late;
 	struct kcndb_file *kf;
-	unsigned int h;
 	struct kcn_buf *kb;
-	uint64_t idx, oidx;
-	size_t len;
+	char path[MAXPATHLEN];
+	size_t i, j, k, size, max;
+	bool rc;
 
-	kf = kdt->kdt_loc;
-	h = kcn_str_hash(loc, loclen, KCNDB_DB_LOC_HASHSIZ);
+	if (kdb->kdb_nlate + n > kdb->kdb_latemax) {
+		max = kdb->kdb_latemax == 0 ? KCNDB_DB_REORDER_MAX :
+		    kdb->kdb_latemax;
+		while (max < kdb->kdb_nlate + n)
+			max *= 2;
+		late = realloc(kdb->kdb_late, max * sizeof(*late));
+		if (late == NULL)
+			return false;
+		kdb->kdb_late = late;
+		kdb->kdb_latemax = max;
+	}
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_LATE_SUFFIX);
+	kf = kcndb_file_open(path);
+	if (kf == NULL)
+		return false;
+	rc = false;
+	if (! kcndb_file_size_get(kf, &size))
+		goto out;
+	/* a torn record at the tail is overwritten. */
+	if (size % KCNDB_DB_RECORDSIZ != 0 &&
+	    ! kcndb_file_truncate(kf, size - size % KCNDB_DB_RECORDSIZ))
+		goto out;
 	kb = kcndb_file_buf(kf);
 	kcn_buf_reset(kb, 0);
-	if (! kcndb_file_seek_head(kf, 0))
-		return false;
-	if (! kcndb_file_ensure(kf, KCNDB_DB_LOC_INDEXSIZ))
-		return false;
-	kcn_buf_forward(kb, KCNDB_DB_LOC_INDEXSIZ * h);
-	while ((idx = kcn_buf_get64(kb)) != 0) {
-		if (! kcndb_file_seek_head(kf, idx))
-			return false;
-		kcn_buf_reset(kb, 0);
-		if (! kcndb_file_ensure(kf, sizeof(uint16_t)))
-			return false;
-		len = kcn_buf_get16(kb);
-		if (! kcndb_file_ensure(kf, len + sizeof(uint64_t)))
-			return false;
-		if (loclen == len &&
-		    strncmp(kcn_buf_current(kb), loc, loclen) == 0)
+	for (i = 0; i < n; i++) {
+		if (! kcndb_file_reserve(kf, KCNDB_DB_RECORDSIZ))
 			goto out;
-		kcn_buf_forward(kb, len);
+		kcn_buf_put64(kb, kdrs[i].kdr_time);
+		kcn_buf_put64(kb, kdrs[i].kdr_val);
+		kcn_buf_put64(kb, kdrs[i].kdr_locidx);
 	}
-
-	oidx = idx + kcn_buf_headingdata(kb) - sizeof(idx);
-	idx = kcndb_db_loc_size(kdt);
-	kcn_buf_reset(kb, 0);
-	kcn_buf_put16(kb, loclen);
-	kcn_buf_put(kb, loc, loclen);
-	kcn_buf_put64(kb, 0);
-	len = kcn_buf_len(kb);
-	if (! kcndb_file_append(kf))
-		return false;
-	kcndb_db_loc_size_increment(kdt, len);
-
-	kcn_buf_put64(kb, idx);
-	if (! kcndb_file_seek_head(kf, oidx) || ! kcndb_file_write(kf))
-		return false;
+	rc = kcndb_file_append(kf) && kcndb_file_sync(kf);
   out:
-	*idxp = idx;
+	kcndb_file_close(kf);
+	if (! rc)
+		return false;
 
+	/* merge from the tail so that each record is moved once. */
+	i = kdb->kdb_nlate;
+	j = n;
+	for (k = i + j; j > 0; k--) {
+		if (i > 0 && kdb->kdb_late[i - 1].kdr_time >
+		    kdrs[j - 1].kdr_time) {
+			kdb->kdb_late[k - 1] = kdb->kdb_late[--i];
+			continue;
+		}
+		kdb->kdb_late[k - 1] = kdrs[--j];
+		kdb->kdb_late[k - 1].kdr_loc = NULL;
+		kdb->kdb_late[k - 1].kdr_loclen = 0;
+	}
+	kdb->kdb_nlate += n;
 	return true;
 }
 
 static bool
-kcndb_db_loc_lookup(struct kcndb_db_table *kdt, uint64_t idx,
-    const char **locp, size_t *loclenp)
+kcndb_db_init(struct kcndb_db_table *kdt)
 {
-	struct kcndb_file *kf = kdt->kdt_loc;
-	struct kcn_buf *kb = kcndb_file_buf(kf);
+	struct kcndb_db_base *kdb;
 
-	if (kcndb_db_loc_size(kdt) < idx) {
-		errno = ENXIO;
+	kdb = kdt->kdt_base;
+	if (kdb->kdb_post != NULL)
+		return true;
+	if (! kcndb_db_merge_recover(kdt))
 		return false;
-	}
-	kcn_buf_reset(kb, 0);
-	if (! kcndb_file_seek_head(kf, idx))
+	if (! kcndb_file_size_get(kdt->kdt_table, &kdb->kdb_tablesize))
 		return false;
-	if (! kcndb_file_ensure(kf, sizeof(uint16_t)))
+	if (! kcndb_db_table_recover(kdt))
 		return false;
-	*loclenp = kcn_buf_get16(kb);
-	if (! kcndb_file_ensure(kf, *loclenp))
+	if (! kcndb_db_index_init(kdt))
+		return false;
+	if (! kcndb_db_tomb_load(kdt))
+		return false;
+	if (! kcndb_db_late_load(kdt))
 		return false;
-	*locp = kcn_buf_current(kb);
 	return true;
 }
 
-static bool
-kcndb_db_record_read(struct kcndb_db_table *kdt, struct kcndb_db_record *kdr)
+static struct kcndb_post *
+kcndb_db_post(const struct kcndb_db_table *kdt)
 {
-	struct kcn_buf *kb = kcndb_file_buf(kdt->kdt_table);
 
-#define KCNDB_DB_RECORDSIZ	(8 + 8 + 8)
-	if (! kcndb_file_ensure(kdt->kdt_table, KCNDB_DB_RECORDSIZ))
-		return false;
+	return kdt->kdt_base->kdb_post;
+}
 
-	kdr->kdr_time = kcn_buf_get64(kb);
-	kdr->kdr_val = kcn_buf_get64(kb);
-	kdr->kdr_locidx = kcn_buf_get64(kb);
-	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+static struct kcndb_rra *
+kcndb_db_rra(const struct kcndb_db_table *kdt)
+{
+
+	return kdt->kdt_base->kdb_rra;
+}
+
+static size_t
+kcndb_db_table_size(const struct kcndb_db_table *kdt)
+{
+
+	return kdt->kdt_base->kdb_tablesize;
+}
+
+static void
+kcndb_db_table_size_increment(const struct kcndb_db_table *kdt, size_t size)
+{
+
+	kdt->kdt_base->kdb_tablesize += size;
+}
+
+static void
+kcndb_db_dirty(bool *dirtyp)
+{
+
+	if (kcndb_db_durability == KCNDB_DB_DURABILITY_NONE)
+		return;
+	(void)pthread_mutex_lock(&kcndb_db_dirty_mutex);
+	*dirtyp = true;
+	(void)pthread_mutex_unlock(&kcndb_db_dirty_mutex);
+}
+
+static bool
+kcndb_db_dirty_clear(bool *dirtyp)
+{
+	bool dirty;
+
+	(void)pthread_mutex_lock(&kcndb_db_dirty_mutex);
+	dirty = *dirtyp;
+	*dirtyp = false;
+	(void)pthread_mutex_unlock(&kcndb_db_dirty_mutex);
+	return dirty;
+}
+
+/* only a lock contended is timed so that an uncontended one stays cheap. */
+static bool
+kcndb_db_rwlock_rdlock(pthread_rwlock_t *lock)
+{
+	uint64_t start;
+	int error;
+
+	error = pthread_rwlock_tryrdlock(lock);
+	if (error == EBUSY) {
+		start = kcndb_stats_now();
+		error = pthread_rwlock_rdlock(lock);
+		kcndb_stats_latency(KCNDB_STATS_STAGE_LOCK_WAIT, start);
+	}
+	if (error != 0) {
+		errno = error;
+		KCN_LOG(ERR, "database read lock error: %s", strerror(errno));
+	}
+	return error == 0 ? true : false;
+}
+
+static bool
+kcndb_db_rwlock_wrlock(pthread_rwlock_t *lock)
+{
+	uint64_t start;
+	int error;
+
+	error = pthread_rwlock_trywrlock(lock);
+	if (error == EBUSY) {
+		start = kcndb_stats_now();
+		error = pthread_rwlock_wrlock(lock);
+		kcndb_stats_latency(KCNDB_STATS_STAGE_LOCK_WAIT, start);
+	}
+	if (error != 0) {
+		errno = error;
+		KCN_LOG(ERR, "database write lock error: %s", strerror(errno));
+	}
+	return error == 0 ? true : false;
+}
+
+static bool
+kcndb_db_mutex_lock(pthread_mutex_t *lock)
+{
+	uint64_t start;
+	int error;
+
+	error = pthread_mutex_trylock(lock);
+	if (error == EBUSY) {
+		start = kcndb_stats_now();
+		error = pthread_mutex_lock(lock);
+		kcndb_stats_latency(KCNDB_STATS_STAGE_LOCK_WAIT, start);
+	}
+	if (error != 0) {
+		errno = error;
+		KCN_LOG(ERR, "database lock error: %s", strerror(errno));
+	}
+	return error == 0 ? true : false;
+}
+
+static void
+kcndb_db_rwlock_unlock(pthread_rwlock_t *lock)
+{
+	int error;
+
+	error = pthread_rwlock_unlock(lock);
+	if (error != 0) {
+		errno = error;
+		KCN_LOG(ERR, "database unlock failed: %s", strerror(errno));
+	}
+}
+
+static bool
+kcndb_db_rdlock(const struct kcndb_db_table *kdt)
+{
+
+	return kcndb_db_rwlock_rdlock(
+	    &kdt->kdt_base->kdb_lock);
+}
+
+static bool
+kcndb_db_wrlock(const struct kcndb_db_table *kdt)
+{
+
+	return kcndb_db_rwlock_wrlock(
+	    &kdt->kdt_base->kdb_lock);
+}
+
+static void
+kcndb_db_unlock(const struct kcndb_db_table *kdt)
+{
+
+	kcndb_db_rwlock_unlock(&kdt->kdt_base->kdb_lock);
+}
+
+static int
+kcndb_db_loc_map_cmp(const void *a0, const void *b0)
+{
+	const struct kcndb_db_loc_map *a = a0, *b = b0;
+
+	return a->kdlm_oidx < b->kdlm_oidx ? -1 :
+	    a->kdlm_oidx > b->kdlm_oidx ? 1 : 0;
+}
+
+/*
+ * tables used to have their own locator dictionaries.  merge an old
+ * dictionary of a table into the shared one, and rewrite indexes of
+ * records into a temporary table, which replaces an original table after
+ * the old dictionary is removed.  the caller must hold a write lock.
+ */
+static bool
+kcndb_db_table_migrate(struct kcndb_db *kd, const struct kcndb_db_table *kdt)
+{
+	struct kcndb_file *okf, *kf, *tkf;
+	struct kcn_buf *kb;
+	struct kcndb_db_loc_map *map, *nmap, *kdlm, key;
+	struct kcndb_db_record kdr;
+	const char *name;
+	char opath[MAXPATHLEN], path[MAXPATHLEN], tpath[MAXPATHLEN];
+	size_t n, nmax, len, nrecords;
+	uint64_t oidx;
+	bool rc;
+
+	name = kdt->kdt_name;
+	(void)snprintf(opath, sizeof(opath), "%s/%s%s",
+	    kcndb_db_path, name, KCNDB_DB_PATH_LOC_SUFFIX);
+	(void)snprintf(path, sizeof(path), "%s/%s", kcndb_db_path, name);
+	(void)snprintf(tpath, sizeof(tpath), "%s/%s%s",
+	    kcndb_db_path, name, KCNDB_DB_PATH_MIGRATE_SUFFIX);
+	if (access(opath, F_OK) == -1) {
+		if (errno != ENOENT)
+			return false;
+		/* complete a migration interrupted before a rename. */
+		if (rename(tpath, path) == 0)
+			KCN_LOG(INFO, "%s: complete migration", name);
+		else if (errno != ENOENT)
+			return false;
+		return true;
+	}
+
+	KCN_LOG(INFO, "%s: migrate locators into shared dictionary", name);
+	okf = kf = tkf = NULL;
+	map = NULL;
+	n = nmax = nrecords = 0;
+	rc = false;
+	okf = kcndb_file_open(opath);
+	if (okf == NULL)
+		goto out;
+	kb = kcndb_file_buf(okf);
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_seek_head(okf, KCNDB_DB_LOC_INDEXTABLESIZ))
+		goto out;
+	/* entries are appended after a hash table in order of offsets. */
+	for (oidx = KCNDB_DB_LOC_INDEXTABLESIZ;; oidx += len) {
+		if (! kcndb_file_ensure(okf, sizeof(uint16_t)))
+			break;
+		len = kcn_buf_get16(kb);
+		if (! kcndb_file_ensure(okf,
+		    sizeof(uint16_t) + len + sizeof(uint64_t)))
+			break;
+		if (n == nmax) {
+			nmax = nmax == 0 ? KCNDB_DB_LOC_HASHSIZ : nmax * 2;
+			nmap = realloc(map, nmax * sizeof(*map));
+			if (nmap == NULL)
+				goto out;
+			map = nmap;
+		}
+		kdlm = &map[n++];
+		kdlm->kdlm_oidx = oidx;
+		if (! kcndb_db_loc_add(kd, kcn_buf_current(kb), len,
+		    &kdlm->kdlm_idx, NULL))
+			goto out;
+		kcn_buf_forward(kb, len + sizeof(uint64_t));
+		kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+		len += sizeof(uint16_t) + sizeof(uint64_t);
+	}
+	if (errno != ESHUTDOWN)
+		goto out;
+
+	(void)unlink(tpath);
+	kf = kcndb_file_open(path);
+	tkf = kcndb_file_open(tpath);
+	if (kf == NULL || tkf == NULL)
+		goto out;
+	kcn_buf_reset(kcndb_file_buf(kf), 0);
+	kb = kcndb_file_buf(tkf);
+	kcn_buf_reset(kb, 0);
+	while (kcndb_db_record_read(kf, &kdr)) {
+		key.kdlm_oidx = kdr.kdr_locidx;
+		kdlm = bsearch(&key, map, n, sizeof(*map),
+		    kcndb_db_loc_map_cmp);
+		if (kdlm == NULL) {
+			KCN_LOG(ERR, "%s: unknown locator index %llu", name,
+			    (unsigned long long)kdr.kdr_locidx);
+			errno = ENXIO;
+			goto out;
+		}
+		if (kcn_buf_len(kb) + KCNDB_DB_RECORDSIZ > KCNDB_FILE_BUFSIZ &&
+		    ! kcndb_file_append(tkf))
+			goto out;
+		kcn_buf_put64(kb, kdr.kdr_time);
+		kcn_buf_put64(kb, kdr.kdr_val);
+		kcn_buf_put64(kb, kdlm->kdlm_idx);
+		++nrecords;
+	}
+	if (errno != ESHUTDOWN)
+		goto out;
+	if (! kcndb_file_append(tkf) || ! kcndb_file_sync(tkf))
+		goto out;
+
+	/* the old dictionary must be removed first to mark completion. */
+	if (unlink(opath) == -1 || rename(tpath, path) == -1)
+		goto out;
+	KCN_LOG(INFO, "%s: %zu locator(s) and %zu record(s) migrated",
+	    name, n, nrecords);
+	rc = true;
+  out:
+	if (! rc)
+		KCN_LOG(ERR, "%s: cannot migrate: %s", name, strerror(errno));
+	kcndb_file_close(okf);
+	kcndb_file_close(kf);
+	kcndb_file_close(tkf);
+	free(map);
+	return rc;
+}
+
+static struct kcndb_db_table *
+kcndb_db_table_open(struct kcndb_db *kd, enum kcn_eq_type type,
+    unsigned int shard)
+{
+	struct kcndb_db_table *kdt;
+	char path[MAXPATHLEN];
+	bool rc;
+
+	if (kcn_eq_type_ntoa(type) == NULL) {
+		errno = ENOENT;
+		KCN_LOG(DEBUG, "unknown database type: %hu", type);
+		return NULL;
+	}
+
+	kdt = kcndb_db_table_new(type, shard);
+	if (kdt == NULL) {
+		KCN_LOG(DEBUG, "cannot allocate table structure");
+		return NULL;
+	}
+
+	if (! kcndb_db_wrlock(kdt))
+		goto bad;
+	/* only an unsharded table used to have its own dictionary. */
+	rc = shard != 0 || kcndb_db_table_migrate(kd, kdt);
+	if (rc) {
+		(void)snprintf(path, sizeof(path), "%s/%s",
+		    kcndb_db_path, kdt->kdt_name);
+		kdt->kdt_table = kcndb_file_open(path);
+		rc = kdt->kdt_table != NULL && kcndb_db_init(kdt);
+	}
+	kcndb_db_unlock(kdt);
+	if (! rc)
+		goto bad;
+	return kdt;
+  bad:
+	kcndb_db_table_close(kdt);
+	return NULL;
+}
+
+static void
+kcndb_db_table_close(struct kcndb_db_table *kdt)
+{
+
+	if (kdt == NULL)
+		return;
+	kcndb_file_close(kdt->kdt_table);
+	kcndb_db_table_destroy(kdt);
+}
+
+static struct kcndb_db_table *
+kcndb_db_table_lookup(struct kcndb_db *kd, enum kcn_eq_type type,
+    unsigned int shard)
+{
+
+	return kd->kd_tables[TYPE2INDEX(type)][shard];
+}
+
+static unsigned int
+kcndb_db_table_nshards(enum kcn_eq_type type)
+{
+
+	return kcndb_db_ntables[TYPE2INDEX(type)];
+}
+
+static void
+kcndb_db_close(struct kcndb_db *kd)
+{
+	enum kcn_eq_type type;
+	unsigned int shard;
+	int idx;
+
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		idx = TYPE2INDEX(type);
+		for (shard = 0; shard < KCNDB_DB_SHARD_MAX; shard++) {
+			if (kd->kd_tables[idx][shard] == NULL)
+				continue;
+			kcndb_db_table_close(kd->kd_tables[idx][shard]);
+			kd->kd_tables[idx][shard] = NULL;
+		}
+	}
+	kcndb_file_close(kd->kd_loc);
+	kd->kd_loc = NULL;
+}
+
+/* (re)open files of the current generation. */
+static bool
+kcndb_db_open(struct kcndb_db *kd)
+{
+	enum kcn_eq_type type;
+	unsigned int shard;
+	int idx;
+
+	kcndb_db_close(kd);
+	if (! kcndb_db_loc_open(kd))
+		return false;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		idx = TYPE2INDEX(type);
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kd->kd_tables[idx][shard] =
+			    kcndb_db_table_open(kd, type, shard);
+			if (kd->kd_tables[idx][shard] == NULL)
+				return false;
+		}
+	}
+	kd->kd_generation = kcndb_db_generation;
+	return true;
+}
+
+static bool
+kcndb_db_enter(struct kcndb_db *kd)
+{
+
+	if (! kcndb_db_mutex_lock(&kd->kd_lock))
+		return false;
+	if (kd->kd_generation == kcndb_db_generation || kcndb_db_open(kd))
+		return true;
+	KCN_LOG(ERR, "cannot reopen database: %s", strerror(errno));
+	(void)pthread_mutex_unlock(&kd->kd_lock);
+	return false;
+}
+
+static void
+kcndb_db_leave(struct kcndb_db *kd)
+{
+
+	(void)pthread_mutex_unlock(&kd->kd_lock);
+}
+
+/* block operations on all databases until kcndb_db_exclusive_leave(). */
+static bool
+kcndb_db_exclusive_enter(void)
+{
+	struct kcndb_db *kd;
+
+	if (! kcndb_db_mutex_lock(&kcndb_db_listlock))
+		return false;
+	LIST_FOREACH(kd, &kcndb_db_list, kd_chain)
+		(void)pthread_mutex_lock(&kd->kd_lock);
+	return true;
+}
+
+static void
+kcndb_db_exclusive_leave(void)
+{
+	struct kcndb_db *kd;
+
+	LIST_FOREACH(kd, &kcndb_db_list, kd_chain)
+		(void)pthread_mutex_unlock(&kd->kd_lock);
+	(void)pthread_mutex_unlock(&kcndb_db_listlock);
+}
+
+static bool
+kcndb_db_loc_rdlock(void)
+{
+
+	return kcndb_db_rwlock_rdlock(&kcndb_db_loclock);
+}
+
+static bool
+kcndb_db_loc_wrlock(void)
+{
+
+	return kcndb_db_rwlock_wrlock(&kcndb_db_loclock);
+}
+
+static void
+kcndb_db_loc_unlock(void)
+{
+
+	kcndb_db_rwlock_unlock(&kcndb_db_loclock);
+}
+
+static int
+kcndb_db_loc_entry_cmp(const void *a0, const void *b0)
+{
+	const struct kcndb_db_loc_entry *a = a0, *b = b0;
+
+	return a->kdle_idx < b->kdle_idx ? -1 :
+	    a->kdle_idx > b->kdle_idx ? 1 : 0;
+}
+
+static bool
+kcndb_db_loc_link(struct kcndb_file *kf, uint64_t off, uint64_t idx)
+{
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+
+	kcn_buf_reset(kb, 0);
+	kcn_buf_put64(kb, idx);
+	return kcndb_file_seek_head(kf, off) && kcndb_file_write(kf);
+}
+
+/*
+ * a crash may leave a partial entry at the tail, a link to an entry that
+ * is lost, or an entry that is not linked yet.  truncate a partial entry,
+ * clear dangling links, and link entries left alone to tails of chains.
+ * an entry linked to itself is unlinked on purpose, and is ignored.  the
+ * caller must hold a write lock of the dictionary.
+ */
+static bool
+kcndb_db_loc_recover(struct kcndb_db *kd)
+{
+	struct kcndb_file *kf = kd->kd_loc;
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+	struct kcndb_db_loc_entry *entries, *nentries, *kdle, key;
+	uint64_t heads[KCNDB_DB_LOC_HASHSIZ], idx, link, *linkp;
+	size_t i, j, n, nmax, len, nfixes;
+	bool rc;
+
+	if (kcndb_db_locsize < KCNDB_DB_LOC_INDEXTABLESIZ) {
+		KCN_LOG(WARN, "locator: complete torn hash table");
+		kcn_buf_reset(kb, 0);
+		kcn_buf_putnull(kb, KCNDB_DB_LOC_INDEXTABLESIZ -
+		    kcndb_db_locsize);
+		if (! kcndb_file_append(kf))
+			return false;
+		kcndb_db_locsize = KCNDB_DB_LOC_INDEXTABLESIZ;
+	}
+
+	entries = NULL;
+	n = nmax = nfixes = 0;
+	rc = false;
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_seek_head(kf, 0) ||
+	    ! kcndb_file_ensure(kf, KCNDB_DB_LOC_INDEXTABLESIZ))
+		goto out;
+	for (i = 0; i < KCNDB_DB_LOC_HASHSIZ; i++)
+		heads[i] = kcn_buf_get64(kb);
+	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	for (idx = KCNDB_DB_LOC_INDEXTABLESIZ;;
+	    idx += sizeof(uint16_t) + len + sizeof(uint64_t)) {
+		if (! kcndb_file_ensure(kf, sizeof(uint16_t)))
+			break;
+		len = kcn_buf_get16(kb);
+		if (! kcndb_file_ensure(kf,
+		    sizeof(uint16_t) + len + sizeof(uint64_t)))
+			break;
+		if (n == nmax) {
+			nmax = nmax == 0 ? KCNDB_DB_LOC_HASHSIZ : nmax * 2;
+			nentries = realloc(entries, nmax * sizeof(*entries));
+			if (nentries == NULL)
+				goto out;
+			entries = nentries;
+		}
+		kdle = &entries[n];
+		kdle->kdle_idx = idx;
+		kdle->kdle_len = len;
+		kdle->kdle_hash = kcn_str_hash(kcn_buf_current(kb), len,
+		    KCNDB_DB_LOC_HASHSIZ);
+		kcn_buf_forward(kb, len);
+		kdle->kdle_next = kcn_buf_get64(kb);
+		kdle->kdle_linked = false;
+		kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+		if (kdle->kdle_next != idx)
+			++n;
+	}
+	if (errno != ESHUTDOWN)
+		goto out;
+	if (idx < kcndb_db_locsize) {
+		KCN_LOG(WARN, "locator: truncate torn entry of %zu byte(s)",
+		    (size_t)(kcndb_db_locsize - idx));
+		if (! kcndb_file_truncate(kf, idx))
+			goto out;
+		kcndb_db_locsize = idx;
+	}
+
+	/* clear dangling links. */
+	for (i = 0; i < KCNDB_DB_LOC_HASHSIZ + n; i++) {
+		if (i < KCNDB_DB_LOC_HASHSIZ) {
+			linkp = &heads[i];
+			link = KCNDB_DB_LOC_INDEXSIZ * i;
+		} else {
+			kdle = &entries[i - KCNDB_DB_LOC_HASHSIZ];
+			linkp = &kdle->kdle_next;
+			link = kdle->kdle_idx + sizeof(uint16_t) +
+			    kdle->kdle_len;
+		}
+		if (*linkp == 0)
+			continue;
+		key.kdle_idx = *linkp;
+		kdle = bsearch(&key, entries, n, sizeof(*entries),
+		    kcndb_db_loc_entry_cmp);
+		if (kdle != NULL && ! kdle->kdle_linked) {
+			kdle->kdle_linked = true;
+			continue;
+		}
+		KCN_LOG(WARN, "locator: clear dangling link to %llu",
+		    (unsigned long long)*linkp);
+		*linkp = 0;
+		if (! kcndb_db_loc_link(kf, link, 0))
+			goto out;
+		++nfixes;
+	}
+
+	/* link entries left alone. */
+	for (i = 0; i < n; i++) {
+		kdle = &entries[i];
+		if (kdle->kdle_linked)
+			continue;
+		linkp = &heads[kdle->kdle_hash];
+		link = KCNDB_DB_LOC_INDEXSIZ * kdle->kdle_hash;
+		for (j = 0; *linkp != 0 && j < n; j++) {
+			key.kdle_idx = *linkp;
+			nentries = bsearch(&key, entries, n, sizeof(*entries),
+			    kcndb_db_loc_entry_cmp);
+			assert(nentries != NULL);
+			linkp = &nentries->kdle_next;
+			link = nentries->kdle_idx + sizeof(uint16_t) +
+			    nentries->kdle_len;
+		}
+		KCN_LOG(WARN, "locator: link entry at %llu",
+		    (unsigned long long)kdle->kdle_idx);
+		*linkp = kdle->kdle_idx;
+		kdle->kdle_linked = true;
+		if (! kcndb_db_loc_link(kf, link, kdle->kdle_idx))
+			goto out;
+		++nfixes;
+	}
+	KCN_LOG(INFO, "locator: %zu entries checked, %zu link(s) repaired",
+	    n, nfixes);
+	rc = true;
+  out:
+	free(entries);
+	return rc;
+}
+
+static bool
+kcndb_db_loc_open(struct kcndb_db *kd)
+{
+	struct kcn_buf *kb;
+	char path[MAXPATHLEN];
+	bool rc;
+
+	(void)snprintf(path, sizeof(path), "%s/%s",
+	    kcndb_db_path, KCNDB_DB_PATH_LOC);
+	kd->kd_loc = kcndb_file_open(path);
+	if (kd->kd_loc == NULL)
+		return false;
+
+	if (! kcndb_db_loc_wrlock())
+		return false;
+	rc = true;
+	if (kcndb_db_locsize == 0) {
+		rc = kcndb_file_size_get(kd->kd_loc, &kcndb_db_locsize);
+		if (rc && kcndb_db_locsize > 0)
+			rc = kcndb_db_loc_recover(kd);
+	}
+	if (rc && kcndb_db_locsize == 0) {
+		kb = kcndb_file_buf(kd->kd_loc);
+		kcn_buf_reset(kb, 0);
+		kcn_buf_putnull(kb, KCNDB_DB_LOC_INDEXTABLESIZ);
+		rc = kcndb_file_append(kd->kd_loc);
+		if (rc)
+			kcndb_db_locsize = KCNDB_DB_LOC_INDEXTABLESIZ;
+	}
+	kcndb_db_loc_unlock();
+	return rc;
+}
+
+/*
+ * find an index of a locator.  when not found, ENOENT is set, and an offset
+ * of the last link of a hash chain is returned in *linkp.  the caller must
+ * hold a lock of the dictionary.
+ */
+static bool
+kcndb_db_loc_find(struct kcndb_db *kd, const char *loc, size_t loclen,
+    uint64_t *idxp, uint64_t *linkp)
+{
+	struct kcndb_file *kf;
+	unsigned int h;
+	struct kcn_buf *kb;
+	uint64_t idx, off;
+	size_t len;
+
+	kf = kd->kd_loc;
+	h = kcn_str_hash(loc, loclen, KCNDB_DB_LOC_HASHSIZ);
+	kb = kcndb_file_buf(kf);
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_seek_head(kf, 0))
+		return false;
+	if (! kcndb_file_ensure(kf, KCNDB_DB_LOC_INDEXSIZ))
+		return false;
+	kcn_buf_forward(kb, KCNDB_DB_LOC_INDEXSIZ * h);
+	/* an offset at which the buffer starts. */
+	off = 0;
+	while ((idx = kcn_buf_get64(kb)) != 0) {
+		off = idx;
+		if (! kcndb_file_seek_head(kf, idx))
+			return false;
+		kcn_buf_reset(kb, 0);
+		if (! kcndb_file_ensure(kf, sizeof(uint16_t)))
+			return false;
+		len = kcn_buf_get16(kb);
+		if (! kcndb_file_ensure(kf, len + sizeof(uint64_t)))
+			return false;
+		if (loclen == len &&
+		    strncmp(kcn_buf_current(kb), loc, loclen) == 0) {
+			*idxp = idx;
+			return true;
+		}
+		kcn_buf_forward(kb, len);
+	}
+	*linkp = off + kcn_buf_headingdata(kb) - sizeof(idx);
+	errno = ENOENT;
+	return false;
+}
+
+static bool
+kcndb_db_loc_get(struct kcndb_db *kd, const char *loc, size_t loclen,
+    uint64_t *idxp)
+{
+	uint64_t oidx;
+	bool rc;
+
+	if (! kcndb_db_loc_rdlock())
+		return false;
+	rc = kcndb_db_loc_find(kd, loc, loclen, idxp, &oidx);
+	kcndb_db_loc_unlock();
+	return rc;
+}
+
+/* add a locator unless known, and tell if added when addedp is given. */
+static bool
+kcndb_db_loc_add(struct kcndb_db *kd, const char *loc, size_t loclen,
+    uint64_t *idxp, bool *addedp)
+{
+	struct kcndb_file *kf;
+	struct kcn_buf *kb;
+	uint64_t idx, oidx;
+	size_t len;
+	bool rc;
+
+	if (addedp != NULL)
+		*addedp = false;
+	if (! kcndb_db_loc_wrlock())
+		return false;
+	oidx = 0;
+	rc = kcndb_db_loc_find(kd, loc, loclen, idxp, &oidx);
+	if (rc || errno != ENOENT)
+		goto out;
+
+	kf = kd->kd_loc;
+	kb = kcndb_file_buf(kf);
+	idx = kcndb_db_locsize;
+	kcn_buf_reset(kb, 0);
+	kcn_buf_put16(kb, loclen);
+	kcn_buf_put(kb, loc, loclen);
+	kcn_buf_put64(kb, 0);
+	len = kcn_buf_len(kb);
+	if (! kcndb_file_append(kf))
+		goto out;
+	kcndb_db_locsize += len;
+	kcndb_db_dirty(&kcndb_db_locdirty);
+
+	if (! kcndb_db_loc_link(kf, oidx, idx))
+		goto out;
+	*idxp = idx;
+	if (addedp != NULL)
+		*addedp = true;
+	rc = true;
+  out:
+	kcndb_db_loc_unlock();
+	return rc;
+}
+
+/*
+ * unlink an entry of a locator from its hash chain, which is left in the
+ * dictionary until a compaction.  the entry is linked to itself first so
+ * that a recovery does not link it again.
+ */
+static bool
+kcndb_db_loc_unlink(struct kcndb_db *kd, uint64_t idx)
+{
+	struct kcndb_file *kf;
+	struct kcn_buf *kb;
+	uint64_t link, next, cur;
+	size_t len;
+	bool rc;
+
+	if (! kcndb_db_loc_wrlock())
+		return false;
+	kf = kd->kd_loc;
+	kb = kcndb_file_buf(kf);
+	rc = false;
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_seek_head(kf, idx) ||
+	    ! kcndb_file_ensure(kf, sizeof(uint16_t)))
+		goto out;
+	len = kcn_buf_get16(kb);
+	if (! kcndb_file_ensure(kf, sizeof(uint16_t) + len + sizeof(uint64_t)))
+		goto out;
+	link = KCNDB_DB_LOC_INDEXSIZ *
+	    kcn_str_hash(kcn_buf_current(kb), len, KCNDB_DB_LOC_HASHSIZ);
+	kcn_buf_forward(kb, len);
+	next = kcn_buf_get64(kb);
+	for (;;) {
+		kcn_buf_reset(kb, 0);
+		if (! kcndb_file_seek_head(kf, link) ||
+		    ! kcndb_file_ensure(kf, sizeof(uint64_t)))
+			goto out;
+		cur = kcn_buf_get64(kb);
+		if (cur == idx)
+			break;
+		if (cur == 0) {
+			errno = ENOENT;
+			goto out;
+		}
+		/* a link of an entry follows its locator. */
+		kcn_buf_reset(kb, 0);
+		if (! kcndb_file_seek_head(kf, cur) ||
+		    ! kcndb_file_ensure(kf, sizeof(uint16_t)))
+			goto out;
+		link = cur + sizeof(uint16_t) + kcn_buf_get16(kb);
+	}
+	if (! kcndb_db_loc_link(kf, idx + sizeof(uint16_t) + len, idx) ||
+	    ! kcndb_db_loc_link(kf, link, next))
+		goto out;
+	kcndb_db_dirty(&kcndb_db_locdirty);
+	rc = true;
+  out:
+	kcndb_db_loc_unlock();
+	return rc;
+}
+
+/* a returned locator is valid until the next access to the dictionary. */
+static bool
+kcndb_db_loc_lookup(struct kcndb_db *kd, uint64_t idx,
+    const char **locp, size_t *loclenp)
+{
+	struct kcndb_file *kf = kd->kd_loc;
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+	bool rc;
+
+	if (! kcndb_db_loc_rdlock())
+		return false;
+	rc = false;
+	if (kcndb_db_locsize < idx) {
+		errno = ENXIO;
+		goto out;
+	}
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_seek_head(kf, idx))
+		goto out;
+	if (! kcndb_file_ensure(kf, sizeof(uint16_t)))
+		goto out;
+	*loclenp = kcn_buf_get16(kb);
+	if (! kcndb_file_ensure(kf, *loclenp))
+		goto out;
+	*locp = kcn_buf_current(kb);
+	rc = true;
+  out:
+	kcndb_db_loc_unlock();
+	return rc;
+}
+
+static bool
+kcndb_db_record_read(struct kcndb_file *kf, struct kcndb_db_record *kdr)
+{
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+
+	if (! kcndb_file_ensure(kf, KCNDB_DB_RECORDSIZ))
+		return false;
+
+	kdr->kdr_time = kcn_buf_get64(kb);
+	kdr->kdr_val = kcn_buf_get64(kb);
+	kdr->kdr_locidx = kcn_buf_get64(kb);
+	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	return true;
+}
+
+static bool
+kcndb_db_record_read_at(struct kcndb_db_table *kdt, uint64_t off,
+    struct kcndb_db_record *kdr)
+{
+
+	kcn_buf_reset(kcndb_file_buf(kdt->kdt_table), 0);
+	if (! kcndb_file_seek_head(kdt->kdt_table, off))
+		return false;
+	return kcndb_db_record_read(kdt->kdt_table, kdr);
+}
+
+static bool
+kcndb_db_record_read_last(struct kcndb_db_table *kdt,
+    struct kcndb_db_record *kdr)
+{
+
+	if (kcndb_db_table_size(kdt) < KCNDB_DB_RECORDSIZ) {
+		kdr->kdr_time = 0;
+		kdr->kdr_val = 0;
+		kdr->kdr_locidx = 0;
+		return true;
+	}
+	return kcndb_db_record_read_at(kdt,
+	    kcndb_db_table_size(kdt) - KCNDB_DB_RECORDSIZ, kdr);
+}
+
+/* the caller must hold a write lock. */
+static bool
+kcndb_db_record_append(struct kcndb_db_table *kdt,
+    const struct kcndb_db_record *kdr)
+{
+	struct kcn_buf *kb = kcndb_file_buf(kdt->kdt_table);
+	uint64_t off;
+
+	kcn_buf_reset(kb, 0);
+	kcn_buf_put64(kb, kdr->kdr_time);
+	kcn_buf_put64(kb, kdr->kdr_val);
+	kcn_buf_put64(kb, kdr->kdr_locidx);
+	off = kcndb_db_table_size(kdt);
+	if (! kcndb_file_append(kdt->kdt_table))
+		return false;
+	kcndb_db_table_size_increment(kdt, KCNDB_DB_RECORDSIZ);
+	kcndb_db_dirty(&kdt->kdt_base->kdb_dirty);
+	return kcndb_post_add(kcndb_db_post(kdt), kdr->kdr_locidx, off) &&
+	    kcndb_rra_add(kcndb_db_rra(kdt), kdr->kdr_locidx, kdr->kdr_time,
+	    kdr->kdr_val);
+}
+
+/* write records from the current position of a file. */
+static bool
+kcndb_db_record_write(struct kcndb_file *kf,
+    const struct kcndb_db_record *kdrs, size_t n)
+{
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+	size_t i;
+
+	for (i = 0; i < n; i++) {
+		if (kcn_buf_len(kb) + KCNDB_DB_RECORDSIZ > KCNDB_FILE_BUFSIZ &&
+		    ! kcndb_file_write(kf))
+			return false;
+		kcn_buf_put64(kb, kdrs[i].kdr_time);
+		kcn_buf_put64(kb, kdrs[i].kdr_val);
+		kcn_buf_put64(kb, kdrs[i].kdr_locidx);
+	}
+	return kcndb_file_write(kf);
+}
+
+static bool
+kcndb_db_record_write_at(struct kcndb_db_table *kdt, uint64_t off,
+    const struct kcndb_db_record *kdrs, size_t n)
+{
+
+	if (! kcndb_file_seek_head(kdt->kdt_table, off))
+		return false;
+	kcn_buf_reset(kcndb_file_buf(kdt->kdt_table), 0);
+	return kcndb_db_record_write(kdt->kdt_table, kdrs, n);
+}
+
+/* a rename is durable only after its directory is synced. */
+static bool
+kcndb_db_dir_sync(void)
+{
+	int fd;
+	bool rc;
+
+	fd = open(kcndb_db_path, O_RDONLY);
+	if (fd == -1)
+		return false;
+	rc = fsync(fd) == 0 ? true : false;
+	(void)close(fd);
+	return rc;
+}
+
+/*
+ * log a merged tail of a table at an offset by writing it aside and
+ * renaming it into place, so that a rewrite can be redone after a crash.
+ */
+static bool
+kcndb_db_merge_log(struct kcndb_db_table *kdt, uint64_t pos,
+    const struct kcndb_db_record *kdrs, size_t n)
+{
+	struct kcndb_file *kf;
+	struct kcn_buf *kb;
+	char path[MAXPATHLEN], tpath[MAXPATHLEN];
+	bool rc;
+
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_MERGE_SUFFIX);
+	kcndb_db_checkpoint_path(tpath, sizeof(tpath), kdt,
+	    KCNDB_DB_PATH_MERGE_TEMP_SUFFIX);
+	(void)unlink(tpath);
+	kf = kcndb_file_open(tpath);
+	if (kf == NULL)
+		return false;
+	kb = kcndb_file_buf(kf);
+	kcn_buf_reset(kb, 0);
+	kcn_buf_put32(kb, KCNDB_DB_MERGE_MAGIC);
+	kcn_buf_put64(kb, pos);
+	rc = kcndb_db_record_write(kf, kdrs, n) && kcndb_file_sync(kf) &&
+	    rename(tpath, path) == 0 && kcndb_db_dir_sync();
+	kcndb_file_close(kf);
+	if (! rc) {
+		(void)unlink(tpath);
+		(void)unlink(path);
+	}
+	return rc;
+}
+
+static void
+kcndb_db_merge_unlog(struct kcndb_db_table *kdt)
+{
+	char path[MAXPATHLEN];
+
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_MERGE_SUFFIX);
+	(void)unlink(path);
+}
+
+/*
+ * redo a logged merge which may have been interrupted by a crash.  since a
+ * log holds the whole merged tail, a rewrite can be redone any times.
+ */
+static bool
+kcndb_db_merge_recover(struct kcndb_db_table *kdt)
+{
+	struct kcndb_file *kf;
+	struct kcn_buf *kb;
+	struct kcndb_db_record *kdrs;
+	char path[MAXPATHLEN];
+	const char *name;
+	uint64_t pos;
+	size_t size, i, n;
+	bool rc;
+
+	name = kdt->kdt_name;
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_MERGE_TEMP_SUFFIX);
+	(void)unlink(path);
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_MERGE_SUFFIX);
+	if (access(path, F_OK) == -1)
+		return errno == ENOENT ? true : false;
+	kf = kcndb_file_open(path);
+	if (kf == NULL)
+		return false;
+	kdrs = NULL;
+	rc = false;
+	if (! kcndb_file_size_get(kf, &size))
+		goto out;
+	kb = kcndb_file_buf(kf);
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_ensure(kf, KCNDB_DB_MERGE_HDRSIZ))
+		goto out;
+	if (kcn_buf_get32(kb) != KCNDB_DB_MERGE_MAGIC) {
+		errno = EINVAL;
+		goto out;
+	}
+	pos = kcn_buf_get64(kb);
+	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	n = (size - KCNDB_DB_MERGE_HDRSIZ) / KCNDB_DB_RECORDSIZ;
+	if (pos % KCNDB_DB_RECORDSIZ != 0 ||
+	    n > KCNDB_DB_MERGE_MAX + KCNDB_DB_REORDER_MAX) {
+		errno = EINVAL;
+		goto out;
+	}
+	kdrs = malloc(n * sizeof(*kdrs) + 1);
+	if (kdrs == NULL)
+		goto out;
+	for (i = 0; i < n; i++)
+		if (! kcndb_db_record_read(kf, &kdrs[i]))
+			goto out;
+	KCN_LOG(WARN, "%s: redo merge of %zu record(s)", name, n);
+	if (! kcndb_db_record_write_at(kdt, pos, kdrs, n) ||
+	    ! kcndb_file_sync(kdt->kdt_table))
+		goto out;
+	rc = true;
+  out:
+	if (! rc)
+		KCN_LOG(ERR, "%s: cannot redo merge: %s", name,
+		    errno == ESHUTDOWN ? "truncated" : strerror(errno));
+	kcndb_file_close(kf);
+	free(kdrs);
+	if (rc)
+		kcndb_db_merge_unlog(kdt);
+	return rc;
+}
+
+/*
+ * rebuild indexes of a table from records when they cannot be updated.
+ * new indexes replace old ones only if built.
+ */
+static bool
+kcndb_db_index_rebuild(struct kcndb_db_table *kdt)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	struct kcndb_post *kp = kdb->kdb_post;
+	struct kcndb_rra *kra = kdb->kdb_rra;
+
+	if (! kcndb_db_index_init(kdt))
+		return false;
+	kcndb_post_destroy(kp);
+	kcndb_rra_destroy(kra);
+	return true;
+}
+
+/*
+ * merge records sorted in time order, some of which are older than the
+ * last one, into a table.  records after the first insertion point are
+ * rewritten, and their offsets in posting lists are rebuilt.  records
+ * whose insertion point is farther than KCNDB_DB_MERGE_MAX records from
+ * the tail are too late, and are kept in a late segment.  the caller must
+ * hold a write lock.
+ */
+static bool
+kcndb_db_record_merge(struct kcndb_db_table *kdt,
+    const struct kcndb_db_record *kdrs, size_t n)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	struct kcndb_file *kf = kdt->kdt_table;
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+	struct kcndb_db_record *tail, *merged, kdr;
+	char path[MAXPATHLEN];
+	uint64_t lo, hi, mid, pos, nrecords;
+	size_t i, j, k, ntail, nlate;
+	int oerrno;
+	bool rc;
+
+	/* records older than the floor would rewrite too many records. */
+	nrecords = kcndb_db_table_size(kdt) / KCNDB_DB_RECORDSIZ;
+	lo = 0;
+	if (nrecords > KCNDB_DB_MERGE_MAX) {
+		lo = nrecords - KCNDB_DB_MERGE_MAX;
+		if (! kcndb_db_record_read_at(kdt,
+		    (lo - 1) * KCNDB_DB_RECORDSIZ, &kdr))
+			return false;
+		for (nlate = 0; nlate < n; nlate++)
+			if (kdrs[nlate].kdr_time >= kdr.kdr_time)
+				break;
+		if (nlate > 0) {
+			KCN_LOG(INFO, "%s: keep %zu record(s) too late to "
+			    "merge aside", kdt->kdt_name, nlate);
+			if (! kcndb_db_late_add(kdt, kdrs, nlate))
+				return false;
+			kdrs += nlate;
+			n -= nlate;
+		}
+		if (n == 0)
+			return true;
+	}
+
+	/* find the first record newer than the oldest one to be merged. */
+	hi = nrecords;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (! kcndb_db_record_read_at(kdt, mid * KCNDB_DB_RECORDSIZ,
+		    &kdr))
+			return false;
+		if (kdr.kdr_time <= kdrs[0].kdr_time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	pos = lo * KCNDB_DB_RECORDSIZ;
+	ntail = nrecords - lo;
+	KCN_LOG(DEBUG, "%s: merge %zu record(s) before %zu record(s)",
+	    kdt->kdt_name, n, ntail);
+
+	tail = malloc(ntail * sizeof(*tail) + 1);
+	merged = malloc((ntail + n) * sizeof(*merged));
+	rc = false;
+	if (tail == NULL || merged == NULL)
+		goto out;
+	if (! kcndb_file_seek_head(kf, pos))
+		goto out;
+	kcn_buf_reset(kb, 0);
+	for (j = 0; j < ntail; j++)
+		if (! kcndb_db_record_read(kf, &tail[j]))
+			goto out;
+	/* a record merged later follows existing ones at the same time. */
+	for (i = j = k = 0; i < n || j < ntail; k++)
+		if (j < ntail &&
+		    (i == n || tail[j].kdr_time <= kdrs[i].kdr_time))
+			merged[k] = tail[j++];
+		else
+			merged[k] = kdrs[i++];
+
+	/* a checkpoint covering rewritten records is no longer valid. */
+	++kdb->kdb_rewrites;
+	if (pos < kdb->kdb_ckptsize) {
+		kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+		    KCNDB_DB_PATH_CHECKPOINT_SUFFIX);
+		if (unlink(path) == -1 && errno != ENOENT)
+			goto out;
+		kdb->kdb_ckptsize = 0;
+	}
+	if (! kcndb_db_merge_log(kdt, pos, merged, ntail + n))
+		goto out;
+	if (! kcndb_db_record_write_at(kdt, pos, merged, ntail + n) ||
+	    ! kcndb_file_sync(kf)) {
+		/* put the old tail back, or a restart redoes the merge. */
+		oerrno = errno;
+		if (kcndb_db_record_write_at(kdt, pos, tail, ntail) &&
+		    kcndb_file_truncate(kf, kcndb_db_table_size(kdt)) &&
+		    kcndb_file_sync(kf))
+			kcndb_db_merge_unlog(kdt);
+		errno = oerrno;
+		goto out;
+	}
+	kcndb_db_merge_unlog(kdt);
+	kcndb_db_table_size_increment(kdt, n * KCNDB_DB_RECORDSIZ);
+	kcndb_db_dirty(&kdb->kdb_dirty);
+
+	kcndb_post_truncate(kcndb_db_post(kdt), pos);
+	for (k = 0; k < ntail + n; k++)
+		if (! kcndb_post_add(kcndb_db_post(kdt), merged[k].kdr_locidx,
+		    pos + k * KCNDB_DB_RECORDSIZ))
+			break;
+	for (i = 0; k == ntail + n && i < n; i++)
+		if (! kcndb_rra_add(kcndb_db_rra(kdt), kdrs[i].kdr_locidx,
+		    kdrs[i].kdr_time, kdrs[i].kdr_val))
+			break;
+	if (k < ntail + n || i < n) {
+		/* records are merged, and indexes must agree with them. */
+		KCN_LOG(ERR, "%s: cannot index merged records: %s",
+		    kdt->kdt_name, strerror(errno));
+		if (! kcndb_db_index_rebuild(kdt))
+			goto out;
+	}
+	rc = true;
+  out:
+	free(tail);
+	free(merged);
+	return rc;
+}
+
+static int
+kcndb_db_reorder_cmp(const struct kcndb_db_record *a,
+    const struct kcndb_db_record *b)
+{
+
+	return a->kdr_time < b->kdr_time ? -1 : a->kdr_time > b->kdr_time;
+}
+
+/*
+ * write records in a reorder buffer at or before a watermark into a table
+ * in time order.  records not older than the last one in a table are
+ * appended, and others are merged.  the caller must hold a write lock.
+ */
+static bool
+kcndb_db_reorder_flush(struct kcndb_db_table *kdt, time_t watermark)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	struct kcndb_db_record last;
+	size_t i, n;
+	bool rc;
+
+	for (n = 0; n < kdb->kdb_nreorder; n++)
+		if (kdb->kdb_reorder[n].kdr_time > watermark)
+			break;
+	if (n == 0)
+		return true;
+	if (! kcndb_db_record_read_last(kdt, &last))
+		return false;
+	for (i = 0; i < n; i++)
+		if (kdb->kdb_reorder[i].kdr_time >= last.kdr_time)
+			break;
+	rc = true;
+	if (i > 0) {
+		KCN_LOG(INFO, "%s: merge %zu late record(s)", kdt->kdt_name, i);
+		rc = kcndb_db_record_merge(kdt, kdb->kdb_reorder, i);
+	}
+	for (; rc && i < n; i++)
+		rc = kcndb_db_record_append(kdt, &kdb->kdb_reorder[i]);
+	/* records failed to be written are dropped as before. */
+	kdb->kdb_nreorder -= n;
+	memmove(kdb->kdb_reorder, kdb->kdb_reorder + n,
+	    kdb->kdb_nreorder * sizeof(*kdb->kdb_reorder));
+	return rc;
+}
+
+/* write all records in a reorder buffer.  the caller must hold a write lock. */
+static bool
+kcndb_db_reorder_drain(struct kcndb_db_table *kdt)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+
+	if (kdb->kdb_nreorder == 0)
+		return true;
+	return kcndb_db_reorder_flush(kdt,
+	    kdb->kdb_reorder[kdb->kdb_nreorder - 1].kdr_time);
+}
+
+/*
+ * insert a record into a reorder buffer in time order, and flush records
+ * that fall out of a window behind the newest record.  a full buffer
+ * flushes its oldest record.  the caller must hold a write lock.
+ */
+static bool
+kcndb_db_reorder_add(struct kcndb_db_table *kdt,
+    const struct kcndb_db_record *kdr)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	time_t watermark;
+	size_t i;
+
+	if (kdb->kdb_reorder == NULL) {
+		kdb->kdb_reorder = malloc(KCNDB_DB_REORDER_MAX *
+		    sizeof(*kdb->kdb_reorder));
+		if (kdb->kdb_reorder == NULL)
+			return false;
+	}
+	if (kdb->kdb_nreorder == KCNDB_DB_REORDER_MAX &&
+	    ! kcndb_db_reorder_flush(kdt, kdb->kdb_reorder[0].kdr_time))
+		return false;
+
+	/* a record follows ones at the same time in order of arrival. */
+	for (i = kdb->kdb_nreorder;
+	    i > 0 && kcndb_db_reorder_cmp(&kdb->kdb_reorder[i - 1], kdr) > 0;
+	    i--)
+		;
+	memmove(kdb->kdb_reorder + i + 1, kdb->kdb_reorder + i,
+	    (kdb->kdb_nreorder - i) * sizeof(*kdb->kdb_reorder));
+	kdb->kdb_reorder[i] = *kdr;
+	kdb->kdb_reorder[i].kdr_loc = NULL;
+	kdb->kdb_reorder[i].kdr_loclen = 0;
+	++kdb->kdb_nreorder;
+	(void)time(&kdb->kdb_reorderlast);
+
+	watermark = kdb->kdb_reorder[kdb->kdb_nreorder - 1].kdr_time -
+	    kcndb_db_reorder_window;
+	return kcndb_db_reorder_flush(kdt, watermark);
+}
+
+/*
+ * records are held in a reorder buffer within a window so that late ones
+ * are sorted in memory, and records older than the window are merged into
+ * a table.
+ */
+bool
+kcndb_db_record_add(struct kcndb_db *kd, enum kcn_eq_type type,
+    struct kcndb_db_record *kdr)
+{
+	struct kcndb_db_record kdr0;
+	struct kcndb_db_table *kdt;
+	uint64_t start;
+	bool rc;
+
+	start = kcndb_stats_now();
+	if (! kcndb_db_enter(kd))
+		return false;
+	/* a locator must be known to choose a shard. */
+	rc = kcndb_db_loc_add(kd, kdr->kdr_loc, kdr->kdr_loclen,
+	    &kdr->kdr_locidx, NULL);
+	if (! rc)
+		goto bad;
+	kdt = kcndb_db_table_lookup(kd, type, kcndb_db_shard(kdr->kdr_locidx));
+	rc = kcndb_db_wrlock(kdt);
+	if (! rc)
+		goto bad;
+	if (kcndb_db_reorder_window > 0) {
+		rc = kcndb_db_reorder_add(kdt, kdr);
+		goto out;
+	}
+	rc = kcndb_db_record_read_last(kdt, &kdr0);
+	if (! rc)
+		goto out;
+	if (kdr0.kdr_time > kdr->kdr_time)
+		rc = kcndb_db_record_merge(kdt, kdr, 1);
+	else
+		rc = kcndb_db_record_append(kdt, kdr);
+
+  out:
+	kcndb_db_unlock(kdt);
+  bad:
+	kcndb_db_leave(kd);
+	kcndb_stats_latency(KCNDB_STATS_STAGE_RECORD_ADD, start);
+	if (rc)
+		KCN_LOG(DEBUG, "record: add %llu %llu %.*s@%llu",
+		    (unsigned long long)kdr->kdr_time,
+		    (unsigned long long)kdr->kdr_val,
+		    (int)kdr->kdr_loclen, kdr->kdr_loc, kdr->kdr_locidx);
+	else
+		KCN_LOG(ERR, "record: cannot add: %llu %llu %.*s",
+		    (unsigned long long)kdr->kdr_time,
+		    (unsigned long long)kdr->kdr_val,
+		    (int)kdr->kdr_loclen, kdr->kdr_loc);
+	return rc;
+}
+
+/*
+ * delete records of a locator, or of all locators if no locator is given,
+ * in a time range by adding a tombstone to every shard.  records added
+ * later in the range are also hidden until a compaction.
+ */
+bool
+kcndb_db_record_del(struct kcndb_db *kd, enum kcn_eq_type type,
+    const char *loc, size_t loclen, time_t start, time_t end)
+{
+	struct kcndb_db_table *kdt;
+	struct kcndb_db_tomb kdtb;
+	unsigned int shard;
+	bool rc;
+
+	if (end == KCN_TIME_NOW && time(&end) == -1)
+		return false;
+	if (! kcndb_db_enter(kd))
+		return false;
+	kdtb.kdtb_locidx = 0;
+	kdtb.kdtb_start = start;
+	kdtb.kdtb_end = end;
+	if (loclen > 0 &&
+	    ! kcndb_db_loc_get(kd, loc, loclen, &kdtb.kdtb_locidx)) {
+		/* nothing to delete. */
+		rc = errno == ENOENT ? true : false;
+		goto out;
+	}
+	rc = true;
+	for (shard = 0; rc && shard < kcndb_db_table_nshards(type); shard++) {
+		kdt = kcndb_db_table_lookup(kd, type, shard);
+		if (! kcndb_db_wrlock(kdt)) {
+			rc = false;
+			break;
+		}
+		rc = kcndb_db_tomb_add(kdt, &kdtb);
+		kcndb_db_unlock(kdt);
+	}
+  out:
+	kcndb_db_leave(kd);
+	if (rc)
+		KCN_LOG(INFO, "record: delete %s %.*s from %llu to %llu",
+		    kcn_eq_type_ntoa(type), (int)loclen, loclen > 0 ? loc : "*",
+		    (unsigned long long)start, (unsigned long long)end);
+	else
+		KCN_LOG(ERR, "record: cannot delete %s %.*s: %s",
+		    kcn_eq_type_ntoa(type), (int)loclen, loc, strerror(errno));
+	return rc;
+}
+
+void
+kcndb_db_reorder_window_set(unsigned int window)
+{
+
+	kcndb_db_reorder_window = window;
+}
+
+static void *
+kcndb_db_reorder_main(void *arg)
+{
+	struct kcndb_db *kd = arg;
+	struct kcndb_db_table *kdt;
+	struct kcndb_db_base *kdb;
+	enum kcn_eq_type type;
+	unsigned int shard;
+	time_t now;
+
+	/* drain buffers of shards to which no record has been added lately. */
+	for (;;) {
+		(void)sleep(1);
+		(void)time(&now);
+		if (! kcndb_db_enter(kd))
+			continue;
+		for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX;
+		    type++)
+			for (shard = 0; shard < kcndb_db_table_nshards(type);
+			    shard++) {
+				kdt = kcndb_db_table_lookup(kd, type, shard);
+				if (! kcndb_db_wrlock(kdt))
+					continue;
+				kdb = kdt->kdt_base;
+				if (now - kdb->kdb_reorderlast >=
+				    (time_t)kcndb_db_reorder_window)
+					(void)kcndb_db_reorder_drain(kdt);
+				kcndb_db_unlock(kdt);
+			}
+		kcndb_db_leave(kd);
+	}
+	/*NOTREACHED*/
+	return NULL;
+}
+
+/* start a thread draining idle reorder buffers if a window is enabled. */
+bool
+kcndb_db_reorder_start(void)
+{
+	struct kcndb_db *kd;
+	pthread_t tid;
+	int error;
+
+	if (kcndb_db_reorder_window == 0)
+		return true;
+	kd = kcndb_db_new();
+	if (kd == NULL)
+		return false;
+	error = pthread_create(&tid, NULL, kcndb_db_reorder_main, kd);
+	if (error != 0) {
+		kcndb_db_destroy(kd);
+		errno = error;
+		return false;
+	}
+	(void)pthread_detach(tid);
+	KCN_LOG(INFO, "reorder records within %u sec",
+	    kcndb_db_reorder_window);
+	return true;
+}
+
+static bool
+kcndb_db_aggregate_cb(uint64_t locidx, double v, void *arg)
+{
+	struct kcndb_db_aggregate *kda = arg;
+	struct kcndb_db_record kdr;
+
+	kdr.kdr_time = 0;
+	kdr.kdr_val = v;
+	kdr.kdr_locidx = locidx;
+	if (! kcndb_db_loc_lookup(kda->kda_kd, locidx,
+	    &kdr.kdr_loc, &kdr.kdr_loclen)) {
+		KCN_LOG(DEBUG, "cannot find locator: %s", strerror(errno));
+		return false;
+	}
+	KCN_LOG(DEBUG, "aggregate: match loc=%.*s with %f",
+	    (int)kdr.kdr_loclen, kdr.kdr_loc, v);
+	if (! (*kda->kda_cb)(&kdr, 0 /* XXX: score */, kda->kda_arg))
+		return false;
+	++kda->kda_n;
+	kcndb_stats_add(KCNDB_STATS_RECORDS_MATCHED, 1);
+	return true;
+}
+
+/* feed a record to aggregations of equations in whose windows it falls. */
+static bool
+kcndb_db_aggregate_record(struct kcndb_db_table *kdt,
+    const struct kcn_eq *kes, struct kcndb_agg **kas, size_t neqs,
+    const struct kcndb_db_record *kdr)
+{
+	size_t j;
+
+	if (kcndb_db_tomb_match(kdt, kdr))
+		return true;
+	for (j = 0; j < neqs; j++) {
+		if (kes[j].ke_type != kdt->kdt_type ||
+		    ! kcn_eq_time_match(kdr->kdr_time, &kes[j]))
+			continue;
+		if (! kcndb_agg_add(kas[j], kdr->kdr_locidx,
+		    kdr->kdr_time, kdr->kdr_val)) {
+			KCN_LOG(ERR, "cannot aggregate record: %s",
+			    strerror(errno));
+			return false;
+		}
+	}
+	return true;
+}
+
+/*
+ * feed records in windows to aggregations of equations on a table in one
+ * pass, followed by records held in its reorder buffer and late segment.
+ * the caller must hold a read lock.
+ */
+static bool
+kcndb_db_aggregate_scan(struct kcndb_db_table *kdt, const struct kcn_eq *kes,
+    struct kcndb_agg **kas, size_t neqs)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	struct kcndb_db_record kdr;
+	time_t start, end;
+	size_t i, j, k, n;
+
+	/* a union of windows. */
+	start = end = 0;
+	for (j = 0, n = 0; j < neqs; j++) {
+		if (kes[j].ke_type != kdt->kdt_type)
+			continue;
+		if (n++ == 0 || kes[j].ke_start < start)
+			start = kes[j].ke_start;
+		if (end != KCN_TIME_NOW &&
+		    (kes[j].ke_end == KCN_TIME_NOW || kes[j].ke_end > end))
+			end = kes[j].ke_end;
+	}
+
+	if (! kcndb_file_seek_head(kdt->kdt_table, 0)) /* XXX: should improve */
+		return false;
+	kcn_buf_reset(kcndb_file_buf(kdt->kdt_table), 0);
+
+	for (i = 0;; i++) {
+		if (! kcndb_db_record_read(kdt->kdt_table, &kdr)) {
+			if (errno == ESHUTDOWN)
+				break;
+			KCN_LOG(ERR, "cannot read record: %s", strerror(errno));
+			return false;
+		}
+		if (kdr.kdr_time < start)
+			continue;
+		if (end != KCN_TIME_NOW && kdr.kdr_time > end)
+			break; /* records are sorted in time order. */
+		if (! kcndb_db_aggregate_record(kdt, kes, kas, neqs, &kdr))
+			return false;
+	}
+	/* records held may be older than those in a table. */
+	for (j = 0; j < kdb->kdb_nreorder; j++)
+		if (! kcndb_db_aggregate_record(kdt, kes, kas, neqs,
+		    &kdb->kdb_reorder[j]))
+			return false;
+	for (k = 0; k < kdb->kdb_nlate; k++)
+		if (! kcndb_db_aggregate_record(kdt, kes, kas, neqs,
+		    &kdb->kdb_late[k]))
+			return false;
+	KCN_LOG(INFO, "%s: %zu record(s) read", kdt->kdt_name, i + j + k);
+	kcndb_stats_add(KCNDB_STATS_RECORDS_SCANNED, i + j + k);
+	return true;
+}
+
+/*
+ * feed records of all shards of a type in turn.  a locator is fed from
+ * one shard unless the number of shards has been changed.
+ */
+static bool
+kcndb_db_aggregate_scan_shards(struct kcndb_db *kd, enum kcn_eq_type type,
+    const struct kcn_eq *kes, struct kcndb_agg **kas, size_t neqs)
+{
+	struct kcndb_db_table *kdt;
+	unsigned int shard;
+	bool rc;
+
+	for (shard = 0; shard < kcndb_db_table_nshards(type); shard++) {
+		kdt = kcndb_db_table_lookup(kd, type, shard);
+		if (! kcndb_db_rdlock(kdt))
+			return false;
+		rc = kcndb_db_aggregate_scan(kdt, kes, kas, neqs);
+		kcndb_db_unlock(kdt);
+		if (! rc)
+			return false;
+	}
+	return true;
+}
+
+static bool
+kcndb_db_aggregate(struct kcndb_db *kd, const struct kcn_eq *ke,
+    size_t maxnlocs,
+    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+{
+	struct kcndb_agg *ka;
+	struct kcndb_db_aggregate kda;
+	bool rc;
+
+	ka = kcndb_agg_new(ke);
+	if (ka == NULL) {
+		KCN_LOG(ERR, "cannot allocate aggregation: %s",
+		    strerror(errno));
+		return false;
+	}
+	rc = false;
+	if (! kcndb_db_aggregate_scan_shards(kd, ke->ke_type, ke, &ka, 1))
+		goto out;
+
+	kda.kda_kd = kd;
+	kda.kda_cb = cb;
+	kda.kda_arg = arg;
+	kda.kda_n = 0;
+	if (! kcndb_agg_match(ka, maxnlocs, kcndb_db_aggregate_cb, &kda))
+		goto out;
+	if (kda.kda_n == 0) {
+		KCN_LOG(DEBUG, "no matching locator found");
+		errno = ESRCH;
+		goto out;
+	}
+	rc = true;
+  out:
+	kcndb_agg_destroy(ka);
+	return rc;
+}
+
+static bool
+kcndb_db_archive(struct kcndb_db *kd, const struct kcn_eq *ke, int archive,
+    time_t now, size_t maxnlocs,
+    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+{
+	struct kcndb_db_aggregate kda;
+	struct kcndb_db_table *kdt;
+	unsigned int shard;
+	bool rc;
+
+	kda.kda_kd = kd;
+	kda.kda_cb = cb;
+	kda.kda_arg = arg;
+	kda.kda_n = 0;
+	for (shard = 0; shard < kcndb_db_table_nshards(ke->ke_type) &&
+	    kda.kda_n < maxnlocs; shard++) {
+		kdt = kcndb_db_table_lookup(kd, ke->ke_type, shard);
+		if (! kcndb_db_rdlock(kdt))
+			return false;
+		rc = kcndb_rra_match(kcndb_db_rra(kdt), ke, archive, now,
+		    maxnlocs - kda.kda_n, kcndb_db_aggregate_cb, &kda);
+		kcndb_db_unlock(kdt);
+		if (! rc)
+			return false;
+	}
+	if (kda.kda_n == 0) {
+		KCN_LOG(DEBUG, "no matching locator found");
+		errno = ESRCH;
+		return false;
+	}
+	return true;
+}
+
+/* probe other equations with a locator matching the driving equation. */
+static bool
+kcndb_db_join_cb(uint64_t locidx, double v, void *arg)
+{
+	struct kcndb_db_join *kdj = arg;
+	struct kcndb_db_record kdr;
+	double ov;
+	size_t i;
+
+	if (kdj->kdj_n == kdj->kdj_maxnlocs)
+		return true;
+	for (i = 0; i < kdj->kdj_neqs; i++)
+		if (i != kdj->kdj_driver &&
+		    ! kcndb_agg_lookup(kdj->kdj_kas[i], locidx, &ov))
+			return true;
+	kdr.kdr_time = 0;
+	kdr.kdr_val = v;
+	kdr.kdr_locidx = locidx;
+	if (! kcndb_db_loc_lookup(kdj->kdj_kd, locidx,
+	    &kdr.kdr_loc, &kdr.kdr_loclen)) {
+		KCN_LOG(DEBUG, "cannot find locator: %s", strerror(errno));
+		return false;
+	}
+	KCN_LOG(DEBUG, "join: match loc=%.*s",
+	    (int)kdr.kdr_loclen, kdr.kdr_loc);
+	if (! (*kdj->kdj_cb)(&kdr, 0 /* XXX: score */, kdj->kdj_arg))
+		return false;
+	++kdj->kdj_n;
+	kcndb_stats_add(KCNDB_STATS_RECORDS_MATCHED, 1);
+	return true;
+}
+
+/*
+ * search for locators satisfying all equations.  each table is scanned
+ * once to collect locators matching its equations, and locators of the
+ * equation with the fewest matches drive probes into the others.
+ */
+static bool
+kcndb_db_join(struct kcndb_db *kd, const struct kcn_eq *kes, size_t neqs,
+    size_t maxnlocs,
+    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+{
+	struct kcndb_db_join kdj;
+	enum kcn_eq_type type;
+	bool used[KCN_EQ_TYPE_MAX - 1];
+	size_t i, n, minn;
+	bool rc;
+
+	memset(used, 0, sizeof(used));
+	rc = false;
+	kdj.kdj_kas = calloc(neqs, sizeof(*kdj.kdj_kas));
+	if (kdj.kdj_kas == NULL) {
+		KCN_LOG(ERR, "cannot allocate join: %s", strerror(errno));
+		return false;
+	}
+	for (i = 0; i < neqs; i++) {
+		kdj.kdj_kas[i] = kcndb_agg_new(&kes[i]);
+		if (kdj.kdj_kas[i] == NULL) {
+			KCN_LOG(ERR, "cannot allocate aggregation: %s",
+			    strerror(errno));
+			goto out;
+		}
+		used[TYPE2INDEX(kes[i].ke_type)] = true;
+	}
+
+	/*
+	 * each table is scanned once for all of its equations.  a lock is
+	 * held only while a shard is scanned, so none is left to release
+	 * on an error.
+	 */
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		if (! used[TYPE2INDEX(type)])
+			continue;
+		if (! kcndb_db_aggregate_scan_shards(kd, type, kes,
+		    kdj.kdj_kas, neqs))
+			goto out;
+	}
+
+	kdj.kdj_driver = 0;
+	minn = kcndb_agg_finish(kdj.kdj_kas[0]);
+	for (i = 1; i < neqs; i++) {
+		n = kcndb_agg_finish(kdj.kdj_kas[i]);
+		if (n < minn) {
+			kdj.kdj_driver = i;
+			minn = n;
+		}
+	}
+	KCN_LOG(DEBUG, "join: equation[%zu] drives %zu locator(s)",
+	    kdj.kdj_driver, minn);
+
+	kdj.kdj_kd = kd;
+	kdj.kdj_kes = kes;
+	kdj.kdj_neqs = neqs;
+	kdj.kdj_maxnlocs = maxnlocs;
+	kdj.kdj_cb = cb;
+	kdj.kdj_arg = arg;
+	kdj.kdj_n = 0;
+	if (minn > 0 && ! kcndb_agg_match(kdj.kdj_kas[kdj.kdj_driver],
+	    (size_t)-1, kcndb_db_join_cb, &kdj))
+		goto out;
+	if (kdj.kdj_n == 0) {
+		KCN_LOG(DEBUG, "no matching locator found");
+		errno = ESRCH;
+		goto out;
+	}
+	rc = true;
+  out:
+	for (i = 0; i < neqs; i++)
+		kcndb_agg_destroy(kdj.kdj_kas[i]);
+	free(kdj.kdj_kas);
+	return rc;
+}
+
+/* call back a record if it matches an equation, and count it in *np. */
+static bool
+kcndb_db_scan_record(struct kcndb_db *kd, struct kcndb_db_table *kdt,
+    const struct kcn_eq *ke, struct kcndb_db_record *kdr, size_t *np,
+    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+{
+	size_t score;
+
+	if (! kcn_eq_time_match(kdr->kdr_time, ke) ||
+	    kcndb_db_tomb_match(kdt, kdr))
+		return true;
+
+	switch (ke->ke_op) {
+	case KCN_EQ_OP_LT:
+		if (kdr->kdr_val >= ke->ke_val)
+			return true;
+		break;
+	case KCN_EQ_OP_LE:
+		if (kdr->kdr_val > ke->ke_val)
+			return true;
+		break;
+	case KCN_EQ_OP_EQ:
+		if (kdr->kdr_val != ke->ke_val)
+			return true;
+		break;
+	case KCN_EQ_OP_GT:
+		if (kdr->kdr_val <= ke->ke_val)
+			return true;
+		break;
+	case KCN_EQ_OP_GE:
+		if (kdr->kdr_val < ke->ke_val)
+			return true;
+		break;
+	default:
+		assert(0);
+		return true;
+	}
+	if (! kcndb_db_loc_lookup(kd, kdr->kdr_locidx,
+	    &kdr->kdr_loc, &kdr->kdr_loclen)) {
+		KCN_LOG(DEBUG, "cannot find locator: %s", strerror(errno));
+		return false;
+	}
+	KCN_LOG(DEBUG, "record: match loc=%.*s",
+	    (int)kdr->kdr_loclen, kdr->kdr_loc);
+	score = 0; /* XXX: should compute score. */
+	if (! (*cb)(kdr, score, arg))
+		return false;
+	++*np;
+	return true;
+}
+
+/*
+ * call back matching records of a table, followed by those held in its
+ * reorder buffer and late segment, in addition to *np ones up to maxnlocs.
+ * the caller must hold a read lock.
+ */
+static bool
+kcndb_db_scan(struct kcndb_db *kd, struct kcndb_db_table *kdt,
+    const struct kcn_eq *ke, size_t maxnlocs, size_t *np,
+    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	struct kcn_buf *kb;
+	struct kcndb_db_record kdr;
+	size_t i, j, k, n;
+
+	if (! kcndb_file_seek_head(kdt->kdt_table, 0)) /* XXX: should improve */
+		return false;
+	kb = kcndb_file_buf(kdt->kdt_table);
+	kcn_buf_reset(kb, 0);
+
+	for (i = 0, n = *np; n < maxnlocs; i++) {
+		if (! kcndb_db_record_read(kdt->kdt_table, &kdr)) {
+			if (errno == ESHUTDOWN)
+				break;
+			/* XXX: should we accept this error??? */
+			KCN_LOG(ERR, "cannot read record: %s", strerror(errno));
+			return false;
+		}
+
+		KCN_LOG(DEBUG, "record[%zu]: %llu %llu %zu", i,
+		    (unsigned long long)kdr.kdr_time,
+		    (unsigned long long)kdr.kdr_val,
+		    (size_t)kdr.kdr_locidx);
+
+		if (! kcndb_db_scan_record(kd, kdt, ke, &kdr, &n, cb, arg))
+			return false;
+	}
+	for (j = 0; j < kdb->kdb_nreorder && n < maxnlocs; j++) {
+		kdr = kdb->kdb_reorder[j];
+		if (! kcndb_db_scan_record(kd, kdt, ke, &kdr, &n, cb, arg))
+			return false;
+	}
+	for (k = 0; k < kdb->kdb_nlate && n < maxnlocs; k++) {
+		kdr = kdb->kdb_late[k];
+		if (! kcndb_db_scan_record(kd, kdt, ke, &kdr, &n, cb, arg))
+			return false;
+	}
+
+	KCN_LOG(INFO, "%s: %zu record(s) read", kdt->kdt_name, i + j + k);
+	kcndb_stats_add(KCNDB_STATS_RECORDS_SCANNED, i + j + k);
+	kcndb_stats_add(KCNDB_STATS_RECORDS_MATCHED, n - *np);
+	*np = n;
+	return true;
+}
+
+/* whether records sorted in time order fall in a window. */
+static bool
+kcndb_db_held_overlap(const struct kcndb_db_record *kdrs, size_t n,
+    const struct kcn_eq *ke)
+{
+
+	return n > 0 && kdrs[n - 1].kdr_time >= ke->ke_start &&
+	    (ke->ke_end == KCN_TIME_NOW || kdrs[0].kdr_time <= ke->ke_end);
+}
+
+/* archives still count records hidden by tombstones. */
+static bool
+kcndb_db_tomb_exist(struct kcndb_db *kd, enum kcn_eq_type type)
+{
+	struct kcndb_db_table *kdt;
+	unsigned int shard;
+	size_t n;
+
+	for (shard = 0; shard < kcndb_db_table_nshards(type); shard++) {
+		kdt = kcndb_db_table_lookup(kd, type, shard);
+		if (! kcndb_db_rdlock(kdt))
+			return true;
+		n = kdt->kdt_base->kdb_ntombs;
+		kcndb_db_unlock(kdt);
+		if (n > 0)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * nor do they count records held in reorder buffers or late segments in a
+ * window.
+ */
+static bool
+kcndb_db_held_exist(struct kcndb_db *kd, const struct kcn_eq *ke)
+{
+	struct kcndb_db_table *kdt;
+	struct kcndb_db_base *kdb;
+	unsigned int shard;
+	bool rc;
+
+	for (shard = 0; shard < kcndb_db_table_nshards(ke->ke_type);
+	    shard++) {
+		kdt = kcndb_db_table_lookup(kd, ke->ke_type, shard);
+		if (! kcndb_db_rdlock(kdt))
+			return true;
+		kdb = kdt->kdt_base;
+		rc = kcndb_db_held_overlap(kdb->kdb_reorder,
+		    kdb->kdb_nreorder, ke) ||
+		    kcndb_db_held_overlap(kdb->kdb_late, kdb->kdb_nlate, ke);
+		kcndb_db_unlock(kdt);
+		if (rc)
+			return true;
+	}
+	return false;
+}
+
+static bool
+kcndb_db_select(struct kcndb_db *kd, const struct kcn_eq *ke, size_t neqs,
+    size_t maxnlocs,
+    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+{
+	struct kcndb_db_table *kdt;
+	unsigned int shard;
+	uint64_t start;
+	size_t n;
+	time_t now;
+	int archive;
+	bool rc;
+
+	assert(neqs > 0);
+	if (neqs > 1)
+		return kcndb_db_join(kd, ke, neqs, maxnlocs, cb, arg);
+	if (ke->ke_func != KCN_EQ_FUNC_NONE) {
+		if (time(&now) == -1)
+			return false;
+		/*
+		 * an aggregate over a long window is answered by
+		 * consolidated samples if possible.
+		 */
+		archive = kcndb_rra_select(ke, now);
+		if (archive >= 0 && ! kcndb_db_tomb_exist(kd, ke->ke_type) &&
+		    ! kcndb_db_held_exist(kd, ke)) {
+			kcndb_stats_add(KCNDB_STATS_ARCHIVE_HITS, 1);
+			return kcndb_db_archive(kd, ke, archive, now, maxnlocs,
+			    cb, arg);
+		}
+		return kcndb_db_aggregate(kd, ke, maxnlocs, cb, arg);
+	}
+
+	/* shards are scanned in turn, and their matches are concatenated. */
+	n = 0;
+	for (shard = 0; shard < kcndb_db_table_nshards(ke->ke_type) &&
+	    n < maxnlocs; shard++) {
+		kdt = kcndb_db_table_lookup(kd, ke->ke_type, shard);
+		if (! kcndb_db_rdlock(kdt))
+			return false;
+		start = kcndb_stats_now();
+		rc = kcndb_db_scan(kd, kdt, ke, maxnlocs, &n, cb, arg);
+		kcndb_stats_latency(KCNDB_STATS_STAGE_SCAN, start);
+		kcndb_db_unlock(kdt);
+		if (! rc)
+			return false;
+	}
+	if (n == 0) {
+		KCN_LOG(DEBUG, "no matching record found");
+		errno = ESRCH;
+		return false;
+	}
+	return true;
+}
+
+bool
+kcndb_db_search(struct kcndb_db *kd, const struct kcn_eq *ke, size_t neqs,
+    size_t maxnlocs,
+    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+{
+	uint64_t start;
+	bool rc;
+
+	start = kcndb_stats_now();
+	if (! kcndb_db_enter(kd))
+		return false;
+	rc = kcndb_db_select(kd, ke, neqs, maxnlocs, cb, arg);
+	kcndb_db_leave(kd);
+	kcndb_stats_latency(KCNDB_STATS_STAGE_SEARCH, start);
+	return rc;
+}
+
+/*
+ * a cursor on a posting list of a locator in a shard, or on records held
+ * in a reorder buffer or a late segment of a shard, whose records of other
+ * locators are skipped.
+ */
+struct kcndb_db_history {
+	struct kcndb_db_table *kdh_kdt;
+	const uint64_t *kdh_offs;	/* NULL for records held */
+	const struct kcndb_db_record *kdh_held;
+	uint64_t kdh_locidx;
+	size_t kdh_noffs;
+	size_t kdh_i;
+	struct kcndb_db_record kdh_kdr;
+};
+
+static bool
+kcndb_db_history_read_at(struct kcndb_db_history *kdh, size_t i)
+{
+
+	if (kdh->kdh_offs == NULL) {
+		kdh->kdh_kdr = kdh->kdh_held[i];
+		return true;
+	}
+	return kcndb_db_record_read_at(kdh->kdh_kdt, kdh->kdh_offs[i],
+	    &kdh->kdh_kdr);
+}
+
+/*
+ * read a record at a cursor skipping deleted ones, or mark a cursor
+ * exhausted.
+ */
+static bool
+kcndb_db_history_read(struct kcndb_db_history *kdh, time_t end)
+{
+
+	for (; kdh->kdh_i < kdh->kdh_noffs; kdh->kdh_i++) {
+		if (! kcndb_db_history_read_at(kdh, kdh->kdh_i))
+			return false;
+		if (kdh->kdh_kdr.kdr_locidx != kdh->kdh_locidx)
+			continue;
+		if (end != KCN_TIME_NOW && kdh->kdh_kdr.kdr_time > end) {
+			kdh->kdh_i = kdh->kdh_noffs;
+			break;
+		}
+		if (! kcndb_db_tomb_match(kdh->kdh_kdt, &kdh->kdh_kdr))
+			break;
+	}
+	return true;
+}
+
+/* position a cursor at the first record in a window by a binary search. */
+static bool
+kcndb_db_history_seek(struct kcndb_db_history *kdh, time_t start, time_t end)
+{
+	size_t i, lo, hi;
+
+	lo = 0;
+	hi = kdh->kdh_noffs;
+	while (lo < hi) {
+		i = lo + (hi - lo) / 2;
+		if (! kcndb_db_history_read_at(kdh, i))
+			return false;
+		if (kdh->kdh_kdr.kdr_time < start)
+			lo = i + 1;
+		else
+			hi = i;
+	}
+	kdh->kdh_i = lo;
+	return kcndb_db_history_read(kdh, end);
+}
+
+/* position a cursor on records held if any, and count it in *np. */
+static bool
+kcndb_db_history_held(struct kcndb_db_history *kdh,
+    struct kcndb_db_table *kdt, uint64_t locidx,
+    const struct kcndb_db_record *kdrs, size_t n, time_t start, time_t end,
+    unsigned int *np)
+{
+
+	if (n == 0)
+		return true;
+	kdh->kdh_kdt = kdt;
+	kdh->kdh_locidx = locidx;
+	kdh->kdh_offs = NULL;
+	kdh->kdh_held = kdrs;
+	kdh->kdh_noffs = n;
+	if (! kcndb_db_history_seek(kdh, start, end))
+		return false;
+	++*np;
+	return true;
+}
+
+/*
+ * call back samples of a locator in a time range in time order.  records
+ * are found by a posting list of the locator instead of a full scan, and
+ * in a reorder buffer and a late segment.  all shards are looked up since
+ * a locator may have moved to another shard when the number of shards was
+ * changed, and records are merged in time order.
+ */
+static bool
+kcndb_db_history_merge(struct kcndb_db *kd, enum kcn_eq_type type,
+    const char *loc, size_t loclen, time_t start, time_t end,
+    size_t maxcount,
+    bool (*cb)(const struct kcndb_db_record *, void *), void *arg)
+{
+	struct kcndb_db_history kdhs[KCNDB_DB_SHARD_MAX * 3], *kdh, *min;
+	struct kcndb_db_table *kdt;
+	struct kcndb_db_base *kdb;
+	struct kcndb_db_record kdr;
+	uint64_t locidx;
+	unsigned int shard, nshards, nlocked, ncursors;
+	size_t n, nreads;
+	bool rc;
+
+	if (! kcndb_db_loc_get(kd, loc, loclen, &locidx)) {
+		if (errno == ENOENT)
+			goto nolocator;
+		return false;
+	}
+
+	/* lock shards in order to avoid a deadlock. */
+	rc = false;
+	nshards = kcndb_db_table_nshards(type);
+	ncursors = 0;
+	for (nlocked = 0; nlocked < nshards; nlocked++) {
+		kdt = kcndb_db_table_lookup(kd, type, nlocked);
+		if (! kcndb_db_rdlock(kdt))
+			goto out;
+		kdh = &kdhs[ncursors];
+		kdh->kdh_kdt = kdt;
+		kdh->kdh_locidx = locidx;
+		if (kcndb_post_lookup(kcndb_db_post(kdt), locidx,
+		    &kdh->kdh_offs, &kdh->kdh_noffs)) {
+			if (! kcndb_db_history_seek(kdh, start, end))
+				goto out;
+			++ncursors;
+		}
+		kdb = kdt->kdt_base;
+		/* records held follow those written at the same time. */
+		if (! kcndb_db_history_held(&kdhs[ncursors], kdt, locidx,
+		    kdb->kdb_reorder, kdb->kdb_nreorder, start, end,
+		    &ncursors) ||
+		    ! kcndb_db_history_held(&kdhs[ncursors], kdt, locidx,
+		    kdb->kdb_late, kdb->kdb_nlate, start, end, &ncursors))
+			goto out;
+	}
+	if (ncursors == 0) {
+		errno = ENOENT;
+		goto out;
+	}
+
+	kdr.kdr_loc = loc;
+	kdr.kdr_loclen = loclen;
+	for (n = nreads = 0; maxcount == 0 || n < maxcount; n++) {
+		min = NULL;
+		for (shard = 0; shard < ncursors; shard++) {
+			kdh = &kdhs[shard];
+			if (kdh->kdh_i < kdh->kdh_noffs &&
+			    (min == NULL ||
+			    kdh->kdh_kdr.kdr_time < min->kdh_kdr.kdr_time))
+				min = kdh;
+		}
+		if (min == NULL)
+			break;
+		kdr.kdr_time = min->kdh_kdr.kdr_time;
+		kdr.kdr_val = min->kdh_kdr.kdr_val;
+		kdr.kdr_locidx = min->kdh_kdr.kdr_locidx;
+		if (! (*cb)(&kdr, arg))
+			goto out;
+		++min->kdh_i;
+		++nreads;
+		if (! kcndb_db_history_read(min, end))
+			goto out;
+	}
+	KCN_LOG(INFO, "%zu record(s) read from %u cursor(s)", nreads,
+	    ncursors);
+	if (n == 0) {
+		KCN_LOG(DEBUG, "no record found in a window");
+		errno = ESRCH;
+		goto out;
+	}
+	rc = true;
+  out:
+	while (nlocked-- > 0)
+		kcndb_db_unlock(kcndb_db_table_lookup(kd, type, nlocked));
+	if (rc || errno != ENOENT)
+		return rc;
+  nolocator:
+	KCN_LOG(DEBUG, "no record of %.*s", (int)loclen, loc);
+	errno = ESRCH;
+	return false;
+}
+
+bool
+kcndb_db_history(struct kcndb_db *kd, enum kcn_eq_type type,
+    const char *loc, size_t loclen, time_t start, time_t end,
+    size_t maxcount,
+    bool (*cb)(const struct kcndb_db_record *, void *), void *arg)
+{
+	bool rc;
+
+	if (! kcndb_db_enter(kd))
+		return false;
+	rc = kcndb_db_history_merge(kd, type, loc, loclen, start, end,
+	    maxcount, cb, arg);
+	kcndb_db_leave(kd);
+	return rc;
+}
+
+void
+kcndb_db_durability_set(enum kcndb_db_durability durability,
+    unsigned int interval)
+{
+
+	kcndb_db_durability = durability;
+	kcndb_db_sync_interval = interval;
+}
+
+/*
+ * flush dirty files.  the dictionary is flushed first so that flushed
+ * records refer to flushed locators as far as possible.
+ */
+bool
+kcndb_db_sync(struct kcndb_db *kd)
+{
+	bool dirty[KCN_EQ_TYPE_MAX - 1][KCNDB_DB_SHARD_MAX];
+	struct kcndb_db_table *kdt;
+	enum kcn_eq_type type;
+	unsigned int shard;
+	int idx;
+	bool rc;
+
+	if (! kcndb_db_enter(kd))
+		return false;
+	rc = true;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		idx = TYPE2INDEX(type);
+		for (shard = 0; shard < kcndb_db_table_nshards(type); shard++)
+			dirty[idx][shard] = kcndb_db_dirty_clear(
+			    &kcndb_db_base[idx][shard].kdb_dirty);
+	}
+	if (kcndb_db_dirty_clear(&kcndb_db_locdirty) &&
+	    ! kcndb_file_sync(kd->kd_loc)) {
+		kcndb_db_dirty(&kcndb_db_locdirty);
+		rc = false;
+	}
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		idx = TYPE2INDEX(type);
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			if (dirty[idx][shard] &&
+			    ! kcndb_file_sync(kdt->kdt_table)) {
+				kcndb_db_dirty(&kdt->kdt_base->kdb_dirty);
+				rc = false;
+			}
+		}
+	}
+	kcndb_db_leave(kd);
+	return rc;
+}
+
+/* write records held in reorder buffers of all shards if any. */
+static bool
+kcndb_db_reorder_drain_all(struct kcndb_db *kd)
+{
+	struct kcndb_db_table *kdt;
+	enum kcn_eq_type type;
+	unsigned int shard;
+	bool rc;
+
+	if (kcndb_db_reorder_window == 0)
+		return true;
+	if (! kcndb_db_enter(kd))
+		return false;
+	rc = true;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			if (! kcndb_db_wrlock(kdt)) {
+				rc = false;
+				continue;
+			}
+			if (! kcndb_db_reorder_drain(kdt))
+				rc = false;
+			kcndb_db_unlock(kdt);
+		}
+	kcndb_db_leave(kd);
+	return rc;
+}
+
+/*
+ * called after a batch of messages received at once is processed.  records
+ * acknowledged must not be left in reorder buffers.
+ */
+bool
+kcndb_db_batch_done(struct kcndb_db *kd)
+{
+
+	if (kcndb_db_durability != KCNDB_DB_DURABILITY_BATCH)
+		return true;
+	if (! kcndb_db_reorder_drain_all(kd))
+		return false;
+	return kcndb_db_sync(kd);
+}
+
+/* records held in reorder buffers are also written on every sync. */
+static void *
+kcndb_db_syncer_main(void *arg)
+{
+	struct kcndb_db *kd = arg;
+	struct timespec ts;
+
+	ts.tv_sec = kcndb_db_sync_interval / 1000;
+	ts.tv_nsec = (kcndb_db_sync_interval % 1000) * 1000 * 1000;
+	for (;;) {
+		(void)nanosleep(&ts, NULL);
+		(void)kcndb_db_reorder_drain_all(kd);
+		(void)kcndb_db_sync(kd);
+	}
+	/*NOTREACHED*/
+	return NULL;
+}
+
+/* start a thread flushing files periodically if necessary. */
+bool
+kcndb_db_syncer_start(void)
+{
+	struct kcndb_db *kd;
+	pthread_t tid;
+	int error;
+
+	if (kcndb_db_durability != KCNDB_DB_DURABILITY_PERIODIC)
+		return true;
+	kd = kcndb_db_new();
+	if (kd == NULL)
+		return false;
+	error = pthread_create(&tid, NULL, kcndb_db_syncer_main, kd);
+	if (error != 0) {
+		kcndb_db_destroy(kd);
+		errno = error;
+		return false;
+	}
+	(void)pthread_detach(tid);
+	KCN_LOG(INFO, "sync files every %u msec", kcndb_db_sync_interval);
+	return true;
+}
+
+static bool
+kcndb_db_warmup_file(struct kcndb_file *kf, const char *name, size_t size,
+    size_t len, bool lock)
+{
+
+	if (len == 0)
+		return true;
+	KCN_LOG(INFO, "warm up %s: last %zu of %zu byte(s)", name, len, size);
+	return kcndb_file_warmup(kf, size - len, len, lock);
+}
+
+static int
+kcndb_db_warmup_cmp(const void *a0, const void *b0)
+{
+	const struct kcndb_db_table * const *a = a0, * const *b = b0;
+	size_t asize, bsize;
+
+	asize = kcndb_db_table_size(*a);
+	bsize = kcndb_db_table_size(*b);
+	return asize < bsize ? -1 : asize > bsize ? 1 : 0;
+}
+
+/*
+ * read ahead, or lock onto memory, the whole dictionary and the recent part
+ * of every table within a memory budget before a server starts.  a budget
+ * left after the dictionary is evenly shared among tables, and a share that
+ * a small table does not use is passed to larger ones.
+ */
+bool
+kcndb_db_warmup(size_t budget, bool lock)
+{
+	struct kcndb_db *kd;
+	struct kcndb_db_table *kdts[(KCN_EQ_TYPE_MAX - 1) * KCNDB_DB_SHARD_MAX];
+	struct timespec start, end;
+	enum kcn_eq_type type;
+	unsigned int shard;
+	size_t i, n, size, len, total;
+	bool rc;
+
+	if (budget == 0)
+		return true;
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	KCN_LOG(INFO, "warm up with %zu byte(s) of budget%s", budget,
+	    lock ? " locked" : "");
+	kd = kcndb_db_new();
+	if (kd == NULL)
+		return false;
+	rc = false;
+	total = 0;
+
+	if (! kcndb_db_loc_rdlock())
+		goto out;
+	size = kcndb_db_locsize;
+	kcndb_db_loc_unlock();
+	len = size < budget ? size : budget;
+	if (! kcndb_db_warmup_file(kd->kd_loc, KCNDB_DB_PATH_LOC, size, len,
+	    lock))
+		goto out;
+	total += len;
+
+	n = 0;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type); shard++)
+			kdts[n++] = kcndb_db_table_lookup(kd, type, shard);
+	qsort(kdts, n, sizeof(kdts[0]), kcndb_db_warmup_cmp);
+	for (i = 0; i < n; i++) {
+		size = kcndb_db_table_size(kdts[i]);
+		len = (budget - total) / (n - i);
+		if (len > size)
+			len = size;
+		len -= len % KCNDB_DB_RECORDSIZ;
+		if (! kcndb_db_warmup_file(kdts[i]->kdt_table,
+		    kdts[i]->kdt_name, size, len, lock))
+			goto out;
+		total += len;
+	}
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &end);
+	if (end.tv_nsec < start.tv_nsec) {
+		end.tv_nsec += 1000 * 1000 * 1000;
+		--end.tv_sec;
+	}
+	KCN_LOG(INFO, "warm up %zu byte(s) in %ld.%03ld sec", total,
+	    (long)(end.tv_sec - start.tv_sec),
+	    (end.tv_nsec - start.tv_nsec) / (1000 * 1000));
+	rc = true;
+  out:
+	if (rc && lock)
+		kcndb_db_warm = kd;
+	else
+		kcndb_db_destroy(kd);
+	return rc;
+}
+
+void
+kcndb_db_checkpoint_interval_set(unsigned int interval)
+{
+
+	kcndb_db_checkpoint_interval = interval;
+}
+
+/*
+ * write a checkpoint of indexes of a table if records were added after the
+ * last one.  indexes are serialized in memory under a read lock, and
+ * written after the lock is released.  the table is flushed first so that
+ * a checkpoint never covers records that may be lost, and the checkpoint
+ * replaces an old one atomically unless records were rewritten meanwhile.
+ */
+static bool
+kcndb_db_checkpoint(struct kcndb_db_table *kdt)
+{
+	struct kcndb_db_base *kdb;
+	struct kcndb_file *kf;
+	struct kcn_buf *kb;
+	struct kcndb_db_record kdr;
+	char path[MAXPATHLEN], tpath[MAXPATHLEN];
+	const char *name;
+	uint64_t rewrites;
+	size_t size;
+	bool locked, rc;
+
+	kdb = kdt->kdt_base;
+	name = kdt->kdt_name;
+	kcndb_db_checkpoint_path(path, sizeof(path), kdt,
+	    KCNDB_DB_PATH_CHECKPOINT_SUFFIX);
+	kcndb_db_checkpoint_path(tpath, sizeof(tpath), kdt,
+	    KCNDB_DB_PATH_CHECKPOINT_TEMP_SUFFIX);
+	if (! kcndb_db_rdlock(kdt))
+		return false;
+	size = kcndb_db_table_size(kdt);
+	if (size == kdb->kdb_ckptsize) {
+		kcndb_db_unlock(kdt);
+		return true;
+	}
+	locked = true;
+	kf = NULL;
+	rc = false;
+	rewrites = kdb->kdb_rewrites;
+	if (! kcndb_db_record_read_last(kdt, &kdr))
+		goto out;
+	(void)unlink(tpath);
+	kf = kcndb_file_open(tpath);
+	if (kf == NULL)
+		goto out;
+	kcndb_file_spool(kf);
+	kb = kcndb_file_buf(kf);
+	kcn_buf_reset(kb, 0);
+	kcn_buf_put32(kb, KCNDB_DB_CHECKPOINT_MAGIC);
+	kcn_buf_put32(kb, KCNDB_DB_CHECKPOINT_VERSION);
+	kcn_buf_put64(kb, size);
+	kcn_buf_put64(kb, kdr.kdr_time);
+	kcn_buf_put64(kb, kdr.kdr_val);
+	kcn_buf_put64(kb, kdr.kdr_locidx);
+	if (! kcndb_post_save(kdb->kdb_post, kf) ||
+	    ! kcndb_rra_save(kdb->kdb_rra, kf) ||
+	    ! kcndb_file_append(kf))
+		goto out;
+	kcndb_db_unlock(kdt);
+	locked = false;
+
+	/* a table may grow meanwhile, but records covered are written. */
+	if (! kcndb_file_sync(kdt->kdt_table) ||
+	    ! kcndb_file_spool_flush(kf) || ! kcndb_file_sync(kf))
+		goto out;
+
+	if (! kcndb_db_rdlock(kdt))
+		goto out;
+	locked = true;
+	/* a checkpoint would refer to offsets of rewritten records. */
+	if (kdb->kdb_rewrites != rewrites) {
+		KCN_LOG(INFO, "%s: discard checkpoint of rewritten records",
+		    name);
+		(void)unlink(tpath);
+		rc = true;
+		goto out;
+	}
+	if (rename(tpath, path) == -1)
+		goto out;
+	/* only a checkpointer updates this under a read lock. */
+	kdb->kdb_ckptsize = size;
+	KCN_LOG(INFO, "%s: checkpoint %llu record(s)", name,
+	    (unsigned long long)(size / KCNDB_DB_RECORDSIZ));
+	rc = true;
+  out:
+	if (! rc) {
+		KCN_LOG(ERR, "%s: cannot write checkpoint: %s", name,
+		    strerror(errno));
+		(void)unlink(tpath);
+	}
+	kcndb_file_close(kf);
+	if (locked)
+		kcndb_db_unlock(kdt);
+	return rc;
+}
+
+static void *
+kcndb_db_checkpointer_main(void *arg)
+{
+	struct kcndb_db *kd = arg;
+	enum kcn_eq_type type;
+	unsigned int shard;
+
+	/* the first checkpoint saves a scan at the next startup. */
+	for (;;) {
+		if (kcndb_db_enter(kd)) {
+			for (type = KCN_EQ_TYPE_MIN + 1;
+			    type < KCN_EQ_TYPE_MAX; type++)
+				for (shard = 0;
+				    shard < kcndb_db_table_nshards(type);
+				    shard++)
+					(void)kcndb_db_checkpoint(
+					    kcndb_db_table_lookup(kd, type,
+					    shard));
+			kcndb_db_leave(kd);
+		}
+		(void)sleep(kcndb_db_checkpoint_interval);
+	}
+	/*NOTREACHED*/
+	return NULL;
+}
+
+/* start a thread writing checkpoints of indexes periodically if enabled. */
+bool
+kcndb_db_checkpointer_start(void)
+{
+	struct kcndb_db *kd;
+	pthread_t tid;
+	int error;
+
+	if (kcndb_db_checkpoint_interval == 0)
+		return true;
+	kd = kcndb_db_new();
+	if (kd == NULL)
+		return false;
+	error = pthread_create(&tid, NULL, kcndb_db_checkpointer_main, kd);
+	if (error != 0) {
+		kcndb_db_destroy(kd);
+		errno = error;
+		return false;
+	}
+	(void)pthread_detach(tid);
+	KCN_LOG(INFO, "checkpoint indexes every %u sec",
+	    kcndb_db_checkpoint_interval);
+	return true;
+}
+
+void
+kcndb_db_compact_interval_set(unsigned int interval)
+{
+
+	kcndb_db_compact_interval = interval;
+}
+
+/*
+ * complete a compaction or an attachment committed by a marker: replace
+ * tables by rewritten ones after removing their tombstones, late segments
+ * and checkpoints, and replace the dictionary if rewritten.  each step can
+ * be redone if interrupted, and the marker is removed at last.
+ */
+static bool
+kcndb_db_compact_finish(void)
+{
+	enum kcn_eq_type type;
+	char name[KCNDB_DB_NAMELEN], path[MAXPATHLEN], cpath[MAXPATHLEN];
+	unsigned int shard;
+
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < KCNDB_DB_SHARD_MAX; shard++) {
+			kcndb_db_table_name(name, sizeof(name), type, shard);
+			(void)snprintf(path, sizeof(path), "%s/%s%s",
+			    kcndb_db_path, name, KCNDB_DB_PATH_COMPACT_SUFFIX);
+			if (access(path, F_OK) == -1) {
+				if (errno != ENOENT)
+					return false;
+				continue;
+			}
+			(void)snprintf(cpath, sizeof(cpath), "%s/%s%s",
+			    kcndb_db_path, name, KCNDB_DB_PATH_TOMB_SUFFIX);
+			if (unlink(cpath) == -1 && errno != ENOENT)
+				return false;
+			(void)snprintf(cpath, sizeof(cpath), "%s/%s%s",
+			    kcndb_db_path, name,
+			    KCNDB_DB_PATH_CHECKPOINT_SUFFIX);
+			if (unlink(cpath) == -1 && errno != ENOENT)
+				return false;
+			(void)snprintf(cpath, sizeof(cpath), "%s/%s%s",
+			    kcndb_db_path, name, KCNDB_DB_PATH_MERGE_SUFFIX);
+			if (unlink(cpath) == -1 && errno != ENOENT)
+				return false;
+			(void)snprintf(cpath, sizeof(cpath), "%s/%s%s",
+			    kcndb_db_path, name, KCNDB_DB_PATH_LATE_SUFFIX);
+			if (unlink(cpath) == -1 && errno != ENOENT)
+				return false;
+			(void)snprintf(cpath, sizeof(cpath), "%s/%s",
+			    kcndb_db_path, name);
+			if (rename(path, cpath) == -1)
+				return false;
+		}
+	(void)snprintf(path, sizeof(path), "%s/%s%s",
+	    kcndb_db_path, KCNDB_DB_PATH_LOC, KCNDB_DB_PATH_COMPACT_SUFFIX);
+	(void)snprintf(cpath, sizeof(cpath), "%s/%s",
+	    kcndb_db_path, KCNDB_DB_PATH_LOC);
+	if (rename(path, cpath) == -1 && errno != ENOENT)
+		return false;
+	(void)snprintf(path, sizeof(path), "%s/%s",
+	    kcndb_db_path, KCNDB_DB_PATH_COMMIT);
+	return unlink(path) == 0 ? true : false;
+}
+
+/* files written aside are committed by creating a marker. */
+static bool
+kcndb_db_compact_commit(void)
+{
+	struct kcndb_file *kf;
+	char path[MAXPATHLEN];
+	bool rc;
+
+	(void)snprintf(path, sizeof(path), "%s/%s",
+	    kcndb_db_path, KCNDB_DB_PATH_COMMIT);
+	kf = kcndb_file_open(path);
+	if (kf == NULL)
+		return false;
+	rc = kcndb_file_sync(kf);
+	kcndb_file_close(kf);
+	return rc;
+}
+
+/*
+ * complete a committed compaction or attachment interrupted by a crash, or
+ * remove files left by an uncommitted one.
+ */
+static void
+kcndb_db_compact_recover(void)
+{
+	enum kcn_eq_type type;
+	char name[KCNDB_DB_NAMELEN], path[MAXPATHLEN];
+	unsigned int shard;
+
+	(void)snprintf(path, sizeof(path), "%s/%s",
+	    kcndb_db_path, KCNDB_DB_PATH_COMMIT);
+	if (access(path, F_OK) == 0) {
+		KCN_LOG(INFO, "complete committed rewrite of files");
+		if (! kcndb_db_compact_finish())
+			KCN_LOG(ERR, "cannot complete rewrite of files: %s",
+			    strerror(errno));
+		return;
+	}
+	(void)snprintf(path, sizeof(path), "%s/%s%s",
+	    kcndb_db_path, KCNDB_DB_PATH_LOC, KCNDB_DB_PATH_COMPACT_SUFFIX);
+	(void)unlink(path);
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < KCNDB_DB_SHARD_MAX; shard++) {
+			kcndb_db_table_name(name, sizeof(name), type, shard);
+			(void)snprintf(path, sizeof(path), "%s/%s%s",
+			    kcndb_db_path, name, KCNDB_DB_PATH_COMPACT_SUFFIX);
+			(void)unlink(path);
+		}
+}
+
+/*
+ * indexes are rebuilt when files are opened for the first time, and late
+ * segments are loaded again.
+ */
+static void
+kcndb_db_base_reset(struct kcndb_db_base *kdb)
+{
+
+	kcndb_post_destroy(kdb->kdb_post);
+	kcndb_rra_destroy(kdb->kdb_rra);
+	kcndb_tomb_destroy(kdb->kdb_tomb);
+	free(kdb->kdb_late);
+	kdb->kdb_post = NULL;
+	kdb->kdb_rra = NULL;
+	kdb->kdb_tomb = NULL;
+	kdb->kdb_ntombs = 0;
+	kdb->kdb_late = NULL;
+	kdb->kdb_nlate = kdb->kdb_latemax = 0;
+}
+
+/*
+ * a shard rewritten aside by a compaction or an attachment, with its
+ * indexes built on the way.  records up to a size at a snapshot and late
+ * ones copied at the snapshot are rewritten without a lock, and are
+ * rewritten again if records are rewritten, deleted or kept late
+ * meanwhile.
+ */
+struct kcndb_db_compact_shard {
+	struct kcndb_file *kdcs_kf;
+	struct kcndb_post *kdcs_post;
+	struct kcndb_rra *kdcs_rra;
+	struct kcndb_tomb *kdcs_tomb;	/* tombstones at a snapshot */
+	size_t kdcs_ntombs;
+	size_t kdcs_size;		/* table size at a snapshot */
+	struct kcndb_db_record *kdcs_late;	/* late records at a snapshot */
+	size_t kdcs_nlate;
+	uint64_t kdcs_rewrites;
+	uint64_t kdcs_off;		/* to which a next record is written */
+	time_t kdcs_last;		/* time of the last record written */
+	size_t kdcs_ndeleted;
+	size_t kdcs_nstaged;		/* records attached */
+};
+
+struct kcndb_db_compact {
+	struct kcndb_db *kdc_kd;
+	struct kcndb_db_loc_map *kdc_map;	/* sorted by old indexes */
+	size_t kdc_n;
+	size_t kdc_nmax;
+	size_t kdc_omapsize;		/* size of an old dictionary mapped */
+	struct kcndb_file *kdc_loc;	/* a new dictionary */
+	uint64_t kdc_heads[KCNDB_DB_LOC_HASHSIZ];
+	uint64_t kdc_locsize;
+	struct kcndb_db_compact_shard
+	    kdc_shards[KCN_EQ_TYPE_MAX - 1][KCNDB_DB_SHARD_MAX];
+};
+
+/* map entries of an old dictionary up to a size to no index. */
+static bool
+kcndb_db_compact_map(struct kcndb_db_compact *kdc, size_t size)
+{
+	struct kcndb_file *kf = kdc->kdc_kd->kd_loc;
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+	struct kcndb_db_loc_map *map;
+	uint64_t oidx;
+	size_t len;
+
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_seek_head(kf, kdc->kdc_omapsize))
+		return false;
+	for (oidx = kdc->kdc_omapsize; oidx < size;
+	    oidx += sizeof(uint16_t) + len + sizeof(uint64_t)) {
+		if (! kcndb_file_ensure(kf, sizeof(uint16_t)))
+			return false;
+		len = kcn_buf_get16(kb);
+		if (! kcndb_file_ensure(kf,
+		    sizeof(uint16_t) + len + sizeof(uint64_t)))
+			return false;
+		if (kdc->kdc_n == kdc->kdc_nmax) {
+			kdc->kdc_nmax = kdc->kdc_nmax == 0 ?
+			    KCNDB_DB_LOC_HASHSIZ : kdc->kdc_nmax * 2;
+			map = realloc(kdc->kdc_map,
+			    kdc->kdc_nmax * sizeof(*map));
+			if (map == NULL)
+				return false;
+			kdc->kdc_map = map;
+		}
+		kdc->kdc_map[kdc->kdc_n].kdlm_oidx = oidx;
+		kdc->kdc_map[kdc->kdc_n].kdlm_idx = 0;
+		++kdc->kdc_n;
+		kcn_buf_forward(kb, len + sizeof(uint64_t));
+		kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	}
+	kdc->kdc_omapsize = size;
+	return true;
+}
+
+static struct kcndb_db_loc_map *
+kcndb_db_compact_lookup(struct kcndb_db_compact *kdc, uint64_t oidx)
+{
+	struct kcndb_db_loc_map *kdlm, key;
+
+	key.kdlm_oidx = oidx;
+	kdlm = bsearch(&key, kdc->kdc_map, kdc->kdc_n, sizeof(*kdlm),
+	    kcndb_db_loc_map_cmp);
+	if (kdlm == NULL) {
+		KCN_LOG(ERR, "compact: unknown locator index %llu",
+		    (unsigned long long)oidx);
+		errno = ENXIO;
+	}
+	return kdlm;
+}
+
+/*
+ * add a locator to a new dictionary, which is prepended to its chain.  a
+ * new index must belong to the same shard as an old one since records are
+ * rewritten in their shards, and empty entries linked to themselves, which
+ * are ignored as unlinked ones, are put before the locator until it does.
+ */
+static bool
+kcndb_db_compact_loc_add(struct kcndb_db_compact *kdc, const char *loc,
+    size_t len, struct kcndb_db_loc_map *kdlm)
+{
+	struct kcn_buf *tkb = kcndb_file_buf(kdc->kdc_loc);
+	unsigned int h;
+
+	while (kcndb_db_shard(kdc->kdc_locsize) !=
+	    kcndb_db_shard(kdlm->kdlm_oidx)) {
+		if (! kcndb_file_reserve(kdc->kdc_loc,
+		    sizeof(uint16_t) + sizeof(uint64_t)))
+			return false;
+		kcn_buf_put16(tkb, 0);
+		kcn_buf_put64(tkb, kdc->kdc_locsize);
+		kdc->kdc_locsize += sizeof(uint16_t) + sizeof(uint64_t);
+	}
+	h = kcn_str_hash(loc, len, KCNDB_DB_LOC_HASHSIZ);
+	if (! kcndb_file_reserve(kdc->kdc_loc,
+	    sizeof(uint16_t) + len + sizeof(uint64_t)))
+		return false;
+	kcn_buf_put16(tkb, len);
+	kcn_buf_put(tkb, loc, len);
+	kcn_buf_put64(tkb, kdc->kdc_heads[h]);
+	kdc->kdc_heads[h] = kdlm->kdlm_idx = kdc->kdc_locsize;
+	kdc->kdc_locsize += sizeof(uint16_t) + len + sizeof(uint64_t);
+	return true;
+}
+
+/*
+ * (re)start a table of a shard written aside.  an old table is kept until
+ * a commit.
+ */
+static bool
+kcndb_db_compact_shard_init(struct kcndb_db_table *kdt,
+    struct kcndb_db_compact_shard *kdcs)
+{
+	char tpath[MAXPATHLEN];
+
+	kcndb_file_close(kdcs->kdcs_kf);
+	kcndb_post_destroy(kdcs->kdcs_post);
+	kcndb_rra_destroy(kdcs->kdcs_rra);
+	kdcs->kdcs_off = 0;
+	kdcs->kdcs_last = 0;
+	kdcs->kdcs_ndeleted = 0;
+	kdcs->kdcs_nstaged = 0;
+	kcndb_db_checkpoint_path(tpath, sizeof(tpath), kdt,
+	    KCNDB_DB_PATH_COMPACT_SUFFIX);
+	(void)unlink(tpath);
+	kdcs->kdcs_kf = kcndb_file_open(tpath);
+	kdcs->kdcs_post = kcndb_post_new();
+	kdcs->kdcs_rra = kcndb_rra_new();
+	if (kdcs->kdcs_kf == NULL || kdcs->kdcs_post == NULL ||
+	    kdcs->kdcs_rra == NULL)
+		return false;
+	kcn_buf_reset(kcndb_file_buf(kdcs->kdcs_kf), 0);
+	return true;
+}
+
+static void
+kcndb_db_compact_shard_finish(struct kcndb_db_compact_shard *kdcs)
+{
+
+	kcndb_file_close(kdcs->kdcs_kf);
+	kcndb_post_destroy(kdcs->kdcs_post);
+	kcndb_rra_destroy(kdcs->kdcs_rra);
+	kcndb_tomb_destroy(kdcs->kdcs_tomb);
+	free(kdcs->kdcs_late);
+}
+
+/* take a snapshot of a shard to be rewritten aside. */
+static bool
+kcndb_db_compact_snapshot(struct kcndb_db_table *kdt,
+    struct kcndb_db_compact_shard *kdcs)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	bool rc;
+
+	if (! kcndb_db_rdlock(kdt))
+		return false;
+	kdcs->kdcs_size = kdb->kdb_tablesize;
+	kdcs->kdcs_rewrites = kdb->kdb_rewrites;
+	kdcs->kdcs_ntombs = kdb->kdb_ntombs;
+	kdcs->kdcs_nlate = kdb->kdb_nlate;
+	rc = true;
+	if (kdcs->kdcs_nlate > 0) {
+		kdcs->kdcs_late = malloc(kdcs->kdcs_nlate *
+		    sizeof(*kdcs->kdcs_late));
+		if (kdcs->kdcs_late == NULL)
+			rc = false;
+		else
+			memcpy(kdcs->kdcs_late, kdb->kdb_late,
+			    kdcs->kdcs_nlate * sizeof(*kdcs->kdcs_late));
+	}
+	kcndb_db_unlock(kdt);
+	return rc;
+}
+
+/*
+ * a cursor on live records of a shard in a range of a table merged with
+ * late ones in time order, where records hidden by tombstones are skipped.
+ * records in a table precede late ones at the same time.
+ */
+struct kcndb_db_live {
+	struct kcndb_db_table *kdl_kdt;
+	const struct kcndb_tomb *kdl_kt;
+	uint64_t kdl_off;
+	uint64_t kdl_end;
+	const struct kcndb_db_record *kdl_late;
+	size_t kdl_nlate;
+	size_t kdl_i;
+	struct kcndb_db_record kdl_kdr;	/* a table record read ahead */
+	bool kdl_ahead;
+	size_t kdl_ndeleted;
+};
+
+static bool
+kcndb_db_live_init(struct kcndb_db_live *kdl, struct kcndb_db_table *kdt,
+    const struct kcndb_tomb *kt, uint64_t start, uint64_t end,
+    const struct kcndb_db_record *late, size_t nlate)
+{
+
+	if (! kcndb_file_seek_head(kdt->kdt_table, start))
+		return false;
+	kcn_buf_reset(kcndb_file_buf(kdt->kdt_table), 0);
+	kdl->kdl_kdt = kdt;
+	kdl->kdl_kt = kt;
+	kdl->kdl_off = start;
+	kdl->kdl_end = end;
+	kdl->kdl_late = late;
+	kdl->kdl_nlate = nlate;
+	kdl->kdl_i = 0;
+	kdl->kdl_ahead = false;
+	kdl->kdl_ndeleted = 0;
+	return true;
+}
+
+/* read the next live record, or fail with ESHUTDOWN at the end. */
+static bool
+kcndb_db_live_read(struct kcndb_db_live *kdl, struct kcndb_db_record *kdr)
+{
+	const struct kcndb_db_record *late;
+
+	for (;;) {
+		if (! kdl->kdl_ahead && kdl->kdl_off < kdl->kdl_end) {
+			if (! kcndb_db_record_read(kdl->kdl_kdt->kdt_table,
+			    &kdl->kdl_kdr))
+				return false;
+			kdl->kdl_off += KCNDB_DB_RECORDSIZ;
+			kdl->kdl_ahead = true;
+		}
+		late = kdl->kdl_i < kdl->kdl_nlate ?
+		    &kdl->kdl_late[kdl->kdl_i] : NULL;
+		if (kdl->kdl_ahead &&
+		    (late == NULL || kdl->kdl_kdr.kdr_time <= late->kdr_time)) {
+			*kdr = kdl->kdl_kdr;
+			kdl->kdl_ahead = false;
+		} else if (late != NULL) {
+			*kdr = *late;
+			++kdl->kdl_i;
+		} else {
+			errno = ESHUTDOWN;
+			return false;
+		}
+		if (kdl->kdl_kt == NULL ||
+		    ! kcndb_tomb_match(kdl->kdl_kt, kdr->kdr_locidx,
+		    kdr->kdr_time))
+			return true;
+		++kdl->kdl_ndeleted;
+	}
+}
+
+/* mark locators referred to by records surviving tombstones. */
+static bool
+kcndb_db_compact_mark(struct kcndb_db_compact *kdc,
+    struct kcndb_db_table *kdt, const struct kcndb_db_compact_shard *kdcs)
+{
+	struct kcndb_db_loc_map *kdlm;
+	struct kcndb_db_live kdl;
+	struct kcndb_db_record kdr;
+
+	if (! kcndb_db_live_init(&kdl, kdt, kdcs->kdcs_tomb, 0,
+	    kdcs->kdcs_size, kdcs->kdcs_late, kdcs->kdcs_nlate))
+		return false;
+	while (kcndb_db_live_read(&kdl, &kdr)) {
+		kdlm = kcndb_db_compact_lookup(kdc, kdr.kdr_locidx);
+		if (kdlm == NULL)
+			return false;
+		kdlm->kdlm_idx = 1;
+	}
+	return errno == ESHUTDOWN ? true : false;
+}
+
+/* write a record of a shard aside, and index it. */
+static bool
+kcndb_db_compact_put(struct kcndb_db_compact_shard *kdcs,
+    const struct kcndb_db_record *kdr)
+{
+	struct kcn_buf *tkb = kcndb_file_buf(kdcs->kdcs_kf);
+
+	if (! kcndb_file_reserve(kdcs->kdcs_kf, KCNDB_DB_RECORDSIZ))
+		return false;
+	kcn_buf_put64(tkb, kdr->kdr_time);
+	kcn_buf_put64(tkb, kdr->kdr_val);
+	kcn_buf_put64(tkb, kdr->kdr_locidx);
+	if (! kcndb_post_add(kdcs->kdcs_post, kdr->kdr_locidx,
+	    kdcs->kdcs_off) ||
+	    ! kcndb_rra_add(kdcs->kdcs_rra, kdr->kdr_locidx, kdr->kdr_time,
+	    kdr->kdr_val))
+		return false;
+	kdcs->kdcs_off += KCNDB_DB_RECORDSIZ;
+	kdcs->kdcs_last = kdr->kdr_time;
+	return true;
+}
+
+/*
+ * write records of a shard in a range merged with late ones aside with new
+ * indexes of locators, and index them.  a locator not in a new dictionary
+ * yet, i.e., added or referred to again during a compaction, is added to
+ * it.
+ */
+static bool
+kcndb_db_compact_write(struct kcndb_db_compact *kdc,
+    struct kcndb_db_table *kdt, struct kcndb_db_compact_shard *kdcs,
+    const struct kcndb_tomb *kt, uint64_t start, uint64_t end,
+    const struct kcndb_db_record *late, size_t nlate)
+{
+	struct kcndb_db_loc_map *kdlm;
+	struct kcndb_db_live kdl;
+	struct kcndb_db_record kdr;
+	const char *loc;
+	size_t len;
+
+	if (! kcndb_db_live_init(&kdl, kdt, kt, start, end, late, nlate))
+		return false;
+	while (kcndb_db_live_read(&kdl, &kdr)) {
+		kdlm = kcndb_db_compact_lookup(kdc, kdr.kdr_locidx);
+		if (kdlm == NULL)
+			return false;
+		if (kdlm->kdlm_idx == 0 &&
+		    (! kcndb_db_loc_lookup(kdc->kdc_kd, kdlm->kdlm_oidx, &loc,
+		    &len) || ! kcndb_db_compact_loc_add(kdc, loc, len, kdlm)))
+			return false;
+		kdr.kdr_locidx = kdlm->kdlm_idx;
+		if (! kcndb_db_compact_put(kdcs, &kdr))
+			return false;
+	}
+	kdcs->kdcs_ndeleted += kdl.kdl_ndeleted;
+	return errno == ESHUTDOWN ? true : false;
+}
+
+/*
+ * replace indexes of a shard by those built with a table rewritten, so that
+ * files are reopened without indexing records again.  tombstones, a late
+ * segment and a checkpoint are already removed.
+ */
+static void
+kcndb_db_compact_install(struct kcndb_db_base *kdb,
+    struct kcndb_db_compact_shard *kdcs)
+{
+
+	kcndb_db_base_reset(kdb);
+	kdb->kdb_post = kdcs->kdcs_post;
+	kdb->kdb_rra = kdcs->kdcs_rra;
+	kdcs->kdcs_post = NULL;
+	kdcs->kdcs_rra = NULL;
+	kdb->kdb_tablesize = kdcs->kdcs_off;
+	kdb->kdb_ckptsize = 0;
+	++kdb->kdb_rewrites;
+}
+
+/*
+ * rewrite tables without records hidden by tombstones and with late ones
+ * folded, and the dictionary without locators no longer referred to.
+ * entries of a new dictionary are kept in order of old ones, and each is
+ * prepended to its hash chain.  files and their indexes are built aside
+ * from a snapshot of tables while operations go on, and records and
+ * locators added meanwhile are caught up in an exclusive section, in which
+ * a marker commits new files.  a shard whose records were rewritten,
+ * deleted or kept late meanwhile is rewritten again in the exclusive
+ * section.  the caller must hold the rewrite lock.
+ *
+ * XXX: indexes are built twice on memory during a compaction, and regions
+ *	locked by a warm-up keep old files on memory.
+ */
+static bool
+kcndb_db_compact(struct kcndb_db *kd)
+{
+	struct kcndb_db_compact *kdc;
+	struct kcndb_db_compact_shard *kdcs;
+	struct kcndb_db_table *kdt;
+	struct kcndb_db_base *kdb;
+	const struct kcndb_db_record *late;
+	struct kcndb_file *kf;
+	struct kcn_buf *kb, *tkb;
+	enum kcn_eq_type type;
+	char tpath[MAXPATHLEN];
+	unsigned int shard, h;
+	uint64_t start;
+	size_t i, n, len, locsize, ntombs, nlate, nrecords, ndeleted;
+	bool exclusive, committed, rc;
+
+	if (kd->kd_generation != kcndb_db_generation && ! kcndb_db_open(kd))
+		return false;
+	kdc = calloc(1, sizeof(*kdc));
+	if (kdc == NULL)
+		return false;
+	kdc->kdc_kd = kd;
+	kdc->kdc_omapsize = KCNDB_DB_LOC_INDEXTABLESIZ;
+	ntombs = nlate = 0;
+	exclusive = committed = rc = false;
+
+	/* take a snapshot of tables, and then of the dictionary. */
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			kdcs = &kdc->kdc_shards[TYPE2INDEX(type)][shard];
+			if (! kcndb_db_compact_snapshot(kdt, kdcs))
+				goto out;
+			ntombs += kdcs->kdcs_ntombs;
+			nlate += kdcs->kdcs_nlate;
+		}
+	if (ntombs == 0 && nlate == 0) {
+		rc = true;
+		goto out;
+	}
+	KCN_LOG(INFO, "compact with %zu tombstone(s) and %zu late record(s)",
+	    ntombs, nlate);
+	if (! kcndb_db_loc_rdlock())
+		goto out;
+	locsize = kcndb_db_locsize;
+	kcndb_db_loc_unlock();
+	if (! kcndb_db_compact_map(kdc, locsize))
+		goto out;
+
+	/* mark locators referred to by records surviving tombstones. */
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			kdcs = &kdc->kdc_shards[TYPE2INDEX(type)][shard];
+			/* a shard is rewritten again if some are not read. */
+			if (! kcndb_db_tomb_read(kdt, kdcs->kdcs_ntombs,
+			    &kdcs->kdcs_tomb, &kdcs->kdcs_ntombs))
+				goto out;
+			if (! kcndb_db_compact_mark(kdc, kdt, kdcs))
+				goto out;
+		}
+
+	/* write a new dictionary but its hash table. */
+	(void)snprintf(tpath, sizeof(tpath), "%s/%s%s",
+	    kcndb_db_path, KCNDB_DB_PATH_LOC, KCNDB_DB_PATH_COMPACT_SUFFIX);
+	(void)unlink(tpath);
+	kdc->kdc_loc = kcndb_file_open(tpath);
+	if (kdc->kdc_loc == NULL)
+		goto out;
+	tkb = kcndb_file_buf(kdc->kdc_loc);
+	kcn_buf_reset(tkb, 0);
+	kcn_buf_putnull(tkb, KCNDB_DB_LOC_INDEXTABLESIZ);
+	kdc->kdc_locsize = KCNDB_DB_LOC_INDEXTABLESIZ;
+	kf = kd->kd_loc;
+	kb = kcndb_file_buf(kf);
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_seek_head(kf, KCNDB_DB_LOC_INDEXTABLESIZ))
+		goto out;
+	for (i = 0; i < kdc->kdc_n; i++) {
+		if (! kcndb_file_ensure(kf, sizeof(uint16_t)))
+			goto out;
+		len = kcn_buf_get16(kb);
+		if (! kcndb_file_ensure(kf,
+		    sizeof(uint16_t) + len + sizeof(uint64_t)))
+			goto out;
+		if (kdc->kdc_map[i].kdlm_idx != 0 &&
+		    ! kcndb_db_compact_loc_add(kdc, kcn_buf_current(kb), len,
+		    &kdc->kdc_map[i]))
+			goto out;
+		kcn_buf_forward(kb, len + sizeof(uint64_t));
+		kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	}
+
+	/* rewrite tables with new indexes of locators. */
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			kdcs = &kdc->kdc_shards[TYPE2INDEX(type)][shard];
+			if (! kcndb_db_compact_shard_init(kdt, kdcs) ||
+			    ! kcndb_db_compact_write(kdc, kdt, kdcs,
+			    kdcs->kdcs_tomb, 0, kdcs->kdcs_size,
+			    kdcs->kdcs_late, kdcs->kdcs_nlate))
+				goto out;
+		}
+
+	/* catch up with records and locators added meanwhile. */
+	if (! kcndb_db_exclusive_enter())
+		goto out;
+	exclusive = true;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++)
+			if (! kcndb_db_reorder_drain(
+			    kcndb_db_table_lookup(kd, type, shard)))
+				goto out;
+	if (! kcndb_db_compact_map(kdc, kcndb_db_locsize))
+		goto out;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			kdb = kdt->kdt_base;
+			kdcs = &kdc->kdc_shards[TYPE2INDEX(type)][shard];
+			start = kdcs->kdcs_size;
+			late = NULL;
+			nlate = 0;
+			/* late records are only added or folded. */
+			if (kdb->kdb_rewrites != kdcs->kdcs_rewrites ||
+			    kdb->kdb_ntombs != kdcs->kdcs_ntombs ||
+			    kdb->kdb_nlate != kdcs->kdcs_nlate) {
+				KCN_LOG(INFO, "%s: compact again since "
+				    "changed meanwhile", kdt->kdt_name);
+				if (! kcndb_db_compact_shard_init(kdt, kdcs))
+					goto out;
+				start = 0;
+				late = kdb->kdb_late;
+				nlate = kdb->kdb_nlate;
+			}
+			if (! kcndb_db_compact_write(kdc, kdt, kdcs,
+			    kdb->kdb_ntombs > 0 ? kdb->kdb_tomb : NULL,
+			    start, kdb->kdb_tablesize, late, nlate))
+				goto out;
+			if (! kcndb_file_append(kdcs->kdcs_kf) ||
+			    ! kcndb_file_sync(kdcs->kdcs_kf))
+				goto out;
+		}
+	if (! kcndb_file_append(kdc->kdc_loc) ||
+	    ! kcndb_file_seek_head(kdc->kdc_loc, 0))
+		goto out;
+	for (h = 0; h < KCNDB_DB_LOC_HASHSIZ; h++)
+		kcn_buf_put64(tkb, kdc->kdc_heads[h]);
+	if (! kcndb_file_write(kdc->kdc_loc) ||
+	    ! kcndb_file_sync(kdc->kdc_loc))
+		goto out;
+
+	if (! kcndb_db_compact_commit())
+		goto out;
+	committed = true;
+	if (! kcndb_db_compact_finish())
+		goto out;
+	nrecords = ndeleted = 0;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdcs = &kdc->kdc_shards[TYPE2INDEX(type)][shard];
+			nrecords += kdcs->kdcs_off / KCNDB_DB_RECORDSIZ;
+			ndeleted += kdcs->kdcs_ndeleted;
+			kcndb_db_compact_install(
+			    &kcndb_db_base[TYPE2INDEX(type)][shard], kdcs);
+		}
+	kcndb_db_locsize = kdc->kdc_locsize;
+	++kcndb_db_generation;
+	for (i = 0, n = 0; i < kdc->kdc_n; i++)
+		if (kdc->kdc_map[i].kdlm_idx == 0)
+			++n;
+	KCN_LOG(INFO, "compact: %zu record(s) and %zu locator(s) removed, "
+	    "%zu record(s) kept", ndeleted, n, nrecords);
+	rc = true;
+  out:
+	if (exclusive)
+		kcndb_db_exclusive_leave();
+	if (! rc) {
+		KCN_LOG(ERR, "cannot compact%s: %s",
+		    committed ? " after commit" : "", strerror(errno));
+		if (! committed)
+			kcndb_db_compact_recover();
+	}
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < KCNDB_DB_SHARD_MAX; shard++)
+			kcndb_db_compact_shard_finish(
+			    &kdc->kdc_shards[TYPE2INDEX(type)][shard]);
+	kcndb_file_close(kdc->kdc_loc);
+	free(kdc->kdc_map);
+	free(kdc);
+	return rc;
+}
+
+/* wait for an attachment requested until the next compaction if any. */
+static struct kcndb_db_attach_req *
+kcndb_db_compactor_wait(const struct timespec *ts)
+{
+	struct kcndb_db_attach_req *kdar;
+	int error;
+
+	(void)pthread_mutex_lock(&kcndb_db_attach_reqlock);
+	error = 0;
+	while ((kdar = STAILQ_FIRST(&kcndb_db_attach_reqs)) == NULL &&
+	    error != ETIMEDOUT) {
+		if (kcndb_db_compact_interval == 0)
+			error = pthread_cond_wait(&kcndb_db_attach_reqcond,
+			    &kcndb_db_attach_reqlock);
+		else
+			error = pthread_cond_timedwait(
+			    &kcndb_db_attach_reqcond,
+			    &kcndb_db_attach_reqlock, ts);
+	}
+	if (kdar != NULL)
+		STAILQ_REMOVE_HEAD(&kcndb_db_attach_reqs, kdar_chain);
+	(void)pthread_mutex_unlock(&kcndb_db_attach_reqlock);
+	return kdar;
+}
+
+static void *
+kcndb_db_compactor_main(void *arg)
+{
+	struct kcndb_db *kd = arg;
+	struct kcndb_db_attach_req *kdar;
+	struct timespec ts;
+	int error;
+
+	(void)clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += kcndb_db_compact_interval;
+	for (;;) {
+		kdar = kcndb_db_compactor_wait(&ts);
+		if (kdar != NULL) {
+			error = 0;
+			if (! kcndb_db_attach(kd, kdar->kdar_dir))
+				error = errno != 0 ? errno : EIO;
+			(*kdar->kdar_cb)(error, kdar->kdar_arg);
+			free(kdar);
+			continue;
+		}
+		if (kcndb_db_mutex_lock(&kcndb_db_rewritelock)) {
+			(void)kcndb_db_compact(kd);
+			(void)pthread_mutex_unlock(&kcndb_db_rewritelock);
+		}
+		(void)clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += kcndb_db_compact_interval;
+	}
+	/*NOTREACHED*/
+	return NULL;
+}
+
+/*
+ * start a thread compacting deleted and late records periodically if
+ * enabled, and attaching directories requested.
+ */
+bool
+kcndb_db_compactor_start(void)
+{
+	struct kcndb_db *kd;
+	pthread_t tid;
+	int error;
+
+	kd = kcndb_db_new();
+	if (kd == NULL)
+		return false;
+	error = pthread_create(&tid, NULL, kcndb_db_compactor_main, kd);
+	if (error != 0) {
+		kcndb_db_destroy(kd);
+		errno = error;
+		return false;
+	}
+	(void)pthread_detach(tid);
+	(void)pthread_mutex_lock(&kcndb_db_attach_reqlock);
+	kcndb_db_compactor_running = true;
+	(void)pthread_mutex_unlock(&kcndb_db_attach_reqlock);
+	if (kcndb_db_compact_interval != 0)
+		KCN_LOG(INFO, "compact deleted and late records every %u sec",
+		    kcndb_db_compact_interval);
+	return true;
+}
+
+/*
+ * request the compactor thread to attach a directory.  a callback is
+ * called in the thread with an error, or 0, when the attachment completes.
+ */
+bool
+kcndb_db_attach_request(const char *dir, void (*cb)(int, void *), void *arg)
+{
+	struct kcndb_db_attach_req *kdar;
+
+	if (strlen(dir) >= sizeof(kdar->kdar_dir)) {
+		errno = ENAMETOOLONG;
+		return false;
+	}
+	kdar = malloc(sizeof(*kdar));
+	if (kdar == NULL)
+		return false;
+	kdar->kdar_cb = cb;
+	kdar->kdar_arg = arg;
+	strlcpy(kdar->kdar_dir, dir, sizeof(kdar->kdar_dir));
+	(void)pthread_mutex_lock(&kcndb_db_attach_reqlock);
+	if (! kcndb_db_compactor_running) {
+		(void)pthread_mutex_unlock(&kcndb_db_attach_reqlock);
+		free(kdar);
+		errno = ESRCH;
+		return false;
+	}
+	STAILQ_INSERT_TAIL(&kcndb_db_attach_reqs, kdar, kdar_chain);
+	(void)pthread_cond_signal(&kcndb_db_attach_reqcond);
+	(void)pthread_mutex_unlock(&kcndb_db_attach_reqlock);
 	return true;
 }
 
+/* read the next staged record of a shard with a new index of a locator. */
 static bool
-kcndb_db_record_read_last(struct kcndb_db_table *kdt,
-    struct kcndb_db_record *kdr)
+kcndb_db_attach_staged(struct kcndb_file *kf, unsigned int shard,
+    const struct kcndb_db_loc_map *map, size_t n, struct kcndb_db_record *kdr)
 {
-	size_t off;
+	struct kcndb_db_loc_map *kdlm, key;
 
-	if (kcndb_db_table_size(kdt) < KCNDB_DB_RECORDSIZ) {
-		kdr->kdr_time = 0;
-		kdr->kdr_val = 0;
-		kdr->kdr_locidx = 0;
+	while (kcndb_db_record_read(kf, kdr)) {
+		key.kdlm_oidx = kdr->kdr_locidx;
+		kdlm = bsearch(&key, map, n, sizeof(*map),
+		    kcndb_db_loc_map_cmp);
+		if (kdlm == NULL) {
+			KCN_LOG(ERR, "unknown staged locator index %llu",
+			    (unsigned long long)kdr->kdr_locidx);
+			errno = ENXIO;
+			return false;
+		}
+		if (kcndb_db_shard(kdlm->kdlm_idx) != shard)
+			continue;
+		kdr->kdr_locidx = kdlm->kdlm_idx;
 		return true;
 	}
-	off = kcndb_db_table_size(kdt) - KCNDB_DB_RECORDSIZ;
-	if (! kcndb_file_seek_head(kdt->kdt_table, off))
+	return false;
+}
+
+/*
+ * (re)write records of a shard up to a size and late ones merged with
+ * staged ones aside in time order.  records hidden by tombstones are
+ * dropped on the way, and live records precede staged ones at the same
+ * time.
+ */
+static bool
+kcndb_db_attach_table(struct kcndb_db_table *kdt,
+    struct kcndb_db_compact_shard *kdcs, const struct kcndb_tomb *kt,
+    uint64_t size, const struct kcndb_db_record *late, size_t nlate,
+    struct kcndb_file *kf, const struct kcndb_db_loc_map *map, size_t n)
+{
+	struct kcndb_db_live kdl;
+	struct kcndb_db_record kdr, skdr;
+	bool live, staged;
+
+	if (! kcndb_db_compact_shard_init(kdt, kdcs))
+		return false;
+	if (! kcndb_db_live_init(&kdl, kdt, kt, 0, size, late, nlate) ||
+	    ! kcndb_file_seek_head(kf, 0))
+		return false;
+	kcn_buf_reset(kcndb_file_buf(kf), 0);
+	live = kcndb_db_live_read(&kdl, &kdr);
+	if (! live && errno != ESHUTDOWN)
+		return false;
+	staged = kcndb_db_attach_staged(kf, kdt->kdt_shard, map, n, &skdr);
+	if (! staged && errno != ESHUTDOWN)
 		return false;
-	return kcndb_db_record_read(kdt, kdr);
+	while (live || staged) {
+		if (live && (! staged || kdr.kdr_time <= skdr.kdr_time)) {
+			if (! kcndb_db_compact_put(kdcs, &kdr))
+				return false;
+			live = kcndb_db_live_read(&kdl, &kdr);
+			if (! live && errno != ESHUTDOWN)
+				return false;
+		} else {
+			if (! kcndb_db_compact_put(kdcs, &skdr))
+				return false;
+			++kdcs->kdcs_nstaged;
+			staged = kcndb_db_attach_staged(kf, kdt->kdt_shard,
+			    map, n, &skdr);
+			if (! staged && errno != ESHUTDOWN)
+				return false;
+		}
+	}
+	return true;
 }
 
-bool
-kcndb_db_record_add(struct kcndb_db *kd, enum kcn_eq_type type,
-    struct kcndb_db_record *kdr)
+/*
+ * catch up with records of a shard added during an attachment, or merge
+ * all records again if they were rewritten, deleted or kept late
+ * meanwhile, or if they are older than those written.  the caller must be
+ * in an exclusive section.
+ */
+static bool
+kcndb_db_attach_catchup(struct kcndb_db_table *kdt,
+    struct kcndb_db_compact_shard *kdcs, struct kcndb_file *kf,
+    const struct kcndb_db_loc_map *map, size_t n)
+{
+	struct kcndb_db_base *kdb = kdt->kdt_base;
+	const struct kcndb_tomb *kt;
+	struct kcndb_db_record kdr;
+	uint64_t off;
+
+	kt = kdb->kdb_ntombs > 0 ? kdb->kdb_tomb : NULL;
+	off = kdcs->kdcs_size;
+	if (kdb->kdb_rewrites == kdcs->kdcs_rewrites &&
+	    kdb->kdb_ntombs == kdcs->kdcs_ntombs &&
+	    kdb->kdb_nlate == kdcs->kdcs_nlate) {
+		if (off == kdb->kdb_tablesize)
+			return true;
+		if (! kcndb_db_record_read_at(kdt, off, &kdr))
+			return false;
+		/* records are appended to a table in time order. */
+		while (kdr.kdr_time >= kdcs->kdcs_last) {
+			if ((kt == NULL ||
+			    ! kcndb_tomb_match(kt, kdr.kdr_locidx,
+			    kdr.kdr_time)) &&
+			    ! kcndb_db_compact_put(kdcs, &kdr))
+				return false;
+			off += KCNDB_DB_RECORDSIZ;
+			if (off == kdb->kdb_tablesize)
+				return true;
+			if (! kcndb_db_record_read(kdt->kdt_table, &kdr))
+				return false;
+		}
+	}
+	KCN_LOG(INFO, "%s: attach again since changed meanwhile",
+	    kdt->kdt_name);
+	return kcndb_db_attach_table(kdt, kdcs, kt, kdb->kdb_tablesize,
+	    kdb->kdb_late, kdb->kdb_nlate, kf, map, n);
+}
+
+static int
+kcndb_db_attach_idx_cmp(const void *a0, const void *b0)
+{
+	const uint64_t *a = a0, *b = b0;
+
+	return *a < *b ? -1 : *a > *b ? 1 : 0;
+}
+
+/*
+ * unlink locators added by a failed attachment unless records added
+ * meanwhile refer to them.  the caller must be in an exclusive section.
+ */
+static void
+kcndb_db_attach_rollback(struct kcndb_db *kd,
+    struct kcndb_db_compact_shard (*kdcss)[KCNDB_DB_SHARD_MAX],
+    const uint64_t *added, size_t n)
 {
-	struct kcndb_db_record kdr0;
 	struct kcndb_db_table *kdt;
-	struct kcn_buf *kb;
-	bool rc;
+	struct kcndb_db_base *kdb;
+	struct kcndb_db_compact_shard *kdcs;
+	struct kcndb_db_record kdr;
+	enum kcn_eq_type type;
+	unsigned int shard;
+	const uint64_t *p;
+	uint64_t off;
+	size_t i, nunlinked;
+	bool *kept;
 
-	kdt = kcndb_db_table_lookup(kd, type);
-	kb = kcndb_file_buf(kdt->kdt_table);
-	rc = kcndb_db_wrlock(kdt);
-	if (! rc)
+	if (n == 0)
+		return;
+	kept = calloc(n, sizeof(*kept));
+	if (kept == NULL)
 		goto bad;
-	rc = kcndb_db_record_read_last(kdt, &kdr0);
-	if (! rc)
-		goto out;
-	if (kdr0.kdr_time > kdr->kdr_time) {
-		errno = ERANGE; /* XXX */
-		rc = false;
-		goto out;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			kdb = kdt->kdt_base;
+			kdcs = &kdcss[TYPE2INDEX(type)][shard];
+			off = kdb->kdb_rewrites == kdcs->kdcs_rewrites ?
+			    kdcs->kdcs_size : 0;
+			if (! kcndb_file_seek_head(kdt->kdt_table, off))
+				goto bad;
+			kcn_buf_reset(kcndb_file_buf(kdt->kdt_table), 0);
+			for (i = 0; off < kdb->kdb_tablesize ||
+			    i < kdb->kdb_nreorder + kdb->kdb_nlate;) {
+				if (off < kdb->kdb_tablesize) {
+					if (! kcndb_db_record_read(
+					    kdt->kdt_table, &kdr))
+						goto bad;
+					off += KCNDB_DB_RECORDSIZ;
+				} else if (i < kdb->kdb_nreorder)
+					kdr = kdb->kdb_reorder[i++];
+				else
+					kdr = kdb->kdb_late[i++ -
+					    kdb->kdb_nreorder];
+				p = bsearch(&kdr.kdr_locidx, added, n,
+				    sizeof(*added), kcndb_db_attach_idx_cmp);
+				if (p != NULL)
+					kept[p - added] = true;
+			}
+		}
+	for (i = nunlinked = 0; i < n; i++) {
+		if (kept[i])
+			continue;
+		if (! kcndb_db_loc_unlink(kd, added[i]))
+			goto bad;
+		++nunlinked;
 	}
-	rc = kcndb_db_loc_add(kdt, kdr->kdr_loc, kdr->kdr_loclen,
-	    &kdr->kdr_locidx);
-	if (! rc)
-		goto out;
-	kcn_buf_put64(kb, kdr->kdr_time);
-	kcn_buf_put64(kb, kdr->kdr_val);
-	kcn_buf_put64(kb, kdr->kdr_locidx);
-	rc = kcndb_file_append(kdt->kdt_table);
-	if (rc)
-		kcndb_db_table_size_increment(kdt, KCNDB_DB_RECORDSIZ);
-
-  out:
-	kcndb_db_unlock(kdt);
+	KCN_LOG(INFO, "unlink %zu of %zu locator(s) added", nunlinked, n);
+	free(kept);
+	return;
   bad:
-	if (rc)
-		KCN_LOG(DEBUG, "record: add %llu %llu %.*s@%llu",
-		    (unsigned long long)kdr->kdr_time,
-		    (unsigned long long)kdr->kdr_val,
-		    (int)kdr->kdr_loclen, kdr->kdr_loc, kdr->kdr_locidx);
-	else
-		KCN_LOG(ERR, "record: cannot add: %llu %llu %.*s",
-		    (unsigned long long)kdr->kdr_time,
-		    (unsigned long long)kdr->kdr_val,
-		    (int)kdr->kdr_loclen, kdr->kdr_loc);
-	return rc;
+	KCN_LOG(ERR, "cannot unlink locators added: %s", strerror(errno));
+	free(kept);
 }
 
+/*
+ * attach a directory built offline by kcndbctl, which has a dictionary and
+ * unsharded tables in the same format.  staged locators are added into the
+ * dictionary, and shards of staged tables are rewritten aside with staged
+ * records merged from a snapshot while operations go on.  records added
+ * meanwhile are caught up in an exclusive section, in which a marker
+ * commits new tables as a compaction.  indexes are built on the way, and
+ * tables are not indexed again.  staged locators are unlinked if an
+ * attachment fails.
+ */
 bool
-kcndb_db_search(struct kcndb_db *kd, const struct kcn_eq *ke, size_t maxnlocs,
-    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+kcndb_db_attach(struct kcndb_db *kd, const char *dir)
 {
+	struct kcndb_db_compact_shard (*kdcss)[KCNDB_DB_SHARD_MAX], *kdcs;
 	struct kcndb_db_table *kdt;
+	struct kcndb_file *lkf, *kfs[KCN_EQ_TYPE_MAX - 1], *kf;
 	struct kcn_buf *kb;
-	struct kcndb_db_record kdr;
-	size_t i, n, score;
+	struct kcndb_db_loc_map *map, *nmap;
+	enum kcn_eq_type type;
+	char name[KCNDB_DB_NAMELEN], path[MAXPATHLEN];
+	unsigned int shard;
+	uint64_t oidx, *added, *nadded;
+	size_t n, nmax, nnew, len, ntombs, ntables, nrecords;
+	bool isnew, exclusive, committed, rc;
 
-	kdt = kcndb_db_table_lookup(kd, ke->ke_type);
-	if (! kcndb_db_rdlock(kdt))
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, KCNDB_DB_PATH_LOC);
+	if (access(path, F_OK) == -1) {
+		KCN_LOG(ERR, "%s: cannot attach: %s", dir, strerror(errno));
 		return false;
-	if (! kcndb_file_seek_head(kdt->kdt_table, 0)) /* XXX: should improve */
-		goto bad;
-	kb = kcndb_file_buf(kdt->kdt_table);
-	kcn_buf_reset(kb, 0);
+	}
+	if (! kcndb_db_mutex_lock(&kcndb_db_rewritelock))
+		return false;
+	lkf = NULL;
+	memset(kfs, 0, sizeof(kfs));
+	map = NULL;
+	added = NULL;
+	n = nmax = nnew = ntables = nrecords = 0;
+	exclusive = committed = rc = false;
+	kdcss = calloc(KCN_EQ_TYPE_MAX - 1, sizeof(*kdcss));
+	if (kdcss == NULL)
+		goto out;
+	if (kd->kd_generation != kcndb_db_generation && ! kcndb_db_open(kd))
+		goto out;
 
-	score = 0; /* XXX: should compute score. */
-	for (i = 0, n = 0; n < maxnlocs; i++) {
-		if (! kcndb_db_record_read(kdt, &kdr)) {
-			if (errno == ESHUTDOWN)
-				break;
-			/* XXX: should we accept this error??? */
-			KCN_LOG(ERR, "cannot read record: %s", strerror(errno));
-			goto bad;
+	/* take a snapshot of tables before adding staged locators. */
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		for (shard = 0; shard < kcndb_db_table_nshards(type);
+		    shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			kdcs = &kdcss[TYPE2INDEX(type)][shard];
+			if (! kcndb_db_compact_snapshot(kdt, kdcs))
+				goto out;
 		}
-
-		KCN_LOG(DEBUG, "record[%zu]: %llu %llu %zu", i,
-		    (unsigned long long)kdr.kdr_time,
-		    (unsigned long long)kdr.kdr_val,
-		    (size_t)kdr.kdr_locidx);
-
-		if (! kcn_eq_time_match(kdr.kdr_time, ke))
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		kcndb_db_table_name(name, sizeof(name), type, 0);
+		(void)snprintf(path, sizeof(path), "%s/%s", dir, name);
+		if (access(path, F_OK) == -1) {
+			if (errno != ENOENT)
+				goto out;
 			continue;
+		}
+		kfs[TYPE2INDEX(type)] = kcndb_file_open(path);
+		if (kfs[TYPE2INDEX(type)] == NULL)
+			goto out;
+		++ntables;
+	}
+	if (ntables == 0) {
+		errno = ENOENT;
+		goto out;
+	}
 
-		switch (ke->ke_op) {
-		case KCN_EQ_OP_LT:
-			if (kdr.kdr_val >= ke->ke_val)
-				continue;
-			break;
-		case KCN_EQ_OP_LE:
-			if (kdr.kdr_val > ke->ke_val)
-				continue;
-			break;
-		case KCN_EQ_OP_EQ:
-			if (kdr.kdr_val != ke->ke_val)
-				continue;
-			break;
-		case KCN_EQ_OP_GT:
-			if (kdr.kdr_val <= ke->ke_val)
-				continue;
+	/* add staged locators in order of their indexes. */
+	(void)snprintf(path, sizeof(path), "%s/%s", dir, KCNDB_DB_PATH_LOC);
+	lkf = kcndb_file_open(path);
+	if (lkf == NULL)
+		goto out;
+	kb = kcndb_file_buf(lkf);
+	kcn_buf_reset(kb, 0);
+	if (! kcndb_file_seek_head(lkf, KCNDB_DB_LOC_INDEXTABLESIZ))
+		goto out;
+	for (oidx = KCNDB_DB_LOC_INDEXTABLESIZ;;
+	    oidx += sizeof(uint16_t) + len + sizeof(uint64_t)) {
+		if (! kcndb_file_ensure(lkf, sizeof(uint16_t)))
 			break;
-		case KCN_EQ_OP_GE:
-			if (kdr.kdr_val < ke->ke_val)
-				continue;
+		len = kcn_buf_get16(kb);
+		if (! kcndb_file_ensure(lkf,
+		    sizeof(uint16_t) + len + sizeof(uint64_t)))
 			break;
-		default:
-			assert(0);
-			continue;
-		}
-		if (! kcndb_db_loc_lookup(kdt, kdr.kdr_locidx,
-		    &kdr.kdr_loc, &kdr.kdr_loclen)) {
-			KCN_LOG(DEBUG, "cannot find locator: %s",
-			    strerror(errno));
-			goto bad;
+		if (n == nmax) {
+			nmax = nmax == 0 ? KCNDB_DB_LOC_HASHSIZ : nmax * 2;
+			nmap = realloc(map, nmax * sizeof(*map));
+			if (nmap == NULL)
+				goto out;
+			map = nmap;
+			nadded = realloc(added, nmax * sizeof(*added));
+			if (nadded == NULL)
+				goto out;
+			added = nadded;
 		}
-		KCN_LOG(DEBUG, "record[%zu]: match loc=%.*s",
-		    i, (int)kdr.kdr_loclen, kdr.kdr_loc);
-		if (! (*cb)(&kdr, score, arg))
-			goto bad;
+		map[n].kdlm_oidx = oidx;
+		if (! kcndb_db_loc_add(kd, kcn_buf_current(kb), len,
+		    &map[n].kdlm_idx, &isnew))
+			goto out;
+		/* locators are added at the tail in order. */
+		if (isnew)
+			added[nnew++] = map[n].kdlm_idx;
 		++n;
+		kcn_buf_forward(kb, len + sizeof(uint64_t));
+		kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
 	}
+	if (errno != ESHUTDOWN)
+		goto out;
+	/* rewritten tables must not refer to locators lost by a crash. */
+	if (! kcndb_file_sync(kd->kd_loc))
+		goto out;
 
-	KCN_LOG(INFO, "%zu record(s) read", i);
+	/* staged records are added only to configured shards. */
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		kf = kfs[TYPE2INDEX(type)];
+		if (kf == NULL)
+			continue;
+		for (shard = 0; shard < kcndb_db_nshards; shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			kdcs = &kdcss[TYPE2INDEX(type)][shard];
+			if (! kcndb_db_tomb_read(kdt, kdcs->kdcs_ntombs,
+			    &kdcs->kdcs_tomb, &ntombs) ||
+			    ! kcndb_db_attach_table(kdt, kdcs, kdcs->kdcs_tomb,
+			    kdcs->kdcs_size, kdcs->kdcs_late, kdcs->kdcs_nlate,
+			    kf, map, n))
+				goto out;
+		}
+	}
 
-	if (n == 0) {
-		KCN_LOG(DEBUG, "no matching record found");
-		errno = ESRCH;
-		goto bad;
+	/* catch up with records added meanwhile. */
+	if (! kcndb_db_exclusive_enter())
+		goto out;
+	exclusive = true;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		kf = kfs[TYPE2INDEX(type)];
+		if (kf == NULL)
+			continue;
+		for (shard = 0; shard < kcndb_db_nshards; shard++) {
+			kdt = kcndb_db_table_lookup(kd, type, shard);
+			kdcs = &kdcss[TYPE2INDEX(type)][shard];
+			if (! kcndb_db_reorder_drain(kdt) ||
+			    ! kcndb_db_attach_catchup(kdt, kdcs, kf, map, n) ||
+			    ! kcndb_file_append(kdcs->kdcs_kf) ||
+			    ! kcndb_file_sync(kdcs->kdcs_kf))
+				goto out;
+		}
 	}
 
-	return true;
-  bad:
-	kcndb_db_unlock(kdt);
-	return false;
+	if (! kcndb_db_compact_commit())
+		goto out;
+	committed = true;
+	if (! kcndb_db_compact_finish())
+		goto out;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		if (kfs[TYPE2INDEX(type)] == NULL)
+			continue;
+		for (shard = 0; shard < kcndb_db_nshards; shard++) {
+			kdcs = &kdcss[TYPE2INDEX(type)][shard];
+			nrecords += kdcs->kdcs_nstaged;
+			kcndb_db_compact_install(
+			    &kcndb_db_base[TYPE2INDEX(type)][shard], kdcs);
+		}
+	}
+	++kcndb_db_generation;
+	KCN_LOG(INFO, "%s: attach %zu table(s) with %zu locator(s) and "
+	    "%zu record(s)", dir, ntables, n, nrecords);
+	rc = true;
+  out:
+	if (! rc) {
+		KCN_LOG(ERR, "%s: cannot attach%s: %s", dir,
+		    committed ? " after commit" : "", strerror(errno));
+		if (! committed) {
+			kcndb_db_compact_recover();
+			if (! exclusive)
+				exclusive = kcndb_db_exclusive_enter();
+			if (exclusive)
+				kcndb_db_attach_rollback(kd, kdcss, added,
+				    nnew);
+		}
+	}
+	if (exclusive)
+		kcndb_db_exclusive_leave();
+	kcndb_file_close(lkf);
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++)
+		kcndb_file_close(kfs[TYPE2INDEX(type)]);
+	if (kdcss != NULL)
+		for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX;
+		    type++)
+			for (shard = 0; shard < KCNDB_DB_SHARD_MAX; shard++)
+				kcndb_db_compact_shard_finish(
+				    &kdcss[TYPE2INDEX(type)][shard]);
+	free(kdcss);
+	free(map);
+	free(added);
+	(void)pthread_mutex_unlock(&kcndb_db_rewritelock);
+	return rc;
 }
 
 struct kcndb_db *
 kcndb_db_new(void)
 {
 	struct kcndb_db *kd;
-	enum kcn_eq_type type;
-	int idx;
+	int error;
+	bool rc;
 
+	(void)pthread_once(&kcndb_db_once, kcndb_db_base_init);
 	kd = malloc(sizeof(*kd));
 	if (kd == NULL)
-		goto bad;
-	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
-		idx = TYPE2INDEX(type);
-		kd->kd_tables[idx] = kcndb_db_table_open(type);
-		if (kd->kd_tables[idx] == NULL)
-			goto bad;
+		return NULL;
+	error = pthread_mutex_init(&kd->kd_lock, NULL);
+	if (error != 0) {
+		free(kd);
+		errno = error;
+		return NULL;
 	}
-	/* XXX: may need to pre-load onto memory... */
+	kd->kd_generation = 0;
+	kd->kd_loc = NULL;
+	memset(kd->kd_tables, 0, sizeof(kd->kd_tables));
+	(void)pthread_mutex_lock(&kcndb_db_listlock);
+	LIST_INSERT_HEAD(&kcndb_db_list, kd, kd_chain);
+	(void)pthread_mutex_unlock(&kcndb_db_listlock);
+	if (! kcndb_db_mutex_lock(&kd->kd_lock))
+		goto bad;
+	rc = kcndb_db_open(kd);
+	kcndb_db_leave(kd);
+	if (! rc)
+		goto bad;
+	/* files are pre-loaded onto memory by kcndb_db_warmup() if needed. */
 
 	return kd;
   bad:
@@ -537,17 +4678,14 @@ kcndb_db_new(void)
 void
 kcndb_db_destroy(struct kcndb_db *kd)
 {
-	enum kcn_eq_type type;
-	int idx;
 
 	if (kd == NULL)
 		return;
-	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
-		idx = TYPE2INDEX(type);
-		if (kd->kd_tables[idx] == NULL)
-			break;
-		kcndb_db_table_close(kd->kd_tables[idx]);
-		kd->kd_tables[idx] = NULL;
-	}
+	(void)pthread_mutex_lock(&kcndb_db_listlock);
+	LIST_REMOVE(kd, kd_chain);
+	(void)pthread_mutex_unlock(&kcndb_db_listlock);
+	kcndb_db_close(kd);
+	(void)pthread_mutex_destroy(&kd->kd_lock);
+	free(kd);
 	/* XXX: may need to write back on-memory cache in the future. */
 }
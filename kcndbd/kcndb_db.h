@@ -1,5 +1,3 @@
-#define KCNDB_DB_PATH_LOC_SUFFIX	"-loc"
-
 struct kcndb_db_record {
 	time_t kdr_time;
 	unsigned long long kdr_val;
@@ -8,13 +6,46 @@ struct kcndb_db_record {
 	size_t kdr_loclen;
 };
 
+enum kcndb_db_durability {
+	KCNDB_DB_DURABILITY_NONE,
+	KCNDB_DB_DURABILITY_PERIODIC,
+	KCNDB_DB_DURABILITY_BATCH
+};
+
+#define KCNDB_DB_SYNC_INTERVAL_MAX	(60 * 1000)	/* msec */
+#define KCNDB_DB_REORDER_WINDOW_MAX	(60 * 60)	/* sec */
+#define KCNDB_DB_WARMUP_MAX		(1024 * 1024)	/* MB */
+#define KCNDB_DB_CHECKPOINT_INTERVAL_DEFAULT	(10 * 60)	/* sec */
+#define KCNDB_DB_CHECKPOINT_INTERVAL_MAX	(24 * 60 * 60)	/* sec */
+#define KCNDB_DB_COMPACT_INTERVAL_DEFAULT	(60 * 60)	/* sec */
+#define KCNDB_DB_COMPACT_INTERVAL_MAX	(7 * 24 * 60 * 60)	/* sec */
+
 struct kcndb_db;
 
 void kcndb_db_path_set(const char *);
 const char *kcndb_db_path_get(void);
 bool kcndb_db_record_add(struct kcndb_db *, enum kcn_eq_type,
     struct kcndb_db_record *);
-bool kcndb_db_search(struct kcndb_db *, const struct kcn_eq *, size_t,
+bool kcndb_db_record_del(struct kcndb_db *, enum kcn_eq_type, const char *,
+    size_t, time_t, time_t);
+bool kcndb_db_search(struct kcndb_db *, const struct kcn_eq *, size_t, size_t,
     bool (*)(const struct kcndb_db_record *, size_t, void *), void *);
+bool kcndb_db_history(struct kcndb_db *, enum kcn_eq_type, const char *,
+    size_t, time_t, time_t, size_t,
+    bool (*)(const struct kcndb_db_record *, void *), void *);
+void kcndb_db_reorder_window_set(unsigned int);
+bool kcndb_db_reorder_start(void);
+void kcndb_db_shards_set(unsigned int);
+void kcndb_db_durability_set(enum kcndb_db_durability, unsigned int);
+bool kcndb_db_sync(struct kcndb_db *);
+bool kcndb_db_batch_done(struct kcndb_db *);
+bool kcndb_db_syncer_start(void);
+bool kcndb_db_warmup(size_t, bool);
+void kcndb_db_checkpoint_interval_set(unsigned int);
+bool kcndb_db_checkpointer_start(void);
+void kcndb_db_compact_interval_set(unsigned int);
+bool kcndb_db_compactor_start(void);
+bool kcndb_db_attach(struct kcndb_db *, const char *);
+bool kcndb_db_attach_request(const char *, void (*)(int, void *), void *);
 struct kcndb_db *kcndb_db_new(void);
 void kcndb_db_destroy(struct kcndb_db *);
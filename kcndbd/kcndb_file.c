@@ -1,3 +1,4 @@
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <assert.h>
 #include <errno.h>
@@ -18,8 +19,14 @@ struct kcndb_file {
 	size_t kf_size;
 	struct kcn_buf kf_kb;
 	struct kcn_buf_data *kf_kbd;
+	void *kf_map;
+	size_t kf_maplen;
+	bool kf_spooling;
+	struct kcn_buf_queue kf_spool;
 };
 
+#define KCNDB_FILE_WARMUP_CHUNKSIZ	(64 * 1024)
+
 static void kcndb_file_destroy(struct kcndb_file *);
 
 static struct kcndb_file *
@@ -32,6 +39,10 @@ kcndb_file_new(void)
 		goto bad;
 	kf->kf_fd = -1;
 	kf->kf_size = 0;
+	kf->kf_map = NULL;
+	kf->kf_maplen = 0;
+	kf->kf_spooling = false;
+	kcn_buf_queue_init(&kf->kf_spool);
 	kf->kf_kbd = kcn_buf_data_new(KCNDB_FILE_BUFSIZ);
 	if (kf->kf_kbd == NULL)
 		goto bad;
@@ -49,11 +60,14 @@ kcndb_file_destroy(struct kcndb_file *kf)
 
 	if (kf == NULL)
 		return;
+	if (kf->kf_map != NULL)
+		(void)munmap(kf->kf_map, kf->kf_maplen);
 	if (kf->kf_fd >= 0) {
 		oerrno = errno;
 		(void)close(kf->kf_fd);
 		errno = oerrno;
 	}
+	kcn_buf_purge(&kf->kf_spool);
 	kcn_buf_data_destroy(kf->kf_kbd);
 	free(kf);
 }
@@ -161,17 +175,158 @@ kcndb_file_write(struct kcndb_file *kf)
 	return true;
 }
 
+bool
+kcndb_file_sync(struct kcndb_file *kf)
+{
+
+	if (fsync(kf->kf_fd) == -1) {
+		KCN_LOG(ERR, "cannot sync file: %s", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
+bool
+kcndb_file_truncate(struct kcndb_file *kf, size_t size)
+{
+
+	if (ftruncate(kf->kf_fd, size) == -1) {
+		KCN_LOG(ERR, "cannot truncate file: %s", strerror(errno));
+		return false;
+	}
+	return true;
+}
+
 bool
 kcndb_file_append(struct kcndb_file *kf)
 {
 	size_t len;
 	bool rc;
 
+	len = kcn_buf_len(&kf->kf_kb);
+	if (kf->kf_spooling) {
+		if (! kcn_buf_enqueue(&kf->kf_kb, &kf->kf_spool))
+			return false;
+		kcn_buf_reset(&kf->kf_kb, 0);
+		kf->kf_size += len;
+		return true;
+	}
 	if (! kcndb_file_seek(kf, 0, SEEK_END))
 		return false;
-	len = kcn_buf_len(&kf->kf_kb);
 	rc = kcndb_file_write(kf);
 	if (rc)
 		kf->kf_size += len;
 	return rc;
 }
+
+/*
+ * keep data appended in memory instead of writing it until a spool is
+ * flushed.  this lets a caller build a file under a lock and write it
+ * after releasing the lock.
+ */
+void
+kcndb_file_spool(struct kcndb_file *kf)
+{
+
+	kf->kf_spooling = true;
+}
+
+/* write out data spooled in order, and stop spooling. */
+bool
+kcndb_file_spool_flush(struct kcndb_file *kf)
+{
+	struct kcn_buf kb;
+	int error;
+
+	kf->kf_spooling = false;
+	if (! kcndb_file_seek(kf, 0, SEEK_END))
+		return false;
+	while (kcn_buf_fetch(&kb, &kf->kf_spool)) {
+		while (kcn_buf_len(&kb) > 0)
+			if ((error = kcn_buf_write(kf->kf_fd, &kb)) != 0) {
+				KCN_LOG(ERR, "cannot write file: %s",
+				    strerror(error));
+				errno = error;
+				return false;
+			}
+		kcn_buf_drop(&kb, &kf->kf_spool);
+	}
+	return true;
+}
+
+/* make room for len bytes in a buffer by appending buffered data. */
+bool
+kcndb_file_reserve(struct kcndb_file *kf, size_t len)
+{
+
+	assert(len <= KCNDB_FILE_BUFSIZ);
+	if (kcn_buf_len(&kf->kf_kb) + len <= KCNDB_FILE_BUFSIZ)
+		return true;
+	return kcndb_file_append(kf);
+}
+
+static bool
+kcndb_file_lock(struct kcndb_file *kf, off_t off, size_t len)
+{
+	void *map;
+
+	assert(kf->kf_map == NULL);
+	map = mmap(NULL, len, PROT_READ, MAP_SHARED, kf->kf_fd, off);
+	if (map == MAP_FAILED)
+		return false;
+	if (mlock(map, len) == -1) {
+		(void)munmap(map, len);
+		return false;
+	}
+	kf->kf_map = map;
+	kf->kf_maplen = len;
+	return true;
+}
+
+/*
+ * bring a region of a file into the page cache.  the region is locked into
+ * memory until the file is closed if requested and permitted, or just read
+ * otherwise.
+ */
+bool
+kcndb_file_warmup(struct kcndb_file *kf, off_t off, size_t len, bool lock)
+{
+	char *buf;
+	long pagesize;
+	ssize_t n;
+
+	pagesize = sysconf(_SC_PAGESIZE);
+	if (pagesize > 0) {
+		len += off % pagesize;
+		off -= off % pagesize;
+	}
+	if (len == 0)
+		return true;
+	if (lock) {
+		if (kcndb_file_lock(kf, off, len))
+			return true;
+		KCN_LOG(WARN, "cannot lock file onto memory, read instead: %s",
+		    strerror(errno));
+	}
+#ifdef POSIX_FADV_WILLNEED
+	(void)posix_fadvise(kf->kf_fd, off, len, POSIX_FADV_WILLNEED);
+#endif /* POSIX_FADV_WILLNEED */
+	buf = malloc(KCNDB_FILE_WARMUP_CHUNKSIZ);
+	if (buf == NULL)
+		return false;
+	n = 0;
+	while (len > 0) {
+		n = pread(kf->kf_fd, buf, len < KCNDB_FILE_WARMUP_CHUNKSIZ ?
+		    len : KCNDB_FILE_WARMUP_CHUNKSIZ, off);
+		if (n <= 0) {
+			if (n == -1)
+				KCN_LOG(ERR, "cannot read file: %s",
+				    strerror(errno));
+			break;
+		}
+		off += n;
+		len -= n;
+	}
+	free(buf);
+	return n != -1;
+}
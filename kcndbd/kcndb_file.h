@@ -9,4 +9,10 @@ struct kcn_buf *kcndb_file_buf(struct kcndb_file *);
 bool kcndb_file_ensure(struct kcndb_file *, size_t);
 bool kcndb_file_seek_head(struct kcndb_file *, off_t);
 bool kcndb_file_write(struct kcndb_file *);
+bool kcndb_file_sync(struct kcndb_file *);
+bool kcndb_file_truncate(struct kcndb_file *, size_t);
 bool kcndb_file_append(struct kcndb_file *);
+bool kcndb_file_reserve(struct kcndb_file *, size_t);
+void kcndb_file_spool(struct kcndb_file *);
+bool kcndb_file_spool_flush(struct kcndb_file *);
+bool kcndb_file_warmup(struct kcndb_file *, off_t, size_t, bool);
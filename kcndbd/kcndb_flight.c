@@ -0,0 +1,235 @@
+/*
+ * single-flight of identical queries.
+ *
+ * the first worker that receives a query becomes a leader, scans a table
+ * and records matched locators.  other workers receiving an identical query
+ * while the scan is in progress attach to the flight, wait for the leader
+ * landing, and replay recorded locators instead of scanning again.
+ */
+#include <sys/queue.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pthread.h>
+
+#include "kcn.h"
+#include "kcn_str.h"
+#include "kcn_eq.h"
+#include "kcn_log.h"
+#include "kcn_buf.h"
+#include "kcn_msg.h"
+
+#include "kcndb_db.h"
+#include "kcndb_flight.h"
+
+struct kcndb_flight_loc {
+	char *kfl_loc;
+	size_t kfl_loclen;
+	size_t kfl_score;
+};
+
+struct kcndb_flight {
+	TAILQ_ENTRY(kcndb_flight) kf_chain;
+	struct kcn_msg_query kf_kmq;
+	unsigned int kf_refcnt;
+	bool kf_landed;
+	int kf_error;
+	size_t kf_nlocs;
+	struct kcndb_flight_loc kf_locs[1];
+};
+
+static TAILQ_HEAD(, kcndb_flight) kcndb_flight_list =
+    TAILQ_HEAD_INITIALIZER(kcndb_flight_list);
+static pthread_mutex_t kcndb_flight_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t kcndb_flight_cond = PTHREAD_COND_INITIALIZER;
+
+static struct kcndb_flight *
+kcndb_flight_new(const struct kcn_msg_query *kmq)
+{
+	struct kcndb_flight *kf;
+
+	kf = malloc(offsetof(struct kcndb_flight, kf_locs[kmq->kmq_maxcount]));
+	if (kf == NULL)
+		return NULL;
+	kf->kf_kmq = *kmq;
+	kf->kf_refcnt = 1;
+	kf->kf_landed = false;
+	kf->kf_error = 0;
+	kf->kf_nlocs = 0;
+	return kf;
+}
+
+static void
+kcndb_flight_destroy(struct kcndb_flight *kf)
+{
+	size_t i;
+
+	for (i = 0; i < kf->kf_nlocs; i++)
+		free(kf->kf_locs[i].kfl_loc);
+	free(kf);
+}
+
+static void
+kcndb_flight_lock(void)
+{
+	int error;
+
+	error = pthread_mutex_lock(&kcndb_flight_mutex);
+	if (error != 0)
+		KCN_LOG(EMERG, "flight lock error: %s", strerror(error));
+	assert(error == 0);
+}
+
+static void
+kcndb_flight_unlock(void)
+{
+	int error;
+
+	error = pthread_mutex_unlock(&kcndb_flight_mutex);
+	if (error != 0)
+		KCN_LOG(EMERG, "flight unlock error: %s", strerror(error));
+	assert(error == 0);
+}
+
+static bool
+kcndb_flight_match(const struct kcndb_flight *kf,
+    const struct kcn_msg_query *kmq)
+{
+	const struct kcn_eq *ke1, *ke2;
+	size_t i;
+
+	if (kf->kf_kmq.kmq_loctype != kmq->kmq_loctype ||
+	    kf->kf_kmq.kmq_maxcount != kmq->kmq_maxcount ||
+	    kf->kf_kmq.kmq_neqs != kmq->kmq_neqs)
+		return false;
+	for (i = 0; i < kmq->kmq_neqs; i++) {
+		ke1 = &kf->kf_kmq.kmq_eqs[i];
+		ke2 = &kmq->kmq_eqs[i];
+		if (ke1->ke_type != ke2->ke_type ||
+		    ke1->ke_func != ke2->ke_func ||
+		    ke1->ke_funcarg != ke2->ke_funcarg ||
+		    ke1->ke_op != ke2->ke_op ||
+		    ke1->ke_val != ke2->ke_val ||
+		    ke1->ke_start != ke2->ke_start ||
+		    ke1->ke_end != ke2->ke_end)
+			return false;
+	}
+	return true;
+}
+
+/*
+ * return a flight of an identical query in progress, or a new flight that
+ * the caller should lead if there is no such flight.
+ */
+struct kcndb_flight *
+kcndb_flight_join(const struct kcn_msg_query *kmq, bool *leaderp)
+{
+	struct kcndb_flight *kf;
+
+	kcndb_flight_lock();
+	TAILQ_FOREACH(kf, &kcndb_flight_list, kf_chain)
+		if (kcndb_flight_match(kf, kmq)) {
+			++kf->kf_refcnt;
+			*leaderp = false;
+			goto out;
+		}
+	kf = kcndb_flight_new(kmq);
+	if (kf != NULL) {
+		TAILQ_INSERT_TAIL(&kcndb_flight_list, kf, kf_chain);
+		*leaderp = true;
+	}
+  out:
+	kcndb_flight_unlock();
+	return kf;
+}
+
+/* only a leader calls this, and followers never see locators until landing. */
+bool
+kcndb_flight_loc_add(struct kcndb_flight *kf, const char *loc, size_t loclen,
+    size_t score)
+{
+	struct kcndb_flight_loc *kfl;
+
+	assert(! kf->kf_landed);
+	if (kf->kf_nlocs == kf->kf_kmq.kmq_maxcount) {
+		errno = ETOOMANYREFS; /* XXX */
+		return false;
+	}
+	kfl = &kf->kf_locs[kf->kf_nlocs];
+	kfl->kfl_loc = kcn_str_dup(loc, loclen);
+	if (kfl->kfl_loc == NULL)
+		return false;
+	kfl->kfl_loclen = loclen;
+	kfl->kfl_score = score;
+	++kf->kf_nlocs;
+	return true;
+}
+
+void
+kcndb_flight_land(struct kcndb_flight *kf, int error)
+{
+	int oerrno;
+
+	oerrno = errno;
+	kcndb_flight_lock();
+	assert(! kf->kf_landed);
+	kf->kf_landed = true;
+	kf->kf_error = error;
+	TAILQ_REMOVE(&kcndb_flight_list, kf, kf_chain);
+	if (kf->kf_refcnt > 1)
+		KCN_LOG(DEBUG, "flight lands with %u follower(s)",
+		    kf->kf_refcnt - 1);
+	(void)pthread_cond_broadcast(&kcndb_flight_cond);
+	kcndb_flight_unlock();
+	kcndb_flight_leave(kf);
+	errno = oerrno;
+}
+
+bool
+kcndb_flight_wait(struct kcndb_flight *kf,
+    bool (*cb)(const struct kcndb_db_record *, size_t, void *), void *arg)
+{
+	const struct kcndb_flight_loc *kfl;
+	struct kcndb_db_record kdr;
+	size_t i;
+
+	kcndb_flight_lock();
+	while (! kf->kf_landed)
+		(void)pthread_cond_wait(&kcndb_flight_cond,
+		    &kcndb_flight_mutex);
+	kcndb_flight_unlock();
+
+	/* recorded locators are never modified after landing. */
+	memset(&kdr, 0, sizeof(kdr));
+	for (i = 0; i < kf->kf_nlocs; i++) {
+		kfl = &kf->kf_locs[i];
+		kdr.kdr_loc = kfl->kfl_loc;
+		kdr.kdr_loclen = kfl->kfl_loclen;
+		if (! (*cb)(&kdr, kfl->kfl_score, arg))
+			return false;
+	}
+	if (kf->kf_error != 0) {
+		errno = kf->kf_error;
+		return false;
+	}
+	return true;
+}
+
+void
+kcndb_flight_leave(struct kcndb_flight *kf)
+{
+	bool last;
+
+	kcndb_flight_lock();
+	assert(kf->kf_refcnt > 0);
+	last = --kf->kf_refcnt == 0 ? true : false;
+	kcndb_flight_unlock();
+	if (last)
+		kcndb_flight_destroy(kf);
+}
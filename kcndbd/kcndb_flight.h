@@ -0,0 +1,8 @@
+struct kcndb_flight;
+
+struct kcndb_flight *kcndb_flight_join(const struct kcn_msg_query *, bool *);
+bool kcndb_flight_loc_add(struct kcndb_flight *, const char *, size_t, size_t);
+void kcndb_flight_land(struct kcndb_flight *, int);
+bool kcndb_flight_wait(struct kcndb_flight *,
+    bool (*)(const struct kcndb_db_record *, size_t, void *), void *);
+void kcndb_flight_leave(struct kcndb_flight *);
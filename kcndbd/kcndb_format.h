@@ -0,0 +1,77 @@
+/*
+ * formats of files of kcndbd shared with tools that read or write them
+ * directly.  integers are written in network byte order.
+ */
+#define KCNDB_DB_PATH_LOC		"loc"
+#define KCNDB_DB_PATH_LOC_SUFFIX	"-loc"		/* obsolete */
+#define KCNDB_DB_PATH_MIGRATE_SUFFIX	".migrate"
+#define KCNDB_DB_PATH_CHECKPOINT_SUFFIX	".ckpt"
+#define KCNDB_DB_PATH_CHECKPOINT_TEMP_SUFFIX	".ckpt.tmp"
+#define KCNDB_DB_PATH_TOMB_SUFFIX	".del"
+#define KCNDB_DB_PATH_MERGE_SUFFIX	".merge"
+#define KCNDB_DB_PATH_MERGE_TEMP_SUFFIX	".merge.tmp"
+#define KCNDB_DB_PATH_LATE_SUFFIX	".late"
+#define KCNDB_DB_PATH_COMPACT_SUFFIX	".compact"
+#define KCNDB_DB_PATH_COMMIT		"commit"
+
+#define KCNDB_DB_SHARD_MAX		16
+
+/*
+ * a dictionary of locators is a hash table of heads of chains followed by
+ * entries of length(2) locator next(8), and an index of a locator is an
+ * offset of its entry.
+ */
+#define KCNDB_DB_LOC_HASHSIZ	256
+#define KCNDB_DB_LOC_INDEXSIZ	sizeof(uint64_t)
+#define KCNDB_DB_LOC_INDEXTABLESIZ					\
+	(KCNDB_DB_LOC_INDEXSIZ * KCNDB_DB_LOC_HASHSIZ)
+
+/* time(8) value(8) index(8) of a record, and index(8) start(8) end(8). */
+#define KCNDB_DB_RECORDSIZ	(8 + 8 + 8)
+#define KCNDB_DB_TOMBSIZ	(8 + 8 + 8)
+
+#define KCNDB_CAPTURE_MAGIC		"KCNC"
+#define KCNDB_CAPTURE_VERSION		1
+#define KCNDB_CAPTURE_HDRSIZ		(4 + 2)
+#define KCNDB_CAPTURE_ENTRYHDRSIZ	(8 + 4 + 2)
+
+static inline void
+kcndb_format_put64(uint8_t *p, uint64_t v)
+{
+	int i;
+
+	for (i = 7; i >= 0; i--, v >>= 8)
+		p[i] = v & 0xff;
+}
+
+static inline uint64_t
+kcndb_format_get64(const uint8_t *p)
+{
+	uint64_t v;
+	int i;
+
+	for (i = 0, v = 0; i < 8; i++)
+		v = (v << 8) | p[i];
+	return v;
+}
+
+/* a shard to which records of a locator are added. */
+static inline unsigned int
+kcndb_format_shard(uint64_t locidx, unsigned int nshards)
+{
+
+	return ((locidx * 0x9e3779b97f4a7c15ULL) >> 32) % nshards;
+}
+
+/* a file name of a shard of a table, where the first has no suffix. */
+static inline void
+kcndb_format_table_name(char *name, size_t len, enum kcn_eq_type type,
+    unsigned int shard)
+{
+
+	if (shard == 0)
+		(void)snprintf(name, len, "%s", kcn_eq_type_ntoa(type));
+	else
+		(void)snprintf(name, len, "%s.%u", kcn_eq_type_ntoa(type),
+		    shard);
+}
@@ -0,0 +1,95 @@
+/*
+ * open hash tables of entries keyed by a locator index.
+ *
+ * entries are linked to a bucket, and are owned by a caller, which keeps
+ * its own list to walk them.  a table is doubled as entries increase.
+ */
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "kcndb_hash.h"
+
+#define KCNDB_HASH_BITS_MIN	8
+#define KCNDB_HASH_BITS_MAX	30
+
+static unsigned int
+kcndb_hash_index(uint64_t key, unsigned int bits)
+{
+
+	return (key * 0x9e3779b97f4a7c15ULL) >> (64 - bits);
+}
+
+static bool
+kcndb_hash_alloc(struct kcndb_hash *kh, unsigned int bits)
+{
+	struct kcndb_hash_entry **buckets, *khe, *nkhe;
+	unsigned int h, i;
+
+	buckets = calloc((size_t)1 << bits, sizeof(*buckets));
+	if (buckets == NULL)
+		return false;
+	if (kh->kh_buckets != NULL)
+		for (i = 0; i < (1U << kh->kh_bits); i++)
+			for (khe = kh->kh_buckets[i]; khe != NULL; khe = nkhe) {
+				nkhe = khe->khe_next;
+				h = kcndb_hash_index(khe->khe_key, bits);
+				khe->khe_next = buckets[h];
+				buckets[h] = khe;
+			}
+	free(kh->kh_buckets);
+	kh->kh_buckets = buckets;
+	kh->kh_bits = bits;
+	return true;
+}
+
+bool
+kcndb_hash_init(struct kcndb_hash *kh)
+{
+
+	kh->kh_n = 0;
+	kh->kh_buckets = NULL;
+	return kcndb_hash_alloc(kh, KCNDB_HASH_BITS_MIN);
+}
+
+/* entries are not freed. */
+void
+kcndb_hash_finish(struct kcndb_hash *kh)
+{
+
+	free(kh->kh_buckets);
+	kh->kh_buckets = NULL;
+}
+
+struct kcndb_hash_entry *
+kcndb_hash_find(const struct kcndb_hash *kh, uint64_t key)
+{
+	struct kcndb_hash_entry *khe;
+
+	khe = kh->kh_buckets[kcndb_hash_index(key, kh->kh_bits)];
+	for (; khe != NULL; khe = khe->khe_next)
+		if (khe->khe_key == key)
+			return khe;
+	return NULL;
+}
+
+/* a key of an entry must be set, and must not be in a table. */
+bool
+kcndb_hash_insert(struct kcndb_hash *kh, struct kcndb_hash_entry *khe)
+{
+	unsigned int h;
+
+	assert(kcndb_hash_find(kh, khe->khe_key) == NULL);
+	/* keep an average chain length less than 1. */
+	if (kh->kh_n >= ((size_t)1 << kh->kh_bits) &&
+	    kh->kh_bits < KCNDB_HASH_BITS_MAX &&
+	    ! kcndb_hash_alloc(kh, kh->kh_bits + 1))
+		return false;
+	h = kcndb_hash_index(khe->khe_key, kh->kh_bits);
+	khe->khe_next = kh->kh_buckets[h];
+	kh->kh_buckets[h] = khe;
+	++kh->kh_n;
+	return true;
+}
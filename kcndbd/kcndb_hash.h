@@ -0,0 +1,16 @@
+/* an entry must be the first member of a structure hashed. */
+struct kcndb_hash_entry {
+	struct kcndb_hash_entry *khe_next;
+	uint64_t khe_key;
+};
+
+struct kcndb_hash {
+	unsigned int kh_bits;
+	size_t kh_n;
+	struct kcndb_hash_entry **kh_buckets;
+};
+
+bool kcndb_hash_init(struct kcndb_hash *);
+void kcndb_hash_finish(struct kcndb_hash *);
+struct kcndb_hash_entry *kcndb_hash_find(const struct kcndb_hash *, uint64_t);
+bool kcndb_hash_insert(struct kcndb_hash *, struct kcndb_hash_entry *);
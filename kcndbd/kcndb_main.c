@@ -16,8 +16,10 @@
 #include "kcn_signal.h"
 #include "kcn_netstat.h"
 
+#include "kcndb_format.h"
 #include "kcndb_db.h"
 #include "kcndb_server.h"
+#include "kcndb_capture.h"
 
 static void usage(const char *, ...);
 
@@ -26,16 +28,29 @@ static const char *pname;
 int
 main(int argc, char * const argv[])
 {
-	const char *p;
-	bool dflag, fflag;
+	struct kcndb_db *kd;
+	const char *p, *attach, *capture;
+	bool dflag, fflag, lflag, rc;
 	int ch;
-	unsigned long long llval;
+	unsigned long long llval, warmup;
 
 	pname = (p = strrchr(argv[0], '/')) != NULL ? p + 1 : argv[0];
 
-	dflag = fflag = false;
-	while ((ch = getopt(argc, argv, "d:fhp:v?")) != -1) {
+	dflag = fflag = lflag = false;
+	attach = capture = NULL;
+	warmup = 0;
+	while ((ch = getopt(argc, argv, "a:c:d:fhk:lm:n:p:r:s:t:v?")) != -1) {
 		switch (ch) {
+		case 'a':
+			attach = optarg;
+			break;
+		case 'c':
+			if (! kcn_strtoull(optarg, 0,
+			    KCNDB_DB_CHECKPOINT_INTERVAL_MAX, &llval))
+				usage("invalid checkpoint interval");
+				/*NOTREACHED*/
+			kcndb_db_checkpoint_interval_set(llval);
+			break;
 		case 'd':
 			if (dflag)
 				usage("-d can be specified only once");
@@ -45,6 +60,29 @@ main(int argc, char * const argv[])
 		case 'f':
 			fflag = true;
 			break;
+		case 'k':
+			if (! kcn_strtoull(optarg, 0,
+			    KCNDB_DB_COMPACT_INTERVAL_MAX, &llval))
+				usage("invalid compaction interval");
+				/*NOTREACHED*/
+			kcndb_db_compact_interval_set(llval);
+			break;
+		case 'l':
+			lflag = true;
+			break;
+		case 'm':
+			if (! kcn_strtoull(optarg, 0, KCNDB_DB_WARMUP_MAX,
+			    &warmup))
+				usage("invalid warm-up budget");
+				/*NOTREACHED*/
+			break;
+		case 'n':
+			if (! kcn_strtoull(optarg, 1, KCNDB_DB_SHARD_MAX,
+			    &llval))
+				usage("invalid number of shards");
+				/*NOTREACHED*/
+			kcndb_db_shards_set(llval);
+			break;
 		case 'p':
 			if (! kcn_strtoull(optarg, KCNDB_NET_PORT_MIN,
 			    KCNDB_NET_PORT_MAX, &llval))
@@ -52,6 +90,31 @@ main(int argc, char * const argv[])
 				/*NOTERACHED*/
 			kcndb_server_port_set(llval);
 			break;
+		case 'r':
+			if (! kcn_strtoull(optarg, 0,
+			    KCNDB_DB_REORDER_WINDOW_MAX, &llval))
+				usage("invalid reorder window");
+				/*NOTREACHED*/
+			kcndb_db_reorder_window_set(llval);
+			break;
+		case 's':
+			if (strcmp(optarg, "none") == 0)
+				kcndb_db_durability_set(
+				    KCNDB_DB_DURABILITY_NONE, 0);
+			else if (strcmp(optarg, "batch") == 0)
+				kcndb_db_durability_set(
+				    KCNDB_DB_DURABILITY_BATCH, 0);
+			else if (kcn_strtoull(optarg, 1,
+			    KCNDB_DB_SYNC_INTERVAL_MAX, &llval))
+				kcndb_db_durability_set(
+				    KCNDB_DB_DURABILITY_PERIODIC, llval);
+			else
+				usage("invalid sync policy");
+				/*NOTREACHED*/
+			break;
+		case 't':
+			capture = optarg;
+			break;
 		case 'v':
 			kcn_log_priority_increment();
 			break;
@@ -72,10 +135,43 @@ main(int argc, char * const argv[])
 		usage("cannot daemonize");
 		/*NOTREACHED*/
 
+	if (attach != NULL) {
+		kd = kcndb_db_new();
+		rc = kd != NULL && kcndb_db_attach(kd, attach);
+		kcndb_db_destroy(kd);
+		if (! rc)
+			usage("cannot attach %s", attach);
+			/*NOTREACHED*/
+	}
+
+	if (! kcndb_db_warmup(warmup * 1024 * 1024, lflag))
+		usage("cannot warm up database");
+		/*NOTREACHED*/
+
+	if (capture != NULL && ! kcndb_capture_open(capture))
+		usage("cannot open capture file %s", capture);
+		/*NOTREACHED*/
+
 	if (! kcndb_server_start())
 		usage("cannot launch server");
 		/*NOTREACHED*/
 
+	if (! kcndb_db_syncer_start())
+		usage("cannot launch syncer");
+		/*NOTREACHED*/
+
+	if (! kcndb_db_reorder_start())
+		usage("cannot launch reorder buffer");
+		/*NOTREACHED*/
+
+	if (! kcndb_db_checkpointer_start())
+		usage("cannot launch checkpointer");
+		/*NOTREACHED*/
+
+	if (! kcndb_db_compactor_start())
+		usage("cannot launch compactor");
+		/*NOTREACHED*/
+
 	kcndb_server_loop();
 
 	return 0;
@@ -96,15 +192,37 @@ usage(const char *errfmt, ...)
 		va_end(ap);
 	}
 	fprintf(stderr, "\
-Usage: %s [-d directory] [-h] [-p port] [-v] ...\n\
+Usage: %s [-a directory] [-c seconds] [-d directory] [-h] [-k seconds]\n\
+	[-l] [-m megabytes] [-n shards] [-p port] [-r seconds] [-s sync]\n\
+	[-t file] [-v] ...\n\
 \n\
 Options:\n\
+	-a: attach a directory built by kcndbctl -b before serving\n\
+	-c: interval to checkpoint indexes (default %d, 0 disables)\n\
 	-d: databse directory (default %s)\n\
 	-f: do not daemonize\n\
 	-h: print this messsage\n\
+	-k: interval to compact deleted records and fold records too late\n\
+	    to merge (default %d, 0 disables)\n\
+	-l: lock warmed up regions onto memory\n\
+	-m: memory budget to warm up database files before serving\n\
+	    (default 0, i.e., no warm-up)\n\
+	-n: number of shards of each table to add records in parallel\n\
+	    (default 1, up to %d)\n\
 	-p: TCP listen port number (default %d)\n\
+	-r: window to hold records in memory to sort late ones (default 0,\n\
+	    up to %d); older records are merged into tables, and records\n\
+	    held are written on every sync with -s\n\
+	-s: sync files to disk: none (default), batch (every batch of\n\
+	    received messages), or interval in msec (up to %d)\n\
+	-t: capture received messages to a file to replay them later by\n\
+	    kcnreplay (appended if exists)\n\
 	-v: increment verbosity (can be specified 7 times at maximum)\n\
 \n",
-	    pname, KCN_DB_PATH, KCN_NETSTAT_PORT_DEFAULT);
+	    pname, KCNDB_DB_CHECKPOINT_INTERVAL_DEFAULT, KCN_DB_PATH,
+	    KCNDB_DB_COMPACT_INTERVAL_DEFAULT,
+	    KCNDB_DB_SHARD_MAX, KCN_NETSTAT_PORT_DEFAULT,
+	    KCNDB_DB_REORDER_WINDOW_MAX,
+	    KCNDB_DB_SYNC_INTERVAL_MAX);
 	exit(EXIT_FAILURE);
 }
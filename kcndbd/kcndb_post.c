@@ -0,0 +1,226 @@
+/*
+ * per-locator posting lists of record offsets in a table.
+ *
+ * offsets are appended in order of records, and are sorted in time order
+ * as same as records in a table.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "kcn.h"
+#include "kcn_buf.h"
+
+#include "kcndb_file.h"
+#include "kcndb_hash.h"
+#include "kcndb_post.h"
+
+struct kcndb_post_list {
+	struct kcndb_hash_entry kpl_hentry;	/* must be first. */
+#define kpl_locidx	kpl_hentry.khe_key
+	STAILQ_ENTRY(kcndb_post_list) kpl_chain;
+	size_t kpl_n;
+	size_t kpl_size;
+	uint64_t *kpl_offs;
+};
+
+struct kcndb_post {
+	size_t kp_nlists;
+	struct kcndb_hash kp_hash;
+	STAILQ_HEAD(, kcndb_post_list) kp_lists;
+};
+
+#define KCNDB_POST_OFFSIZ_MIN	4
+
+struct kcndb_post *
+kcndb_post_new(void)
+{
+	struct kcndb_post *kp;
+
+	kp = malloc(sizeof(*kp));
+	if (kp == NULL)
+		return NULL;
+	kp->kp_nlists = 0;
+	STAILQ_INIT(&kp->kp_lists);
+	if (! kcndb_hash_init(&kp->kp_hash)) {
+		free(kp);
+		return NULL;
+	}
+	return kp;
+}
+
+void
+kcndb_post_destroy(struct kcndb_post *kp)
+{
+	struct kcndb_post_list *kpl;
+
+	if (kp == NULL)
+		return;
+	while ((kpl = STAILQ_FIRST(&kp->kp_lists)) != NULL) {
+		STAILQ_REMOVE_HEAD(&kp->kp_lists, kpl_chain);
+		free(kpl->kpl_offs);
+		free(kpl);
+	}
+	kcndb_hash_finish(&kp->kp_hash);
+	free(kp);
+}
+
+static struct kcndb_post_list *
+kcndb_post_list_find(const struct kcndb_post *kp, uint64_t locidx)
+{
+
+	return (struct kcndb_post_list *)kcndb_hash_find(&kp->kp_hash, locidx);
+}
+
+static struct kcndb_post_list *
+kcndb_post_list_lookup(struct kcndb_post *kp, uint64_t locidx)
+{
+	struct kcndb_post_list *kpl;
+
+	kpl = kcndb_post_list_find(kp, locidx);
+	if (kpl != NULL)
+		return kpl;
+	kpl = malloc(sizeof(*kpl));
+	if (kpl == NULL)
+		return NULL;
+	kpl->kpl_locidx = locidx;
+	kpl->kpl_n = 0;
+	kpl->kpl_size = 0;
+	kpl->kpl_offs = NULL;
+	if (! kcndb_hash_insert(&kp->kp_hash, &kpl->kpl_hentry)) {
+		free(kpl);
+		return NULL;
+	}
+	STAILQ_INSERT_TAIL(&kp->kp_lists, kpl, kpl_chain);
+	++kp->kp_nlists;
+	return kpl;
+}
+
+/* offsets must be added in ascending order. */
+bool
+kcndb_post_add(struct kcndb_post *kp, uint64_t locidx, uint64_t off)
+{
+	struct kcndb_post_list *kpl;
+	uint64_t *offs;
+	size_t size;
+
+	kpl = kcndb_post_list_lookup(kp, locidx);
+	if (kpl == NULL)
+		return false;
+	assert(kpl->kpl_n == 0 || kpl->kpl_offs[kpl->kpl_n - 1] < off);
+	if (kpl->kpl_n == kpl->kpl_size) {
+		size = kpl->kpl_size == 0 ?
+		    KCNDB_POST_OFFSIZ_MIN : kpl->kpl_size * 2;
+		offs = realloc(kpl->kpl_offs, size * sizeof(*offs));
+		if (offs == NULL)
+			return false;
+		kpl->kpl_offs = offs;
+		kpl->kpl_size = size;
+	}
+	kpl->kpl_offs[kpl->kpl_n++] = off;
+	return true;
+}
+
+/* remove offsets at or after off, e.g., of records to be rewritten. */
+void
+kcndb_post_truncate(struct kcndb_post *kp, uint64_t off)
+{
+	struct kcndb_post_list *kpl;
+
+	STAILQ_FOREACH(kpl, &kp->kp_lists, kpl_chain)
+		while (kpl->kpl_n > 0 && kpl->kpl_offs[kpl->kpl_n - 1] >= off)
+			--kpl->kpl_n;
+}
+
+/*
+ * a snapshot consists of the number of lists followed by lists, each of
+ * which consists of a locator index, the number of offsets and offsets.
+ */
+bool
+kcndb_post_save(const struct kcndb_post *kp, struct kcndb_file *kf)
+{
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+	const struct kcndb_post_list *kpl;
+	size_t j;
+
+	if (! kcndb_file_reserve(kf, sizeof(uint64_t)))
+		return false;
+	kcn_buf_put64(kb, kp->kp_nlists);
+	STAILQ_FOREACH(kpl, &kp->kp_lists, kpl_chain) {
+		if (! kcndb_file_reserve(kf, sizeof(uint64_t) * 2))
+			return false;
+		kcn_buf_put64(kb, kpl->kpl_locidx);
+		kcn_buf_put64(kb, kpl->kpl_n);
+		for (j = 0; j < kpl->kpl_n; j++) {
+			if (! kcndb_file_reserve(kf, sizeof(uint64_t)))
+				return false;
+			kcn_buf_put64(kb, kpl->kpl_offs[j]);
+		}
+	}
+	return true;
+}
+
+static bool
+kcndb_post_get64(struct kcndb_file *kf, uint64_t *vp)
+{
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+
+	if (! kcndb_file_ensure(kf, sizeof(uint64_t)))
+		return false;
+	*vp = kcn_buf_get64(kb);
+	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	return true;
+}
+
+/* load a snapshot of which offsets must be less than maxoff. */
+bool
+kcndb_post_load(struct kcndb_post *kp, struct kcndb_file *kf,
+    uint64_t maxoff)
+{
+	uint64_t nlists, locidx, n, i, off, prev;
+
+	if (! kcndb_post_get64(kf, &nlists))
+		return false;
+	while (nlists-- > 0) {
+		if (! kcndb_post_get64(kf, &locidx) ||
+		    ! kcndb_post_get64(kf, &n))
+			return false;
+		if (kcndb_post_list_find(kp, locidx) != NULL)
+			goto bad;
+		for (i = 0, prev = 0; i < n; i++, prev = off) {
+			if (! kcndb_post_get64(kf, &off))
+				return false;
+			if (off >= maxoff || (i > 0 && off <= prev))
+				goto bad;
+			if (! kcndb_post_add(kp, locidx, off))
+				return false;
+		}
+	}
+	return true;
+  bad:
+	errno = EINVAL;
+	return false;
+}
+
+/* returned offsets are valid until the next addition. */
+bool
+kcndb_post_lookup(const struct kcndb_post *kp, uint64_t locidx,
+    const uint64_t **offsp, size_t *noffsp)
+{
+	const struct kcndb_post_list *kpl;
+
+	kpl = kcndb_post_list_find(kp, locidx);
+	if (kpl == NULL) {
+		errno = ENOENT;
+		return false;
+	}
+	*offsp = kpl->kpl_offs;
+	*noffsp = kpl->kpl_n;
+	return true;
+}
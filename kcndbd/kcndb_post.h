@@ -0,0 +1,10 @@
+struct kcndb_post;
+
+struct kcndb_post *kcndb_post_new(void);
+void kcndb_post_destroy(struct kcndb_post *);
+bool kcndb_post_add(struct kcndb_post *, uint64_t, uint64_t);
+void kcndb_post_truncate(struct kcndb_post *, uint64_t);
+bool kcndb_post_save(const struct kcndb_post *, struct kcndb_file *);
+bool kcndb_post_load(struct kcndb_post *, struct kcndb_file *, uint64_t);
+bool kcndb_post_lookup(const struct kcndb_post *, uint64_t,
+    const uint64_t **, size_t *);
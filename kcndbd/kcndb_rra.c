@@ -0,0 +1,444 @@
+/*
+ * round-robin archives of consolidated samples per locator.
+ *
+ * each archive is a ring of fixed number of slots, each of which
+ * consolidates samples in a step, and an old slot is overwritten when
+ * time goes around.  memory of a locator is therefore bounded regardless
+ * of the number of samples.  a ring is divided into chunks of slots, and
+ * a chunk is allocated when a sample first falls into it so that a
+ * locator sampled rarely costs a few chunks only.  archives are filled
+ * when records are added, and an aggregate query over a long window reads
+ * consolidated slots instead of raw records.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <assert.h>
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kcn.h"
+#include "kcn_eq.h"
+#include "kcn_log.h"
+#include "kcn_time.h"
+#include "kcn_buf.h"
+
+#include "kcndb_file.h"
+#include "kcndb_hash.h"
+#include "kcndb_rra.h"
+
+struct kcndb_rra_archive {
+	time_t kraa_step;
+	size_t kraa_nslots;
+};
+
+/* from the finest to the coarsest. */
+static const struct kcndb_rra_archive kcndb_rra_archives[] = {
+	{ KCN_TIME_MININSEC,	KCN_TIME_DAYINSEC / KCN_TIME_MININSEC },
+	{ KCN_TIME_HOURINSEC,	31 * KCN_TIME_DAYINSEC / KCN_TIME_HOURINSEC },
+};
+
+#define KCNDB_RRA_NARCHIVES						\
+	(sizeof(kcndb_rra_archives) / sizeof(kcndb_rra_archives[0]))
+
+/* an hour of the finest archive. */
+#define KCNDB_RRA_CHUNKSIZ	60
+#define KCNDB_RRA_NCHUNKS(kraa)						\
+	(((kraa)->kraa_nslots + KCNDB_RRA_CHUNKSIZ - 1) / KCNDB_RRA_CHUNKSIZ)
+
+/* a window must span this number of steps at least to use an archive. */
+#define KCNDB_RRA_MINSTEPS	24
+
+struct kcndb_rra_slot {
+	uint64_t krs_index;	/* time / step */
+	uint32_t krs_count;
+	double krs_sum;
+	unsigned long long krs_min;
+	unsigned long long krs_max;
+};
+
+struct kcndb_rra_loc {
+	struct kcndb_hash_entry kral_hentry;	/* must be first. */
+#define kral_locidx	kral_hentry.khe_key
+	STAILQ_ENTRY(kcndb_rra_loc) kral_chain;
+	struct kcndb_rra_slot **kral_chunks[KCNDB_RRA_NARCHIVES];
+};
+
+struct kcndb_rra {
+	size_t kra_nlocs;
+	struct kcndb_hash kra_hash;
+	STAILQ_HEAD(, kcndb_rra_loc) kra_locs;
+};
+
+struct kcndb_rra *
+kcndb_rra_new(void)
+{
+	struct kcndb_rra *kra;
+
+	kra = malloc(sizeof(*kra));
+	if (kra == NULL)
+		return NULL;
+	kra->kra_nlocs = 0;
+	STAILQ_INIT(&kra->kra_locs);
+	if (! kcndb_hash_init(&kra->kra_hash)) {
+		free(kra);
+		return NULL;
+	}
+	return kra;
+}
+
+static void
+kcndb_rra_loc_free(struct kcndb_rra_loc *kral)
+{
+	size_t i, j;
+
+	for (i = 0; i < KCNDB_RRA_NARCHIVES; i++) {
+		if (kral->kral_chunks[i] == NULL)
+			continue;
+		for (j = 0; j < KCNDB_RRA_NCHUNKS(&kcndb_rra_archives[i]); j++)
+			free(kral->kral_chunks[i][j]);
+		free(kral->kral_chunks[i]);
+	}
+	free(kral);
+}
+
+void
+kcndb_rra_destroy(struct kcndb_rra *kra)
+{
+	struct kcndb_rra_loc *kral;
+
+	if (kra == NULL)
+		return;
+	while ((kral = STAILQ_FIRST(&kra->kra_locs)) != NULL) {
+		STAILQ_REMOVE_HEAD(&kra->kra_locs, kral_chain);
+		kcndb_rra_loc_free(kral);
+	}
+	kcndb_hash_finish(&kra->kra_hash);
+	free(kra);
+}
+
+static struct kcndb_rra_loc *
+kcndb_rra_loc_lookup(struct kcndb_rra *kra, uint64_t locidx)
+{
+	struct kcndb_rra_loc *kral;
+
+	kral = (struct kcndb_rra_loc *)kcndb_hash_find(&kra->kra_hash, locidx);
+	if (kral != NULL)
+		return kral;
+	kral = calloc(1, sizeof(*kral));
+	if (kral == NULL)
+		return NULL;
+	kral->kral_locidx = locidx;
+	if (! kcndb_hash_insert(&kra->kra_hash, &kral->kral_hentry)) {
+		free(kral);
+		return NULL;
+	}
+	STAILQ_INSERT_TAIL(&kra->kra_locs, kral, kral_chain);
+	++kra->kra_nlocs;
+	return kral;
+}
+
+/* return a slot of an archive, or NULL if its chunk is not allocated. */
+static struct kcndb_rra_slot *
+kcndb_rra_slot_lookup(const struct kcndb_rra_loc *kral, size_t archive,
+    size_t j)
+{
+	struct kcndb_rra_slot *chunk;
+
+	if (kral->kral_chunks[archive] == NULL)
+		return NULL;
+	chunk = kral->kral_chunks[archive][j / KCNDB_RRA_CHUNKSIZ];
+	if (chunk == NULL)
+		return NULL;
+	return &chunk[j % KCNDB_RRA_CHUNKSIZ];
+}
+
+static struct kcndb_rra_slot *
+kcndb_rra_slot_get(struct kcndb_rra_loc *kral, size_t archive, size_t j)
+{
+	const struct kcndb_rra_archive *kraa = &kcndb_rra_archives[archive];
+	struct kcndb_rra_slot **chunkp;
+
+	if (kral->kral_chunks[archive] == NULL) {
+		kral->kral_chunks[archive] = calloc(KCNDB_RRA_NCHUNKS(kraa),
+		    sizeof(*kral->kral_chunks[archive]));
+		if (kral->kral_chunks[archive] == NULL)
+			return NULL;
+	}
+	chunkp = &kral->kral_chunks[archive][j / KCNDB_RRA_CHUNKSIZ];
+	if (*chunkp == NULL) {
+		*chunkp = calloc(KCNDB_RRA_CHUNKSIZ, sizeof(**chunkp));
+		if (*chunkp == NULL)
+			return NULL;
+	}
+	return &(*chunkp)[j % KCNDB_RRA_CHUNKSIZ];
+}
+
+/* records must be added in time order. */
+bool
+kcndb_rra_add(struct kcndb_rra *kra, uint64_t locidx, time_t t,
+    unsigned long long val)
+{
+	const struct kcndb_rra_archive *kraa;
+	struct kcndb_rra_loc *kral;
+	struct kcndb_rra_slot *krs;
+	uint64_t idx;
+	size_t i;
+
+	kral = kcndb_rra_loc_lookup(kra, locidx);
+	if (kral == NULL)
+		return false;
+	for (i = 0; i < KCNDB_RRA_NARCHIVES; i++) {
+		kraa = &kcndb_rra_archives[i];
+		idx = t / kraa->kraa_step;
+		krs = kcndb_rra_slot_get(kral, i, idx % kraa->kraa_nslots);
+		if (krs == NULL)
+			return false;
+		if (krs->krs_count > 0 && krs->krs_index > idx)
+			continue;
+		if (krs->krs_count == 0 || krs->krs_index != idx) {
+			krs->krs_index = idx;
+			krs->krs_count = 0;
+			krs->krs_sum = 0;
+			krs->krs_min = krs->krs_max = val;
+		}
+		if (val < krs->krs_min)
+			krs->krs_min = val;
+		if (val > krs->krs_max)
+			krs->krs_max = val;
+		krs->krs_sum += val;
+		++krs->krs_count;
+	}
+	return true;
+}
+
+#define KCNDB_RRA_SLOTSIZ						\
+	(sizeof(uint32_t) * 2 + sizeof(uint64_t) * 4)
+
+/*
+ * a snapshot consists of the number of locators followed by locators in
+ * order of their appearance.  a locator consists of a locator index and,
+ * for each archive, the number of used slots followed by used slots with
+ * their positions in a ring.
+ */
+bool
+kcndb_rra_save(const struct kcndb_rra *kra, struct kcndb_file *kf)
+{
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+	const struct kcndb_rra_loc *kral;
+	const struct kcndb_rra_slot *krs;
+	size_t i, j, n, nslots;
+	uint64_t sum;
+
+	if (! kcndb_file_reserve(kf, sizeof(uint64_t)))
+		return false;
+	kcn_buf_put64(kb, kra->kra_nlocs);
+	STAILQ_FOREACH(kral, &kra->kra_locs, kral_chain) {
+		if (! kcndb_file_reserve(kf, sizeof(uint64_t)))
+			return false;
+		kcn_buf_put64(kb, kral->kral_locidx);
+		for (i = 0; i < KCNDB_RRA_NARCHIVES; i++) {
+			nslots = kcndb_rra_archives[i].kraa_nslots;
+			for (n = j = 0; j < nslots; j++) {
+				krs = kcndb_rra_slot_lookup(kral, i, j);
+				if (krs != NULL && krs->krs_count > 0)
+					++n;
+			}
+			if (! kcndb_file_reserve(kf, sizeof(uint32_t)))
+				return false;
+			kcn_buf_put32(kb, n);
+			for (j = 0; j < nslots; j++) {
+				krs = kcndb_rra_slot_lookup(kral, i, j);
+				if (krs == NULL || krs->krs_count == 0)
+					continue;
+				if (! kcndb_file_reserve(kf, KCNDB_RRA_SLOTSIZ))
+					return false;
+				memcpy(&sum, &krs->krs_sum, sizeof(sum));
+				kcn_buf_put32(kb, j);
+				kcn_buf_put64(kb, krs->krs_index);
+				kcn_buf_put32(kb, krs->krs_count);
+				kcn_buf_put64(kb, sum);
+				kcn_buf_put64(kb, krs->krs_min);
+				kcn_buf_put64(kb, krs->krs_max);
+			}
+		}
+	}
+	return true;
+}
+
+bool
+kcndb_rra_load(struct kcndb_rra *kra, struct kcndb_file *kf)
+{
+	struct kcn_buf *kb = kcndb_file_buf(kf);
+	struct kcndb_rra_loc *kral;
+	struct kcndb_rra_slot *krs;
+	uint64_t nlocs, sum;
+	size_t i, j, n;
+
+	if (! kcndb_file_ensure(kf, sizeof(uint64_t)))
+		return false;
+	nlocs = kcn_buf_get64(kb);
+	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	while (nlocs-- > 0) {
+		if (! kcndb_file_ensure(kf, sizeof(uint64_t)))
+			return false;
+		kral = kcndb_rra_loc_lookup(kra, kcn_buf_get64(kb));
+		kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+		if (kral == NULL)
+			return false;
+		for (i = 0; i < KCNDB_RRA_NARCHIVES; i++) {
+			if (! kcndb_file_ensure(kf, sizeof(uint32_t)))
+				return false;
+			n = kcn_buf_get32(kb);
+			kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+			while (n-- > 0) {
+				if (! kcndb_file_ensure(kf, KCNDB_RRA_SLOTSIZ))
+					return false;
+				j = kcn_buf_get32(kb);
+				if (j >= kcndb_rra_archives[i].kraa_nslots) {
+					errno = EINVAL;
+					return false;
+				}
+				krs = kcndb_rra_slot_get(kral, i, j);
+				if (krs == NULL)
+					return false;
+				krs->krs_index = kcn_buf_get64(kb);
+				krs->krs_count = kcn_buf_get32(kb);
+				sum = kcn_buf_get64(kb);
+				memcpy(&krs->krs_sum, &sum, sizeof(sum));
+				krs->krs_min = kcn_buf_get64(kb);
+				krs->krs_max = kcn_buf_get64(kb);
+				kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+			}
+		}
+	}
+	return true;
+}
+
+/*
+ * return the coarsest archive that can answer an equation, or -1 if raw
+ * records must be read.  a window is rounded to steps of an archive.
+ */
+int
+kcndb_rra_select(const struct kcn_eq *ke, time_t now)
+{
+	const struct kcndb_rra_archive *kraa;
+	time_t end;
+	int i;
+
+	/* raw samples are never substituted by consolidated ones. */
+	switch (ke->ke_func) {
+	case KCN_EQ_FUNC_AVG:
+	case KCN_EQ_FUNC_MIN:
+	case KCN_EQ_FUNC_MAX:
+		break;
+	default:
+		return -1;
+	}
+	end = ke->ke_end == KCN_TIME_NOW ? now : ke->ke_end;
+	if (ke->ke_start < 0 || end < ke->ke_start || end > now)
+		return -1;
+	for (i = KCNDB_RRA_NARCHIVES - 1; i >= 0; i--) {
+		kraa = &kcndb_rra_archives[i];
+		if (end - ke->ke_start < KCNDB_RRA_MINSTEPS * kraa->kraa_step)
+			continue;
+		/* the oldest slot may have been overwritten. */
+		if (ke->ke_start / kraa->kraa_step +
+		    (time_t)kraa->kraa_nslots <= now / kraa->kraa_step)
+			continue;
+		return i;
+	}
+	return -1;
+}
+
+static bool
+kcndb_rra_val_match(const struct kcn_eq *ke, double v)
+{
+	double val = ke->ke_val;
+
+	switch (ke->ke_op) {
+	case KCN_EQ_OP_LT:	return v < val;
+	case KCN_EQ_OP_LE:	return v <= val;
+	case KCN_EQ_OP_EQ:	return v == val;
+	case KCN_EQ_OP_GT:	return v > val;
+	case KCN_EQ_OP_GE:	return v >= val;
+	default:
+		return false;
+	}
+}
+
+/*
+ * call back locators whose consolidated values in a window satisfy an
+ * equation in order of their appearance up to maxnlocs.
+ */
+bool
+kcndb_rra_match(const struct kcndb_rra *kra, const struct kcn_eq *ke,
+    int archive, time_t now, size_t maxnlocs,
+    bool (*cb)(uint64_t, double, void *), void *arg)
+{
+	const struct kcndb_rra_archive *kraa;
+	const struct kcndb_rra_loc *kral;
+	const struct kcndb_rra_slot *krs;
+	uint64_t idx, first, last;
+	unsigned long long min, max;
+	double sum, v;
+	size_t count, n;
+
+	assert(archive >= 0 && (size_t)archive < KCNDB_RRA_NARCHIVES);
+	kraa = &kcndb_rra_archives[archive];
+	first = ke->ke_start / kraa->kraa_step;
+	last = (ke->ke_end == KCN_TIME_NOW ? now : ke->ke_end) /
+	    kraa->kraa_step;
+	KCN_LOG(DEBUG, "archive: %zu slot(s) of %llu sec. for %zu locator(s)",
+	    (size_t)(last - first + 1), (unsigned long long)kraa->kraa_step,
+	    kra->kra_nlocs);
+	n = 0;
+	STAILQ_FOREACH(kral, &kra->kra_locs, kral_chain) {
+		if (n == maxnlocs)
+			break;
+		count = 0;
+		sum = 0;
+		min = max = 0;
+		for (idx = first; idx <= last; idx++) {
+			krs = kcndb_rra_slot_lookup(kral, archive,
+			    idx % kraa->kraa_nslots);
+			if (krs == NULL || krs->krs_count == 0 ||
+			    krs->krs_index != idx)
+				continue;
+			if (count == 0 || krs->krs_min < min)
+				min = krs->krs_min;
+			if (count == 0 || krs->krs_max > max)
+				max = krs->krs_max;
+			sum += krs->krs_sum;
+			count += krs->krs_count;
+		}
+		if (count == 0)
+			continue;
+		switch (ke->ke_func) {
+		case KCN_EQ_FUNC_AVG:
+			v = sum / count;
+			break;
+		case KCN_EQ_FUNC_MIN:
+			v = min;
+			break;
+		case KCN_EQ_FUNC_MAX:
+			v = max;
+			break;
+		default:
+			assert(0);
+			errno = EINVAL;
+			return false;
+		}
+		if (! kcndb_rra_val_match(ke, v))
+			continue;
+		if (! (*cb)(kral->kral_locidx, v, arg))
+			return false;
+		++n;
+	}
+	return true;
+}
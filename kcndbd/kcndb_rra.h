@@ -0,0 +1,10 @@
+struct kcndb_rra;
+
+struct kcndb_rra *kcndb_rra_new(void);
+void kcndb_rra_destroy(struct kcndb_rra *);
+bool kcndb_rra_add(struct kcndb_rra *, uint64_t, time_t, unsigned long long);
+bool kcndb_rra_save(const struct kcndb_rra *, struct kcndb_file *);
+bool kcndb_rra_load(struct kcndb_rra *, struct kcndb_file *);
+int kcndb_rra_select(const struct kcn_eq *, time_t);
+bool kcndb_rra_match(const struct kcndb_rra *, const struct kcn_eq *, int,
+    time_t, size_t, bool (*)(uint64_t, double, void *), void *);
@@ -1,7 +1,11 @@
+#include <sys/param.h>	/* MAXPATHLEN */
+
 #include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
 #include <pthread.h>
 
@@ -20,6 +24,9 @@
 #include "kcn_msg.h"
 #include "kcn_netstat.h"
 #include "kcndb_db.h"
+#include "kcndb_flight.h"
+#include "kcndb_capture.h"
+#include "kcndb_stats.h"
 #include "kcndb_server.h"
 
 #define LOG(p, fmt, ...)						\
@@ -37,6 +44,22 @@ struct kcndb_thread {
 	int kt_listenfd;
 	struct event_base *kt_evb;
 	struct kcndb_db *kt_db;
+	uint32_t kt_session;
+	int kt_fd;
+	int kt_attachfd;
+	char kt_attach[MAXPATHLEN];
+};
+
+/* a session handed to the compactor thread to respond to an attachment. */
+struct kcndb_server_attach {
+	int ksa_fd;
+	char ksa_name[KCN_SOCKNAMELEN];
+};
+
+struct kcndb_server_query {
+	struct kcn_net *ksq_kn;
+	struct kcndb_flight *ksq_kf;
+	int ksq_senderror;
 };
 
 #define KCNDB_THREAD_NUMBER_MAIN	0
@@ -131,6 +154,14 @@ kcndb_server_loop(void)
 	kcndb_server_main(kt);
 }
 
+static bool
+kcndb_server_write(struct kcn_net *kn, struct kcn_buf *okb)
+{
+
+	kcndb_stats_add(KCNDB_STATS_BYTES_OUT, kcn_buf_len(okb));
+	return kcn_net_write(kn, okb);
+}
+
 static bool
 kcndb_server_response_send(const struct kcndb_db_record *kdr, size_t score,
     void *arg)
@@ -153,7 +184,25 @@ kcndb_server_response_send(const struct kcndb_db_record *kdr, size_t score,
 		kmr.kmr_loclen = 0;
 	}
 	kcn_msg_response_encode(&okb, &kmr);
-	return kcn_net_write(kn, &okb);
+	return kcndb_server_write(kn, &okb);
+}
+
+static bool
+kcndb_server_query_send(const struct kcndb_db_record *kdr, size_t score,
+    void *arg)
+{
+	struct kcndb_server_query *ksq = arg;
+
+	if (ksq->ksq_kf != NULL && ! kcndb_flight_loc_add(ksq->ksq_kf,
+	    kdr->kdr_loc, kdr->kdr_loclen, score))
+		return false;
+	if (ksq->ksq_senderror != 0)
+		return true;
+	if (kcndb_server_response_send(kdr, score, ksq->ksq_kn))
+		return true;
+	/* followers still need records even if this connection fails. */
+	ksq->ksq_senderror = errno;
+	return ksq->ksq_kf != NULL ? true : false;
 }
 
 static bool
@@ -162,13 +211,85 @@ kcndb_server_query_process(struct kcn_net *kn, struct kcn_buf *ikb,
 {
 	struct kcndb_thread *kt;
 	struct kcn_msg_query kmq;
+	struct kcndb_server_query ksq;
+	uint64_t start;
+	size_t i;
+	bool leader;
 
 	kt = kcn_net_data(kn);
-	if (kcn_msg_query_decode(ikb, kmh, &kmq) &&
-	    kcndb_db_search(kt->kt_db, &kmq.kmq_eq, kmq.kmq_maxcount,
-	    kcndb_server_response_send, kn))
+	start = kcndb_stats_now();
+	if (! kcn_msg_query_decode(ikb, kmh, &kmq))
+		goto out;
+	kcndb_stats_latency(KCNDB_STATS_STAGE_QUERY_DECODE, start);
+	for (i = 0; i < kmq.kmq_neqs; i++)
+		kcndb_stats_add(KCNDB_STATS_QUERIES + kmq.kmq_eqs[i].ke_type,
+		    1);
+	ksq.ksq_kn = kn;
+	ksq.ksq_senderror = 0;
+	ksq.ksq_kf = kcndb_flight_join(&kmq, &leader);
+	if (ksq.ksq_kf != NULL && ! leader) {
+		LOG(DEBUG, "attach to an identical query in flight%s", "");
+		kcndb_stats_add(KCNDB_STATS_FLIGHT_HITS, 1);
+		if (kcndb_flight_wait(ksq.ksq_kf, kcndb_server_response_send,
+		    kn))
+			errno = 0;
+		kcndb_flight_leave(ksq.ksq_kf);
+		goto out;
+	}
+	if (kcndb_db_search(kt->kt_db, kmq.kmq_eqs, kmq.kmq_neqs,
+	    kmq.kmq_maxcount, kcndb_server_query_send, &ksq))
 		errno = 0;
+	if (ksq.ksq_kf != NULL)
+		kcndb_flight_land(ksq.ksq_kf, errno);
+	if (ksq.ksq_senderror != 0)
+		errno = ksq.ksq_senderror;
+  out:
 	kcndb_server_response_send(KCNDB_SERVER_RESPONSE_MAGIC, errno, kn);
+	kcndb_stats_latency(KCNDB_STATS_STAGE_QUERY, start);
+	/* always return 0 in order to return a response with an error. */
+	return true;
+}
+
+static bool
+kcndb_server_sample_send(const struct kcndb_db_record *kdr, void *arg)
+{
+	struct kcn_net *kn = arg;
+	struct kcn_msg_sample kms;
+	struct kcn_buf okb;
+
+	kcn_net_obuf(kn, &okb);
+	kms.kms_error = 0;
+	kms.kms_end = false;
+	kms.kms_time = kdr->kdr_time;
+	kms.kms_val = kdr->kdr_val;
+	kcn_msg_sample_encode(&okb, &kms);
+	return kcndb_server_write(kn, &okb);
+}
+
+static bool
+kcndb_server_history_process(struct kcn_net *kn, struct kcn_buf *ikb,
+    const struct kcn_msg_header *kmh)
+{
+	struct kcndb_thread *kt;
+	struct kcn_msg_history kmhi;
+	struct kcn_msg_sample kms;
+	struct kcn_buf okb;
+
+	kt = kcn_net_data(kn);
+	if (! kcn_msg_history_decode(ikb, kmh, &kmhi))
+		goto out;
+	kcndb_stats_add(KCNDB_STATS_HISTORIES, 1);
+	if (kcndb_db_history(kt->kt_db, kmhi.kmhi_type,
+	    kmhi.kmhi_loc, kmhi.kmhi_loclen,
+	    kmhi.kmhi_start, kmhi.kmhi_end, kmhi.kmhi_maxcount,
+	    kcndb_server_sample_send, kn))
+		errno = 0;
+  out:
+	kcn_net_obuf(kn, &okb);
+	kms.kms_error = errno;
+	kms.kms_end = true;
+	kcn_msg_sample_encode(&okb, &kms);
+	kcndb_server_write(kn, &okb);
 	/* always return 0 in order to return a response with an error. */
 	return true;
 }
@@ -184,6 +305,8 @@ kcndb_server_add_process(struct kcn_net *kn, struct kcn_buf *kb,
 	kt = kcn_net_data(kn);
 	if (! kcn_msg_add_decode(kb, kmh, &kma))
 		return false;
+	if (kma.kma_type < KCN_EQ_TYPE_MAX)
+		kcndb_stats_add(KCNDB_STATS_ADDS + kma.kma_type, 1);
 	if (kma.kma_time != (uint64_t)KCN_TIME_NOW)
 		kdr.kdr_time = kma.kma_time;
 	else if (time(&kdr.kdr_time) == -1) {
@@ -196,11 +319,150 @@ kcndb_server_add_process(struct kcn_net *kn, struct kcn_buf *kb,
 	return kcndb_db_record_add(kt->kt_db, kma.kma_type, &kdr);
 }
 
+static bool
+kcndb_server_del_process(struct kcn_net *kn, struct kcn_buf *kb,
+    const struct kcn_msg_header *kmh)
+{
+	struct kcndb_thread *kt;
+	struct kcn_msg_del kmd;
+
+	kt = kcn_net_data(kn);
+	if (! kcn_msg_del_decode(kb, kmh, &kmd))
+		return false;
+	kcndb_stats_add(KCNDB_STATS_DELS, 1);
+	return kcndb_db_record_del(kt->kt_db, kmd.kmd_type, kmd.kmd_loc,
+	    kmd.kmd_loclen, kmd.kmd_start, kmd.kmd_end);
+}
+
+/*
+ * an attachment ends a session, which is handed to the compactor thread
+ * after responses already queued are written.
+ */
+static bool
+kcndb_server_attach_process(struct kcn_net *kn, struct kcn_buf *kb,
+    const struct kcn_msg_header *kmh)
+{
+	struct kcndb_thread *kt;
+	struct kcn_msg_attach kmat;
+
+	kt = kcn_net_data(kn);
+	if (! kcn_msg_attach_decode(kb, kmh, &kmat))
+		goto out;
+	kcndb_stats_add(KCNDB_STATS_ATTACHES, 1);
+	if (kmat.kmat_pathlen >= sizeof(kt->kt_attach)) {
+		errno = ENAMETOOLONG;
+		goto out;
+	}
+	kt->kt_attachfd = dup(kt->kt_fd);
+	if (kt->kt_attachfd == -1)
+		goto out;
+	memcpy(kt->kt_attach, kmat.kmat_path, kmat.kmat_pathlen);
+	kt->kt_attach[kmat.kmat_pathlen] = '\0';
+	LOG(INFO, "attach %s", kt->kt_attach);
+	errno = 0;
+	return false;
+  out:
+	kcndb_server_response_send(KCNDB_SERVER_RESPONSE_MAGIC, errno, kn);
+	/* always return 0 in order to return a response with an error. */
+	return true;
+}
+
+/* called back in the compactor thread when an attachment completes. */
+static void
+kcndb_server_attach_done(int error, void *arg)
+{
+	struct kcndb_server_attach *ksa = arg;
+	struct event_base *evb;
+	struct kcn_net *kn;
+
+	kn = NULL;
+	evb = event_base_new();
+	if (evb != NULL)
+		kn = kcn_net_new(evb, ksa->ksa_fd, KCN_MSG_MAXSIZ,
+		    ksa->ksa_name, NULL, NULL);	/* no message is read. */
+	if (kn == NULL) {
+		kcn_socket_close(&ksa->ksa_fd);
+		KCN_LOG(ERR, "[%s] cannot respond to attachment: %s",
+		    ksa->ksa_name, strerror(errno));
+		goto out;
+	}
+	kcndb_server_response_send(KCNDB_SERVER_RESPONSE_MAGIC, error, kn);
+	kcn_net_loop(kn);
+	kcn_net_destroy(kn);
+	KCN_LOG(INFO, "[%s] respond to attachment", ksa->ksa_name);
+  out:
+	if (evb != NULL)
+		event_base_free(evb);
+	free(ksa);
+}
+
+static void
+kcndb_server_attach_request(struct kcndb_thread *kt, const char *name)
+{
+	struct kcndb_server_attach *ksa;
+
+	ksa = malloc(sizeof(*ksa));
+	if (ksa == NULL)
+		goto bad;
+	ksa->ksa_fd = kt->kt_attachfd;
+	strlcpy(ksa->ksa_name, name, sizeof(ksa->ksa_name));
+	if (! kcndb_db_attach_request(kt->kt_attach, kcndb_server_attach_done,
+	    ksa))
+		goto bad;
+	kt->kt_attachfd = -1;
+	return;
+  bad:
+	LOG(ERR, "[%s] cannot request attachment: %s", name,
+	    strerror(errno));
+	free(ksa);
+	kcn_socket_close(&kt->kt_attachfd);
+}
+
+static bool
+kcndb_server_counter_send(const char *name, uint64_t val, void *arg)
+{
+	struct kcn_net *kn = arg;
+	struct kcn_msg_counter kmc;
+	struct kcn_buf okb;
+
+	kcn_net_obuf(kn, &okb);
+	kmc.kmc_error = 0;
+	kmc.kmc_end = false;
+	kmc.kmc_val = val;
+	kmc.kmc_name = name;
+	kmc.kmc_namelen = strlen(name);
+	kcn_msg_counter_encode(&okb, &kmc);
+	return kcndb_server_write(kn, &okb);
+}
+
+/* counters are sent one by one as samples of history. */
+static bool
+kcndb_server_stats_process(struct kcn_net *kn, struct kcn_buf *kb,
+    const struct kcn_msg_header *kmh)
+{
+	struct kcn_msg_counter kmc;
+	struct kcn_buf okb;
+
+	if (! kcn_msg_stats_decode(kb, kmh))
+		goto out;
+	if (kcndb_stats_walk(kcndb_server_counter_send, kn))
+		errno = 0;
+  out:
+	kcn_net_obuf(kn, &okb);
+	kmc.kmc_error = errno;
+	kmc.kmc_end = true;
+	kcn_msg_counter_encode(&okb, &kmc);
+	kcndb_server_write(kn, &okb);
+	/* always return 0 in order to return a response with an error. */
+	return true;
+}
+
 static int
 kcndb_server_recv(struct kcn_net *kn, struct kcn_buf *kb, void *arg)
 {
 	struct kcndb_thread *kt = arg;
 	struct kcn_msg_header kmh;
+	int error;
 	bool rc;
 
 	LOG(DEBUG, "recv %u bytes", kcn_buf_trailingdata(kb));
@@ -208,6 +470,9 @@ kcndb_server_recv(struct kcn_net *kn, struct kcn_buf *kb, void *arg)
 	while (kcn_buf_trailingdata(kb) > 0) {
 		if (! kcn_msg_header_decode(kb, &kmh))
 			goto bad;
+		kcndb_capture_msg(kt->kt_session, &kmh, kcn_buf_head(kb));
+		kcndb_stats_add(KCNDB_STATS_BYTES_IN,
+		    KCN_MSG_HDRSIZ + kmh.kmh_len);
 
 		switch (kmh.kmh_type) {
 		case KCN_MSG_TYPE_QUERY:
@@ -216,7 +481,18 @@ kcndb_server_recv(struct kcn_net *kn, struct kcn_buf *kb, void *arg)
 		case KCN_MSG_TYPE_ADD:
 			rc = kcndb_server_add_process(kn, kb, &kmh);
 			break;
-		case KCN_MSG_TYPE_DEL: /* XXX */
+		case KCN_MSG_TYPE_DEL:
+			rc = kcndb_server_del_process(kn, kb, &kmh);
+			break;
+		case KCN_MSG_TYPE_HISTORY:
+			rc = kcndb_server_history_process(kn, kb, &kmh);
+			break;
+		case KCN_MSG_TYPE_ATTACH:
+			rc = kcndb_server_attach_process(kn, kb, &kmh);
+			break;
+		case KCN_MSG_TYPE_STATS:
+			rc = kcndb_server_stats_process(kn, kb, &kmh);
+			break;
 		default:
 			rc = false;
 			errno = EOPNOTSUPP;
@@ -227,12 +503,24 @@ kcndb_server_recv(struct kcn_net *kn, struct kcn_buf *kb, void *arg)
 			goto bad;
 		}
 	}
-
-	return EAGAIN;
+	errno = EAGAIN;
   bad:
-	if (errno != EAGAIN)
-		LOG(ERR, "recv invalid message: %s", strerror(errno));
-	return errno;
+	/* records added so far are flushed before responses are sent. */
+	error = errno;
+	if (! kcndb_db_batch_done(kt->kt_db) && error == EAGAIN)
+		error = errno;
+	if (error != EAGAIN && error != 0)
+		LOG(ERR, "recv invalid message: %s", strerror(error));
+	return error;
+}
+
+static void
+kcndb_server_write_time(struct kcn_net *kn, uint64_t usec, void *arg)
+{
+
+	(void)kn;
+	(void)arg;
+	kcndb_stats_latency_add(KCNDB_STATS_STAGE_WRITE, usec);
 }
 
 static void
@@ -241,6 +529,7 @@ kcndb_server_session(struct kcndb_thread *kt, int fd, const char *name)
 	struct kcn_net *kn;
 
 	LOG(INFO, "[%s] connected", name);
+	kcndb_stats_add(KCNDB_STATS_CONNECTIONS, 1);
 
 	kn = kcn_net_new(kt->kt_evb, fd, KCN_MSG_MAXSIZ, name,
 	    kcndb_server_recv, kt);
@@ -250,10 +539,18 @@ kcndb_server_session(struct kcndb_thread *kt, int fd, const char *name)
 		    name, strerror(errno));
 		goto out;
 	}
+	kcn_net_write_time_cb_set(kn, kcndb_server_write_time);
+	kt->kt_session = kcndb_capture_session_new();
+	kt->kt_fd = fd;
+	kt->kt_attachfd = -1;
 	kcn_net_read_enable(kn);
 	kcn_net_loop(kn);
+	if (kt->kt_attachfd != -1)
+		kcndb_server_attach_request(kt, name);
 	kcn_net_destroy(kn);
+	kcndb_capture_session_end(kt->kt_session);
   out:
+	kcndb_stats_add(KCNDB_STATS_DISCONNECTIONS, 1);
 	LOG(INFO, "[%s] disconnected", name);
 }
 
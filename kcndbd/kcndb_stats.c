@@ -0,0 +1,279 @@
+/*
+ * counters and latency histograms of kcndbd itself.
+ *
+ * each thread increments counters in a slot of its own without any lock,
+ * and a reader sums up slots of all threads.  a slot is aligned and padded
+ * to a cache line so that threads never share a line.  counters of a slot
+ * are folded into retired ones when its thread exits.  counters and
+ * buckets are accessed atomically but relaxed so that a reader never sees
+ * a torn one even on 32-bit architectures, while they are not consistent
+ * with each other, e.g., a sum may include a latency not counted yet.
+ *
+ * a latency in usec is put into a bucket of a power of 2, and buckets are
+ * read in a cumulative manner as "<stage>.usec.le.<bound>" followed by
+ * "<stage>.count" and "<stage>.usec.sum".  buckets above the largest one
+ * used are omitted.
+ */
+#include <sys/queue.h>
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pthread.h>
+
+#include "kcn.h"
+#include "kcn_eq.h"
+#include "kcn_log.h"
+
+#include "kcndb_stats.h"
+
+#define KCNDB_STATS_CACHELINESIZ	64
+#define KCNDB_STATS_SLOTSIZ						\
+	((sizeof(struct kcndb_stats_slot) + KCNDB_STATS_CACHELINESIZ - 1) & \
+	 ~(size_t)(KCNDB_STATS_CACHELINESIZ - 1))
+
+#define KCNDB_STATS_NBUCKETS		24	/* the last is unbounded. */
+
+struct kcndb_stats_latency {
+	uint64_t ksl_buckets[KCNDB_STATS_NBUCKETS];
+	uint64_t ksl_sum;
+};
+
+struct kcndb_stats_slot {
+	LIST_ENTRY(kcndb_stats_slot) kss_chain;
+	uint64_t kss_counters[KCNDB_STATS_MAX];
+	struct kcndb_stats_latency kss_latencies[KCNDB_STATS_STAGE_MAX];
+};
+
+struct kcndb_stats_snapshot {
+	uint64_t ksn_counters[KCNDB_STATS_MAX];
+	struct kcndb_stats_latency ksn_latencies[KCNDB_STATS_STAGE_MAX];
+};
+
+static pthread_once_t kcndb_stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t kcndb_stats_key;
+static pthread_mutex_t kcndb_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LIST_HEAD(, kcndb_stats_slot) kcndb_stats_slots =
+    LIST_HEAD_INITIALIZER(kcndb_stats_slots);
+static struct kcndb_stats_snapshot kcndb_stats_retired;
+
+static const char *kcndb_stats_names[KCNDB_STATS_QUERIES] = {
+	[KCNDB_STATS_CONNECTIONS]	= "connections",
+	[KCNDB_STATS_DISCONNECTIONS]	= "disconnections",
+	[KCNDB_STATS_BYTES_IN]		= "bytes.in",
+	[KCNDB_STATS_BYTES_OUT]		= "bytes.out",
+	[KCNDB_STATS_DELS]		= "dels",
+	[KCNDB_STATS_HISTORIES]		= "histories",
+	[KCNDB_STATS_ATTACHES]		= "attaches",
+	[KCNDB_STATS_RECORDS_SCANNED]	= "records.scanned",
+	[KCNDB_STATS_RECORDS_MATCHED]	= "records.matched",
+	[KCNDB_STATS_ARCHIVE_HITS]	= "hits.archive",
+	[KCNDB_STATS_FLIGHT_HITS]	= "hits.flight"
+};
+
+static const char *kcndb_stats_stage_names[KCNDB_STATS_STAGE_MAX] = {
+	[KCNDB_STATS_STAGE_QUERY]		= "query",
+	[KCNDB_STATS_STAGE_QUERY_DECODE]	= "query.decode",
+	[KCNDB_STATS_STAGE_SEARCH]		= "search",
+	[KCNDB_STATS_STAGE_SCAN]		= "scan",
+	[KCNDB_STATS_STAGE_LOCK_WAIT]		= "lock.wait",
+	[KCNDB_STATS_STAGE_RECORD_ADD]		= "record.add",
+	[KCNDB_STATS_STAGE_WRITE]		= "write"
+};
+
+static void
+kcndb_stats_fold(struct kcndb_stats_snapshot *to,
+    const struct kcndb_stats_slot *kss)
+{
+	const struct kcndb_stats_latency *ksl;
+	size_t i, j;
+
+	for (i = 0; i < KCNDB_STATS_MAX; i++)
+		to->ksn_counters[i] += __atomic_load_n(&kss->kss_counters[i],
+		    __ATOMIC_RELAXED);
+	for (i = 0; i < KCNDB_STATS_STAGE_MAX; i++) {
+		ksl = &kss->kss_latencies[i];
+		for (j = 0; j < KCNDB_STATS_NBUCKETS; j++)
+			to->ksn_latencies[i].ksl_buckets[j] +=
+			    __atomic_load_n(&ksl->ksl_buckets[j],
+			    __ATOMIC_RELAXED);
+		to->ksn_latencies[i].ksl_sum += __atomic_load_n(&ksl->ksl_sum,
+		    __ATOMIC_RELAXED);
+	}
+}
+
+static void
+kcndb_stats_slot_destroy(void *arg)
+{
+	struct kcndb_stats_slot *kss = arg;
+
+	(void)pthread_mutex_lock(&kcndb_stats_mutex);
+	kcndb_stats_fold(&kcndb_stats_retired, kss);
+	LIST_REMOVE(kss, kss_chain);
+	(void)pthread_mutex_unlock(&kcndb_stats_mutex);
+	free(kss);
+}
+
+static void
+kcndb_stats_init(void)
+{
+	int error;
+
+	error = pthread_key_create(&kcndb_stats_key, kcndb_stats_slot_destroy);
+	if (error != 0)
+		KCN_LOG(EMERG, "cannot create key of statistics: %s",
+		    strerror(error));
+}
+
+static struct kcndb_stats_slot *
+kcndb_stats_self(void)
+{
+	struct kcndb_stats_slot *kss;
+	void *p;
+
+	(void)pthread_once(&kcndb_stats_once, kcndb_stats_init);
+	kss = pthread_getspecific(kcndb_stats_key);
+	if (kss != NULL)
+		return kss;
+	if (posix_memalign(&p, KCNDB_STATS_CACHELINESIZ,
+	    KCNDB_STATS_SLOTSIZ) != 0)
+		return NULL;
+	kss = p;
+	memset(kss, 0, KCNDB_STATS_SLOTSIZ);
+	if (pthread_setspecific(kcndb_stats_key, kss) != 0) {
+		free(kss);
+		return NULL;
+	}
+	(void)pthread_mutex_lock(&kcndb_stats_mutex);
+	LIST_INSERT_HEAD(&kcndb_stats_slots, kss, kss_chain);
+	(void)pthread_mutex_unlock(&kcndb_stats_mutex);
+	return kss;
+}
+
+uint64_t
+kcndb_stats_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+void
+kcndb_stats_add(enum kcndb_stats_counter c, uint64_t n)
+{
+	struct kcndb_stats_slot *kss;
+
+	assert(c < KCNDB_STATS_MAX);
+	kss = kcndb_stats_self();
+	if (kss == NULL)
+		return; /* XXX: lost. */
+	(void)__atomic_fetch_add(&kss->kss_counters[c], n, __ATOMIC_RELAXED);
+}
+
+void
+kcndb_stats_latency_add(enum kcndb_stats_stage stage, uint64_t usec)
+{
+	struct kcndb_stats_slot *kss;
+	struct kcndb_stats_latency *ksl;
+	unsigned int i;
+
+	assert(stage < KCNDB_STATS_STAGE_MAX);
+	kss = kcndb_stats_self();
+	if (kss == NULL)
+		return; /* XXX: lost. */
+	/* a bucket i has latencies up to 2^i usec. */
+	for (i = 0; i < KCNDB_STATS_NBUCKETS - 1 && usec > (1ULL << i); i++)
+		;
+	ksl = &kss->kss_latencies[stage];
+	(void)__atomic_fetch_add(&ksl->ksl_buckets[i], 1, __ATOMIC_RELAXED);
+	(void)__atomic_fetch_add(&ksl->ksl_sum, usec, __ATOMIC_RELAXED);
+}
+
+/* account a stage started at a given time, and return current time. */
+uint64_t
+kcndb_stats_latency(enum kcndb_stats_stage stage, uint64_t start)
+{
+	uint64_t now;
+
+	now = kcndb_stats_now();
+	kcndb_stats_latency_add(stage, now - start);
+	return now;
+}
+
+static bool
+kcndb_stats_walk_latency(const char *stage,
+    const struct kcndb_stats_latency *ksl,
+    bool (*cb)(const char *, uint64_t, void *), void *arg)
+{
+	char name[64];
+	uint64_t n;
+	int i, last;
+
+	for (last = KCNDB_STATS_NBUCKETS - 2;
+	    last >= 0 && ksl->ksl_buckets[last] == 0; last--)
+		;
+	for (i = 0, n = 0; i <= last; i++) {
+		n += ksl->ksl_buckets[i];
+		(void)snprintf(name, sizeof(name), "%s.usec.le.%llu", stage,
+		    1ULL << i);
+		if (! (*cb)(name, n, arg))
+			return false;
+	}
+	for (; i < KCNDB_STATS_NBUCKETS; i++)
+		n += ksl->ksl_buckets[i];
+	(void)snprintf(name, sizeof(name), "%s.count", stage);
+	if (! (*cb)(name, n, arg))
+		return false;
+	(void)snprintf(name, sizeof(name), "%s.usec.sum", stage);
+	return (*cb)(name, ksl->ksl_sum, arg);
+}
+
+/*
+ * call back counters summed up over all threads in order.  counters per
+ * type have a suffix of a type, and latencies follow counters.
+ */
+bool
+kcndb_stats_walk(bool (*cb)(const char *, uint64_t, void *), void *arg)
+{
+	struct kcndb_stats_snapshot snap;
+	struct kcndb_stats_slot *kss;
+	enum kcn_eq_type type;
+	char name[64];
+	size_t i;
+
+	(void)pthread_mutex_lock(&kcndb_stats_mutex);
+	snap = kcndb_stats_retired;
+	LIST_FOREACH(kss, &kcndb_stats_slots, kss_chain)
+		kcndb_stats_fold(&snap, kss);
+	(void)pthread_mutex_unlock(&kcndb_stats_mutex);
+
+	for (i = 0; i < KCNDB_STATS_QUERIES; i++)
+		if (! (*cb)(kcndb_stats_names[i], snap.ksn_counters[i], arg))
+			return false;
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		(void)snprintf(name, sizeof(name), "queries.%s",
+		    kcn_eq_type_ntoa(type));
+		if (! (*cb)(name, snap.ksn_counters[KCNDB_STATS_QUERIES + type],
+		    arg))
+			return false;
+	}
+	for (type = KCN_EQ_TYPE_MIN + 1; type < KCN_EQ_TYPE_MAX; type++) {
+		(void)snprintf(name, sizeof(name), "adds.%s",
+		    kcn_eq_type_ntoa(type));
+		if (! (*cb)(name, snap.ksn_counters[KCNDB_STATS_ADDS + type],
+		    arg))
+			return false;
+	}
+	for (i = 0; i < KCNDB_STATS_STAGE_MAX; i++)
+		if (! kcndb_stats_walk_latency(kcndb_stats_stage_names[i],
+		    &snap.ksn_latencies[i], cb, arg))
+			return false;
+	return true;
+}
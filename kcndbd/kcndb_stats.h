@@ -0,0 +1,34 @@
+enum kcndb_stats_counter {
+	KCNDB_STATS_CONNECTIONS,
+	KCNDB_STATS_DISCONNECTIONS,
+	KCNDB_STATS_BYTES_IN,
+	KCNDB_STATS_BYTES_OUT,
+	KCNDB_STATS_DELS,
+	KCNDB_STATS_HISTORIES,
+	KCNDB_STATS_ATTACHES,
+	KCNDB_STATS_RECORDS_SCANNED,
+	KCNDB_STATS_RECORDS_MATCHED,
+	KCNDB_STATS_ARCHIVE_HITS,
+	KCNDB_STATS_FLIGHT_HITS,
+	KCNDB_STATS_QUERIES,	/* per type */
+	KCNDB_STATS_ADDS = KCNDB_STATS_QUERIES + KCN_EQ_TYPE_MAX,
+	KCNDB_STATS_MAX = KCNDB_STATS_ADDS + KCN_EQ_TYPE_MAX
+};
+
+/* stages of which latencies are kept in histograms. */
+enum kcndb_stats_stage {
+	KCNDB_STATS_STAGE_QUERY,
+	KCNDB_STATS_STAGE_QUERY_DECODE,
+	KCNDB_STATS_STAGE_SEARCH,
+	KCNDB_STATS_STAGE_SCAN,
+	KCNDB_STATS_STAGE_LOCK_WAIT,
+	KCNDB_STATS_STAGE_RECORD_ADD,
+	KCNDB_STATS_STAGE_WRITE,
+	KCNDB_STATS_STAGE_MAX
+};
+
+uint64_t kcndb_stats_now(void);
+void kcndb_stats_add(enum kcndb_stats_counter, uint64_t);
+void kcndb_stats_latency_add(enum kcndb_stats_stage, uint64_t);
+uint64_t kcndb_stats_latency(enum kcndb_stats_stage, uint64_t);
+bool kcndb_stats_walk(bool (*)(const char *, uint64_t, void *), void *);
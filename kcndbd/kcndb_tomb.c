@@ -0,0 +1,176 @@
+/*
+ * an index of tombstones by locator and time range.
+ *
+ * ranges of each locator, and those of all locators, are kept sorted and
+ * disjoint, in which overlapping or adjacent ones are coalesced, so that a
+ * record is checked by a hash lookup and a binary search regardless of the
+ * number of tombstones.
+ */
+#include <sys/types.h>
+#include <sys/queue.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "kcndb_hash.h"
+#include "kcndb_tomb.h"
+
+struct kcndb_tomb_range {
+	time_t ktr_start;
+	time_t ktr_end;
+};
+
+struct kcndb_tomb_list {
+	struct kcndb_hash_entry ktl_hentry;	/* must be first. */
+#define ktl_locidx	ktl_hentry.khe_key
+	STAILQ_ENTRY(kcndb_tomb_list) ktl_chain;
+	size_t ktl_n;
+	struct kcndb_tomb_range *ktl_ranges;
+};
+
+struct kcndb_tomb {
+	struct kcndb_tomb_list kt_all;	/* of all locators */
+	struct kcndb_hash kt_hash;
+	STAILQ_HEAD(, kcndb_tomb_list) kt_lists;
+};
+
+struct kcndb_tomb *
+kcndb_tomb_new(void)
+{
+	struct kcndb_tomb *kt;
+
+	kt = malloc(sizeof(*kt));
+	if (kt == NULL)
+		return NULL;
+	kt->kt_all.ktl_n = 0;
+	kt->kt_all.ktl_ranges = NULL;
+	STAILQ_INIT(&kt->kt_lists);
+	if (! kcndb_hash_init(&kt->kt_hash)) {
+		free(kt);
+		return NULL;
+	}
+	return kt;
+}
+
+void
+kcndb_tomb_destroy(struct kcndb_tomb *kt)
+{
+	struct kcndb_tomb_list *ktl;
+
+	if (kt == NULL)
+		return;
+	while ((ktl = STAILQ_FIRST(&kt->kt_lists)) != NULL) {
+		STAILQ_REMOVE_HEAD(&kt->kt_lists, ktl_chain);
+		free(ktl->ktl_ranges);
+		free(ktl);
+	}
+	free(kt->kt_all.ktl_ranges);
+	kcndb_hash_finish(&kt->kt_hash);
+	free(kt);
+}
+
+/* return the number of ranges ending before t. */
+static size_t
+kcndb_tomb_list_search(const struct kcndb_tomb_list *ktl, time_t t)
+{
+	size_t lo, hi, mid;
+
+	lo = 0;
+	hi = ktl->ktl_n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (ktl->ktl_ranges[mid].ktr_end < t)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+static bool
+kcndb_tomb_list_add(struct kcndb_tomb_list *ktl, time_t start, time_t end)
+{
+	struct kcndb_tomb_range *ktr;
+	size_t i, j;
+
+	/* ranges from i to j - 1 overlap or adjoin a new one. */
+	i = kcndb_tomb_list_search(ktl, start > 0 ? start - 1 : start);
+	for (j = i; j < ktl->ktl_n; j++) {
+		ktr = &ktl->ktl_ranges[j];
+		if (ktr->ktr_start > end && ktr->ktr_start - end > 1)
+			break;
+		if (ktr->ktr_start < start)
+			start = ktr->ktr_start;
+		if (ktr->ktr_end > end)
+			end = ktr->ktr_end;
+	}
+	if (i == j) {
+		ktr = realloc(ktl->ktl_ranges,
+		    (ktl->ktl_n + 1) * sizeof(*ktr));
+		if (ktr == NULL)
+			return false;
+		ktl->ktl_ranges = ktr;
+		memmove(&ktr[i + 1], &ktr[i], (ktl->ktl_n - i) * sizeof(*ktr));
+		++ktl->ktl_n;
+		++j;
+	}
+	ktl->ktl_ranges[i].ktr_start = start;
+	ktl->ktl_ranges[i].ktr_end = end;
+	memmove(&ktl->ktl_ranges[i + 1], &ktl->ktl_ranges[j],
+	    (ktl->ktl_n - j) * sizeof(*ktl->ktl_ranges));
+	ktl->ktl_n -= j - i - 1;
+	return true;
+}
+
+/* a tombstone of a locator index 0 hides records of all locators. */
+bool
+kcndb_tomb_add(struct kcndb_tomb *kt, uint64_t locidx, time_t start,
+    time_t end)
+{
+	struct kcndb_tomb_list *ktl;
+
+	if (start > end)
+		return true;
+	if (locidx == 0)
+		return kcndb_tomb_list_add(&kt->kt_all, start, end);
+	ktl = (struct kcndb_tomb_list *)kcndb_hash_find(&kt->kt_hash, locidx);
+	if (ktl == NULL) {
+		ktl = malloc(sizeof(*ktl));
+		if (ktl == NULL)
+			return false;
+		ktl->ktl_locidx = locidx;
+		ktl->ktl_n = 0;
+		ktl->ktl_ranges = NULL;
+		if (! kcndb_hash_insert(&kt->kt_hash, &ktl->ktl_hentry)) {
+			free(ktl);
+			return false;
+		}
+		STAILQ_INSERT_TAIL(&kt->kt_lists, ktl, ktl_chain);
+	}
+	return kcndb_tomb_list_add(ktl, start, end);
+}
+
+static bool
+kcndb_tomb_list_match(const struct kcndb_tomb_list *ktl, time_t t)
+{
+	size_t i;
+
+	i = kcndb_tomb_list_search(ktl, t);
+	return i < ktl->ktl_n && ktl->ktl_ranges[i].ktr_start <= t;
+}
+
+bool
+kcndb_tomb_match(const struct kcndb_tomb *kt, uint64_t locidx, time_t t)
+{
+	const struct kcndb_tomb_list *ktl;
+
+	if (kcndb_tomb_list_match(&kt->kt_all, t))
+		return true;
+	ktl = (const struct kcndb_tomb_list *)kcndb_hash_find(&kt->kt_hash,
+	    locidx);
+	return ktl != NULL && kcndb_tomb_list_match(ktl, t);
+}
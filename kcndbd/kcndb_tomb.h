@@ -0,0 +1,6 @@
+struct kcndb_tomb;
+
+struct kcndb_tomb *kcndb_tomb_new(void);
+void kcndb_tomb_destroy(struct kcndb_tomb *);
+bool kcndb_tomb_add(struct kcndb_tomb *, uint64_t, time_t, time_t);
+bool kcndb_tomb_match(const struct kcndb_tomb *, uint64_t, time_t);
@@ -8,12 +8,15 @@
 #include <string.h>
 #include <unistd.h>
 
+#include <event.h>
+
 #include "kcn.h"
 #include "kcn_log.h"
 #include "kcn_info.h"
 #include "kcn_db.h"
 #include "kcn_netstat.h"
 #include "kcn_google.h"
+#include "kcn_ctx.h"
 #include "kcn_buf.h"
 #include "kcn_eq.h"
 #include "kcn_msg.h"
@@ -22,33 +25,85 @@
 #define KCN_DB_DEFAULT			NULL
 #define KCN_LOC_COUNT_MAX_DEFAULT	1
 #define KCN_LOC_TYPE_DEFAULT		KCN_LOC_TYPE_DOMAINNAME
+#define KEY2LOC_PARALLELISM_DEFAULT	16
+#define KEY2LOC_CONNS_DEFAULT		4
+
+/* queries read from a file, one per line, in batch mode. */
+struct batch {
+	struct kcn_ctx *b_kc;
+	struct kcn_client_pool *b_kcp;
+	FILE *b_fp;
+	const char *b_db;
+	enum kcn_loc_type b_loctype;
+	size_t b_nmaxlocs;
+	const char *b_country;
+	const char *b_userip;
+	char *b_line;
+	size_t b_linesize;
+	size_t b_lineno;
+	size_t b_nqueries;
+	size_t b_nresolved;
+	size_t b_nfailed;
+};
+
+struct batch_query {
+	struct batch *bq_b;
+	size_t bq_lineno;
+};
 
-static void usage(const char *, const char *);
-static void doit(size_t, const char *, enum kcn_loc_type, size_t,
-    const char *, const char *, int, char * const []);
+static void usage(struct kcn_ctx *, const char *, const char *);
+static void doit(struct kcn_ctx *, size_t, const char *, enum kcn_loc_type,
+    size_t, const char *, const char *, int, char * const []);
+static int batch(struct kcn_ctx *, const char *, size_t, size_t,
+    const char *, enum kcn_loc_type, size_t, const char *, const char *);
 
 int
 main(int argc, char * const argv[])
 {
+	struct kcn_ctx *kc;
 	enum kcn_loc_type loctype;
-	const char *p, *pname, *db, *country, *userip, *server;
+	const char *p, *pname, *db, *country, *userip, *server, *path;
 	size_t r;
-	int n, ch;
+	int n, ch, parallelism, nconns, rc;
 
 	pname = (p = strrchr(argv[0], '/')) != NULL ? p + 1 : argv[0];
 
-	kcn_netstat_init();
-	kcn_google_init();
+	kc = kcn_ctx_new();
+	if (kc == NULL)
+		err(EXIT_FAILURE, "cannot allocate KCN context");
+	if (! kcn_netstat_init(kc))
+		err(EXIT_FAILURE, "cannot register network statistics");
+	if (! kcn_google_init(kc))
+		err(EXIT_FAILURE, "cannot register Google Web search");
 
 	db = KCN_DB_DEFAULT;
 	loctype = KCN_LOC_TYPE_DEFAULT;
 	country = NULL;
 	userip = NULL;
 	server = NULL;
+	path = NULL;
 	r = 1;
 	n = KCN_LOC_COUNT_MAX_DEFAULT;
-	while ((ch = getopt(argc, argv, "c:hi:n:l:r:s:t:v?")) != -1) {
+	parallelism = KEY2LOC_PARALLELISM_DEFAULT;
+	nconns = KEY2LOC_CONNS_DEFAULT;
+	while ((ch = getopt(argc, argv, "C:c:f:hi:n:l:p:r:s:t:v?")) != -1) {
 		switch (ch) {
+		case 'C':
+			nconns = atoi(optarg);
+			if (nconns <= 0)
+				usage(kc, pname,
+				    "invalid number of connections");
+				/*NOTREACHED*/
+			break;
+		case 'f':
+			path = optarg;
+			break;
+		case 'p':
+			parallelism = atoi(optarg);
+			if (parallelism <= 0)
+				usage(kc, pname, "invalid parallelism");
+				/*NOTREACHED*/
+			break;
 		case 'c':
 			country = optarg;
 			break;
@@ -61,10 +116,11 @@ main(int argc, char * const argv[])
 			else if (strcasecmp(optarg, "uri") == 0)
 				loctype = KCN_LOC_TYPE_URI;
 			else if (strcasecmp(optarg, "ip") == 0)
-				usage(pname, "not yet supported locator type");
+				usage(kc, pname,
+				    "not yet supported locator type");
 				/*NOTREACHED*/
 			else
-				usage(pname, "unknown locator type");
+				usage(kc, pname, "unknown locator type");
 				/*NOTREACHED*/
 			break;
 		case 'n':
@@ -75,13 +131,13 @@ main(int argc, char * const argv[])
 			break;
 		case 's':
 			if (server != NULL)
-				usage(pname, "multiple servers specified");
+				usage(kc, pname, "multiple servers specified");
 				/*NOTREACHED*/
 			server = optarg;
 			break;
 		case 't':
-			if (! kcn_db_exists(optarg))
-				usage(pname, "unknown database type");
+			if (! kcn_db_exists(kc, optarg))
+				usage(kc, pname, "unknown database type");
 				/*NOTREACHED*/
 			db = optarg;
 			break;
@@ -91,55 +147,72 @@ main(int argc, char * const argv[])
 		case 'h':
 		case '?':
 		default:
-			usage(pname, NULL);
+			usage(kc, pname, NULL);
 		}
 	}
 	argc -= optind;
 	argv += optind;
 
-	if (argc < 1)
-		usage(pname, "no keywords specified");
+	if (path != NULL) {
+		if (argc != 0 || r != 1)
+			usage(kc, pname, "keywords specified in batch mode");
+			/*NOTREACHED*/
+	} else if (argc < 1)
+		usage(kc, pname, "no keywords specified");
 		/*NOTREACHED*/
 
-	if (server != NULL)
-		kcn_client_server_name_set(server);
+	if (server != NULL && ! kcn_ctx_server_set(kc, server))
+		err(EXIT_FAILURE, "cannot set server");
 
-	doit(r, db, loctype, n, country, userip, argc, argv);
-	return 0;
+	rc = EXIT_SUCCESS;
+	if (path != NULL)
+		rc = batch(kc, path, parallelism, nconns, db, loctype, n,
+		    country, userip);
+	else
+		doit(kc, r, db, loctype, n, country, userip, argc, argv);
+	kcn_google_finish(kc);
+	kcn_ctx_destroy(kc);
+	return rc;
 }
 
 static void
-usage(const char *pname, const char *errmsg)
+usage(struct kcn_ctx *kc, const char *pname, const char *errmsg)
 {
 
 	if (errmsg != NULL)
 		fprintf(stderr, "ERROR: %s\n\n", errmsg);
 	fprintf(stderr, "\
 Usage: %s [-c country] [-i user IP] [-l loctype] [-n number] [-t type] [-v] <keyword1> [<keyword2>] [<keyword3>] ...\n\
+       %s [-c country] [-i user IP] [-l loctype] [-n number] [-t type] [-v]\n\
+	  -f file [-p parallelism] [-C connections]\n\
 \n\
 Options:\n\
+	-C connections: the number of connections in batch mode\n\
 	-c country: a country code of locators in ISO 3166-1 (e.g., us, jp)\n\
+	-f file: resolve keywords of each line of ``file'' (``-'' for stdin)\n\
 	-i user IP: the IP address of this host\n\
 	-l loctype: a type of locators returned\n\
 		domain: domain name\n\
 		URI: URI\n\
 		IP: IP address (not supported yet)\n\
 	-n number: the maximum number of locators returned\n\
+	-p parallelism: the number of queries in flight in batch mode\n\
 	-r count: repeat to query for ``count'' times\n\
 	-s server: KCN database server\n\
 	-t type: a type of database listed below\n\
 	-v: increment verbosity (can be specified 7 times at maximum)\n\
 \n",
-	    pname);
+	    pname, pname);
 	fprintf(stderr, "\
 Supported database types are:\n");
-	kcn_db_name_list_puts("\t");
+	kcn_db_name_list_puts(kc, "\t");
 	exit(EXIT_FAILURE);
 }
 
 static void
-doit(size_t r, const char *db, enum kcn_loc_type loctype, size_t nmaxlocs,
-    const char *country, const char *userip, int keyc, char * const keyv[])
+doit(struct kcn_ctx *kc, size_t r, const char *db, enum kcn_loc_type loctype,
+    size_t nmaxlocs, const char *country, const char *userip, int keyc,
+    char * const keyv[])
 {
 	struct kcn_info *ki;
 	size_t i, oerrno;
@@ -156,7 +229,7 @@ doit(size_t r, const char *db, enum kcn_loc_type loctype, size_t nmaxlocs,
 	for (i = 0; i < r; i++) {
 		kcn_info_loc_free(ki);
 		gettimeofday(&tvs, NULL);
-		rc = kcn_searchv(ki, keyc, keyv);
+		rc = kcn_searchv(kc, ki, keyc, keyv);
 		oerrno = errno;
 		gettimeofday(&tve, NULL);
 		timersub(&tve, &tvs, &tvd);
@@ -170,3 +243,134 @@ doit(size_t r, const char *db, enum kcn_loc_type loctype, size_t nmaxlocs,
 		printf("%s\n", kcn_info_loc(ki, i));
 	kcn_info_destroy(ki);
 }
+
+static void
+batch_print(struct batch *b, size_t lineno, const struct kcn_info *ki,
+    int error)
+{
+	size_t i;
+
+	if (error != 0) {
+		warnx("line %zu: search failure: %s", lineno, strerror(error));
+		++b->b_nfailed;
+		return;
+	}
+	for (i = 0; i < kcn_info_nlocs(ki); i++)
+		printf("%zu\t%s\n", lineno, kcn_info_loc(ki, i));
+	++b->b_nresolved;
+}
+
+static void
+batch_done(struct kcn_info *ki, int error, void *arg)
+{
+	struct batch_query *bq = arg;
+	struct batch *b = bq->bq_b;
+
+	batch_print(b, bq->bq_lineno, ki, error);
+	kcn_info_destroy(ki);
+	free(bq);
+	--b->b_nqueries;
+}
+
+/* read and start a query of a next line, or return false at the end. */
+static bool
+batch_submit(struct batch *b)
+{
+	struct batch_query *bq;
+	struct kcn_info *ki;
+	ssize_t len;
+	bool rc;
+
+	do {
+		len = getline(&b->b_line, &b->b_linesize, b->b_fp);
+		if (len == -1) {
+			if (ferror(b->b_fp))
+				err(EXIT_FAILURE, "cannot read queries");
+			return false;
+		}
+		++b->b_lineno;
+		while (len > 0 && (b->b_line[len - 1] == '\n' ||
+		    b->b_line[len - 1] == '\r'))
+			b->b_line[--len] = '\0';
+	} while (strspn(b->b_line, " \t") == (size_t)len);
+
+	ki = kcn_info_new(b->b_loctype, b->b_nmaxlocs);
+	bq = malloc(sizeof(*bq));
+	if (ki == NULL || bq == NULL)
+		err(EXIT_FAILURE, "cannot allocate a query");
+	kcn_info_db_set(ki, b->b_db);
+	kcn_info_country_set(ki, b->b_country);
+	kcn_info_userip_set(ki, b->b_userip);
+	bq->bq_b = b;
+	bq->bq_lineno = b->b_lineno;
+	if (kcn_search_async(b->b_kc, b->b_kcp, ki, b->b_line, batch_done,
+	    bq)) {
+		++b->b_nqueries;
+		return true;
+	}
+	/* XXX: a database without connections, e.g., Google, blocks. */
+	if (errno == EOPNOTSUPP)
+		rc = kcn_search(b->b_kc, ki, b->b_line);
+	else
+		rc = false;
+	batch_print(b, bq->bq_lineno, ki, rc ? 0 : errno != 0 ? errno : EINVAL);
+	kcn_info_destroy(ki);
+	free(bq);
+	return true;
+}
+
+/*
+ * resolve queries concurrently over a few connections shared by them,
+ * and print locators prefixed with a line number of a query.
+ */
+static int
+batch(struct kcn_ctx *kc, const char *path, size_t parallelism,
+    size_t nconns, const char *db, enum kcn_loc_type loctype,
+    size_t nmaxlocs, const char *country, const char *userip)
+{
+	struct event_base *evb;
+	struct batch b;
+	struct timeval tvs, tve, tvd;
+	bool eof;
+
+	memset(&b, 0, sizeof(b));
+	b.b_kc = kc;
+	b.b_db = db;
+	b.b_loctype = loctype;
+	b.b_nmaxlocs = nmaxlocs;
+	b.b_country = country;
+	b.b_userip = userip;
+	if (strcmp(path, "-") == 0)
+		b.b_fp = stdin;
+	else if ((b.b_fp = fopen(path, "r")) == NULL)
+		err(EXIT_FAILURE, "cannot open %s", path);
+	evb = event_base_new();
+	if (evb == NULL)
+		err(EXIT_FAILURE, "cannot allocate event base");
+	b.b_kcp = kcn_client_pool_new(kc, evb, nconns);
+	if (b.b_kcp == NULL)
+		err(EXIT_FAILURE, "cannot allocate connection pool");
+
+	gettimeofday(&tvs, NULL);
+	eof = false;
+	for (;;) {
+		while (! eof && b.b_nqueries < parallelism)
+			eof = ! batch_submit(&b);
+		if (b.b_nqueries == 0)
+			break;
+		if (event_base_loop(evb, EVLOOP_ONCE) == -1)
+			err(EXIT_FAILURE, "event dispatch failed");
+	}
+	gettimeofday(&tve, NULL);
+	timersub(&tve, &tvs, &tvd);
+	fprintf(stderr, "Resolution of %zu queries (%zu failures) finishes "
+	    "with %zu.%06zu sec\n", b.b_nresolved + b.b_nfailed, b.b_nfailed,
+	    (size_t)tvd.tv_sec, (size_t)tvd.tv_usec);
+
+	kcn_client_pool_destroy(b.b_kcp);
+	event_base_free(evb);
+	free(b.b_line);
+	if (b.b_fp != stdin)
+		fclose(b.b_fp);
+	return b.b_nfailed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
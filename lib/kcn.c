@@ -97,15 +97,20 @@ kcn_key_free(size_t keyc, char *keyv[])
 	free(keyv);
 }
 
+/*
+ * searches do not modify a context, and can be run by many threads at
+ * once as long as each of them uses its own kcn_info.
+ */
 bool
-kcn_search(struct kcn_info *ki, const char *keys)
+kcn_search(const struct kcn_ctx *kc, struct kcn_info *ki, const char *keys)
 {
 
-	return kcn_db_search(ki, keys);
+	return kcn_db_search(kc, ki, keys);
 }
 
 bool
-kcn_searchv(struct kcn_info *ki, int keyc, char * const keyv[])
+kcn_searchv(const struct kcn_ctx *kc, struct kcn_info *ki, int keyc,
+    char * const keyv[])
 {
 	bool rc;
 	char *keys;
@@ -113,7 +118,21 @@ kcn_searchv(struct kcn_info *ki, int keyc, char * const keyv[])
 	keys = kcn_key_concat(keyc, keyv);
 	if (keys == NULL)
 		return false;
-	rc = kcn_search(ki, keys);
+	rc = kcn_search(kc, ki, keys);
 	free(keys);
 	return rc;
 }
+
+/*
+ * a non-blocking version of kcn_search() running on connections of a pool,
+ * which calls back with an error, or 0 on success.  searches may be
+ * started one after another without waiting for completion.
+ */
+bool
+kcn_search_async(const struct kcn_ctx *kc, struct kcn_client_pool *kcp,
+    struct kcn_info *ki, const char *keys,
+    void (*cb)(struct kcn_info *, int, void *), void *arg)
+{
+
+	return kcn_db_search_async(kc, kcp, ki, keys, cb, arg);
+}
@@ -39,10 +39,16 @@ enum kcn_loc_type {
 	KCN_LOC_TYPE_URI
 };
 
+struct kcn_ctx;
+struct kcn_client_pool;
 struct kcn_info;
 
 char *kcn_key_concat(int, char * const []);
 char **kcn_key_split(const char *, size_t *);
 void kcn_key_free(size_t, char **);
-bool kcn_search(struct kcn_info *, const char *);
-bool kcn_searchv(struct kcn_info *, int, char * const []);
+bool kcn_search(const struct kcn_ctx *, struct kcn_info *, const char *);
+bool kcn_searchv(const struct kcn_ctx *, struct kcn_info *, int,
+    char * const []);
+bool kcn_search_async(const struct kcn_ctx *, struct kcn_client_pool *,
+    struct kcn_info *, const char *,
+    void (*)(struct kcn_info *, int, void *), void *);
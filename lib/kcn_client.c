@@ -1,3 +1,6 @@
+#include <sys/queue.h>
+
+#include <assert.h>
 #include <errno.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -17,26 +20,62 @@
 #include "kcn_msg.h"
 #include "kcn_net.h"
 #include "kcn_netstat.h"
+#include "kcn_ctx.h"
 #include "kcn_client.h"
 
 struct kcn_client_response {
 	int kcr_error;
+	bool kcr_end;
+	bool kcr_discard;
 	struct kcn_info *kcr_ki;
+	bool (*kcr_sample_cb)(const struct kcn_msg_sample *, void *);
+	bool (*kcr_counter_cb)(const struct kcn_msg_counter *, void *);
+	void *kcr_arg;
+};
+
+/* a query in progress on a connection of a pool. */
+struct kcn_client_async {
+	TAILQ_ENTRY(kcn_client_async) kca_chain;
+	struct kcn_client_response kca_kcr;
+	void (*kca_cb)(struct kcn_info *, int, void *);
+	void *kca_arg;
 };
+TAILQ_HEAD(kcn_client_async_queue, kcn_client_async);
 
-static const char *kcn_client_server_name = KCN_NETSTAT_SERVER_STR_DEFAULT;
+struct kcn_client_conn {
+	struct kcn_client_pool *kcc_kcp;
+	struct kcn_net *kcc_kn;
+	bool kcc_down;
+	size_t kcc_nqueries;
+	struct kcn_client_async_queue kcc_queries;
+};
+
+/*
+ * a pool of connections on an event base of a caller.  queries are
+ * pipelined on a connection since a server responds to them in order.
+ */
+struct kcn_client_pool {
+	const struct kcn_ctx *kcp_kc;
+	struct event_base *kcp_evb;
+	struct event kcp_ev;
+	struct kcn_client_async_queue kcp_done;
+	size_t kcp_nconns;
+	struct kcn_client_conn kcp_conns[1];
+};
 
 static int kcn_client_read(struct kcn_net *, struct kcn_buf *, void *);
 
+/* connect to a server of a context with a callback to read messages. */
 struct kcn_net *
-kcn_client_init(struct event_base *evb, void *data)
+kcn_client_connect(const struct kcn_ctx *kc, struct event_base *evb,
+    int (*readcb)(struct kcn_net *, struct kcn_buf *, void *), void *data)
 {
 	struct sockaddr_storage ss;
 	char name[KCN_SOCKNAMELEN];
 	struct kcn_net *kn;
 	int fd;
 
-	if (! kcn_sockaddr_aton(&ss, kcn_client_server_name,
+	if (! kcn_sockaddr_aton(&ss, kcn_ctx_server(kc),
 	    KCN_NETSTAT_PORT_STR_DEFAULT)) {
 		KCN_LOG(ERR, "cannot get numeric server address");
 		goto bad;
@@ -46,16 +85,24 @@ kcn_client_init(struct event_base *evb, void *data)
 		goto bad;
 
 	kcn_sockaddr_ntoa(name, sizeof(name), &ss);
-	kn = kcn_net_new(evb, fd, KCN_MSG_MAXSIZ, name, kcn_client_read, data);
+	kn = kcn_net_new(evb, fd, KCN_MSG_MAXSIZ, name, readcb, data);
 	if (kn == NULL) {
 		KCN_LOG(ERR, "cannot allocate networking structure");
 		goto bad;
 	}
+	kcn_net_timeout_set(kn, kcn_ctx_timeout(kc));
 	return kn;
   bad:
 	return NULL;
 }
 
+struct kcn_net *
+kcn_client_init(const struct kcn_ctx *kc, struct event_base *evb, void *data)
+{
+
+	return kcn_client_connect(kc, evb, kcn_client_read, data);
+}
+
 void
 kcn_client_finish(struct kcn_net *kn)
 {
@@ -63,43 +110,108 @@ kcn_client_finish(struct kcn_net *kn)
 	kcn_net_destroy(kn);
 }
 
-void
-kcn_client_server_name_set(const char *name)
+/*
+ * return false with errno of 0 when the last message is received, or with
+ * an error otherwise.
+ */
+static bool
+kcn_client_response_process(struct kcn_client_response *kcr,
+    struct kcn_buf *kb, const struct kcn_msg_header *kmh)
+{
+	struct kcn_info *ki = kcr->kcr_ki;
+	struct kcn_msg_response kmr;
+
+	kcn_msg_response_init(&kmr);
+	if (! kcn_msg_response_decode(kb, kmh, &kmr))
+		return false;
+	if (kmr.kmr_loclen == 0) {
+		kcr->kcr_end = true;
+		if (kmr.kmr_error != EAGAIN)
+			errno = kmr.kmr_error;
+		return false;
+	}
+	if (ki == NULL) {
+		if (kcr->kcr_discard)
+			return true;
+		errno = EINVAL;
+		return false;
+	}
+	if (kcn_info_maxnlocs(ki) == kcn_info_nlocs(ki)) {
+		errno = ETOOMANYREFS; /* XXX */
+		return false;
+	}
+	return kcn_info_loc_add(ki, kmr.kmr_loc, kmr.kmr_loclen, kmr.kmr_score);
+}
+
+static bool
+kcn_client_sample_process(struct kcn_client_response *kcr,
+    struct kcn_buf *kb, const struct kcn_msg_header *kmh)
 {
+	struct kcn_msg_sample kms;
 
-	kcn_client_server_name = name;
+	if (kcr->kcr_sample_cb == NULL) {
+		errno = EINVAL;
+		return false;
+	}
+	if (! kcn_msg_sample_decode(kb, kmh, &kms))
+		return false;
+	if (kms.kms_end) {
+		kcr->kcr_end = true;
+		if (kms.kms_error != EAGAIN)
+			errno = kms.kms_error;
+		return false;
+	}
+	return (*kcr->kcr_sample_cb)(&kms, kcr->kcr_arg);
+}
+
+static bool
+kcn_client_counter_process(struct kcn_client_response *kcr,
+    struct kcn_buf *kb, const struct kcn_msg_header *kmh)
+{
+	struct kcn_msg_counter kmc;
+
+	if (kcr->kcr_counter_cb == NULL) {
+		errno = EINVAL;
+		return false;
+	}
+	if (! kcn_msg_counter_decode(kb, kmh, &kmc))
+		return false;
+	if (kmc.kmc_end) {
+		kcr->kcr_end = true;
+		if (kmc.kmc_error != EAGAIN)
+			errno = kmc.kmc_error;
+		return false;
+	}
+	return (*kcr->kcr_counter_cb)(&kmc, kcr->kcr_arg);
 }
 
 static int
 kcn_client_read(struct kcn_net *kn, struct kcn_buf *kb, void *arg)
 {
 	struct kcn_client_response *kcr = arg;
-	struct kcn_info *ki = kcr->kcr_ki;
-	struct kcn_msg_response kmr;
 	struct kcn_msg_header kmh;
+	bool rc;
 
 	(void)kn;
 	for (;;) {
 		if (! kcn_msg_header_decode(kb, &kmh))
 			break;
-		if (kmh.kmh_type != KCN_MSG_TYPE_RESPONSE) {
-			errno = EINVAL;
+		switch (kmh.kmh_type) {
+		case KCN_MSG_TYPE_RESPONSE:
+			rc = kcn_client_response_process(kcr, kb, &kmh);
 			break;
-		}
-		kcn_msg_response_init(&kmr);
-		if (! kcn_msg_response_decode(kb, &kmh, &kmr))
+		case KCN_MSG_TYPE_SAMPLE:
+			rc = kcn_client_sample_process(kcr, kb, &kmh);
 			break;
-		if (kmr.kmr_loclen == 0) {
-			if (kmr.kmr_error != EAGAIN)
-				errno = kmr.kmr_error;
+		case KCN_MSG_TYPE_COUNTER:
+			rc = kcn_client_counter_process(kcr, kb, &kmh);
 			break;
-		}
-		if (kcn_info_maxnlocs(ki) == kcn_info_nlocs(ki)) {
-			errno = ETOOMANYREFS; /* XXX */
+		default:
+			errno = EINVAL;
+			rc = false;
 			break;
 		}
-		if (! kcn_info_loc_add(ki,
-		    kmr.kmr_loc, kmr.kmr_loclen, kmr.kmr_score))
+		if (! rc)
 			break;
 	}
 	kcr->kcr_error = errno;
@@ -129,28 +241,99 @@ kcn_client_add_send(struct kcn_net *kn, const struct kcn_msg_add *kma)
 }
 
 bool
-kcn_client_search(struct kcn_info *ki, const struct kcn_msg_query *kmq)
+kcn_client_del_send(struct kcn_net *kn, const struct kcn_msg_del *kmd)
+{
+	struct kcn_buf kb;
+
+	kcn_net_obuf(kn, &kb);
+	kcn_msg_del_encode(&kb, kmd);
+	return kcn_net_write(kn, &kb);
+}
+
+static bool
+kcn_client_history_send(struct kcn_net *kn,
+    const struct kcn_msg_history *kmhi)
+{
+	struct kcn_buf kb;
+
+	kcn_net_obuf(kn, &kb);
+	kcn_msg_history_encode(&kb, kmhi);
+	if (! kcn_net_write(kn, &kb))
+		return false;
+	return kcn_net_read_enable(kn);
+}
+
+static bool
+kcn_client_attach_send(struct kcn_net *kn, const struct kcn_msg_attach *kmat)
+{
+	struct kcn_buf kb;
+
+	kcn_net_obuf(kn, &kb);
+	kcn_msg_attach_encode(&kb, kmat);
+	if (! kcn_net_write(kn, &kb))
+		return false;
+	return kcn_net_read_enable(kn);
+}
+
+static bool
+kcn_client_stats_send(struct kcn_net *kn)
+{
+	struct kcn_buf kb;
+
+	kcn_net_obuf(kn, &kb);
+	kcn_msg_stats_encode(&kb);
+	if (! kcn_net_write(kn, &kb))
+		return false;
+	return kcn_net_read_enable(kn);
+}
+
+/* a connection closed before the last message is a failure of a request. */
+static void
+kcn_client_close(struct kcn_net *kn, int error, void *arg)
+{
+	struct kcn_client_response *kcr = arg;
+
+	(void)kn;
+	if (! kcr->kcr_end && kcr->kcr_error == 0)
+		kcr->kcr_error = error;
+}
+
+/* use an event base of its own so that requests may run in many threads. */
+static bool
+kcn_client_request(const struct kcn_ctx *kc, struct kcn_client_response *kcr,
+    const struct kcn_msg_query *kmq, const struct kcn_msg_history *kmhi,
+    const struct kcn_msg_attach *kmat, bool stats)
 {
 	struct event_base *evb;
 	struct kcn_net *kn;
-	struct kcn_client_response kcr;
 
-	evb = event_init();
+	kn = NULL;
+	evb = event_base_new();
 	if (evb == NULL)
 		goto bad;
 
-	kcr.kcr_error = 0;
-	kcr.kcr_ki = ki;
-	kn = kcn_client_init(evb, &kcr);
+	kcr->kcr_error = 0;
+	kcr->kcr_end = false;
+	kcr->kcr_discard = false;
+	kn = kcn_client_init(kc, evb, kcr);
 	if (kn == NULL)
 		goto bad;
+	kcn_net_close_cb_set(kn, kcn_client_close);
 
-	if (! kcn_client_query_send(kn, kmq))
+	if (kmq != NULL && ! kcn_client_query_send(kn, kmq))
+		goto bad;
+	if (kmhi != NULL && ! kcn_client_history_send(kn, kmhi))
+		goto bad;
+	if (kmat != NULL && ! kcn_client_attach_send(kn, kmat))
+		goto bad;
+	if (stats && ! kcn_client_stats_send(kn))
 		goto bad;
 	if (! kcn_net_loop(kn))
 		goto bad;
-	if (kcr.kcr_error != 0) {
-		errno = kcr.kcr_error;
+	if (! kcr->kcr_end && kcr->kcr_error == 0)
+		kcr->kcr_error = ECONNRESET;
+	if (kcr->kcr_error != 0) {
+		errno = kcr->kcr_error;
 		goto bad;
 	}
 	kcn_client_finish(kn);
@@ -163,3 +346,278 @@ kcn_client_search(struct kcn_info *ki, const struct kcn_msg_query *kmq)
 	}
 	return false;
 }
+
+bool
+kcn_client_search(const struct kcn_ctx *kc, struct kcn_info *ki,
+    const struct kcn_msg_query *kmq)
+{
+	struct kcn_client_response kcr;
+
+	kcr.kcr_ki = ki;
+	kcr.kcr_sample_cb = NULL;
+	kcr.kcr_counter_cb = NULL;
+	kcr.kcr_arg = NULL;
+	return kcn_client_request(kc, &kcr, kmq, NULL, NULL, false);
+}
+
+/* call back samples of a locator in time order. */
+bool
+kcn_client_history(const struct kcn_ctx *kc, const struct kcn_msg_history *kmhi,
+    bool (*cb)(const struct kcn_msg_sample *, void *), void *arg)
+{
+	struct kcn_client_response kcr;
+
+	kcr.kcr_ki = NULL;
+	kcr.kcr_sample_cb = cb;
+	kcr.kcr_counter_cb = NULL;
+	kcr.kcr_arg = arg;
+	return kcn_client_request(kc, &kcr, NULL, kmhi, NULL, false);
+}
+
+/* attach a directory built offline, and wait for its completion. */
+bool
+kcn_client_attach(const struct kcn_ctx *kc, const struct kcn_msg_attach *kmat)
+{
+	struct kcn_client_response kcr;
+
+	kcr.kcr_ki = NULL;
+	kcr.kcr_sample_cb = NULL;
+	kcr.kcr_counter_cb = NULL;
+	kcr.kcr_arg = NULL;
+	return kcn_client_request(kc, &kcr, NULL, NULL, kmat, false);
+}
+
+/* call back counters of the server in an order of the server. */
+bool
+kcn_client_stats(const struct kcn_ctx *kc,
+    bool (*cb)(const struct kcn_msg_counter *, void *), void *arg)
+{
+	struct kcn_client_response kcr;
+
+	kcr.kcr_ki = NULL;
+	kcr.kcr_sample_cb = NULL;
+	kcr.kcr_counter_cb = cb;
+	kcr.kcr_arg = arg;
+	return kcn_client_request(kc, &kcr, NULL, NULL, NULL, true);
+}
+
+static void kcn_client_pool_done_cb(int, short, void *);
+
+struct kcn_client_pool *
+kcn_client_pool_new(const struct kcn_ctx *kc, struct event_base *evb,
+    size_t nconns)
+{
+	struct kcn_client_pool *kcp;
+	struct kcn_client_conn *kcc;
+	size_t i;
+
+	assert(nconns > 0);
+	kcp = malloc(offsetof(struct kcn_client_pool, kcp_conns[nconns]));
+	if (kcp == NULL)
+		return NULL;
+	kcp->kcp_kc = kc;
+	kcp->kcp_evb = evb;
+	evtimer_set(&kcp->kcp_ev, kcn_client_pool_done_cb, kcp);
+	if (event_base_set(evb, &kcp->kcp_ev) == -1) {
+		free(kcp);
+		return NULL;
+	}
+	TAILQ_INIT(&kcp->kcp_done);
+	kcp->kcp_nconns = nconns;
+	for (i = 0; i < nconns; i++) {
+		kcc = &kcp->kcp_conns[i];
+		kcc->kcc_kcp = kcp;
+		kcc->kcc_kn = NULL;
+		kcc->kcc_down = false;
+		kcc->kcc_nqueries = 0;
+		TAILQ_INIT(&kcc->kcc_queries);
+	}
+	return kcp;
+}
+
+static void
+kcn_client_async_queue_purge(struct kcn_client_async_queue *kcaq)
+{
+	struct kcn_client_async *kca;
+
+	while ((kca = TAILQ_FIRST(kcaq)) != NULL) {
+		TAILQ_REMOVE(kcaq, kca, kca_chain);
+		free(kca);
+	}
+}
+
+/* queries in progress are discarded without calling back. */
+void
+kcn_client_pool_destroy(struct kcn_client_pool *kcp)
+{
+	struct kcn_client_conn *kcc;
+	size_t i;
+
+	if (kcp == NULL)
+		return;
+	for (i = 0; i < kcp->kcp_nconns; i++) {
+		kcc = &kcp->kcp_conns[i];
+		kcn_client_async_queue_purge(&kcc->kcc_queries);
+		kcn_client_finish(kcc->kcc_kn);
+	}
+	kcn_client_async_queue_purge(&kcp->kcp_done);
+	evtimer_del(&kcp->kcp_ev);
+	free(kcp);
+}
+
+/* a connection going down cannot be destroyed in its own callback. */
+static void
+kcn_client_pool_conn_reap(struct kcn_client_conn *kcc)
+{
+
+	if (! kcc->kcc_down)
+		return;
+	kcn_client_finish(kcc->kcc_kn);
+	kcc->kcc_kn = NULL;
+	kcc->kcc_down = false;
+}
+
+/* callbacks are deferred so that they can submit queries again. */
+static void
+kcn_client_pool_done(struct kcn_client_conn *kcc, int error)
+{
+	struct kcn_client_pool *kcp = kcc->kcc_kcp;
+	struct kcn_client_async *kca;
+	struct timeval tv;
+
+	kca = TAILQ_FIRST(&kcc->kcc_queries);
+	assert(kca != NULL);
+	TAILQ_REMOVE(&kcc->kcc_queries, kca, kca_chain);
+	--kcc->kcc_nqueries;
+	kca->kca_kcr.kcr_error = error;
+	TAILQ_INSERT_TAIL(&kcp->kcp_done, kca, kca_chain);
+	timerclear(&tv);
+	evtimer_add(&kcp->kcp_ev, &tv);
+}
+
+static void
+kcn_client_pool_done_cb(int fd, short event, void *arg)
+{
+	struct kcn_client_pool *kcp = arg;
+	struct kcn_client_async *kca;
+	size_t i;
+
+	(void)fd;
+	(void)event;
+	for (i = 0; i < kcp->kcp_nconns; i++)
+		kcn_client_pool_conn_reap(&kcp->kcp_conns[i]);
+	while ((kca = TAILQ_FIRST(&kcp->kcp_done)) != NULL) {
+		TAILQ_REMOVE(&kcp->kcp_done, kca, kca_chain);
+		if (kca->kca_cb != NULL)
+			(*kca->kca_cb)(kca->kca_kcr.kcr_ki,
+			    kca->kca_kcr.kcr_error, kca->kca_arg);
+		free(kca);
+	}
+}
+
+static int
+kcn_client_pool_read(struct kcn_net *kn, struct kcn_buf *kb, void *arg)
+{
+	struct kcn_client_conn *kcc = arg;
+	struct kcn_client_async *kca;
+	int error;
+
+	while ((kca = TAILQ_FIRST(&kcc->kcc_queries)) != NULL) {
+		error = kcn_client_read(kn, kb, &kca->kca_kcr);
+		if (error == EAGAIN)
+			return EAGAIN;
+		/* responses of following queries are lost. */
+		if (! kca->kca_kcr.kcr_end)
+			return error != 0 ? error : EINVAL;
+		kcn_client_pool_done(kcc, error);
+	}
+	return EAGAIN;
+}
+
+static void
+kcn_client_pool_close(struct kcn_net *kn, int error, void *arg)
+{
+	struct kcn_client_conn *kcc = arg;
+
+	(void)kn;
+	if (error == 0) /* destroyed by a pool. */
+		return;
+	kcc->kcc_down = true;
+	while (! TAILQ_EMPTY(&kcc->kcc_queries))
+		kcn_client_pool_done(kcc, error);
+}
+
+static struct kcn_client_conn *
+kcn_client_pool_conn_get(struct kcn_client_pool *kcp)
+{
+	struct kcn_client_conn *kcc, *kccmin;
+	size_t i;
+
+	kccmin = NULL;
+	for (i = 0; i < kcp->kcp_nconns; i++) {
+		kcc = &kcp->kcp_conns[i];
+		if (kccmin == NULL || kcc->kcc_nqueries < kccmin->kcc_nqueries)
+			kccmin = kcc;
+	}
+	kcc = kccmin;
+	kcn_client_pool_conn_reap(kcc);
+	if (kcc->kcc_kn != NULL)
+		return kcc;
+	kcc->kcc_kn = kcn_client_connect(kcp->kcp_kc, kcp->kcp_evb,
+	    kcn_client_pool_read, kcc);
+	if (kcc->kcc_kn == NULL)
+		return NULL;
+	kcn_net_close_cb_set(kcc->kcc_kn, kcn_client_pool_close);
+	return kcc;
+}
+
+/*
+ * start a search on a connection of a pool with the fewest queries, and
+ * return immediately.  a callback is called on an event base of the pool
+ * with an error, or 0 on success, when locators are stored into ki.
+ */
+struct kcn_client_async *
+kcn_client_search_async(struct kcn_client_pool *kcp, struct kcn_info *ki,
+    const struct kcn_msg_query *kmq,
+    void (*cb)(struct kcn_info *, int, void *), void *arg)
+{
+	struct kcn_client_conn *kcc;
+	struct kcn_client_async *kca;
+
+	kca = malloc(sizeof(*kca));
+	if (kca == NULL)
+		goto bad;
+	kca->kca_kcr.kcr_error = 0;
+	kca->kca_kcr.kcr_end = false;
+	kca->kca_kcr.kcr_discard = false;
+	kca->kca_kcr.kcr_ki = ki;
+	kca->kca_kcr.kcr_sample_cb = NULL;
+	kca->kca_kcr.kcr_counter_cb = NULL;
+	kca->kca_kcr.kcr_arg = NULL;
+	kca->kca_cb = cb;
+	kca->kca_arg = arg;
+	kcc = kcn_client_pool_conn_get(kcp);
+	if (kcc == NULL)
+		goto bad;
+	if (! kcn_client_query_send(kcc->kcc_kn, kmq))
+		goto bad;
+	TAILQ_INSERT_TAIL(&kcc->kcc_queries, kca, kca_chain);
+	++kcc->kcc_nqueries;
+	return kca;
+  bad:
+	free(kca);
+	return NULL;
+}
+
+/*
+ * cancel a search in progress without calling back.  its responses are
+ * still received but discarded in order to keep a pipeline in sync.
+ */
+void
+kcn_client_async_cancel(struct kcn_client_async *kca)
+{
+
+	kca->kca_kcr.kcr_discard = true;
+	kca->kca_kcr.kcr_ki = NULL;
+	kca->kca_cb = NULL;
+}
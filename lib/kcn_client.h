@@ -1,7 +1,27 @@
 struct event_base;
+struct kcn_buf;
+struct kcn_ctx;
+struct kcn_client_pool;
+struct kcn_client_async;
 
-struct kcn_net *kcn_client_init(struct event_base *, void *);
+struct kcn_net *kcn_client_connect(const struct kcn_ctx *, struct event_base *,
+    int (*)(struct kcn_net *, struct kcn_buf *, void *), void *);
+struct kcn_net *kcn_client_init(const struct kcn_ctx *, struct event_base *,
+    void *);
 void kcn_client_finish(struct kcn_net *);
-void kcn_client_server_name_set(const char *);
 bool kcn_client_add_send(struct kcn_net *, const struct kcn_msg_add *);
-bool kcn_client_search(struct kcn_info *, const struct kcn_msg_query *);
+bool kcn_client_del_send(struct kcn_net *, const struct kcn_msg_del *);
+bool kcn_client_search(const struct kcn_ctx *, struct kcn_info *,
+    const struct kcn_msg_query *);
+struct kcn_client_pool *kcn_client_pool_new(const struct kcn_ctx *,
+    struct event_base *, size_t);
+void kcn_client_pool_destroy(struct kcn_client_pool *);
+struct kcn_client_async *kcn_client_search_async(struct kcn_client_pool *,
+    struct kcn_info *, const struct kcn_msg_query *,
+    void (*)(struct kcn_info *, int, void *), void *);
+void kcn_client_async_cancel(struct kcn_client_async *);
+bool kcn_client_history(const struct kcn_ctx *, const struct kcn_msg_history *,
+    bool (*)(const struct kcn_msg_sample *, void *), void *);
+bool kcn_client_attach(const struct kcn_ctx *, const struct kcn_msg_attach *);
+bool kcn_client_stats(const struct kcn_ctx *,
+    bool (*)(const struct kcn_msg_counter *, void *), void *);
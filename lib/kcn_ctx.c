@@ -0,0 +1,105 @@
+#include <sys/time.h>
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <event.h>
+
+#include "kcn.h"
+#include "kcn_info.h"
+#include "kcn_db.h"
+#include "kcn_buf.h"
+#include "kcn_net.h"
+#include "kcn_netstat.h"
+#include "kcn_ctx.h"
+
+/*
+ * a context holds configuration and databases registered.  it is not
+ * modified by searches, and hence searches of a context can be run by
+ * many threads at once as long as it is not configured meanwhile.
+ */
+struct kcn_ctx {
+	struct kcn_db_list kc_dbs;
+	char *kc_server;
+	struct timeval kc_timeouttv;
+};
+
+struct kcn_ctx *
+kcn_ctx_new(void)
+{
+	struct kcn_ctx *kc;
+
+	kc = malloc(sizeof(*kc));
+	if (kc == NULL)
+		return NULL;
+	TAILQ_INIT(&kc->kc_dbs);
+	kc->kc_server = NULL;
+	kc->kc_timeouttv = kcn_net_timeouttv;
+	if (! kcn_ctx_server_set(kc, KCN_NETSTAT_SERVER_STR_DEFAULT)) {
+		free(kc);
+		return NULL;
+	}
+	return kc;
+}
+
+void
+kcn_ctx_destroy(struct kcn_ctx *kc)
+{
+	struct kcn_db *kd;
+
+	if (kc == NULL)
+		return;
+	while ((kd = TAILQ_FIRST(&kc->kc_dbs)) != NULL)
+		kcn_db_deregister(kc, kd);
+	free(kc->kc_server);
+	free(kc);
+}
+
+struct kcn_db_list *
+kcn_ctx_db_list(struct kcn_ctx *kc)
+{
+
+	return &kc->kc_dbs;
+}
+
+const struct kcn_db_list *
+kcn_ctx_db_list_const(const struct kcn_ctx *kc)
+{
+
+	return &kc->kc_dbs;
+}
+
+bool
+kcn_ctx_server_set(struct kcn_ctx *kc, const char *name)
+{
+	char *s;
+
+	s = strdup(name);
+	if (s == NULL)
+		return false;
+	free(kc->kc_server);
+	kc->kc_server = s;
+	return true;
+}
+
+const char *
+kcn_ctx_server(const struct kcn_ctx *kc)
+{
+
+	return kc->kc_server;
+}
+
+void
+kcn_ctx_timeout_set(struct kcn_ctx *kc, const struct timeval *tv)
+{
+
+	kc->kc_timeouttv = *tv;
+}
+
+const struct timeval *
+kcn_ctx_timeout(const struct kcn_ctx *kc)
+{
+
+	return &kc->kc_timeouttv;
+}
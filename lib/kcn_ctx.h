@@ -0,0 +1,12 @@
+struct timeval;
+struct kcn_ctx;
+struct kcn_db_list;
+
+struct kcn_ctx *kcn_ctx_new(void);
+void kcn_ctx_destroy(struct kcn_ctx *);
+struct kcn_db_list *kcn_ctx_db_list(struct kcn_ctx *);
+const struct kcn_db_list *kcn_ctx_db_list_const(const struct kcn_ctx *);
+bool kcn_ctx_server_set(struct kcn_ctx *, const char *);
+const char *kcn_ctx_server(const struct kcn_ctx *);
+void kcn_ctx_timeout_set(struct kcn_ctx *, const struct timeval *);
+const struct timeval *kcn_ctx_timeout(const struct kcn_ctx *);
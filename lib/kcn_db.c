@@ -9,42 +9,56 @@
 #include "kcn_log.h"
 #include "kcn_info.h"
 #include "kcn_db.h"
+#include "kcn_ctx.h"
 
-static TAILQ_HEAD(, kcn_db) kcn_db_list = TAILQ_HEAD_INITIALIZER(kcn_db_list);
-
-void
-kcn_db_register(struct kcn_db *kdn)
+/* a database is copied so that it can be registered to many contexts. */
+bool
+kcn_db_register(struct kcn_ctx *kc, const struct kcn_db *kd0)
 {
-	struct kcn_db *kd;
+	struct kcn_db_list *kdl = kcn_ctx_db_list(kc);
+	struct kcn_db *kd, *kdn;
 
+	kdn = malloc(sizeof(*kdn));
+	if (kdn == NULL)
+		return false;
+	*kdn = *kd0;
 	KCN_LOG(INFO, "register \"%s\" database", kdn->kd_desc);
-	TAILQ_FOREACH(kd, &kcn_db_list, kd_chain) {
-		assert(kd != kdn);
+	TAILQ_FOREACH(kd, kdl, kd_chain) {
+		assert(strcasecmp(kd->kd_name, kdn->kd_name) != 0);
 		if (kd->kd_prio < kdn->kd_prio) {
 			TAILQ_INSERT_BEFORE(kd, kdn, kd_chain);
-			return;
+			return true;
 		}
 	}
-	TAILQ_INSERT_TAIL(&kcn_db_list, kdn, kd_chain);
+	TAILQ_INSERT_TAIL(kdl, kdn, kd_chain);
+	return true;
 }
 
 void
-kcn_db_deregister(struct kcn_db *kd)
+kcn_db_deregister(struct kcn_ctx *kc, const struct kcn_db *kd0)
 {
+	struct kcn_db_list *kdl = kcn_ctx_db_list(kc);
+	struct kcn_db *kd;
 
+	TAILQ_FOREACH(kd, kdl, kd_chain)
+		if (strcasecmp(kd->kd_name, kd0->kd_name) == 0)
+			break;
+	if (kd == NULL)
+		return;
 	KCN_LOG(INFO, "deregister \"%s\" database", kd->kd_desc);
-	TAILQ_REMOVE(&kcn_db_list, kd, kd_chain);
+	TAILQ_REMOVE(kdl, kd, kd_chain);
+	free(kd);
 }
 
 static const struct kcn_db *
-kcn_db_match(const char *keys)
+kcn_db_match(const struct kcn_ctx *kc, const char *keys)
 {
-	struct kcn_db *kd, *kdmatch;
+	const struct kcn_db *kd, *kdmatch;
 	size_t score, scorematch;
 
 	scorematch = 0;
 	kdmatch = NULL;
-	TAILQ_FOREACH(kd, &kcn_db_list, kd_chain) {
+	TAILQ_FOREACH(kd, kcn_ctx_db_list_const(kc), kd_chain) {
 		if (! (*kd->kd_match)(keys, &score)) {
 			if (errno != 0) {
 				KCN_LOG(DEBUG, "invalid syntax");
@@ -64,11 +78,11 @@ kcn_db_match(const char *keys)
 }
 
 static const struct kcn_db *
-kcn_db_lookup(const char *name)
+kcn_db_lookup(const struct kcn_ctx *kc, const char *name)
 {
 	const struct kcn_db *kd;
 
-	TAILQ_FOREACH(kd, &kcn_db_list, kd_chain)
+	TAILQ_FOREACH(kd, kcn_ctx_db_list_const(kc), kd_chain)
 		if (strcasecmp(kd->kd_name, name) == 0)
 			return kd;
 	errno = ESRCH;
@@ -76,34 +90,66 @@ kcn_db_lookup(const char *name)
 }
 
 bool
-kcn_db_exists(const char *name)
+kcn_db_exists(const struct kcn_ctx *kc, const char *name)
 {
 
-	return kcn_db_lookup(name) != NULL;
+	return kcn_db_lookup(kc, name) != NULL;
 }
 
 void
-kcn_db_name_list_puts(const char *prefix)
+kcn_db_name_list_puts(const struct kcn_ctx *kc, const char *prefix)
 {
 	const struct kcn_db *kd;
 
-	TAILQ_FOREACH(kd, &kcn_db_list, kd_chain)
+	TAILQ_FOREACH(kd, kcn_ctx_db_list_const(kc), kd_chain)
 		fprintf(stderr, "%s%s: %s\n", prefix, kd->kd_name, kd->kd_desc);
 }
 
-bool
-kcn_db_search(struct kcn_info *ki, const char *keys)
+static const struct kcn_db *
+kcn_db_select(const struct kcn_ctx *kc, struct kcn_info *ki, const char *keys)
 {
 	const char *name;
 	const struct kcn_db *kd;
 
 	name = kcn_info_db(ki);
 	if (name == NULL)
-		kd = kcn_db_match(keys);
+		kd = kcn_db_match(kc, keys);
 	else
-		kd = kcn_db_lookup(name);
+		kd = kcn_db_lookup(kc, name);
+	if (kd != NULL)
+		KCN_LOG(DEBUG, "select a database of \"%s\"", kd->kd_name);
+	return kd;
+}
+
+bool
+kcn_db_search(const struct kcn_ctx *kc, struct kcn_info *ki, const char *keys)
+{
+	const struct kcn_db *kd;
+
+	kd = kcn_db_select(kc, ki, keys);
+	if (kd == NULL)
+		return false;
+	return (*kd->kd_search)(kc, ki, keys);
+}
+
+/*
+ * start a search on a connection pool, and call back with an error, or 0
+ * on success, on its completion.  the callback is not called if false
+ * is returned.
+ */
+bool
+kcn_db_search_async(const struct kcn_ctx *kc, struct kcn_client_pool *kcp,
+    struct kcn_info *ki, const char *keys,
+    void (*cb)(struct kcn_info *, int, void *), void *arg)
+{
+	const struct kcn_db *kd;
+
+	kd = kcn_db_select(kc, ki, keys);
 	if (kd == NULL)
 		return false;
-	KCN_LOG(DEBUG, "select a database of \"%s\"", kd->kd_name);
-	return (*kd->kd_search)(ki, keys);
+	if (kd->kd_search_async == NULL) {
+		errno = EOPNOTSUPP;
+		return false;
+	}
+	return (*kd->kd_search_async)(kc, kcp, ki, keys, cb, arg);
 }
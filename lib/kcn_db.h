@@ -1,16 +1,27 @@
 #include <sys/queue.h>
 
+struct kcn_ctx;
+struct kcn_client_pool;
+
 struct kcn_db {
 	TAILQ_ENTRY(kcn_db) kd_chain;
 	size_t kd_prio;
 	const char *kd_name;
 	const char *kd_desc;
 	bool (*kd_match)(const char *, size_t *);
-	bool (*kd_search)(struct kcn_info *, const char *);
+	bool (*kd_search)(const struct kcn_ctx *, struct kcn_info *,
+	    const char *);
+	bool (*kd_search_async)(const struct kcn_ctx *,
+	    struct kcn_client_pool *, struct kcn_info *, const char *,
+	    void (*)(struct kcn_info *, int, void *), void *);
 };
+TAILQ_HEAD(kcn_db_list, kcn_db);
 
-void kcn_db_register(struct kcn_db *);
-void kcn_db_deregister(struct kcn_db *);
-bool kcn_db_exists(const char *);
-void kcn_db_name_list_puts(const char *);
-bool kcn_db_search(struct kcn_info *, const char *);
+bool kcn_db_register(struct kcn_ctx *, const struct kcn_db *);
+void kcn_db_deregister(struct kcn_ctx *, const struct kcn_db *);
+bool kcn_db_exists(const struct kcn_ctx *, const char *);
+void kcn_db_name_list_puts(const struct kcn_ctx *, const char *);
+bool kcn_db_search(const struct kcn_ctx *, struct kcn_info *, const char *);
+bool kcn_db_search_async(const struct kcn_ctx *, struct kcn_client_pool *,
+    struct kcn_info *, const char *, void (*)(struct kcn_info *, int, void *),
+    void *);
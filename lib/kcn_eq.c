@@ -59,6 +59,37 @@ kcn_eq_type_aton(const char *s, enum kcn_eq_type *typep)
 	return true;
 }
 
+bool
+kcn_eq_function_aton(const char *w, enum kcn_eq_function *funcp,
+    unsigned int *argp)
+{
+	unsigned long long ullval;
+
+	*argp = 0;
+	if (strcasecmp("avg", w) == 0 ||
+	    strcasecmp("average", w) == 0 ||
+	    strcasecmp("mean", w) == 0)
+		*funcp = KCN_EQ_FUNC_AVG;
+	else if (strcasecmp("min", w) == 0)
+		*funcp = KCN_EQ_FUNC_MIN;
+	else if (strcasecmp("max", w) == 0)
+		*funcp = KCN_EQ_FUNC_MAX;
+	else if (strcasecmp("median", w) == 0) {
+		*funcp = KCN_EQ_FUNC_PERCENTILE;
+		*argp = 50;
+	} else if ((w[0] == 'p' || w[0] == 'P') &&
+	    kcn_strtoull(w + 1, 0, KCN_EQ_PERCENTILE_MAX, &ullval)) {
+		*funcp = KCN_EQ_FUNC_PERCENTILE;
+		*argp = ullval;
+	} else if (strcasecmp("rate", w) == 0)
+		*funcp = KCN_EQ_FUNC_RATE;
+	else {
+		errno = ENOENT;
+		return false;
+	}
+	return true;
+}
+
 bool
 kcn_eq_operator_aton(const char *w, enum kcn_eq_operator *opp)
 {
@@ -93,6 +124,36 @@ kcn_eq_val_aton(const char *w, unsigned long long *valp)
 	return kcn_strtoull(w, 0, ULLONG_MAX, valp);
 }
 
+bool
+kcn_eq_window_aton(const char *w, time_t *windowp)
+{
+	char buf[sizeof("18446744073709551615s")];
+	unsigned long long ullval, unit;
+	size_t len;
+
+	len = strlen(w);
+	if (len == 0 || len >= sizeof(buf)) {
+		errno = EINVAL;
+		return false;
+	}
+	memcpy(buf, w, len + 1);
+	switch (buf[len - 1]) {
+	case 's':	unit = 1;			break;
+	case 'm':	unit = KCN_TIME_MININSEC;	break;
+	case 'h':	unit = KCN_TIME_HOURINSEC;	break;
+	case 'd':	unit = KCN_TIME_DAYINSEC;	break;
+	default:	unit = 0;			break;
+	}
+	if (unit != 0)
+		buf[len - 1] = '\0';
+	else
+		unit = 1;
+	if (! kcn_strtoull(buf, 1, LONG_MAX / unit, &ullval))
+		return false;
+	*windowp = ullval * unit;
+	return true;
+}
+
 bool
 kcn_eq_time_match(time_t t, const struct kcn_eq *ke)
 {
@@ -20,8 +20,21 @@ enum kcn_eq_operator {
 	KCN_EQ_OP_GE
 };
 
+enum kcn_eq_function {
+	KCN_EQ_FUNC_NONE,
+	KCN_EQ_FUNC_AVG,
+	KCN_EQ_FUNC_MIN,
+	KCN_EQ_FUNC_MAX,
+	KCN_EQ_FUNC_PERCENTILE,
+	KCN_EQ_FUNC_RATE
+};
+
+#define KCN_EQ_PERCENTILE_MAX	100
+
 struct kcn_eq {
 	enum kcn_eq_type ke_type;
+	enum kcn_eq_function ke_func;
+	unsigned int ke_funcarg;	/* percentile */
 	enum kcn_eq_operator ke_op;
 	unsigned long long ke_val;
 	time_t ke_start;
@@ -30,6 +43,9 @@ struct kcn_eq {
 
 const char *kcn_eq_type_ntoa(enum kcn_eq_type);
 bool kcn_eq_type_aton(const char *, enum kcn_eq_type *);
+bool kcn_eq_function_aton(const char *, enum kcn_eq_function *,
+    unsigned int *);
 bool kcn_eq_operator_aton(const char *, enum kcn_eq_operator *);
 bool kcn_eq_val_aton(const char *, unsigned long long *);
+bool kcn_eq_window_aton(const char *, time_t *);
 bool kcn_eq_time_match(time_t, const struct kcn_eq *);
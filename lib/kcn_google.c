@@ -11,6 +11,7 @@
 #include "kcn_uri.h"
 #include "kcn_info.h"
 #include "kcn_db.h"
+#include "kcn_ctx.h"
 #include "kcn_http.h"
 #include "kcn_google.h"
 
@@ -39,9 +40,10 @@
 #define KCN_GOOGLE_API_STARTOPT		"start"
 
 static bool kcn_google_match(const char *, size_t *);
-static bool kcn_google_search(struct kcn_info *, const char *);
+static bool kcn_google_search(const struct kcn_ctx *, struct kcn_info *,
+    const char *);
 
-static struct kcn_db kcn_google = {
+static const struct kcn_db kcn_google = {
 	.kd_prio = 0,
 	.kd_name = "google",
 	.kd_desc = "Google Web search",
@@ -49,18 +51,25 @@ static struct kcn_db kcn_google = {
 	.kd_search = kcn_google_search
 };
 
-void
-kcn_google_init(void)
+bool
+kcn_google_init(struct kcn_ctx *kc)
 {
 
-	kcn_db_register(&kcn_google);
+	if (! kcn_http_init())
+		return false;
+	if (! kcn_db_register(kc, &kcn_google)) {
+		kcn_http_finish();
+		return false;
+	}
+	return true;
 }
 
 void
-kcn_google_finish(void)
+kcn_google_finish(struct kcn_ctx *kc)
 {
 
-	kcn_db_deregister(&kcn_google);
+	kcn_db_deregister(kc, &kcn_google);
+	kcn_http_finish();
 }
 
 static bool
@@ -151,7 +160,8 @@ kcn_google_search_one(const struct kcn_uri *ku, struct kcn_info *ki)
 }
 
 static bool
-kcn_google_search(struct kcn_info *ki, const char *keys)
+kcn_google_search(const struct kcn_ctx *kc, struct kcn_info *ki,
+    const char *keys)
 {
 	struct kcn_uri *ku;
 	char startopt[KCN_INFO_NLOCSTRLEN];
@@ -161,6 +171,7 @@ kcn_google_search(struct kcn_info *ki, const char *keys)
 	size_t n, uriolen, rcountmax;
 	int oerrno;
 
+	(void)kc;
 	assert(kcn_info_loc_type(ki) == KCN_LOC_TYPE_DOMAINNAME ||
 	    kcn_info_loc_type(ki) == KCN_LOC_TYPE_URI);
 	assert(kcn_info_maxnlocs(ki) > 0);
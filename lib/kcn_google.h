@@ -1,2 +1,4 @@
-void kcn_google_init(void);
-void kcn_google_finish(void);
+struct kcn_ctx;
+
+bool kcn_google_init(struct kcn_ctx *);
+void kcn_google_finish(struct kcn_ctx *);
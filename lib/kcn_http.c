@@ -33,6 +33,28 @@ kcn_http_curl_callback(const char *p, size_t size, size_t n, void *khb)
 	return totalsize;
 }
 
+/*
+ * libcurl must be initialized before threads are created since
+ * curl_easy_init() initializes it implicitly without any lock.
+ */
+bool
+kcn_http_init(void)
+{
+
+	if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+		errno = ENOMEM; /* XXX */
+		return false;
+	}
+	return true;
+}
+
+void
+kcn_http_finish(void)
+{
+
+	curl_global_cleanup();
+}
+
 char *
 kcn_http_response_get(const char *uri)
 {
@@ -50,6 +72,7 @@ kcn_http_response_get(const char *uri)
 	curl = curl_easy_init();
 	if (curl == NULL)
 		goto bad;
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L); /* for threads */
 	curl_easy_setopt(curl, CURLOPT_URL, uri);
 	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, kcn_http_curl_callback);
 	curl_easy_setopt(curl, CURLOPT_WRITEDATA, khb);
@@ -2,6 +2,8 @@
 #define KCN_HTTP_OK		200
 #define KCN_HTTP_FORBIDDEN	403
 
+bool kcn_http_init(void);
+void kcn_http_finish(void);
 char *kcn_http_response_get(const char *);
 void kcn_http_response_free(char *);
 
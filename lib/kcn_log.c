@@ -6,6 +6,7 @@
 #include "kcn.h"
 #include "kcn_log.h"
 
+/* XXX: verbosity is process-wide, and should be set before threads run. */
 int kcn_log_priority = LOG_EMERG - 1;
 
 void
@@ -23,9 +24,11 @@ kcn_log(const char *fmt, ...)
 	int oerrno;
 
 	oerrno = errno;
+	flockfile(stderr); /* not to mix lines of threads. */
 	va_start(ap, fmt);
 	vfprintf(stderr, fmt, ap);
 	va_end(ap);
 	fprintf(stderr, "\n");
+	funlockfile(stderr);
 	errno = oerrno;
 }
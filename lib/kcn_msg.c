@@ -69,42 +69,121 @@ kcn_msg_header_decode(struct kcn_buf *kb, struct kcn_msg_header *kmh)
 	return false;
 }
 
+/*
+ * a query consists of a locator type, the maximum number of locators and
+ * one or more equations that all must be satisfied.  a function of an
+ * equation can be omitted only when a query has just one equation for
+ * compatibility with older implementations.
+ */
 void
 kcn_msg_query_encode(struct kcn_buf *kb, const struct kcn_msg_query *kmq)
 {
-	const struct kcn_eq *ke = &kmq->kmq_eq;
+	const struct kcn_eq *ke;
+	size_t i;
 
+	assert(kmq->kmq_neqs > 0 && kmq->kmq_neqs <= KCN_MSG_QUERY_MAXEQS);
 	kcn_msg_pkt_init(kb);
 	kcn_buf_put8(kb, kmq->kmq_loctype);
 	kcn_buf_put8(kb, kmq->kmq_maxcount);
-	kcn_buf_put8(kb, ke->ke_type);
-	kcn_buf_put8(kb, ke->ke_op);
-	kcn_buf_put64(kb, ke->ke_val);
-	kcn_buf_put64(kb, ke->ke_start);
-	kcn_buf_put64(kb, ke->ke_end);
+	for (i = 0; i < kmq->kmq_neqs; i++) {
+		ke = &kmq->kmq_eqs[i];
+		kcn_buf_put8(kb, ke->ke_type);
+		kcn_buf_put8(kb, ke->ke_op);
+		kcn_buf_put64(kb, ke->ke_val);
+		kcn_buf_put64(kb, ke->ke_start);
+		kcn_buf_put64(kb, ke->ke_end);
+		if (kmq->kmq_neqs == 1 && ke->ke_func == KCN_EQ_FUNC_NONE)
+			break;
+		kcn_buf_put8(kb, ke->ke_func);
+		kcn_buf_put8(kb, ke->ke_funcarg);
+	}
 	kcn_msg_header_encode(kb, KCN_MSG_TYPE_QUERY);
 }
 
+static void
+kcn_msg_query_eq_decode(struct kcn_buf *kb, struct kcn_eq *ke, bool hasfunc)
+{
+
+	ke->ke_type = kcn_buf_get8(kb);
+	ke->ke_op = kcn_buf_get8(kb);
+	ke->ke_val = kcn_buf_get64(kb);
+	ke->ke_start = kcn_buf_get64(kb);
+	ke->ke_end = kcn_buf_get64(kb);
+	if (hasfunc) {
+		ke->ke_func = kcn_buf_get8(kb);
+		ke->ke_funcarg = kcn_buf_get8(kb);
+	} else {
+		ke->ke_func = KCN_EQ_FUNC_NONE;
+		ke->ke_funcarg = 0;
+	}
+}
+
+static bool
+kcn_msg_query_eq_validate(const struct kcn_eq *ke)
+{
+
+	if (ke->ke_type <= KCN_EQ_TYPE_MIN || ke->ke_type >= KCN_EQ_TYPE_MAX)
+		return false;
+	switch (ke->ke_op) {
+	case KCN_EQ_OP_LT:
+	case KCN_EQ_OP_LE:
+	case KCN_EQ_OP_EQ:
+	case KCN_EQ_OP_GT:
+	case KCN_EQ_OP_GE:
+		break;
+	default:
+		return false;
+	}
+	switch (ke->ke_func) {
+	case KCN_EQ_FUNC_NONE:
+	case KCN_EQ_FUNC_AVG:
+	case KCN_EQ_FUNC_MIN:
+	case KCN_EQ_FUNC_MAX:
+	case KCN_EQ_FUNC_RATE:
+		break;
+	case KCN_EQ_FUNC_PERCENTILE:
+		if (ke->ke_funcarg <= KCN_EQ_PERCENTILE_MAX)
+			break;
+		/*FALLTHROUGH*/
+	default:
+		return false;
+	}
+	return true;
+}
+
 bool
 kcn_msg_query_decode(struct kcn_buf *kb, const struct kcn_msg_header *kmh,
     struct kcn_msg_query *kmq)
 {
-	struct kcn_eq *ke;
+	size_t i, len;
+	bool hasfunc;
 
-	if (kmh->kmh_len != KCN_MSG_QUERY_SIZ) {
+	len = kmh->kmh_len;
+	if (len == KCN_MSG_QUERY_SIZ) {
+		kmq->kmq_neqs = 1;
+		hasfunc = false;
+	} else if (len > KCN_MSG_QUERY_HDRSIZ &&
+	    (len - KCN_MSG_QUERY_HDRSIZ) % KCN_MSG_QUERY_EQSIZ == 0 &&
+	    (len - KCN_MSG_QUERY_HDRSIZ) / KCN_MSG_QUERY_EQSIZ <=
+	    KCN_MSG_QUERY_MAXEQS) {
+		kmq->kmq_neqs = (len - KCN_MSG_QUERY_HDRSIZ) /
+		    KCN_MSG_QUERY_EQSIZ;
+		hasfunc = true;
+	} else {
 		errno = EINVAL; /* XXX */
 		goto bad;
 	}
-	assert(kcn_buf_trailingdata(kb) >= KCN_MSG_QUERY_SIZ);
+	assert(kcn_buf_trailingdata(kb) >= len);
 	kmq->kmq_loctype = kcn_buf_get8(kb);
 	kmq->kmq_maxcount = kcn_buf_get8(kb);
-	ke = &kmq->kmq_eq;
-	ke->ke_type = kcn_buf_get8(kb);
-	ke->ke_op = kcn_buf_get8(kb);
-	ke->ke_val = kcn_buf_get64(kb);
-	ke->ke_start = kcn_buf_get64(kb);
-	ke->ke_end = kcn_buf_get64(kb);
+	for (i = 0; i < kmq->kmq_neqs; i++)
+		kcn_msg_query_eq_decode(kb, &kmq->kmq_eqs[i], hasfunc);
 	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	for (i = 0; i < kmq->kmq_neqs; i++)
+		if (! kcn_msg_query_eq_validate(&kmq->kmq_eqs[i])) {
+			errno = EINVAL; /* XXX */
+			goto bad;
+		}
 	switch (kmq->kmq_loctype) {
 	case KCN_LOC_TYPE_DOMAINNAME:
 	case KCN_LOC_TYPE_URI:
@@ -197,3 +276,210 @@ kcn_msg_add_decode(struct kcn_buf *kb, const struct kcn_msg_header *kmh,
   bad:
 	return false;
 }
+
+void
+kcn_msg_del_encode(struct kcn_buf *kb, const struct kcn_msg_del *kmd)
+{
+
+	kcn_msg_pkt_init(kb);
+	kcn_buf_put8(kb, kmd->kmd_type);
+	kcn_buf_put64(kb, kmd->kmd_start);
+	kcn_buf_put64(kb, kmd->kmd_end);
+	kcn_buf_put(kb, kmd->kmd_loc, kmd->kmd_loclen);
+	kcn_msg_header_encode(kb, KCN_MSG_TYPE_DEL);
+}
+
+bool
+kcn_msg_del_decode(struct kcn_buf *kb, const struct kcn_msg_header *kmh,
+    struct kcn_msg_del *kmd)
+{
+
+	if (kmh->kmh_len < KCN_MSG_DEL_MINSIZ) {
+		errno = EINVAL;
+		goto bad;
+	}
+	assert(kcn_buf_trailingdata(kb) >= kmh->kmh_len);
+	kmd->kmd_type = kcn_buf_get8(kb);
+	kmd->kmd_start = kcn_buf_get64(kb);
+	kmd->kmd_end = kcn_buf_get64(kb);
+	kmd->kmd_loc = kcn_buf_current(kb);
+	kmd->kmd_loclen = kmh->kmh_len - KCN_MSG_DEL_MINSIZ;
+	kcn_buf_trim_head(kb, kmh->kmh_len);
+	if (kmd->kmd_type <= KCN_EQ_TYPE_MIN ||
+	    kmd->kmd_type >= KCN_EQ_TYPE_MAX) {
+		errno = EINVAL;
+		goto bad;
+	}
+	return true;
+  bad:
+	return false;
+}
+
+void
+kcn_msg_history_encode(struct kcn_buf *kb, const struct kcn_msg_history *kmhi)
+{
+
+	kcn_msg_pkt_init(kb);
+	kcn_buf_put8(kb, kmhi->kmhi_type);
+	kcn_buf_put32(kb, kmhi->kmhi_maxcount);
+	kcn_buf_put64(kb, kmhi->kmhi_start);
+	kcn_buf_put64(kb, kmhi->kmhi_end);
+	kcn_buf_put(kb, kmhi->kmhi_loc, kmhi->kmhi_loclen);
+	kcn_msg_header_encode(kb, KCN_MSG_TYPE_HISTORY);
+}
+
+bool
+kcn_msg_history_decode(struct kcn_buf *kb, const struct kcn_msg_header *kmh,
+    struct kcn_msg_history *kmhi)
+{
+
+	if (kmh->kmh_len <= KCN_MSG_HISTORY_MINSIZ) {
+		errno = EINVAL;
+		goto bad;
+	}
+	assert(kcn_buf_trailingdata(kb) >= kmh->kmh_len);
+	kmhi->kmhi_type = kcn_buf_get8(kb);
+	kmhi->kmhi_maxcount = kcn_buf_get32(kb);
+	kmhi->kmhi_start = kcn_buf_get64(kb);
+	kmhi->kmhi_end = kcn_buf_get64(kb);
+	kmhi->kmhi_loc = kcn_buf_current(kb);
+	kmhi->kmhi_loclen = kmh->kmh_len - KCN_MSG_HISTORY_MINSIZ;
+	kcn_buf_trim_head(kb, kmh->kmh_len);
+	if (kmhi->kmhi_type <= KCN_EQ_TYPE_MIN ||
+	    kmhi->kmhi_type >= KCN_EQ_TYPE_MAX) {
+		errno = EINVAL;
+		goto bad;
+	}
+	return true;
+  bad:
+	return false;
+}
+
+void
+kcn_msg_sample_encode(struct kcn_buf *kb, const struct kcn_msg_sample *kms)
+{
+
+	kcn_msg_pkt_init(kb);
+	kcn_buf_put8(kb, kms->kms_error);
+	if (! kms->kms_end) {
+		kcn_buf_put64(kb, kms->kms_time);
+		kcn_buf_put64(kb, kms->kms_val);
+	}
+	kcn_msg_header_encode(kb, KCN_MSG_TYPE_SAMPLE);
+}
+
+bool
+kcn_msg_sample_decode(struct kcn_buf *kb, const struct kcn_msg_header *kmh,
+    struct kcn_msg_sample *kms)
+{
+
+	if (kmh->kmh_len != KCN_MSG_SAMPLE_ENDSIZ &&
+	    kmh->kmh_len != KCN_MSG_SAMPLE_SIZ) {
+		errno = EINVAL;
+		goto bad;
+	}
+	assert(kcn_buf_trailingdata(kb) >= kmh->kmh_len);
+	kms->kms_error = kcn_buf_get8(kb);
+	if (kmh->kmh_len == KCN_MSG_SAMPLE_ENDSIZ) {
+		kms->kms_end = true;
+		kms->kms_time = 0;
+		kms->kms_val = 0;
+	} else {
+		kms->kms_end = false;
+		kms->kms_time = kcn_buf_get64(kb);
+		kms->kms_val = kcn_buf_get64(kb);
+	}
+	kcn_buf_trim_head(kb, kcn_buf_headingdata(kb));
+	return true;
+  bad:
+	return false;
+}
+
+void
+kcn_msg_attach_encode(struct kcn_buf *kb, const struct kcn_msg_attach *kmat)
+{
+
+	kcn_msg_pkt_init(kb);
+	kcn_buf_put(kb, kmat->kmat_path, kmat->kmat_pathlen);
+	kcn_msg_header_encode(kb, KCN_MSG_TYPE_ATTACH);
+}
+
+bool
+kcn_msg_attach_decode(struct kcn_buf *kb, const struct kcn_msg_header *kmh,
+    struct kcn_msg_attach *kmat)
+{
+
+	if (kmh->kmh_len == 0) {
+		errno = EINVAL;
+		goto bad;
+	}
+	assert(kcn_buf_trailingdata(kb) >= kmh->kmh_len);
+	kmat->kmat_path = kcn_buf_current(kb);
+	kmat->kmat_pathlen = kmh->kmh_len;
+	kcn_buf_trim_head(kb, kmh->kmh_len);
+	return true;
+  bad:
+	return false;
+}
+
+void
+kcn_msg_stats_encode(struct kcn_buf *kb)
+{
+
+	kcn_msg_pkt_init(kb);
+	kcn_msg_header_encode(kb, KCN_MSG_TYPE_STATS);
+}
+
+bool
+kcn_msg_stats_decode(struct kcn_buf *kb, const struct kcn_msg_header *kmh)
+{
+
+	(void)kb;
+	if (kmh->kmh_len != 0) {
+		errno = EINVAL;
+		return false;
+	}
+	return true;
+}
+
+void
+kcn_msg_counter_encode(struct kcn_buf *kb, const struct kcn_msg_counter *kmc)
+{
+
+	kcn_msg_pkt_init(kb);
+	kcn_buf_put8(kb, kmc->kmc_error);
+	if (! kmc->kmc_end) {
+		kcn_buf_put64(kb, kmc->kmc_val);
+		kcn_buf_put(kb, kmc->kmc_name, kmc->kmc_namelen);
+	}
+	kcn_msg_header_encode(kb, KCN_MSG_TYPE_COUNTER);
+}
+
+bool
+kcn_msg_counter_decode(struct kcn_buf *kb, const struct kcn_msg_header *kmh,
+    struct kcn_msg_counter *kmc)
+{
+
+	if (kmh->kmh_len != KCN_MSG_COUNTER_ENDSIZ &&
+	    kmh->kmh_len <= KCN_MSG_COUNTER_MINSIZ) {
+		errno = EINVAL;
+		goto bad;
+	}
+	assert(kcn_buf_trailingdata(kb) >= kmh->kmh_len);
+	kmc->kmc_error = kcn_buf_get8(kb);
+	if (kmh->kmh_len == KCN_MSG_COUNTER_ENDSIZ) {
+		kmc->kmc_end = true;
+		kmc->kmc_val = 0;
+		kmc->kmc_name = NULL;
+		kmc->kmc_namelen = 0;
+	} else {
+		kmc->kmc_end = false;
+		kmc->kmc_val = kcn_buf_get64(kb);
+		kmc->kmc_name = kcn_buf_current(kb);
+		kmc->kmc_namelen = kmh->kmh_len - KCN_MSG_COUNTER_MINSIZ;
+	}
+	kcn_buf_trim_head(kb, kmh->kmh_len);
+	return true;
+  bad:
+	return false;
+}
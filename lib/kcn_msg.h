@@ -2,9 +2,19 @@
 #define KCN_MSG_HDRSIZ		(1 /* version */ + 1 /* type */ + 2 /* length*/)
 #define KCN_MSG_MAXSIZ		4096
 #define KCN_MSG_MAXBODYSIZ	(KCN_MSG_MAXSIZ - KCN_MSG_HDRSIZ)
-#define KCN_MSG_QUERY_SIZ	(1 + 1 + 1 + 1 + 8 + 8 + 8)
+#define KCN_MSG_QUERY_HDRSIZ	(1 + 1)
+#define KCN_MSG_QUERY_EQSIZ	(1 + 1 + 8 + 8 + 8 + 1 + 1)
+#define KCN_MSG_QUERY_SIZ						\
+	(KCN_MSG_QUERY_HDRSIZ + KCN_MSG_QUERY_EQSIZ - 1 - 1)
+#define KCN_MSG_QUERY_MAXEQS	8
 #define KCN_MSG_RESPONSE_MINSIZ	(1 + 1)
 #define KCN_MSG_ADD_MINSIZ	(1 + 8 + 8)
+#define KCN_MSG_DEL_MINSIZ	(1 + 8 + 8)
+#define KCN_MSG_HISTORY_MINSIZ	(1 + 4 + 8 + 8)
+#define KCN_MSG_SAMPLE_ENDSIZ	1
+#define KCN_MSG_SAMPLE_SIZ	(KCN_MSG_SAMPLE_ENDSIZ + 8 + 8)
+#define KCN_MSG_COUNTER_ENDSIZ	1
+#define KCN_MSG_COUNTER_MINSIZ	(KCN_MSG_COUNTER_ENDSIZ + 8)
 #define KCN_MSG_MAXLOCSIZ						\
 	(KCN_MSG_MAXBODYSIZ - max(KCN_MSG_RESPONSE_MINSIZ, KCN_MSG_ADD_MINSIZ))
 
@@ -13,7 +23,12 @@ enum kcn_msg_type {
 	KCN_MSG_TYPE_QUERY,
 	KCN_MSG_TYPE_RESPONSE,
 	KCN_MSG_TYPE_ADD,
-	KCN_MSG_TYPE_DEL
+	KCN_MSG_TYPE_DEL,
+	KCN_MSG_TYPE_HISTORY,
+	KCN_MSG_TYPE_SAMPLE,
+	KCN_MSG_TYPE_ATTACH,
+	KCN_MSG_TYPE_STATS,
+	KCN_MSG_TYPE_COUNTER
 };
 
 struct kcn_msg_header {
@@ -25,7 +40,8 @@ struct kcn_msg_header {
 struct kcn_msg_query {
 	enum kcn_loc_type kmq_loctype;
 	uint8_t kmq_maxcount;
-	struct kcn_eq kmq_eq;
+	size_t kmq_neqs;
+	struct kcn_eq kmq_eqs[KCN_MSG_QUERY_MAXEQS];
 };
 
 struct kcn_msg_response {
@@ -43,6 +59,48 @@ struct kcn_msg_add {
 	size_t kma_loclen;
 };
 
+/* records of a locator, or of all locators if empty, in a time range. */
+struct kcn_msg_del {
+	enum kcn_eq_type kmd_type;
+	uint64_t kmd_start;
+	uint64_t kmd_end;
+	const char *kmd_loc;
+	size_t kmd_loclen;
+};
+
+/* samples of a locator in a time range.  no limit if maxcount is 0. */
+struct kcn_msg_history {
+	enum kcn_eq_type kmhi_type;
+	uint32_t kmhi_maxcount;
+	uint64_t kmhi_start;
+	uint64_t kmhi_end;
+	const char *kmhi_loc;
+	size_t kmhi_loclen;
+};
+
+/* an absolute path of a directory built offline to be attached. */
+struct kcn_msg_attach {
+	const char *kmat_path;
+	size_t kmat_pathlen;
+};
+
+/* the last sample only has an error without time and value. */
+struct kcn_msg_sample {
+	uint8_t kms_error;
+	bool kms_end;
+	uint64_t kms_time;
+	uint64_t kms_val;
+};
+
+/* a counter of the server.  the last one only has an error. */
+struct kcn_msg_counter {
+	uint8_t kmc_error;
+	bool kmc_end;
+	uint64_t kmc_val;
+	const char *kmc_name;
+	size_t kmc_namelen;
+};
+
 bool kcn_msg_header_decode(struct kcn_buf *, struct kcn_msg_header *);
 void kcn_msg_query_encode(struct kcn_buf *, const struct kcn_msg_query *);
 bool kcn_msg_query_decode(struct kcn_buf *, const struct kcn_msg_header *,
@@ -54,3 +112,20 @@ bool kcn_msg_response_decode(struct kcn_buf *, const struct kcn_msg_header *,
 void kcn_msg_add_encode(struct kcn_buf *, const struct kcn_msg_add *);
 bool kcn_msg_add_decode(struct kcn_buf *, const struct kcn_msg_header *,
     struct kcn_msg_add *);
+void kcn_msg_del_encode(struct kcn_buf *, const struct kcn_msg_del *);
+bool kcn_msg_del_decode(struct kcn_buf *, const struct kcn_msg_header *,
+    struct kcn_msg_del *);
+void kcn_msg_history_encode(struct kcn_buf *, const struct kcn_msg_history *);
+bool kcn_msg_history_decode(struct kcn_buf *, const struct kcn_msg_header *,
+    struct kcn_msg_history *);
+void kcn_msg_sample_encode(struct kcn_buf *, const struct kcn_msg_sample *);
+bool kcn_msg_sample_decode(struct kcn_buf *, const struct kcn_msg_header *,
+    struct kcn_msg_sample *);
+void kcn_msg_attach_encode(struct kcn_buf *, const struct kcn_msg_attach *);
+bool kcn_msg_attach_decode(struct kcn_buf *, const struct kcn_msg_header *,
+    struct kcn_msg_attach *);
+void kcn_msg_stats_encode(struct kcn_buf *);
+bool kcn_msg_stats_decode(struct kcn_buf *, const struct kcn_msg_header *);
+void kcn_msg_counter_encode(struct kcn_buf *, const struct kcn_msg_counter *);
+bool kcn_msg_counter_decode(struct kcn_buf *, const struct kcn_msg_header *,
+    struct kcn_msg_counter *);
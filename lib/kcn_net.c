@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <netinet/in.h>
 
@@ -40,7 +41,11 @@ struct kcn_net {
 	struct kcn_buf_data *kn_obufdata;
 	struct kcn_buf_queue kn_obufq;
 	int (*kn_readcb)(struct kcn_net *, struct kcn_buf *, void *);
+	void (*kn_closecb)(struct kcn_net *, int, void *);
+	void (*kn_draincb)(struct kcn_net *, void *);
+	void (*kn_writetimecb)(struct kcn_net *, uint64_t, void *);
 	void *kn_data;
+	struct timeval kn_timeouttv;
 };
 #define kn_evb	kn_evread.ev_base
 #define kn_fd	kn_evread.ev_fd
@@ -49,13 +54,13 @@ struct kcn_net {
 	KCN_LOG(p, "%s: " fmt, kn->kn_name, __VA_ARGS__)
 
 #define KCN_NET_TIMEOUT	5
-struct timeval kcn_net_timeouttv = {
+const struct timeval kcn_net_timeouttv = {
 	.tv_sec = KCN_NET_TIMEOUT,
 	.tv_usec = 0
 };
 
 static bool kcn_net_write_enable(struct kcn_net *);
-static void kcn_net_disconnect(struct kcn_net *);
+static void kcn_net_disconnect(struct kcn_net *, int);
 static void kcn_net_read_cb(int, short, void *);
 static void kcn_net_write_cb(int, short, void *);
 
@@ -79,7 +84,11 @@ kcn_net_new(struct event_base *evb, int fd, size_t size, const char *name,
 	kn->kn_obufdata = kcn_buf_data_new(size);
 	kcn_buf_queue_init(&kn->kn_obufq);
 	kn->kn_readcb = readcb;
+	kn->kn_closecb = NULL;
+	kn->kn_draincb = NULL;
+	kn->kn_writetimecb = NULL;
 	kn->kn_data = data;
+	kn->kn_timeouttv = kcn_net_timeouttv;
 	if (event_base_set(evb, &kn->kn_evread) == -1)
 		goto bad;
 	if (event_base_set(evb, &kn->kn_evwrite) == -1)
@@ -102,7 +111,7 @@ kcn_net_destroy(struct kcn_net *kn)
 
 	if (kn == NULL)
 		return;
-	kcn_net_disconnect(kn);
+	kcn_net_disconnect(kn, 0);
 	kcn_buf_data_destroy(kn->kn_ibufdata);
 	kcn_buf_data_destroy(kn->kn_obufdata);
 	kcn_buf_purge(&kn->kn_obufq);
@@ -163,18 +172,73 @@ kcn_net_data(const struct kcn_net *kn)
 	return kn->kn_data;
 }
 
+/*
+ * set a callback called with an error, or 0 on kcn_net_destroy(), when
+ * a connection is closed.  the callback must not destroy a connection.
+ */
+void
+kcn_net_close_cb_set(struct kcn_net *kn,
+    void (*closecb)(struct kcn_net *, int, void *))
+{
+
+	kn->kn_closecb = closecb;
+}
+
+/*
+ * set a callback called when all enqueued packets are written, which
+ * allows a caller to pace packets without kcn_net_flush().
+ */
+void
+kcn_net_drain_cb_set(struct kcn_net *kn,
+    void (*draincb)(struct kcn_net *, void *))
+{
+
+	kn->kn_draincb = draincb;
+}
+
+/*
+ * set a callback called with usec spent to write packets to a socket on
+ * each write event.  time is not measured unless the callback is set.
+ */
+void
+kcn_net_write_time_cb_set(struct kcn_net *kn,
+    void (*writetimecb)(struct kcn_net *, uint64_t, void *))
+{
+
+	kn->kn_writetimecb = writetimecb;
+}
+
+static uint64_t
+kcn_net_now(void)
+{
+	struct timespec ts;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* set a timeout of a connection instead of kcn_net_timeouttv. */
+void
+kcn_net_timeout_set(struct kcn_net *kn, const struct timeval *tv)
+{
+
+	kn->kn_timeouttv = *tv;
+	if (event_pending(&kn->kn_evwrite, EV_TIMEOUT, NULL))
+		(void)event_add(&kn->kn_evwrite, &kn->kn_timeouttv);
+}
+
 static bool
 kcn_net_event_enable(struct kcn_net *kn, struct event *ev, const char *name)
 {
 
 	if (event_pending(ev, EV_TIMEOUT, NULL))
 		return true;
-	if (event_add(ev, &kcn_net_timeouttv) == -1) {
+	if (event_add(ev, &kn->kn_timeouttv) == -1) {
 		LOG(WARN, "cannot enable %s event", name);
 		return false;
 	}
 	LOG(DEBUG, "enable %s event with %lld sec timeout",
-	    name, (long long)kcn_net_timeouttv.tv_sec);
+	    name, (long long)kn->kn_timeouttv.tv_sec);
 	return true;
 }
 
@@ -200,7 +264,7 @@ kcn_net_write_enable(struct kcn_net *kn)
 }
 
 static void
-kcn_net_disconnect(struct kcn_net *kn)
+kcn_net_disconnect(struct kcn_net *kn, int error)
 {
 
 	if (kn->kn_state == KCN_NET_STATE_DISCONNECTED)
@@ -209,6 +273,8 @@ kcn_net_disconnect(struct kcn_net *kn)
 	event_del(&kn->kn_evwrite);
 	kcn_socket_close(&kn->kn_fd);
 	kcn_net_state_change(kn, KCN_NET_STATE_DISCONNECTED);
+	if (kn->kn_closecb != NULL)
+		(*kn->kn_closecb)(kn, error, kn->kn_data);
 }
 
 static void
@@ -216,7 +282,7 @@ kcn_net_timeout(struct kcn_net *kn, short event)
 {
 
 	LOG(DEBUG, "%s timeout", event & EV_READ ? "read" : "write");
-	kcn_net_disconnect(kn);
+	kcn_net_disconnect(kn, ETIMEDOUT);
 }
 
 static bool
@@ -255,7 +321,7 @@ kcn_net_read_cb(int fd, short events, void *arg)
 	if (error == EAGAIN)
 		kcn_net_read_enable(kn);
 	else if (error != 0)
-		kcn_net_disconnect(kn);
+		kcn_net_disconnect(kn, error);
 }
 
 bool
@@ -281,6 +347,7 @@ kcn_net_write_cb(int fd, short events, void *arg)
 {
 	struct kcn_net *kn = arg;
 	struct kcn_buf kb;
+	uint64_t start;
 	int error;
 
 	assert(kn->kn_fd == fd);
@@ -296,20 +363,54 @@ kcn_net_write_cb(int fd, short events, void *arg)
 	if (! kcn_net_event_check(kn, events, EV_WRITE))
 		return;
 
+	start = kn->kn_writetimecb != NULL ? kcn_net_now() : 0;
+	error = 0;
 	while (kcn_buf_fetch(&kb, &kn->kn_obufq)) {
 		error = kcn_buf_write(kn->kn_fd, &kb);
 		if (error == EAGAIN) {
 			kcn_net_write_enable(kn);
-			return;
+			break;
 		}
 		if (error != 0) {
-			LOG(WARN, "write() failed: %s", strerror(errno));
-			kcn_net_disconnect(kn);
+			LOG(WARN, "write() failed: %s", strerror(error));
+			kcn_net_disconnect(kn, error);
 			return;
 		}
 		if (kcn_buf_trailingdata(&kb) == 0)
 			kcn_buf_drop(&kb, &kn->kn_obufq);
 	}
+	if (kn->kn_writetimecb != NULL)
+		(*kn->kn_writetimecb)(kn, kcn_net_now() - start, kn->kn_data);
+	if (error == 0 && kn->kn_draincb != NULL)
+		(*kn->kn_draincb)(kn, kn->kn_data);
+}
+
+/*
+ * dispatch events until all enqueued packets are written, which allows
+ * a caller producing many packets to bound memory for the output queue.
+ */
+bool
+kcn_net_flush(struct kcn_net *kn)
+{
+
+	while (! STAILQ_EMPTY(&kn->kn_obufq)) {
+		if (kn->kn_state == KCN_NET_STATE_DISCONNECTED) {
+			errno = ENETDOWN;
+			LOG(ERR, "cannot flush packets: %s", strerror(errno));
+			return false;
+		}
+		switch (event_base_loop(kn->kn_evb, EVLOOP_ONCE)) {
+		case 0:
+			break;
+		case 1:
+			errno = ENETDOWN; /* XXX: no events pending. */
+			return false;
+		default:
+			LOG(ERR, "event dispatch failed: %s", strerror(errno));
+			return false;
+		}
+	}
+	return true;
 }
 
 bool
@@ -9,12 +9,14 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <time.h>
 
 #include "kcn.h"
 #include "kcn_info.h"
 #include "kcn_eq.h"
 #include "kcn_db.h"
+#include "kcn_ctx.h"
 #include "kcn_buf.h"
 #include "kcn_time.h"
 #include "kcn_msg.h"
@@ -22,28 +24,34 @@
 #include "kcn_netstat.h"
 
 static bool kcn_netstat_match(const char *, size_t *);
-static bool kcn_netstat_search(struct kcn_info *, const char *);
+static bool kcn_netstat_search(const struct kcn_ctx *, struct kcn_info *,
+    const char *);
+static bool kcn_netstat_search_async(const struct kcn_ctx *,
+    struct kcn_client_pool *,
+    struct kcn_info *, const char *,
+    void (*)(struct kcn_info *, int, void *), void *);
 
-static struct kcn_db kcn_netstat = {
+static const struct kcn_db kcn_netstat = {
 	.kd_prio = 255,
 	.kd_name = "net",
 	.kd_desc = "Network statistics",
 	.kd_match = kcn_netstat_match,
-	.kd_search = kcn_netstat_search
+	.kd_search = kcn_netstat_search,
+	.kd_search_async = kcn_netstat_search_async
 };
 
-void
-kcn_netstat_init(void)
+bool
+kcn_netstat_init(struct kcn_ctx *kc)
 {
 
-	kcn_db_register(&kcn_netstat);
+	return kcn_db_register(kc, &kcn_netstat);
 }
 
 void
-kcn_netstat_finish(void)
+kcn_netstat_finish(struct kcn_ctx *kc)
 {
 
-	kcn_db_deregister(&kcn_netstat);
+	kcn_db_deregister(kc, &kcn_netstat);
 }
 
 static bool
@@ -85,6 +93,10 @@ do {									\
 	MATCH("lt");
 	MATCH("max");
 	MATCH("min");
+	MATCH("avg");
+	MATCH("average");
+	MATCH("median");
+	MATCH("rate");
 #undef MATCH
 	*scorep = score;
 	errno = 0; /* XXX: should cause errors when format is invalid. */
@@ -94,32 +106,87 @@ do {									\
 		return true;
 }
 
+/*
+ * keywords of an equation are compiled as follows:
+ *
+ *	type [function] operator value [window]
+ *
+ * e.g., "cpu avg < 50 5m" for an average CPU load over last 5 minutes.
+ */
 static bool
-kcn_netstat_compile(size_t keyc, char * const keyv[], struct kcn_eq *ke)
+kcn_netstat_compile_eq(size_t keyc, char * const keyv[], struct kcn_eq *ke)
 {
+	time_t window;
+	size_t i;
 
 	errno = 0;
 	if (keyc < 3)
 		return false;
-	if (! kcn_eq_type_aton(keyv[0], &ke->ke_type))
+	i = 0;
+	if (! kcn_eq_type_aton(keyv[i++], &ke->ke_type))
 		return false;
-	if (! kcn_eq_operator_aton(keyv[1], &ke->ke_op))
+	if (kcn_eq_function_aton(keyv[i], &ke->ke_func, &ke->ke_funcarg))
+		i++;
+	else
+		ke->ke_func = KCN_EQ_FUNC_NONE;
+	if (keyc < i + 2)
 		return false;
-	if (! kcn_eq_val_aton(keyv[2], &ke->ke_val))
+	if (! kcn_eq_operator_aton(keyv[i++], &ke->ke_op))
 		return false;
-	if (keyc == 3) {
-		if (time(&ke->ke_start) == -1)
-			return false;
-		ke->ke_start -= KCN_TIME_JITTER;
-		ke->ke_end = KCN_TIME_NOW;
-	} else {
+	if (! kcn_eq_val_aton(keyv[i++], &ke->ke_val))
+		return false;
+	window = KCN_TIME_JITTER;
+	if (i < keyc && ! kcn_eq_window_aton(keyv[i++], &window))
+		return false;
+	if (i != keyc) {
 		/* XXX: should compile time expressions. */
+		errno = EINVAL;
+		return false;
+	}
+	if (time(&ke->ke_start) == -1)
+		return false;
+	ke->ke_start -= window;
+	ke->ke_end = KCN_TIME_NOW;
+	return true;
+}
+
+static bool
+kcn_netstat_conjunction(const char *key)
+{
+
+	return strcasecmp(key, "and") == 0 || strcmp(key, "&&") == 0;
+}
+
+/*
+ * equations can be conjuncted by "and", e.g., "cpu < 50 and rtt < 20"
+ * for locators satisfying both of them.
+ */
+static bool
+kcn_netstat_compile(size_t keyc, char * const keyv[],
+    struct kcn_msg_query *kmq)
+{
+	size_t i, j;
+
+	kmq->kmq_neqs = 0;
+	for (i = 0; i <= keyc; i = j + 1) {
+		for (j = i; j < keyc; j++)
+			if (kcn_netstat_conjunction(keyv[j]))
+				break;
+		if (kmq->kmq_neqs == KCN_MSG_QUERY_MAXEQS) {
+			errno = E2BIG;
+			return false;
+		}
+		if (! kcn_netstat_compile_eq(j - i, &keyv[i],
+		    &kmq->kmq_eqs[kmq->kmq_neqs]))
+			return false;
+		++kmq->kmq_neqs;
 	}
 	return true;
 }
 
 static bool
-kcn_netstat_search(struct kcn_info *ki, const char *keys)
+kcn_netstat_search(const struct kcn_ctx *kc, struct kcn_info *ki,
+    const char *keys)
 {
 	struct kcn_msg_query kmq;
 	size_t keyc;
@@ -132,9 +199,37 @@ kcn_netstat_search(struct kcn_info *ki, const char *keys)
 	}
 	kmq.kmq_loctype = kcn_info_loc_type(ki);
 	kmq.kmq_maxcount = kcn_info_maxnlocs(ki);
-	if (! kcn_netstat_compile(keyc, keyv, &kmq.kmq_eq))
+	if (! kcn_netstat_compile(keyc, keyv, &kmq))
+		goto bad;
+	if (! kcn_client_search(kc, ki, &kmq))
+		goto bad;
+	kcn_key_free(keyc, keyv);
+	return true;
+  bad:
+	kcn_key_free(keyc, keyv);
+	return false;
+}
+
+static bool
+kcn_netstat_search_async(const struct kcn_ctx *kc, struct kcn_client_pool *kcp,
+    struct kcn_info *ki, const char *keys,
+    void (*cb)(struct kcn_info *, int, void *), void *arg)
+{
+	struct kcn_msg_query kmq;
+	size_t keyc;
+	char **keyv;
+
+	(void)kc;
+	keyv = kcn_key_split(keys, &keyc);
+	if (keyv == NULL) {
+		errno = EINVAL;
+		return false;
+	}
+	kmq.kmq_loctype = kcn_info_loc_type(ki);
+	kmq.kmq_maxcount = kcn_info_maxnlocs(ki);
+	if (! kcn_netstat_compile(keyc, keyv, &kmq))
 		goto bad;
-	if (! kcn_client_search(ki, &kmq))
+	if (kcn_client_search_async(kcp, ki, &kmq, cb, arg) == NULL)
 		goto bad;
 	kcn_key_free(keyc, keyv);
 	return true;
@@ -2,5 +2,7 @@
 #define KCN_NETSTAT_PORT_DEFAULT	9410
 #define KCN_NETSTAT_PORT_STR_DEFAULT	"9410"
 
-void kcn_netstat_init(void);
-void kcn_netstat_finish(void);
+struct kcn_ctx;
+
+bool kcn_netstat_init(struct kcn_ctx *);
+void kcn_netstat_finish(struct kcn_ctx *);
@@ -6,6 +6,7 @@
 #include <unistd.h>
 
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 
 #include "kcn.h"
 #include "kcn_log.h"
@@ -32,6 +33,21 @@ kcn_socket_nonblock(int s)
 	return true;
 }
 
+/*
+ * messages are pipelined on a connection, and a small message such as
+ * the end of responses should not wait for an acknowledgement.
+ */
+static void
+kcn_socket_nodelay(int s)
+{
+	int on;
+
+	on = 1;
+	if (setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on)) == -1)
+		KCN_LOG(WARN, "setsockopt(TCP_NODELAY) failed for %d: %s",
+		    s, strerror(errno));
+}
+
 int
 kcn_socket_listen(int domain, in_port_t port)
 {
@@ -112,6 +128,7 @@ kcn_socket_connect(struct sockaddr_storage *ss)
 	}
 	if (! kcn_socket_nonblock(s))
 		goto bad;
+	kcn_socket_nodelay(s);
 	sslen = kcn_sockaddr_len(ss);
 	assert(sslen != (socklen_t)-1);
 	if (connect(s, (struct sockaddr *)ss, sslen) == -1) {
@@ -145,6 +162,7 @@ kcn_socket_accept(int ls, char *name, size_t namelen)
 		}
 	if (! kcn_socket_nonblock(s))
 		goto bad;
+	kcn_socket_nodelay(s);
 	if (name != NULL)
 		kcn_sockaddr_ntoa(name, namelen, &ss);
 	return s;